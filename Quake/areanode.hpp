@@ -11,5 +11,8 @@ struct areanode_t
     link_t solid_edicts;
 };
 
-#define AREA_DEPTH 4
-#define AREA_NODES 32
+// The areanode tree depth is chosen per level from the world bounds and the
+// number of linked edicts, between these two limits.
+#define AREA_MIN_DEPTH 4
+#define AREA_MAX_DEPTH 10
+#define AREA_NODES (2 << AREA_MAX_DEPTH)
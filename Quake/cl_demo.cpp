@@ -84,7 +84,7 @@ CL_WriteDemoMessage
 Dumps the current net message, prefixed by the length and view angles
 ====================
 */
-static void CL_WriteDemoMessage()
+void CL_WriteDemoMessage()
 {
     int len = LittleLong(net_message.cursize);
     fwrite(&len, 4, 1, cls.demofile);
@@ -192,7 +192,9 @@ int CL_GetMessage()
         }
     }
 
-    if(cls.demorecording)
+    // PEXTQVR_ACKDELTAS -- snapshots that delta from frames the demo doesn't
+    // have are left out, the one that ends the resync writes itself
+    if(cls.demorecording && !(r == 2 && cl.legacyresync))
     {
         CL_WriteDemoMessage();
     }
@@ -333,6 +335,8 @@ void CL_Record_f()
         return;
     }
 
+    COM_InvalidateFileIndex(); // so playdemo can find it
+
     cls.forcetrack = track;
     fprintf(cls.demofile, "%i\n", cls.forcetrack);
 
@@ -407,6 +411,9 @@ void CL_Record_f()
         // restore net_message
         net_message.data = data;
         net_message.cursize = cursize;
+
+        // the acked frames the server deltas from aren't in the demo
+        CL_ResyncLegacyFrames();
     }
 }
 
@@ -42,6 +42,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "input.hpp"
 #include "q_sound.hpp"
 #include "crc.hpp"
+#include "profiler.hpp"
 
 #include <string>
 #include <vector>
@@ -121,6 +122,7 @@ void CL_ClearState()
     }
 
     CL_ClearTrailStates();
+    COM_ClearPrefetch(); // left over from an interrupted load
 
     PR_ClearProgs(&cl.qcvm);
 
@@ -316,6 +318,11 @@ void CL_SignonReply()
 
         case 4:
             SCR_EndLoadingPlaque(); // allow normal screen updates
+            if(cls.netcon && !cls.demoplayback)
+            {
+                Con_DPrintf("Signon took %.2f seconds\n",
+                    net_time - NET_QSocketGetTime(cls.netcon));
+            }
             break;
     }
 }
@@ -1058,6 +1065,7 @@ void CL_Download_Finished_f()
             q_snprintf(finalpath, sizeof(finalpath), "%s/%s", com_gamedir,
                 cls.download.current);
             rename(cls.download.temp, finalpath);
+            COM_InvalidateFileIndex();
             Con_SafePrintf("Downloaded %s: %u bytes\n", cls.download.current,
                 cls.download.size);
         }
@@ -1183,9 +1191,63 @@ bool CL_CheckDownload(const char* filename)
 
 // download+load models and sounds as needed, once complete let the server know
 // we're ready for the next stage. returning false will trigger nops.
+/*
+=================
+CL_PrefetchPrecaches
+
+Reads every precached model and sound that isn't in memory yet on the worker
+pool, and decodes the compressed sounds, before CL_CheckDownloads loads them
+one by one.
+=================
+*/
+static void CL_PrefetchPrecaches()
+{
+    std::vector<std::string> names;
+    std::vector<std::string> sounds;
+
+    for(int i = 1; i < cl.model_count; i++)
+    {
+        const char* name = cl.model_name[i];
+        if(*name && *name != '*' && Mod_NeedsLoad(name))
+        {
+            names.emplace_back(name);
+        }
+    }
+
+    // the world's lighting and entity overrides, see Mod_LoadBrushModel
+    if(cl.model_count > 1 &&
+        !q_strcasecmp(COM_FileGetExtension(cl.model_name[1]), "bsp") &&
+        Mod_NeedsLoad(cl.model_name[1]))
+    {
+        const std::string world = cl.model_name[1];
+        const std::string base = world.substr(0, world.size() - 4);
+        names.push_back(base + ".lit");
+        names.push_back(base + ".ent");
+    }
+
+    for(int i = 1; i < cl.sound_count; i++)
+    {
+        const char* name = cl.sound_name[i];
+        if(*name && S_NeedsLoad(name))
+        {
+            names.push_back(std::string{"sound/"} + name);
+            sounds.emplace_back(name);
+        }
+    }
+
+    COM_Prefetch(names);
+    S_PredecodeSounds(sounds);
+}
+
 bool CL_CheckDownloads()
 {
     int i;
+    if(!cl.precache_prefetched)
+    {
+        cl.precache_prefetched = true;
+        CL_PrefetchPrecaches();
+    }
+
     if(cl.model_download == 0 && cl.model_count && cl.model_name[1])
     { // haxors, download the lit first, but only if we don't already have the
       // bsp
@@ -1295,6 +1357,9 @@ bool CL_CheckDownloads()
             cl.model_precache[cl.static_entities[i]->netstate.modelindex];
         R_AddEfrags(cl.static_entities[i]);
     }
+
+    COM_ClearPrefetch();
+    COM_EndLoadStats();
     return true;
 }
 
@@ -1308,6 +1373,8 @@ Read all incoming data from the server
 */
 int CL_ReadFromServer()
 {
+    QUAKE_PROFILE_ZONE("CL_ReadFromServer");
+
     int ret;
     extern int num_temp_entities; // johnfitz
     int num_beams = 0;            // johnfitz
@@ -46,7 +46,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.hpp"
 #include "snd_voip.hpp"
 
+#include <algorithm>
 #include <limits>
+#include <utility>
+#include <vector>
 
 const char* svc_strings[128] = {
     "svc_bad", "svc_nop", "svc_disconnect", "svc_updatestat",
@@ -1469,6 +1472,63 @@ void CL_KeepaliveMessage()
 }
 #endif
 
+// PEXTQVR_ACKDELTAS -- what each of the last frames left the updated entities
+// as, in entity order, so that U_ACKED updates can delta from them
+static struct
+{
+    int sequence;
+    std::vector<std::pair<int, entity_state_t>> ents;
+} cl_legacyframes[64];
+
+/*
+==================
+CL_LegacyState
+
+Our copy of entity `num` as of PEXTQVR_ACKDELTAS frame `sequence`, if it was
+updated in that frame.
+==================
+*/
+static const entity_state_t* CL_LegacyState(const int sequence, const int num)
+{
+    const auto& frame =
+        cl_legacyframes[sequence % std::size(cl_legacyframes)];
+    if(frame.sequence != sequence)
+    {
+        return nullptr;
+    }
+
+    const auto it = std::lower_bound(frame.ents.begin(), frame.ents.end(),
+        num, [](const auto& e, const int n) { return e.first < n; });
+
+    return (it != frame.ents.end() && it->first == num) ? &it->second
+                                                        : nullptr;
+}
+
+/*
+==================
+CL_ResyncLegacyFrames
+
+Asks the server to send PEXTQVR_ACKDELTAS updates from the baselines until we
+ack a frame again, for when we no longer have the frame it deltas from.
+==================
+*/
+void CL_ResyncLegacyFrames()
+{
+    if(!(cl.protocol_pextqvr & PEXTQVR_ACKDELTAS) || cls.demoplayback ||
+        cl.legacyresync)
+    {
+        return;
+    }
+
+    cl.legacyresync = true;
+
+    if(cl.ackframes_count == std::size(cl.ackframes))
+    {
+        cl.ackframes_count--;
+    }
+    cl.ackframes[cl.ackframes_count++] = -1;
+}
+
 /*
 ==================
 CL_ParseServerInfo
@@ -1486,6 +1546,13 @@ void CL_ParseServerInfo()
 
     Con_DPrintf("Serverinfo packet received.\n");
 
+    // a local server already did this in SV_SpawnServer
+    if(!sv.active)
+    {
+        COM_InvalidateFileIndex();
+        COM_BeginLoadStats();
+    }
+
     // ericw -- bring up loading plaque for map changes within a demo.
     //          it will be hidden in CL_SignonReply.
     if(cls.demoplayback)
@@ -1531,9 +1598,27 @@ void CL_ParseServerInfo()
             }
             continue;
         }
+        if(i == PROTOCOL_QUAKEVR_PEXT)
+        {
+            cl.protocol_pextqvr = MSG_ReadLong();
+            if(cl.protocol_pextqvr & ~PEXTQVR_SUPPORTED_CLIENT)
+            {
+                Host_Error(
+                    "Server returned QuakeVR protocol extensions that are not "
+                    "supported (%#x)",
+                    cl.protocol_pextqvr & ~PEXTQVR_SUPPORTED_CLIENT);
+            }
+            continue;
+        }
         break;
     }
 
+    for(auto& frame : cl_legacyframes)
+    {
+        frame.sequence = 0;
+        frame.ents.clear();
+    }
+
     // johnfitz -- support multiple protocols
     if(i != PROTOCOL_QUAKEVR)
     {
@@ -1749,6 +1834,29 @@ static void CL_ParseUpdate(int bits)
     ent->msgtime = cl.mtime[0];
     ent->netstate = ent->baseline;
 
+    // PEXTQVR_ACKDELTAS -- fields that weren't sent come from the acked frame
+    const entity_state_t* acked = nullptr;
+    if(bits & U_ACKED)
+    {
+        acked = CL_LegacyState(cl.legacybase, num);
+        if(!acked)
+        {
+            // still has to be read, but the result is wrong until the
+            // server stops deltaing from frames we don't have
+            Con_DPrintf("CL_ParseUpdate: entity %i missing from frame %i\n",
+                num, cl.legacybase);
+            CL_ResyncLegacyFrames();
+        }
+    }
+    const entity_state_t& base = acked ? *acked : ent->baseline;
+
+    // PEXTQVR_PACKED -- origins and angles come bit-packed at the end
+    constexpr int packedfields =
+        U_ORIGIN1 | U_ORIGIN2 | U_ORIGIN3 | U_ANGLE1 | U_ANGLE2 | U_ANGLE3;
+    const bool packed =
+        (bits & U_ACKED) && (cl.protocol_pextqvr & PEXTQVR_PACKED);
+    const int fieldbits = packed ? bits & ~packedfields : bits;
+
     if(bits & U_MODEL)
     {
         modnum = MSG_ReadByte();
@@ -1759,7 +1867,7 @@ static void CL_ParseUpdate(int bits)
     }
     else
     {
-        modnum = ent->baseline.modelindex;
+        modnum = base.modelindex;
     }
 
     if(bits & U_FRAME)
@@ -1768,7 +1876,7 @@ static void CL_ParseUpdate(int bits)
     }
     else
     {
-        ent->frame = ent->baseline.frame;
+        ent->frame = base.frame;
     }
 
     if(bits & U_COLORMAP)
@@ -1777,8 +1885,9 @@ static void CL_ParseUpdate(int bits)
     }
     else
     {
-        i = ent->baseline.colormap;
+        i = base.colormap;
     }
+    const int colormap = i;
     if(!i)
     {
         ent->colormap = vid.colormap;
@@ -1797,7 +1906,7 @@ static void CL_ParseUpdate(int bits)
     }
     else
     {
-        skin = ent->baseline.skin;
+        skin = base.skin;
     }
     if(skin != ent->skinnum)
     {
@@ -1814,7 +1923,7 @@ static void CL_ParseUpdate(int bits)
     }
     else
     {
-        ent->effects = ent->baseline.effects;
+        ent->effects = base.effects;
     }
 
     // shift the known values for interpolation
@@ -1826,7 +1935,7 @@ static void CL_ParseUpdate(int bits)
     const auto doIt = [&](const auto fn, const int bit, auto& target,
                           const auto& baselineData, const int index)
     {
-        if(bits & bit)
+        if(fieldbits & bit)
         {
             target[index] = fn(cl.protocolflags);
         }
@@ -1837,28 +1946,36 @@ static void CL_ParseUpdate(int bits)
     };
 
     // clang-format off
-    doIt(&MSG_ReadCoord, U_ORIGIN1, ent->msg_origins[0], ent->baseline.origin, 0);
-    doIt(&MSG_ReadAngle, U_ANGLE1, ent->msg_angles[0], ent->baseline.angles, 0);
-    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], ent->baseline.model_scale, 0);
+    doIt(&MSG_ReadCoord, U_ORIGIN1, ent->msg_origins[0], base.origin, 0);
+    doIt(&MSG_ReadAngle, U_ANGLE1, ent->msg_angles[0], base.angles, 0);
+    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], base.model_scale, 0);
 
-    doIt(&MSG_ReadCoord, U_ORIGIN2, ent->msg_origins[0], ent->baseline.origin, 1);
-    doIt(&MSG_ReadAngle, U_ANGLE2, ent->msg_angles[0], ent->baseline.angles, 1);
-    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], ent->baseline.model_scale, 1);
+    doIt(&MSG_ReadCoord, U_ORIGIN2, ent->msg_origins[0], base.origin, 1);
+    doIt(&MSG_ReadAngle, U_ANGLE2, ent->msg_angles[0], base.angles, 1);
+    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], base.model_scale, 1);
 
-    doIt(&MSG_ReadCoord, U_ORIGIN3, ent->msg_origins[0], ent->baseline.origin, 2);
-    doIt(&MSG_ReadAngle, U_ANGLE3, ent->msg_angles[0], ent->baseline.angles, 2);
-    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], ent->baseline.model_scale, 2);
+    doIt(&MSG_ReadCoord, U_ORIGIN3, ent->msg_origins[0], base.origin, 2);
+    doIt(&MSG_ReadAngle, U_ANGLE3, ent->msg_angles[0], base.angles, 2);
+    doIt(&MSG_ReadCoord, U_SCALE, ent->msg_scales[0], base.model_scale, 2);
     // clang-format on
 
     if(bits & U_SCALE)
     {
         ent->model_scale_origin = MSG_ReadVec3(cl.protocolflags);
     }
+    else if(bits & U_ACKED)
+    {
+        ent->model_scale_origin = base.model_scale_origin;
+    }
 
     if(bits & U_MODELOFFSET)
     {
         ent->model_offset = MSG_ReadVec3(cl.protocolflags);
     }
+    else if(bits & U_ACKED)
+    {
+        ent->model_offset = base.model_offset;
+    }
 
     // johnfitz -- lerping for movetype_step entities
     if(bits & U_STEP)
@@ -1881,7 +1998,7 @@ static void CL_ParseUpdate(int bits)
         }
         else
         {
-            ent->alpha = ent->baseline.alpha;
+            ent->alpha = base.alpha;
         }
 
         if(bits & U_FRAME2)
@@ -1910,6 +2027,59 @@ static void CL_ParseUpdate(int bits)
     }
     // johnfitz
 
+    if(packed)
+    {
+        constexpr int anglebits[3] = {U_ANGLE1, U_ANGLE2, U_ANGLE3};
+        msgbits_t acc{};
+
+        for(int i = 0; i < 3; i++)
+        {
+            if(bits & (U_ORIGIN1 << i))
+            {
+                ent->msg_origins[0][i] =
+                    MSG_UnpackCoord(MSG_PackCoord(base.origin[i]) +
+                                    MSG_ReadVarBits(acc, PACKED_COORD_WIDTHS));
+            }
+        }
+
+        for(int i = 0; i < 3; i++)
+        {
+            if(bits & anglebits[i])
+            {
+                ent->msg_angles[0][i] = MSG_UnpackAngle(
+                    (MSG_PackAngle(base.angles[i]) +
+                        MSG_ReadVarBits(acc, PACKED_ANGLE_WIDTHS)) &
+                    65535);
+            }
+        }
+    }
+
+    if((cl.protocol_pextqvr & PEXTQVR_ACKDELTAS) &&
+        (acked || !(bits & U_ACKED)))
+    {
+        entity_state_t state = base;
+        state.origin = ent->msg_origins[0];
+        state.angles = ent->msg_angles[0];
+        state.model_scale = ent->msg_scales[0];
+        if(bits & U_SCALE)
+        {
+            state.model_scale_origin = ent->model_scale_origin;
+        }
+        if(bits & U_MODELOFFSET)
+        {
+            state.model_offset = ent->model_offset;
+        }
+        state.modelindex = modnum;
+        state.frame = ent->frame;
+        state.colormap = colormap;
+        state.skin = skin;
+        state.effects = ent->effects;
+        state.alpha = ent->alpha;
+
+        cl_legacyframes[cl.legacyframe % std::size(cl_legacyframes)]
+            .ents.emplace_back(num, state);
+    }
+
     // johnfitz -- moved here from above
     model = cl.model_precache[modnum];
     if(model != ent->model)
@@ -2883,6 +3053,34 @@ void CL_ParseServerMessage()
                 {
                     MSG_ReadShort(); // input sequence ack.
                 }
+
+                if(cl.protocol_pextqvr & PEXTQVR_ACKDELTAS)
+                {
+                    cl.legacyframe = MSG_ReadLong();
+                    cl.legacybase = MSG_ReadLong();
+
+                    auto& frame = cl_legacyframes[cl.legacyframe %
+                                                  std::size(cl_legacyframes)];
+                    frame.sequence = cl.legacyframe;
+                    frame.ents.clear();
+
+                    if(cl.legacyresync && cl.legacyframe && !cl.legacybase)
+                    {
+                        // first frame that is all from the baselines
+                        cl.legacyresync = false;
+                        if(cls.demorecording)
+                        {
+                            CL_WriteDemoMessage();
+                        }
+                    }
+
+                    // frame 0 is the spawn message, not a snapshot
+                    if(cl.legacyframe && !cl.legacyresync &&
+                        cl.ackframes_count < std::size(cl.ackframes))
+                    {
+                        cl.ackframes[cl.ackframes_count++] = cl.legacyframe;
+                    }
+                }
                 break;
 
             case svc_clientdata:
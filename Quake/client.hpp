@@ -301,6 +301,10 @@ struct client_state_t
     unsigned protocol; // johnfitz
     unsigned protocolflags;
     unsigned protocol_pext2; // spike -- flag of fte protocol extensions
+    unsigned protocol_pextqvr; // PEXTQVR_ flags, our own extensions
+    int legacyframe; // PEXTQVR_ACKDELTAS frame being parsed
+    int legacybase;  // acked frame that U_ACKED updates delta from
+    bool legacyresync; // lost a base frame, waiting for one without a base
 
     // QSS
     bool protocol_dpdownload;
@@ -352,6 +356,7 @@ struct client_state_t
     int sound_download;
     char sound_name[MAX_SOUNDS][MAX_QPATH];
     // spike -- end downloads
+    bool precache_prefetched; // see CL_PrefetchPrecaches
 
     qcvm_t qcvm; // for csqc.
 
@@ -538,6 +543,7 @@ void CL_ClearTrailStates(); // QSS
 //
 void CL_StopPlayback();
 int CL_GetMessage();
+void CL_WriteDemoMessage();
 
 void CL_Stop_f();
 void CL_Record_f();
@@ -548,6 +554,7 @@ void CL_TimeDemo_f();
 // cl_parse.c
 //
 void CL_ParseServerMessage();
+void CL_ResyncLegacyFrames();
 void CL_RegisterParticles(); // QSS
 
 //
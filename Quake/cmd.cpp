@@ -1045,6 +1045,18 @@ void Cmd_ForwardToServer()
     }
 
     MSG_WriteByte(&cls.message, clc_stringcmd);
+
+    // QSS -- the server asks for our extensions with 'cmd pext', answer it
+    // with the ones we support unless the user wants the base protocol
+    if(!q_strcasecmp(Cmd_Argv(0), "cmd") && Cmd_Argc() == 2 &&
+        !q_strcasecmp(Cmd_Argv(1), "pext") && !cl_nopext.value)
+    {
+        SZ_Print(&cls.message,
+            va("pext 0x%x 0x%x\n", PROTOCOL_QUAKEVR_PEXT,
+                PEXTQVR_SUPPORTED_CLIENT));
+        return;
+    }
+
     if(q_strcasecmp(Cmd_Argv(0), "cmd") != 0)
     {
         SZ_Print(&cls.message, Cmd_Argv(0));
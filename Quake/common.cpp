@@ -45,10 +45,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.hpp"
 #include "draw.hpp"
 #include "gl_texmgr.hpp"
+#include "tasks.hpp"
 
 #include <cerrno>
+#include <deque>
 #include <string_view>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifdef _WIN32
@@ -68,6 +72,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 static char* largv[MAX_NUM_ARGVS + 1];
@@ -75,6 +83,10 @@ static char argvdummy[] = " ";
 
 int safemode;
 
+extern cvar_t fs_zipcache;
+
+cvar_t fs_mmap = {"fs_mmap", "1", CVAR_NONE};
+
 cvar_t registered = {"registered", "1",
     CVAR_ROM}; /* set to correct value in COM_CheckRegistered() */
 cvar_t cmdline = {
@@ -88,6 +100,7 @@ cvar_t allow_download = {"allow_download",
 static bool com_modified; // set true if using non-id files
 
 static void COM_Path_f();
+static void COM_DropPrefetch();
 
 // if a packfile directory differs from this, it is assumed to be hacked
 #define PAK0_COUNT 339      /* id1/pak0.pak - v1.0x */
@@ -1357,6 +1370,8 @@ void COM_WriteFile(const char* filename, const void* data, int len)
     Sys_Printf("COM_WriteFile: %s\n", name);
     Sys_FileWrite(handle, data, len);
     Sys_FileClose(handle);
+
+    COM_InvalidateFileIndex();
 }
 
 /*
@@ -1399,286 +1414,1062 @@ long COM_filelength(FILE* f)
 }
 
 /*
-===========
-COM_FindFile
+==============================================================================
 
-Finds the file in the search path.
-Sets com_filesize and one of handle or file
-If neither of file or handle is set, this
-can be used for detecting a file's presence.
-===========
+FILE INDEX
+
+Every file of every mounted pak, zip and loose game directory, keyed by its
+lowercased path. Entries sharing a name are chained in search order, so the
+first usable one is what the old walk over com_searchpaths would have found.
+The index is rebuilt lazily after COM_InvalidateFileIndex, which is called
+whenever the search path changes, the engine writes into the game directory,
+and on every map load so that files added behind our back are picked up.
+
+==============================================================================
 */
-static int COM_FindFile(
-    const char* filename, int* handle, FILE** file, unsigned int* path_id)
+
+struct comfileentry_t
 {
-    if(file && handle)
-    {
-        Sys_Error("COM_FindFile: both handle and file set");
-    }
+    searchpath_t* search;
+    int file;         // index in search->pack->files, -1 for loose files
+    const char* path; // on-disk name relative to search->filename, if loose
+    int next;         // next entry with the same name, -1 if last
+};
+
+static struct
+{
+    bool valid;
+    std::vector<comfileentry_t> entries;
+    std::deque<std::string> names; // storage for the views below
+    std::unordered_map<std::string_view, std::pair<int, int>> chains;
+
+    // statistics for path_stats
+    int builds;
+    double buildtime;
+    unsigned long long lookups;
+    unsigned long long hits;
+    double lookuptime;
+} com_fileindex;
 
-    file_from_pak = 0;
+/*
+============
+COM_InvalidateFileIndex
+============
+*/
+void COM_InvalidateFileIndex()
+{
+    com_fileindex.valid = false;
+    COM_DropPrefetch();
+}
 
-    //
-    // search through the path, one element at a time
-    //
-    for(searchpath_t* search = com_searchpaths; search; search = search->next)
+/*
+============
+COM_IndexFile
+============
+*/
+static void COM_IndexFile(
+    searchpath_t* search, const int file, const char* name, const char* path)
+{
+    std::string& key = com_fileindex.names.emplace_back(name);
+    for(char& c : key)
     {
-        if(search->pack) /* look through all the pak file elements */
-        {
-            pack_t* pak = search->pack;
-            for(int i = 0; i < pak->numfiles; i++)
-            {
-                if(strcmp(pak->files[i].name, filename) != 0)
-                {
-                    continue;
-                }
-
-                // VR: This hack allows multiple "start.bsp" maps to coexist.
-                // The user can decide which one is loaded by setting a CVar.
-                const auto extractedPakName = VR_ExtractPakName(*pak);
-                if(std::strcmp(filename, "maps/start.bsp") == 0 &&
-                    extractedPakName != VR_GetActiveStartPakName() &&
-                    extractedPakName != "pak0")
-                {
-                    continue;
-                }
+        c = q_tolower(c);
+    }
 
-                // found it!
-                com_filesize = pak->files[i].filelen;
-                file_from_pak = 1;
+    const int index = static_cast<int>(com_fileindex.entries.size());
+    com_fileindex.entries.push_back({search, file, path, -1});
 
-                if(path_id)
-                {
-                    *path_id = search->path_id;
-                }
+    const auto [it, inserted] =
+        com_fileindex.chains.try_emplace(key, index, index);
+    if(inserted)
+    {
+        return;
+    }
 
-                if(handle)
-                {
-                    if(pak->files[i].deflatedsize)
-                    {
-                        FILE* f;
-                        f = fopen(pak->filename, "rb");
-                        if(f)
-                        {
-                            fseek(f, pak->files[i].filepos, SEEK_SET);
-                            f = FSZIP_Deflate(f, pak->files[i].deflatedsize,
-                                pak->files[i].filelen);
-                            *handle = Sys_FileOpenStdio(f);
-                        }
-                        else
-                        { // error!
-                            com_filesize = -1;
-                            *handle = -1;
-                        }
-                    }
-                    else
-                    {
-                        *handle = pak->handle;
-                        Sys_FileSeek(pak->handle, pak->files[i].filepos);
-                    }
-                    return com_filesize;
-                }
-                else if(file)
-                { /* open a new file on the pakfile */
+    // later in the search order than the ones already indexed
+    com_fileindex.names.pop_back();
+    com_fileindex.entries[it->second.second].next = index;
+    it->second.second = index;
+}
 
-                    *file = fopen(pak->filename, "rb");
+/*
+============
+COM_IndexDirectory
 
-                    if(*file)
-                    {
-                        fseek(*file, pak->files[i].filepos, SEEK_SET);
-                        if(pak->files[i].deflatedsize)
-                            *file =
-                                FSZIP_Deflate(*file, pak->files[i].deflatedsize,
-                                    pak->files[i].filelen);
-                    }
+Recursively indexes the loose files below search->filename.
+============
+*/
+static void COM_IndexDirectory(
+    searchpath_t* search, const char* prefix, const int depth)
+{
+    if(depth > 16) // symlink loops
+    {
+        return;
+    }
 
-                    return com_filesize;
-                }
-                else /* for COM_FileExists() */
-                {
-                    return com_filesize;
-                }
-            }
+    const auto add = [&](const char* name, const bool isdir) {
+        if(!strcmp(name, ".") || !strcmp(name, ".."))
+        {
+            return;
         }
-        else /* check a file in the directory tree */
+
+        char path[MAX_OSPATH];
+        if(q_snprintf(path, sizeof(path), "%s%s", prefix, name) >=
+            (int)sizeof(path) - 1)
         {
-            char netpath[MAX_OSPATH];
-            q_snprintf(
-                netpath, sizeof(netpath), "%s/%s", search->filename, filename);
+            return;
+        }
 
-            const int findtime = Sys_FileTime(netpath);
-            if(findtime == -1)
-            {
-                continue;
-            }
+        if(isdir)
+        {
+            q_strlcat(path, "/", sizeof(path));
+            COM_IndexDirectory(search, path, depth + 1);
+            return;
+        }
 
-            if(path_id)
-            {
-                *path_id = search->path_id;
-            }
+        const char* stored = com_fileindex.names.emplace_back(path).c_str();
+        COM_IndexFile(search, -1, stored, stored);
+    };
 
-            if(handle)
-            {
-                int i;
-                com_filesize = Sys_FileOpenRead(netpath, &i);
-                *handle = i;
-                return com_filesize;
-            }
-            else if(file)
-            {
-                *file = fopen(netpath, "rb");
-                com_filesize = (*file == nullptr) ? -1 : COM_filelength(*file);
-                return com_filesize;
-            }
-            else
-            {
-                return 0; /* dummy valid value for COM_FileExists() */
-            }
-        }
-    }
+    char dirpath[MAX_OSPATH];
 
-    const char* ext = COM_FileGetExtension(filename);
-    if(strcmp(ext, "pcx") != 0 && strcmp(ext, "tga") != 0 &&
-        strcmp(ext, "png") != 0 && strcmp(ext, "jpg") != 0 &&
-        strcmp(ext, "jpeg") != 0 && strcmp(ext, "lit") != 0 &&
-        strcmp(ext, "ent") != 0)
+#ifdef _WIN32
+    WIN32_FIND_DATA fdat;
+    q_snprintf(dirpath, sizeof(dirpath), "%s/%s*", search->filename, prefix);
+    HANDLE fhnd = FindFirstFile(dirpath, &fdat);
+    if(fhnd == INVALID_HANDLE_VALUE)
     {
-        Con_DPrintf2("FindFile: can't find %s\n", filename);
+        return;
     }
-    else
+    do
     {
-        Con_DPrintf3("FindFile: can't find %s\n", filename);
-    }
-    // Log pcx, tga, lit, ent misses only if (developer.value >= 2)
-
-    if(handle)
+        add(fdat.cFileName,
+            (fdat.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    } while(FindNextFile(fhnd, &fdat));
+    FindClose(fhnd);
+#else
+    q_snprintf(dirpath, sizeof(dirpath), "%s/%s", search->filename, prefix);
+    DIR* dir_p = opendir(dirpath);
+    if(dir_p == nullptr)
     {
-        *handle = -1;
+        return;
     }
-
-    if(file)
+    while(const struct dirent* dir_t = readdir(dir_p))
     {
-        *file = nullptr;
+        bool isdir = dir_t->d_type == DT_DIR;
+        if(dir_t->d_type == DT_UNKNOWN || dir_t->d_type == DT_LNK)
+        {
+            char fullpath[MAX_OSPATH];
+            struct stat st;
+            q_snprintf(fullpath, sizeof(fullpath), "%s%s", dirpath,
+                dir_t->d_name);
+            isdir = !stat(fullpath, &st) && S_ISDIR(st.st_mode);
+        }
+        add(dir_t->d_name, isdir);
     }
-
-    com_filesize = -1;
-    return com_filesize;
+    closedir(dir_p);
+#endif
 }
 
-
 /*
-===========
-COM_FileExists
-
-Returns whether the file is found in the quake filesystem.
-===========
+============
+COM_BuildFileIndex
+============
 */
-bool COM_FileExists(const char* filename, unsigned int* path_id)
+static void COM_BuildFileIndex()
 {
-    int ret = COM_FindFile(filename, nullptr, nullptr, path_id);
-    return (ret == -1) ? false : true;
+    const double start = Sys_DoubleTime();
+
+    com_fileindex.entries.clear();
+    com_fileindex.names.clear();
+    com_fileindex.chains.clear();
+
+    for(searchpath_t* search = com_searchpaths; search; search = search->next)
+    {
+        if(search->pack)
+        {
+            pack_t* pak = search->pack;
+            for(int i = 0; i < pak->numfiles; i++)
+            {
+                COM_IndexFile(search, i, pak->files[i].name, nullptr);
+            }
+        }
+        else
+        {
+            COM_IndexDirectory(search, "", 0);
+        }
+    }
+
+    com_fileindex.valid = true;
+    com_fileindex.builds++;
+    com_fileindex.buildtime += Sys_DoubleTime() - start;
 }
 
 /*
-===========
-COM_OpenFile
+============
+COM_FindIndexedFile
 
-filename never has a leading slash, but may contain directory walks
-returns a handle and a length
-it may actually be inside a pak file
-===========
+Returns the first index entry named `filename` (case insensitive), or -1.
+============
 */
-int COM_OpenFile(const char* filename, int* handle, unsigned int* path_id)
+static int COM_FindIndexedFile(const char* filename)
 {
-    return COM_FindFile(filename, handle, nullptr, path_id);
+    if(!com_fileindex.valid)
+    {
+        COM_BuildFileIndex();
+    }
+
+    char key[MAX_OSPATH];
+    int len = 0;
+    for(; filename[len]; len++)
+    {
+        if(len == (int)sizeof(key))
+        {
+            return -1;
+        }
+        key[len] = q_tolower(filename[len]);
+    }
+
+    const auto it = com_fileindex.chains.find(std::string_view(key, len));
+    return it == com_fileindex.chains.end() ? -1 : it->second.first;
 }
 
 /*
-===========
-COM_FOpenFile
-
-If the requested file is inside a packfile, a new FILE * will be opened
-into the file.
-===========
+============
+COM_PathStats_f
+============
 */
-int COM_FOpenFile(const char* filename, FILE** file, unsigned int* path_id)
+static void COM_PathStats_f()
 {
-    return COM_FindFile(filename, nullptr, file, path_id);
+    if(!com_fileindex.valid)
+    {
+        COM_BuildFileIndex();
+    }
+
+    Con_Printf("%d files, %d unique names, built %d times in %.2f ms\n",
+        (int)com_fileindex.entries.size(), (int)com_fileindex.chains.size(),
+        com_fileindex.builds, com_fileindex.buildtime * 1000.0);
+
+    const unsigned long long lookups = com_fileindex.lookups;
+    Con_Printf("%llu lookups, %llu hits, %llu misses, %.2f ms (%.2f us each)\n",
+        lookups, com_fileindex.hits, lookups - com_fileindex.hits,
+        com_fileindex.lookuptime * 1000.0,
+        lookups ? com_fileindex.lookuptime * 1e6 / lookups : 0.0);
 }
 
 /*
 ============
-COM_CloseFile
+COM_MapPack
 
-If it is a pak file handle, don't really close it
+Maps the whole archive into memory, see COM_LoadStackFileView. Only done
+on little-endian POSIX hosts; elsewhere members are read through stdio.
 ============
 */
-void COM_CloseFile(int h)
+static void COM_MapPack(pack_t* pak)
 {
-    searchpath_t* s;
+#ifndef _WIN32
+    if(!fs_mmap.value || host_bigendian)
+    {
+        return;
+    }
 
-    for(s = com_searchpaths; s; s = s->next)
+    const int fd = open(pak->filename, O_RDONLY);
+    if(fd == -1)
     {
-        if(s->pack && s->pack->handle == h)
+        return;
+    }
+
+    struct stat st;
+    if(!fstat(fd, &st) && st.st_size > 0)
+    {
+        void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED)
         {
-            return;
+            pak->mapped = (byte*)p;
+            pak->mappedsize = st.st_size;
         }
     }
 
-    Sys_FileClose(h);
+    close(fd); // the mapping keeps the file open
+#else
+    (void)pak;
+#endif
 }
 
+/*
+============
+COM_UnmapPack
+============
+*/
+static void COM_UnmapPack(pack_t* pak)
+{
+#ifndef _WIN32
+    if(pak->mapped)
+    {
+        munmap(pak->mapped, pak->mappedsize);
+    }
+#endif
+    pak->mapped = nullptr;
+    pak->mappedsize = 0;
+}
 
 /*
 ============
-COM_LoadFile
+COM_MappedMember
 
-Filename are reletive to the quake directory.
-Allways appends a 0 byte.
+Returns the data of uncompressed member `i` inside a memory-mapped pak.
 ============
 */
-#define LOADFILE_ZONE 0
-#define LOADFILE_HUNK 1
-#define LOADFILE_TEMPHUNK 2
-#define LOADFILE_CACHE 3
-#define LOADFILE_STACK 4
-#define LOADFILE_MALLOC 5
+static byte* COM_MappedMember(const pack_t* pak, const int i)
+{
+    const packfile_t* file = &pak->files[i];
+    if(!pak->mapped || file->deflatedsize || file->filepos < 0 ||
+        file->filelen < 0 ||
+        (size_t)file->filepos + file->filelen > pak->mappedsize)
+    {
+        return nullptr;
+    }
 
-static byte* loadbuf;
-static cache_user_t* loadcache;
-static int loadsize;
+    return pak->mapped + file->filepos;
+}
 
-byte* COM_LoadFile(const char* path, int usehunk, unsigned int* path_id)
+// a pak member located by COM_FindFile but left unopened, because it is
+// compressed or inside a memory-mapped pak
+struct compackmember_t
 {
-    int h;
-    byte* buf;
-    char base[32];
-    int len;
+    const pack_t* pak;
+    const packfile_t* file;
+};
 
-    buf = nullptr; // quiet compiler warning
+/*
+===========
+COM_OpenPackFile
 
-    // look for it in the filesystem or pack files
-    len = COM_OpenFile(path, &h, path_id);
-    if(h == -1)
-    {
-        return nullptr;
-    }
+Opens file `i` of the pak in `search`, see COM_FindFile.
+===========
+*/
+static int COM_OpenPackFile(searchpath_t* search, const int i, int* handle,
+    FILE** file, compackmember_t* member)
+{
+    pack_t* pak = search->pack;
 
-    // extract the filename base name for hunk tag
-    COM_FileBase(path, base, sizeof(base));
+    com_filesize = pak->files[i].filelen;
+    file_from_pak = 1;
 
-    switch(usehunk)
+    if(member && (pak->files[i].deflatedsize || COM_MappedMember(pak, i)))
     {
-        case LOADFILE_HUNK: buf = (byte*)Hunk_AllocName(len + 1, base); break;
-        case LOADFILE_TEMPHUNK: buf = (byte*)Hunk_TempAlloc(len + 1); break;
-        case LOADFILE_ZONE: buf = (byte*)Z_Malloc(len + 1); break;
-        case LOADFILE_CACHE:
-            buf = (byte*)Cache_Alloc(loadcache, len + 1, base);
-            break;
-        case LOADFILE_STACK:
-            if(len < loadsize)
-            {
-                buf = loadbuf;
+        // the caller inflates or copies it straight into its own buffer
+        member->pak = pak;
+        member->file = &pak->files[i];
+        if(handle)
+        {
+            *handle = -1;
+        }
+    }
+    else if(handle)
+    {
+        if(pak->files[i].deflatedsize)
+        {
+            FILE* f = FSZIP_OpenMember(pak, &pak->files[i]);
+            if(f)
+            {
+                *handle = Sys_FileOpenStdio(f);
+            }
+            else
+            { // error!
+                Con_Printf("Couldn't decompress %s\n", pak->files[i].name);
+                com_filesize = -1;
+                *handle = -1;
+            }
+        }
+        else
+        {
+            *handle = pak->handle;
+            Sys_FileSeek(pak->handle, pak->files[i].filepos);
+        }
+    }
+    else if(file)
+    {
+        if(pak->files[i].deflatedsize)
+        { /* a memory stream over the inflated member */
+            *file = FSZIP_OpenMember(pak, &pak->files[i]);
+            if(!*file)
+            {
+                Con_Printf("Couldn't decompress %s\n", pak->files[i].name);
+            }
+        }
+        else
+        { /* open a new file on the pakfile */
+            *file = fopen(pak->filename, "rb");
+            if(*file)
+            {
+                fseek(*file, pak->files[i].filepos, SEEK_SET);
+            }
+        }
+    }
+
+    return com_filesize;
+}
+
+/*
+===========
+COM_NormalizePath
+
+Writes `in` to `out` the way COM_IndexDirectory names files: '/' separated,
+without empty or "." components. Fails on "..", and on names too long or
+too deep to have been indexed.
+===========
+*/
+static bool COM_NormalizePath(const char* in, char* out, const int size)
+{
+    int len = 0;
+    int depth = 0;
+
+    while(*in)
+    {
+        if(*in == '/' || *in == '\\')
+        {
+            in++;
+            continue;
+        }
+
+        const char* end = in;
+        while(*end && *end != '/' && *end != '\\')
+        {
+            end++;
+        }
+
+        const int complen = static_cast<int>(end - in);
+        if(complen == 2 && in[0] == '.' && in[1] == '.')
+        {
+            return false;
+        }
+
+        if(complen != 1 || in[0] != '.')
+        {
+            if(len + complen + 2 > size)
+            {
+                return false;
+            }
+
+            if(len)
+            {
+                out[len++] = '/';
+                depth++;
+            }
+
+            memcpy(out + len, in, complen);
+            len += complen;
+        }
+
+        in = end;
+    }
+
+    out[len] = '\0';
+    return len && depth <= 16; // see COM_IndexDirectory
+}
+
+/*
+===========
+COM_IsRegularFile
+===========
+*/
+static bool COM_IsRegularFile(const char* path)
+{
+#ifdef _WIN32
+    const DWORD attrs = GetFileAttributes(path);
+    return attrs != INVALID_FILE_ATTRIBUTES &&
+           !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return !stat(path, &st) && S_ISREG(st.st_mode);
+#endif
+}
+
+/*
+===========
+COM_IndexWrittenFile
+
+Adds `filename` to the index if it is a loose file of com_gamedir, where
+anything written with plain fopen since the index was built (demos, QC
+files) ends up. Returns the name it was indexed as, or nullptr.
+===========
+*/
+static const char* COM_IndexWrittenFile(const char* filename)
+{
+    char name[MAX_OSPATH];
+    if(!COM_NormalizePath(filename, name, sizeof(name)))
+    {
+        return nullptr;
+    }
+
+    searchpath_t* search = com_searchpaths;
+    for(; search; search = search->next)
+    {
+        if(!search->pack && !strcmp(search->filename, com_gamedir))
+        {
+            break;
+        }
+    }
+
+    char netpath[MAX_OSPATH];
+    if(!search ||
+        q_snprintf(netpath, sizeof(netpath), "%s/%s", com_gamedir, name) >=
+            (int)sizeof(netpath) ||
+        !COM_IsRegularFile(netpath))
+    {
+        return nullptr;
+    }
+
+    const char* stored = com_fileindex.names.emplace_back(name).c_str();
+    COM_IndexFile(search, -1, stored, stored);
+    return stored;
+}
+
+/*
+===========
+COM_LocateFile
+
+Returns the index entry COM_FindFile opens for `filename`, or nullptr. Misses
+are retried under the normalized name, then looked for among the files
+written into com_gamedir since the index was built.
+===========
+*/
+static const comfileentry_t* COM_LocateFile(
+    const char* filename, const bool probe = true)
+{
+    const double start = Sys_DoubleTime();
+    com_fileindex.lookups++;
+
+    //
+    // walk the index entries for this name, in search path order
+    //
+    for(int e = COM_FindIndexedFile(filename); e != -1;
+        e = com_fileindex.entries[e].next)
+    {
+        const comfileentry_t& entry = com_fileindex.entries[e];
+        searchpath_t* search = entry.search;
+
+        if(search->pack) /* a pak file element */
+        {
+            // VR: This hack allows multiple "start.bsp" maps to coexist.
+            // The user can decide which one is loaded by setting a CVar.
+            const auto extractedPakName = VR_ExtractPakName(*search->pack);
+            if(std::strcmp(filename, "maps/start.bsp") == 0 &&
+                extractedPakName != VR_GetActiveStartPakName() &&
+                extractedPakName != "pak0")
+            {
+                continue;
+            }
+        }
+        else /* a file in the directory tree */
+        {
+            char netpath[MAX_OSPATH];
+            q_snprintf(netpath, sizeof(netpath), "%s/%s", search->filename,
+                entry.path);
+
+            if(Sys_FileTime(netpath) == -1)
+            {
+                continue; // removed since the index was built
+            }
+        }
+
+        // found it!
+        com_fileindex.hits++;
+        com_fileindex.lookuptime += Sys_DoubleTime() - start;
+        return &entry;
+    }
+
+    com_fileindex.lookuptime += Sys_DoubleTime() - start;
+
+    if(!probe)
+    {
+        return nullptr;
+    }
+
+    char name[MAX_OSPATH];
+    if(COM_NormalizePath(filename, name, sizeof(name)) &&
+        strcmp(name, filename))
+    {
+        if(const comfileentry_t* entry = COM_LocateFile(name, false))
+        {
+            return entry;
+        }
+    }
+
+    const char* written = COM_IndexWrittenFile(filename);
+    return written ? COM_LocateFile(written, false) : nullptr;
+}
+
+/*
+===========
+COM_FindFile
+
+Finds the file in the search path.
+Sets com_filesize and one of handle or file
+If neither of file or handle is set, this
+can be used for detecting a file's presence.
+If member is set, compressed pak members are
+returned there instead of being opened.
+===========
+*/
+static int COM_FindFile(const char* filename, int* handle, FILE** file,
+    unsigned int* path_id, compackmember_t* member = nullptr)
+{
+    if(file && handle)
+    {
+        Sys_Error("COM_FindFile: both handle and file set");
+    }
+
+    file_from_pak = 0;
+
+    if(const comfileentry_t* entry = COM_LocateFile(filename))
+    {
+        searchpath_t* search = entry->search;
+
+        if(path_id)
+        {
+            *path_id = search->path_id;
+        }
+
+        if(search->pack) /* a pak file element */
+        {
+            return COM_OpenPackFile(search, entry->file, handle, file, member);
+        }
+
+        /* a file in the directory tree */
+        char netpath[MAX_OSPATH];
+        q_snprintf(
+            netpath, sizeof(netpath), "%s/%s", search->filename, entry->path);
+
+        if(handle)
+        {
+            int i;
+            com_filesize = Sys_FileOpenRead(netpath, &i);
+            *handle = i;
+            return com_filesize;
+        }
+        else if(file)
+        {
+            *file = fopen(netpath, "rb");
+            com_filesize = (*file == nullptr) ? -1 : COM_filelength(*file);
+            return com_filesize;
+        }
+        else
+        {
+            return 0; /* dummy valid value for COM_FileExists() */
+        }
+    }
+
+    const char* ext = COM_FileGetExtension(filename);
+    if(strcmp(ext, "pcx") != 0 && strcmp(ext, "tga") != 0 &&
+        strcmp(ext, "png") != 0 && strcmp(ext, "jpg") != 0 &&
+        strcmp(ext, "jpeg") != 0 && strcmp(ext, "lit") != 0 &&
+        strcmp(ext, "ent") != 0)
+    {
+        Con_DPrintf2("FindFile: can't find %s\n", filename);
+    }
+    else
+    {
+        Con_DPrintf3("FindFile: can't find %s\n", filename);
+    }
+    // Log pcx, tga, lit, ent misses only if (developer.value >= 2)
+
+    if(handle)
+    {
+        *handle = -1;
+    }
+
+    if(file)
+    {
+        *file = nullptr;
+    }
+
+    com_filesize = -1;
+    return com_filesize;
+}
+
+
+/*
+===========
+COM_FileExists
+
+Returns whether the file is found in the quake filesystem.
+===========
+*/
+bool COM_FileExists(const char* filename, unsigned int* path_id)
+{
+    int ret = COM_FindFile(filename, nullptr, nullptr, path_id);
+    return (ret == -1) ? false : true;
+}
+
+/*
+===========
+COM_OpenFile
+
+filename never has a leading slash, but may contain directory walks
+returns a handle and a length
+it may actually be inside a pak file
+===========
+*/
+int COM_OpenFile(const char* filename, int* handle, unsigned int* path_id)
+{
+    return COM_FindFile(filename, handle, nullptr, path_id);
+}
+
+/*
+===========
+COM_FOpenFile
+
+If the requested file is inside a packfile, a new FILE * will be opened
+into the file.
+===========
+*/
+int COM_FOpenFile(const char* filename, FILE** file, unsigned int* path_id)
+{
+    return COM_FindFile(filename, nullptr, file, path_id);
+}
+
+/*
+============
+COM_CloseFile
+
+If it is a pak file handle, don't really close it
+============
+*/
+void COM_CloseFile(int h)
+{
+    searchpath_t* s;
+
+    for(s = com_searchpaths; s; s = s->next)
+    {
+        if(s->pack && s->pack->handle == h)
+        {
+            return;
+        }
+    }
+
+    Sys_FileClose(h);
+}
+
+
+/*
+=============================================================================
+
+ASSET PREFETCH
+
+Precache lists are known before anything is loaded, so their files are read
+ahead on the worker pool and handed to COM_LoadFile from memory. Parsing
+stays on the main thread: the model and sound loaders share loadmodel, the
+hunk and the cache allocator.
+
+=============================================================================
+*/
+
+// a file read ahead by COM_Prefetch
+struct comprefetch_t
+{
+    // where it lives: a pak member, or a loose file
+    const pack_t* pak;
+    const packfile_t* file;
+    std::string netpath;
+
+    unsigned int path_id;
+    byte* data; // malloced, with the trailing 0 COM_LoadFile appends
+    int len;
+};
+
+static std::unordered_map<std::string, comprefetch_t> com_prefetch;
+
+// buffers handed out as LOADFILE_VIEW, freed by COM_ClearPrefetch
+static std::vector<byte*> com_prefetch_views;
+
+/*
+============
+COM_ReadPrefetch
+
+Runs on a worker thread, so it only does I/O and reports nothing.
+============
+*/
+static void COM_ReadPrefetch(comprefetch_t& p)
+{
+    FILE* f = nullptr;
+    if(!p.pak)
+    {
+        f = fopen(p.netpath.c_str(), "rb");
+        if(!f)
+        {
+            return;
+        }
+        p.len = COM_filelength(f);
+    }
+    else if(!p.file->deflatedsize)
+    {
+        f = fopen(p.pak->filename, "rb");
+        if(!f)
+        {
+            return;
+        }
+        fseek(f, p.file->filepos, SEEK_SET);
+    }
+
+    byte* data = (byte*)malloc(p.len + 1);
+    bool read = false;
+    if(data)
+    {
+        data[p.len] = 0;
+        read = f ? (int)fread(data, 1, p.len, f) == p.len
+                 : FSZIP_Inflate(p.pak, p.file, data);
+    }
+
+    if(f)
+    {
+        fclose(f);
+    }
+
+    if(!read)
+    {
+        free(data); // COM_LoadFile retries it and reports the error
+        return;
+    }
+
+    p.data = data;
+}
+
+/*
+============
+COM_Prefetch
+============
+*/
+void COM_Prefetch(const std::vector<std::string>& names)
+{
+    const double start = Sys_DoubleTime();
+
+    // resolving touches the index and com_filesize, so it stays on this thread
+    std::vector<comprefetch_t*> pending;
+    for(const std::string& name : names)
+    {
+        if(com_prefetch.count(name))
+        {
+            continue;
+        }
+
+        const comfileentry_t* entry = COM_LocateFile(name.c_str());
+        if(!entry)
+        {
+            continue;
+        }
+
+        comprefetch_t p{};
+        p.path_id = entry->search->path_id;
+
+        if(const pack_t* pak = entry->search->pack)
+        {
+            if(byte* mapped = COM_MappedMember(pak, entry->file))
+            {
+#ifndef _WIN32
+                // already zero-copy, just get the pages faulted in early
+                posix_madvise(mapped, pak->files[entry->file].filelen,
+                    POSIX_MADV_WILLNEED);
+#endif
+                continue;
+            }
+
+            p.pak = pak;
+            p.file = &pak->files[entry->file];
+            p.len = p.file->filelen;
+        }
+        else
+        {
+            p.netpath = std::string{entry->search->filename} + "/";
+            p.netpath += entry->path;
+        }
+
+        auto it = com_prefetch.emplace(name, std::move(p)).first;
+        pending.push_back(&it->second);
+    }
+
+    quake::tasks::parallelFor(static_cast<int>(pending.size()),
+        [&](const int i) { COM_ReadPrefetch(*pending[i]); });
+
+    int files = 0;
+    int bytes = 0;
+    for(comprefetch_t* p : pending)
+    {
+        files += p->data != nullptr;
+        bytes += p->data ? p->len : 0;
+    }
+
+    COM_AddLoadStat(
+        LOADSTAT_PREFETCH, Sys_DoubleTime() - start, bytes, files);
+}
+
+/*
+============
+COM_DropPrefetch
+
+Forgets files that were prefetched but not loaded yet, e.g. because the
+search path changed under them. Views already handed out stay valid.
+============
+*/
+static void COM_DropPrefetch()
+{
+    for(auto& [name, p] : com_prefetch)
+    {
+        free(p.data);
+    }
+    com_prefetch.clear();
+}
+
+/*
+============
+COM_ClearPrefetch
+============
+*/
+void COM_ClearPrefetch()
+{
+    COM_DropPrefetch();
+
+    for(byte* data : com_prefetch_views)
+    {
+        free(data);
+    }
+    com_prefetch_views.clear();
+}
+
+/*
+=============================================================================
+
+LOAD STATISTICS
+
+=============================================================================
+*/
+
+static const char* const loadstat_names[LOADSTAT_COUNT] = {
+    "prefetch", "brush", "alias", "sprite", "other", "sound"};
+
+static struct
+{
+    double start; // zero once the load is over
+    double total;
+    double time[LOADSTAT_COUNT];
+    int count[LOADSTAT_COUNT];
+    long long bytes[LOADSTAT_COUNT];
+} com_loadstats;
+
+/*
+============
+COM_BeginLoadStats
+============
+*/
+void COM_BeginLoadStats()
+{
+    com_loadstats = {};
+    com_loadstats.start = Sys_DoubleTime();
+}
+
+/*
+============
+COM_EndLoadStats
+============
+*/
+void COM_EndLoadStats()
+{
+    if(com_loadstats.start)
+    {
+        com_loadstats.total = Sys_DoubleTime() - com_loadstats.start;
+        com_loadstats.start = 0;
+    }
+}
+
+/*
+============
+COM_AddLoadStat
+============
+*/
+void COM_AddLoadStat(const loadstat_t type, const double seconds,
+    const int bytes, const int count)
+{
+    com_loadstats.time[type] += seconds;
+    com_loadstats.count[type] += count;
+    com_loadstats.bytes[type] += bytes;
+}
+
+/*
+============
+COM_LoadStats_f
+
+Prints where the time of the last map load went.
+============
+*/
+static void COM_LoadStats_f()
+{
+    if(com_loadstats.start)
+    {
+        Con_Printf("map load in progress\n");
+        return;
+    }
+
+    Con_Printf("type        count       KB        ms\n");
+    for(int i = 0; i < LOADSTAT_COUNT; i++)
+    {
+        Con_Printf("%-8s %8d %8lld %9.2f\n", loadstat_names[i],
+            com_loadstats.count[i], com_loadstats.bytes[i] / 1024,
+            com_loadstats.time[i] * 1000.0);
+    }
+    Con_Printf("total %.2f ms, %d workers\n", com_loadstats.total * 1000.0,
+        quake::tasks::numWorkers());
+}
+
+/*
+============
+COM_LoadFile
+
+Filename are reletive to the quake directory.
+Allways appends a 0 byte.
+============
+*/
+#define LOADFILE_ZONE 0
+#define LOADFILE_HUNK 1
+#define LOADFILE_TEMPHUNK 2
+#define LOADFILE_CACHE 3
+#define LOADFILE_STACK 4
+#define LOADFILE_MALLOC 5
+#define LOADFILE_VIEW 6 // LOADFILE_STACK unless memory-mapped
+
+static byte* loadbuf;
+static cache_user_t* loadcache;
+static int loadsize;
+
+/*
+============
+COM_AllocLoadBuffer
+============
+*/
+static byte* COM_AllocLoadBuffer(const char* path, int usehunk, int len)
+{
+    byte* buf;
+    char base[32];
+
+    buf = nullptr; // quiet compiler warning
+
+    // extract the filename base name for hunk tag
+    COM_FileBase(path, base, sizeof(base));
+
+    switch(usehunk)
+    {
+        case LOADFILE_HUNK: buf = (byte*)Hunk_AllocName(len + 1, base); break;
+        case LOADFILE_TEMPHUNK: buf = (byte*)Hunk_TempAlloc(len + 1); break;
+        case LOADFILE_ZONE: buf = (byte*)Z_Malloc(len + 1); break;
+        case LOADFILE_CACHE:
+            buf = (byte*)Cache_Alloc(loadcache, len + 1, base);
+            break;
+        case LOADFILE_STACK:
+        case LOADFILE_VIEW:
+            if(len < loadsize)
+            {
+                buf = loadbuf;
             }
             else
             {
@@ -1695,9 +2486,112 @@ byte* COM_LoadFile(const char* path, int usehunk, unsigned int* path_id)
     }
 
     ((byte*)buf)[len] = 0;
+    return buf;
+}
 
-    Sys_FileRead(h, buf, len);
-    COM_CloseFile(h);
+/*
+============
+COM_LoadPrefetched
+
+Serves a file read ahead by COM_Prefetch, or returns nullptr if it wasn't.
+============
+*/
+static byte* COM_LoadPrefetched(
+    const char* path, int usehunk, unsigned int* path_id)
+{
+    auto it = com_prefetch.find(path);
+    if(it == com_prefetch.end())
+    {
+        return nullptr;
+    }
+
+    comprefetch_t p = std::move(it->second);
+    com_prefetch.erase(it);
+    if(!p.data)
+    {
+        return nullptr; // the read failed, go through the normal path
+    }
+
+    com_filesize = p.len;
+    file_from_pak = p.pak != nullptr;
+    if(path_id)
+    {
+        *path_id = p.path_id;
+    }
+
+    if(usehunk == LOADFILE_VIEW)
+    {
+        com_prefetch_views.push_back(p.data);
+        return p.data;
+    }
+
+    byte* buf = COM_AllocLoadBuffer(path, usehunk, p.len);
+    memcpy(buf, p.data, p.len);
+    free(p.data);
+    return buf;
+}
+
+byte* COM_LoadFile(const char* path, int usehunk, unsigned int* path_id)
+{
+    int h;
+    byte* buf;
+    int len;
+
+    if(!com_prefetch.empty())
+    {
+        if(byte* prefetched = COM_LoadPrefetched(path, usehunk, path_id))
+        {
+            return prefetched;
+        }
+    }
+
+    // look for it in the filesystem or pack files
+    compackmember_t member{};
+    len = COM_FindFile(path, &h, nullptr, path_id, &member);
+    if(h == -1 && !member.file)
+    {
+        return nullptr;
+    }
+
+    // uncompressed member of a memory-mapped pak
+    byte* mapped = member.file ? COM_MappedMember(member.pak,
+                                     member.file - member.pak->files)
+                               : nullptr;
+    if(mapped && usehunk == LOADFILE_VIEW)
+    {
+        return mapped;
+    }
+
+    buf = COM_AllocLoadBuffer(path, usehunk, len);
+
+    if(!member.file)
+    {
+        Sys_FileRead(h, buf, len);
+        COM_CloseFile(h);
+    }
+    else if(mapped)
+    {
+        memcpy(buf, mapped, len);
+    }
+    else if(!FSZIP_Inflate(member.pak, member.file, buf))
+    {
+        Con_Printf("Couldn't decompress %s\n", path);
+
+        // hunk allocations are reclaimed with their owners
+        if(usehunk == LOADFILE_ZONE)
+        {
+            Z_Free(buf);
+        }
+        else if(usehunk == LOADFILE_MALLOC)
+        {
+            free(buf);
+        }
+        else if(usehunk == LOADFILE_CACHE)
+        {
+            Cache_Free(loadcache, false);
+        }
+        return nullptr;
+    }
 
     return buf;
 }
@@ -1737,6 +2631,15 @@ byte* COM_LoadStackFile(
     return buf;
 }
 
+// zero-copy if the file is in a memory-mapped pak, see common.hpp
+byte* COM_LoadStackFileView(
+    const char* path, void* buffer, int bufsize, unsigned int* path_id)
+{
+    loadbuf = (byte*)buffer;
+    loadsize = bufsize;
+    return COM_LoadFile(path, LOADFILE_VIEW, path_id);
+}
+
 // returns malloc'd memory
 byte* COM_LoadMallocFile(const char* path, unsigned int* path_id)
 {
@@ -1915,6 +2818,7 @@ static pack_t* COM_LoadPackFile(const char* packfile)
     pack->handle = packhandle;
     pack->numfiles = numpackfiles;
     pack->files = newfiles;
+    COM_MapPack(pack);
 
     // Sys_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
     return pack;
@@ -2060,6 +2964,7 @@ static bool COM_AddPackage(searchpath_t* basepath, const char* pakfile)
         pak = FSZIP_LoadArchive(pakfile);
         if(pak)
         {
+            COM_MapPack(pak);
             com_modified =
                 true; // would always be true, so we don't bother with crcs.
         }
@@ -2080,6 +2985,7 @@ static bool COM_AddPackage(searchpath_t* basepath, const char* pakfile)
     search->next = com_searchpaths;
     com_searchpaths = search;
 
+    COM_InvalidateFileIndex();
     return true;
 }
 
@@ -2170,6 +3076,8 @@ static void COM_AddGameDirectory(const char* base, const char* dir)
 {
     bool been_here = false;
 
+    COM_InvalidateFileIndex();
+
     q_strlcpy(com_gamedir, va("%s/%s", base, dir), sizeof(com_gamedir));
 
     // assign a path_id to this game directory
@@ -2333,6 +3241,7 @@ static void COM_Game_f()
         {
             if(com_searchpaths->pack)
             {
+                COM_UnmapPack(com_searchpaths->pack);
                 Sys_FileClose(com_searchpaths->pack->handle);
                 Z_Free(com_searchpaths->pack->files);
                 Z_Free(com_searchpaths->pack);
@@ -2341,6 +3250,8 @@ static void COM_Game_f()
             Z_Free(com_searchpaths);
             com_searchpaths = search;
         }
+        COM_InvalidateFileIndex();
+        FSZIP_FlushCache();
         hipnotic = false;
         rogue = false;
         standard_quake = true;
@@ -2441,6 +3352,10 @@ void COM_InitFilesystem() // johnfitz -- modified based on topaz's tutorial
     Cvar_RegisterVariable(&registered);
     Cvar_RegisterVariable(&cmdline);
     Cmd_AddCommand("path", COM_Path_f);
+    Cmd_AddCommand("path_stats", COM_PathStats_f);
+    Cmd_AddCommand("loadstats", COM_LoadStats_f);
+    Cvar_RegisterVariable(&fs_zipcache);
+    Cvar_RegisterVariable(&fs_mmap);
     Cmd_AddCommand("game", COM_Game_f); // johnfitz
 
     i = COM_CheckParm("-basedir");
@@ -28,6 +28,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "q_stdinc.hpp"
 #include "link.hpp"
 
+#include <string>
+#include <vector>
+
 // comndef.h  -- general definitions
 
 #if defined(_WIN32)
@@ -147,6 +150,8 @@ typedef struct pack_s
     int handle;
     int numfiles;
     packfile_t* files;
+    byte* mapped; // whole archive, when memory-mapped (fs_mmap)
+    size_t mappedsize;
 } pack_t;
 
 typedef struct searchpath_s
@@ -174,12 +179,18 @@ const char* COM_GetGameNames(bool full);
 bool COM_GameDirMatches(const char* tdirs);
 
 pack_t* FSZIP_LoadArchive(const char* packfile);
-FILE* FSZIP_Deflate(FILE* src, int srcsize, int outsize);
+// Inflates a compressed member into `out`, which holds file->filelen bytes.
+// Thread-safe and silent; callers report failures.
+bool FSZIP_Inflate(const pack_t* pak, const packfile_t* file, void* out);
+// Returns a read-only stream over a compressed member, or nullptr.
+FILE* FSZIP_OpenMember(const pack_t* pak, const packfile_t* file);
+void FSZIP_FlushCache();
 
 void COM_WriteFile(const char* filename, const void* data, int len);
 int COM_OpenFile(const char* filename, int* handle, unsigned int* path_id);
 int COM_FOpenFile(const char* filename, FILE** file, unsigned int* path_id);
 bool COM_FileExists(const char* filename, unsigned int* path_id);
+void COM_InvalidateFileIndex();
 void COM_CloseFile(int h);
 
 // these procedures open a file using COM_FindFile and loads it into a proper
@@ -190,6 +201,13 @@ byte* COM_LoadStackFile(
 // uses the specified stack stack buffer with the specified size
 // of bufsize. if bufsize is too short, uses temp hunk. the bufsize
 // must include the +1
+byte* COM_LoadStackFileView(
+    const char* path, void* buffer, int bufsize, unsigned int* path_id);
+// like COM_LoadStackFile, but uncompressed members of memory-mapped paks are
+// returned as views into the mapping, without the terminating 0 byte. the
+// mapping is private copy-on-write, so writes cost a page copy and are seen
+// by later views of the same member: only loaders whose writes are no-ops on
+// little-endian hosts (byte swapping in place) may use this.
 byte* COM_LoadTempFile(const char* path, unsigned int* path_id);
 // allocates the buffer on the temp hunk.
 byte* COM_LoadHunkFile(const char* path, unsigned int* path_id);
@@ -202,6 +220,31 @@ void COM_LoadCacheFile(
 byte* COM_LoadMallocFile(const char* path, unsigned int* path_id);
 // allocates the buffer on the system mem (malloc).
 
+void COM_Prefetch(const std::vector<std::string>& names);
+// reads the named files on the worker pool, so that the next COM_Load*File
+// of each is served from memory. files that are missing or already in
+// memory-mapped paks are skipped.
+void COM_ClearPrefetch();
+// frees prefetched files that were never loaded, and the views handed out.
+
+enum loadstat_t
+{
+    LOADSTAT_PREFETCH,
+    LOADSTAT_BRUSH,
+    LOADSTAT_ALIAS,
+    LOADSTAT_SPRITE,
+    LOADSTAT_OTHER,
+    LOADSTAT_SOUND,
+    LOADSTAT_COUNT
+};
+
+void COM_BeginLoadStats();
+void COM_EndLoadStats();
+// bracket a map load, from server spawn or serverinfo to the first frame.
+void COM_AddLoadStat(
+    loadstat_t type, double seconds, int bytes, int count = 1);
+// accumulates into the "loadstats" report.
+
 // Opens the given path directly, ignoring search paths.
 // Returns nullptr on failure, or else a '\0'-terminated malloc'ed buffer.
 // Loads in "t" mode so CRLF to LF translation is performed on Windows.
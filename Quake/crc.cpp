@@ -88,3 +88,21 @@ unsigned short CRC_Block(const byte* start, int count)
 
     return crc;
 }
+
+uint64_t Hash64_Block(const void* start, std::size_t count, uint64_t hash)
+{
+    const byte* p = (const byte*)start;
+    for(; count >= 8; p += 8, count -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    for(; count; p++, count--)
+    {
+        hash = (hash ^ *p) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
@@ -23,8 +23,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 /* crc.h */
 
+#include <cstddef>
+#include <cstdint>
+
 void CRC_Init(unsigned short* crcvalue);
 void CRC_ProcessByte(unsigned short* crcvalue, byte data);
 unsigned short CRC_Value(unsigned short crcvalue);
 unsigned short CRC_Block(
     const byte* start, int count); // johnfitz -- texture crc
+
+// fast 64-bit hash for keying on-disk caches, not a CRC; `hash` chains calls
+uint64_t Hash64_Block(const void* start, std::size_t count, uint64_t hash = 0);
@@ -22,6 +22,11 @@ struct edict_t
     bool onladder; /* spike -- content_ladder stuff */ // QSS
 
     float freetime; /* qcvm->time when the object was freed */
+
+    string_t visiblemodelstr; /* v.model value `visiblemodel` was computed
+                                 for */
+    bool visiblemodel;        /* cached `PR_GetString(v.model)[0] != 0` */
+
     entvars_t v;    /* C exported fields from progs */
 
     /* other fields from progs come immediately after */
@@ -5,6 +5,15 @@
 #include "zone.hpp"
 #include "q_stdinc.hpp"
 #include "common.hpp"
+#include "cvar.hpp"
+
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #ifdef USE_ZLIB
 #include <zlib.h>
@@ -897,77 +906,275 @@ pack_t* FSZIP_LoadArchive(const char* packfile)
     return pack;
 }
 
-FILE* FSZIP_Deflate(FILE* src, int srcsize, int outsize)
+//==============================================================================
+// Member inflation. Compressed members are inflated straight into memory:
+// COM_LoadFile hands over its destination buffer, streaming consumers get a
+// read-only FILE* backed by a malloced copy. Recently inflated members are
+// kept in a small LRU cache keyed by (archive, offset), bounded by
+// fs_zipcache megabytes, so repeated probes of the same file are cheap.
+//==============================================================================
+
+cvar_t fs_zipcache = {"fs_zipcache", "16", CVAR_ARCHIVE};
+
+namespace
+{
+
+struct zipcacheentry_t
+{
+    std::string key;
+    std::vector<byte> data;
+};
+
+std::mutex zipcache_mutex; // members may be inflated off the main thread
+std::list<zipcacheentry_t> zipcache; // most recently used first
+std::unordered_map<std::string_view, std::list<zipcacheentry_t>::iterator>
+    zipcache_index;
+std::size_t zipcache_size;
+
+[[nodiscard]] std::string FSZIP_CacheKey(
+    const pack_t* pak, const packfile_t* file)
+{
+    return std::string{pak->filename} + ':' + std::to_string(file->filepos);
+}
+
+[[nodiscard]] std::size_t FSZIP_CacheLimit()
 {
+    return fs_zipcache.value > 0 ? (std::size_t)fs_zipcache.value << 20 : 0;
+}
+
+// Copies a cached member into `out`, returns false if it isn't cached.
+bool FSZIP_CacheLookup(const std::string& key, void* out, int outsize)
+{
+    std::lock_guard lock{zipcache_mutex};
+
+    const auto it = zipcache_index.find(key);
+    if(it == zipcache_index.end() || (int)it->second->data.size() != outsize)
+    {
+        return false;
+    }
+
+    zipcache.splice(zipcache.begin(), zipcache, it->second);
+    memcpy(out, zipcache.front().data.data(), outsize);
+    return true;
+}
+
+void FSZIP_CacheStore(std::string key, const void* data, int size)
+{
+    const std::size_t limit = FSZIP_CacheLimit();
+
+    // a single member may use at most a quarter of the cache
+    if((std::size_t)size > limit / 4)
+    {
+        return;
+    }
+
+    std::lock_guard lock{zipcache_mutex};
+
+    if(zipcache_index.count(key))
+    {
+        return;
+    }
+
+    while(zipcache_size + size > limit && !zipcache.empty())
+    {
+        zipcache_size -= zipcache.back().data.size();
+        zipcache_index.erase(zipcache.back().key);
+        zipcache.pop_back();
+    }
+
+    const byte* bytes = (const byte*)data;
+    zipcache.push_front({std::move(key), {bytes, bytes + size}});
+    zipcache_index.emplace(zipcache.front().key, zipcache.begin());
+    zipcache_size += size;
+}
+
 #ifdef USE_ZLIB
-    byte inbuffer[65536];
-    byte outbuffer[65536];
+// Inflates `file` from its archive into `out` without touching the cache.
+// Reports nothing, since it also runs on worker threads.
+bool FSZIP_InflateMember(const pack_t* pak, const packfile_t* file, void* out)
+{
+    std::vector<byte> in;
+    const byte* src;
+
+    if(pak->mapped &&
+        (size_t)file->filepos + file->deflatedsize <= pak->mappedsize)
+    {
+        src = pak->mapped + file->filepos;
+    }
+    else
+    {
+        FILE* f = fopen(pak->filename, "rb");
+        if(!f)
+        {
+            return false;
+        }
+
+        in.resize(file->deflatedsize);
+        fseek(f, file->filepos, SEEK_SET);
+        const bool read = fread(in.data(), 1, in.size(), f) == in.size();
+        fclose(f);
+
+        if(!read)
+        {
+            return false;
+        }
+
+        src = in.data();
+    }
+
     z_stream strm;
-    int ret;
+    memset(&strm, 0, sizeof(strm));
+    strm.data_type = Z_UNKNOWN;
+    strm.next_in = (Bytef*)src;
+    strm.avail_in = file->deflatedsize;
+    strm.next_out = (Bytef*)out;
+    strm.avail_out = file->filelen;
 
-    FILE* of;
-#ifdef _WIN32
-    /*warning: annother app might manage to open the file before we can. if the
-    file is not opened exclusively then we can end up with issues on windows,
-    fopen is typically exclusive anyway, but not on unix. but on unix, tmpfile
-    is actually usable, so special-case the windows code and hope that its never
-    an issue tmpfile isn't usable in windows. it creates the file in the root
-    dir and requires admin rights, which is stupid.
+    inflateInit2(&strm, -MAX_WBITS);
+    const int ret = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+
+    return ret == Z_STREAM_END && strm.total_out == (uLong)file->filelen;
+}
+#endif
+
+struct zipmemfile_t
+{
+    byte* data;
+    long size;
+    long pos;
+};
+
+#if defined(__GLIBC__)
+ssize_t FSZIP_MemRead(void* cookie, char* buf, size_t size)
+{
+    zipmemfile_t* mf = (zipmemfile_t*)cookie;
+    const size_t n = q_min(size, (size_t)(mf->size - mf->pos));
+    memcpy(buf, mf->data + mf->pos, n);
+    mf->pos += n;
+    return n;
+}
+
+int FSZIP_MemSeek(void* cookie, off64_t* offset, int whence)
+{
+    zipmemfile_t* mf = (zipmemfile_t*)cookie;
+    const long base =
+        whence == SEEK_SET ? 0 : whence == SEEK_CUR ? mf->pos : mf->size;
+    if(base + *offset < 0 || base + *offset > mf->size)
+    {
+        return -1;
+    }
+    *offset = mf->pos = base + *offset;
+    return 0;
+}
+
+int FSZIP_MemClose(void* cookie)
+{
+    zipmemfile_t* mf = (zipmemfile_t*)cookie;
+    free(mf->data);
+    free(mf);
+    return 0;
+}
+#endif
+
+// Wraps the malloced `data` in a read-only stream that frees it on fclose.
+FILE* FSZIP_MemOpen(byte* data, long size)
+{
+#if defined(__GLIBC__)
+    zipmemfile_t* mf = (zipmemfile_t*)malloc(sizeof(zipmemfile_t));
+    *mf = {data, size, 0};
+
+    cookie_io_functions_t io = {FSZIP_MemRead, nullptr, FSZIP_MemSeek,
+        FSZIP_MemClose};
+    FILE* f = fopencookie(mf, "rb", io);
+    if(!f)
+    {
+        FSZIP_MemClose(mf);
+    }
+    return f;
+#else
+    /*no memory streams here, so spill the inflated data to a temp file with
+    a single write. warning: annother app might manage to open the file before
+    we can. if the file is not opened exclusively then we can end up with
+    issues on windows, fopen is typically exclusive anyway, but not on unix.
+    tmpfile isn't usable in windows. it creates the file in the root dir and
+    requires admin rights, which is stupid.
     */
+#ifdef _WIN32
     char* fname = _tempnam(nullptr, "ftemp");
-    of = fopen(fname, "w+bD");
+    FILE* f = fopen(fname, "w+bD");
+    free(fname);
 #else
-    of = tmpfile();
+    FILE* f = tmpfile();
 #endif
-
-    if(!of)
+    if(f)
     {
-        fclose(src);
-        return nullptr;
+        fwrite(data, 1, size, f);
+        fseek(f, 0, SEEK_SET);
     }
+    free(data);
+    return f;
+#endif
+}
 
-    memset(&strm, 0, sizeof(strm));
-    strm.data_type = Z_UNKNOWN;
-    inflateInit2(&strm, -MAX_WBITS);
-    while((ret = inflate(&strm, Z_SYNC_FLUSH)) != Z_STREAM_END)
+} // namespace
+
+bool FSZIP_Inflate(const pack_t* pak, const packfile_t* file, void* out)
+{
+#ifdef USE_ZLIB
+    const bool cache = FSZIP_CacheLimit() > 0;
+    std::string key;
+
+    if(cache)
     {
-        if(strm.avail_in == 0 || strm.avail_out == 0)
+        key = FSZIP_CacheKey(pak, file);
+        if(FSZIP_CacheLookup(key, out, file->filelen))
         {
-            if(strm.avail_in == 0)
-            {
-                strm.avail_in = fread(inbuffer, 1, sizeof(inbuffer), src);
-                strm.next_in = inbuffer;
-                if(!strm.avail_in) break;
-            }
-            if(strm.avail_out == 0)
-            {
-                strm.next_out = outbuffer;
-                fwrite(outbuffer, 1, strm.total_out, of);
-                strm.total_out = 0;
-                strm.avail_out = sizeof(outbuffer);
-            }
-            continue;
+            return true;
         }
+    }
 
-        // doh, it terminated for no reason
-        if(ret != Z_STREAM_END)
-        {
-            inflateEnd(&strm);
-            fclose(src);
-            fclose(of);
-            Con_Printf("Couldn't decompress file\n");
-            return nullptr;
-        }
+    if(!FSZIP_InflateMember(pak, file, out))
+    {
+        return false;
     }
-    fwrite(outbuffer, 1, strm.total_out, of);
-    inflateEnd(&strm);
 
-    fclose(src);
+    if(cache)
+    {
+        FSZIP_CacheStore(std::move(key), out, file->filelen);
+    }
 
-    fseek(of, SEEK_SET, 0);
-    return of;
+    return true;
 #else
-    fclose(src);
-    return nullptr;
+    (void)pak;
+    (void)file;
+    (void)out;
+    return false;
 #endif
 }
+
+FILE* FSZIP_OpenMember(const pack_t* pak, const packfile_t* file)
+{
+    byte* data = (byte*)malloc(q_max(file->filelen, 1));
+    if(!data)
+    {
+        return nullptr;
+    }
+
+    if(!FSZIP_Inflate(pak, file, data))
+    {
+        free(data);
+        return nullptr;
+    }
+
+    return FSZIP_MemOpen(data, file->filelen);
+}
+
+void FSZIP_FlushCache()
+{
+    std::lock_guard lock{zipcache_mutex};
+
+    zipcache_index.clear();
+    zipcache.clear();
+    zipcache_size = 0;
+}
@@ -42,6 +42,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.hpp"
 #include "sys.hpp"
 #include "srcformat.hpp"
+#include "crc.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 qmodel_t* loadmodel;
 char loadname[32]; // for hunk tags
@@ -56,6 +69,9 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash);
 cvar_t external_ents = {"external_ents", "1", CVAR_ARCHIVE};
 cvar_t gl_load24bit = {"gl_load24bit", "1", CVAR_ARCHIVE};
 cvar_t mod_ignorelmscale = {"mod_ignorelmscale", "0"};
+cvar_t mod_pvscache = {"mod_pvscache", "32", CVAR_NONE}; // MB, 0 = off
+cvar_t mod_bspcache = {"mod_bspcache", "1", CVAR_ARCHIVE};
+cvar_t mod_bspcache_pvs = {"mod_bspcache_pvs", "64", CVAR_ARCHIVE}; // MB
 
 static byte* mod_novis;
 static int mod_novis_capacity;
@@ -63,12 +79,31 @@ static int mod_novis_capacity;
 static byte* mod_decompressed;
 static int mod_decompressed_capacity;
 
+// Direct-mapped cache of decompressed leaf PVS rows for one model, sized by
+// `mod_pvscache`. Big enough for every leaf on most maps.
+static struct
+{
+    const qmodel_t* model;
+    const byte* visdata;
+    float megabytes;
+    int rowbytes;
+    int numslots;
+    int* tags; // leaf number held by each slot, -1 if none
+    byte* rows;
+} mod_pvscache_state;
+
+// bumped whenever cached PVS data may have become stale
+static unsigned int mod_pvsgeneration;
+
 #define MAX_MOD_KNOWN                                                          \
     8192 /*spike -- new value, was 2048 in qs, 512 in vanilla. Needs to be big \
             for big maps with many many inline models. */
 qmodel_t mod_known[MAX_MOD_KNOWN];
 int mod_numknown;
 
+// mod_known by name; the keys point into mod_known[].name
+static std::unordered_map<std::string_view, qmodel_t*> mod_knownindex;
+
 texture_t* r_notexture_mip;  // johnfitz -- moved here from r_main.c
 texture_t* r_notexture_mip2; // johnfitz -- used for non-lightmapped surfs with
                              // a missing texture
@@ -84,6 +119,9 @@ void Mod_Init()
     Cvar_RegisterVariable(&external_ents);
     Cvar_RegisterVariable(&gl_load24bit);
     Cvar_RegisterVariable(&mod_ignorelmscale);
+    Cvar_RegisterVariable(&mod_pvscache);
+    Cvar_RegisterVariable(&mod_bspcache);
+    Cvar_RegisterVariable(&mod_bspcache_pvs);
 
     // johnfitz -- create notexture miptex
     r_notexture_mip =
@@ -237,13 +275,118 @@ byte* Mod_DecompressVis(byte* in, qmodel_t* model)
     return mod_decompressed;
 }
 
+/*
+===================
+Mod_ClearPVSCache
+===================
+*/
+static void Mod_ClearPVSCache()
+{
+    free(mod_pvscache_state.tags);
+    free(mod_pvscache_state.rows);
+    memset(&mod_pvscache_state, 0, sizeof(mod_pvscache_state));
+
+    ++mod_pvsgeneration;
+}
+
+/*
+===================
+Mod_SetupPVSCache
+
+Returns false if the cache is disabled or too small to hold a single row.
+===================
+*/
+static bool Mod_SetupPVSCache(qmodel_t* model)
+{
+    auto& c = mod_pvscache_state;
+
+    if(c.model == model && c.visdata == model->visdata &&
+        c.megabytes == mod_pvscache.value)
+    {
+        return c.numslots > 0;
+    }
+
+    Mod_ClearPVSCache();
+
+    c.model = model;
+    c.visdata = model->visdata;
+    c.megabytes = mod_pvscache.value;
+
+    // keep rows 8-byte aligned for the word-wide ORs in SV_FatPVS
+    c.rowbytes = (((model->numleafs + 7) >> 3) + 7) & ~7;
+
+    const double capacity = double(c.megabytes) * 1024.0 * 1024.0;
+    c.numslots = int(q_min(capacity / c.rowbytes, model->numleafs + 1.0));
+
+    if(c.numslots <= 0)
+    {
+        c.numslots = 0;
+        return false;
+    }
+
+    c.tags = (int*)malloc(c.numslots * sizeof(int));
+    c.rows = (byte*)malloc(size_t(c.numslots) * c.rowbytes);
+    if(!c.tags || !c.rows)
+    {
+        Sys_Error("Mod_SetupPVSCache: malloc() failed on %d rows of %d bytes",
+            c.numslots, c.rowbytes);
+    }
+
+    memset(c.tags, 0xff, c.numslots * sizeof(int));
+    return true;
+}
+
+/*
+===================
+Mod_LeafPVS
+
+The returned row is only valid until the next call.
+===================
+*/
 byte* Mod_LeafPVS(mleaf_t* leaf, qmodel_t* model)
 {
     if(leaf == model->leafs)
     {
         return Mod_NoVisPVS(model);
     }
-    return Mod_DecompressVis(leaf->compressed_vis, model);
+
+    const int leafnum = leaf - model->leafs;
+    if(leafnum < model->numpvsrows)
+    {
+        return model->pvsrows + size_t(leafnum) * model->pvsrowbytes;
+    }
+
+    if(!model->visdata || !Mod_SetupPVSCache(model))
+    {
+        return Mod_DecompressVis(leaf->compressed_vis, model);
+    }
+
+    auto& c = mod_pvscache_state;
+
+    const int slot = leafnum % c.numslots;
+    byte* row = c.rows + size_t(slot) * c.rowbytes;
+
+    if(c.tags[slot] != leafnum)
+    {
+        memcpy(row, Mod_DecompressVis(leaf->compressed_vis, model),
+            (model->numleafs + 7) >> 3);
+        c.tags[slot] = leafnum;
+    }
+
+    return row;
+}
+
+/*
+===================
+Mod_PVSGeneration
+
+Changes whenever PVS data returned earlier may be stale, so that users can
+cache what they compute from it.
+===================
+*/
+unsigned int Mod_PVSGeneration()
+{
+    return mod_pvsgeneration;
 }
 
 byte* Mod_NoVisPVS(qmodel_t* model)
@@ -266,6 +409,8 @@ byte* Mod_NoVisPVS(qmodel_t* model)
     return mod_novis;
 }
 
+static void Mod_ReleaseSidecar(qmodel_t* mod);
+
 /*
 ===================
 Mod_ClearAll
@@ -283,8 +428,11 @@ void Mod_ClearAll()
             mod->needload = true;
             TexMgr_FreeTexturesForOwner(mod); // johnfitz
             PScript_ClearSurfaceParticles(mod);
+            Mod_ReleaseSidecar(mod);
         }
     }
+
+    Mod_ClearPVSCache();
 }
 
 void Mod_ResetAll()
@@ -302,9 +450,26 @@ void Mod_ResetAll()
             TexMgr_FreeTexturesForOwner(mod);
             PScript_ClearSurfaceParticles(mod);
         }
+        Mod_ReleaseSidecar(mod);
         memset(mod, 0, sizeof(qmodel_t));
     }
     mod_numknown = 0;
+    mod_knownindex.clear();
+
+    Mod_ClearPVSCache();
+}
+
+/*
+==================
+Mod_FindKnown
+
+Returns the mod_known entry named `name`, or nullptr.
+==================
+*/
+static qmodel_t* Mod_FindKnown(const char* name)
+{
+    const auto it = mod_knownindex.find(name);
+    return it != mod_knownindex.end() ? it->second : nullptr;
 }
 
 /*
@@ -323,31 +488,38 @@ qmodel_t* Mod_FindName(const char* name)
     //
     // search the currently loaded models
     //
-    int i;
-    qmodel_t* mod;
-    for(i = 0, mod = mod_known; i < mod_numknown; i++, mod++)
+    if(qmodel_t* mod = Mod_FindKnown(name))
     {
-        if(!strcmp(mod->name, name))
-        {
-            break;
-        }
+        return mod;
     }
 
-    if(i == mod_numknown)
+    if(mod_numknown == MAX_MOD_KNOWN)
     {
-        if(mod_numknown == MAX_MOD_KNOWN)
-        {
-            Sys_Error("mod_numknown == MAX_MOD_KNOWN");
-        }
-
-        q_strlcpy(mod->name, name, MAX_QPATH);
-        mod->needload = true;
-        mod_numknown++;
+        Sys_Error("mod_numknown == MAX_MOD_KNOWN");
     }
 
+    qmodel_t* mod = &mod_known[mod_numknown++];
+    q_strlcpy(mod->name, name, MAX_QPATH);
+    mod->needload = true;
+    mod_knownindex.emplace(mod->name, mod);
+
     return mod;
 }
 
+/*
+==================
+Mod_NeedsLoad
+
+True if loading `name` would read it from disk, see Mod_LoadModel.
+==================
+*/
+bool Mod_NeedsLoad(const char* name)
+{
+    qmodel_t* mod = Mod_FindKnown(name);
+    return !mod || mod->needload ||
+           (mod->type == mod_alias && !Cache_Check(&mod->cache));
+}
+
 void Mod_ForAllKnownNames(void (*f)(const char*)) noexcept
 {
     int i;
@@ -404,6 +576,8 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash)
         }
     }
 
+    const double loadstart = Sys_DoubleTime();
+
     //
     // load the file
     //
@@ -411,6 +585,12 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash)
     {
         buf = nullptr;
     }
+    else if(!q_strcasecmp(COM_FileGetExtension(mod->name), "bsp"))
+    {
+        // the brush model loader only byte-swaps its input in place
+        buf = COM_LoadStackFileView(
+            mod->name, stackbuf, sizeof(stackbuf), &mod->path_id);
+    }
     else
     {
         buf = COM_LoadStackFile(
@@ -457,6 +637,9 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash)
     // call the apropriate loader
     mod->needload = false;
 
+    // process the skins and textures of the model in parallel
+    TexMgr_BeginBatch();
+
     const int mod_type =
         (buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24));
 
@@ -511,6 +694,8 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash)
         default: Mod_LoadBrushModel(mod, buf); break;
     }
 
+    TexMgr_EndBatch();
+
     if(crash && mod->type == mod_ext_invalid)
     { // any of those formats for a world map will be screwed up.
         Sys_Error("Mod_LoadModel: couldn't load %s",
@@ -521,6 +706,15 @@ qmodel_t* Mod_LoadModel(qmodel_t* mod, bool crash)
     Mod_SetExtraFlags(mod); // johnfitz. spike -- moved this to be generic,
                             // because most of the flags are anyway.
 
+    if(*mod->name != '*')
+    {
+        const loadstat_t stat = mod->type == mod_brush    ? LOADSTAT_BRUSH
+                                : mod->type == mod_alias  ? LOADSTAT_ALIAS
+                                : mod->type == mod_sprite ? LOADSTAT_SPRITE
+                                                          : LOADSTAT_OTHER;
+        COM_AddLoadStat(stat, Sys_DoubleTime() - loadstart, com_filesize);
+    }
+
     return mod;
 }
 
@@ -677,6 +871,361 @@ static void Q1BSPX_Setup(qmodel_t* mod, char* filebase, unsigned int filelen,
     bspxheader = h;
 }
 
+/*
+===============================================================================
+
+                    BSP SIDECAR CACHE
+
+What Mod_LoadBrushModel works out from the BSP, rather than reads from it, is
+kept in <gamedir>/bspcache/<map>.bsc, keyed by a hash of the file and of the
+settings that change the results. The next load maps the file and uses it
+instead of recomputing: the surface extents and bounds, the water vis flags,
+the world's lightmap layout and, if it fits in mod_bspcache_pvs megabytes,
+the decompressed PVS of every leaf. Everything is stored as arrays indexed
+like the model's own, so the mapped file is used as is.
+
+===============================================================================
+*/
+
+#define BSPCACHE_VERSION 1
+#define BSPCACHE_MINSIZE (256 * 1024) // smaller BSPs are quick to load anyway
+
+struct bspcacheheader_t
+{
+    char magic[4]; // "QBSC"
+    uint32_t version;
+    uint64_t key;
+    int32_t numsurfaces;
+    int32_t contentstransparent; // -1 if it wasn't worked out (r_novis)
+    int32_t numpvsrows;          // 0 if the PVS isn't stored
+    int32_t pvsrowbytes;
+    uint64_t surfofs;   // bspcachesurf_t[numsurfaces]
+    uint64_t layoutofs; // int32_t[numsurfaces][3], then an lmalloc_t
+    uint64_t pvsofs;    // byte[numpvsrows][pvsrowbytes], 8-byte aligned
+};
+
+struct bspcachesurf_t
+{
+    float mins[3];
+    float maxs[3];
+    int16_t texturemins[2];
+    int16_t extents[2];
+};
+
+// the sidecar of the BSP being loaded
+static bool mod_usesidecar;
+static uint64_t mod_sidecarkey;
+static const bspcacheheader_t* mod_sidecar; // nullptr until it matches
+
+/*
+=================
+Mod_SidecarPath
+=================
+*/
+static void Mod_SidecarPath(qmodel_t* mod, char* path, size_t pathsize)
+{
+    char base[MAX_QPATH];
+
+    COM_FileBase(mod->name, base, sizeof(base));
+    q_snprintf(path, pathsize, "%s/bspcache/%s.bsc", com_gamedir, base);
+}
+
+/*
+=================
+Mod_ReleaseSidecar
+=================
+*/
+static void Mod_ReleaseSidecar(qmodel_t* mod)
+{
+    // submodels share the world's copy
+    if(mod->sidecar && mod->name[0] != '*')
+    {
+#ifndef _WIN32
+        munmap(mod->sidecar, mod->sidecarsize);
+#else
+        free(mod->sidecar);
+#endif
+    }
+
+    mod->sidecar = nullptr;
+    mod->sidecarsize = 0;
+    mod->pvsrows = nullptr;
+    mod->pvsrowbytes = 0;
+    mod->numpvsrows = 0;
+    mod->lightmaplayout = nullptr;
+}
+
+/*
+=================
+Mod_OpenSidecar -- maps the sidecar and sets mod_sidecar if it matches
+=================
+*/
+static void Mod_OpenSidecar(qmodel_t* mod)
+{
+    char path[MAX_OSPATH];
+    void* data = nullptr;
+    size_t size = 0;
+
+    Mod_SidecarPath(mod, path, sizeof(path));
+
+#ifndef _WIN32
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1)
+    {
+        return;
+    }
+
+    struct stat st;
+    if(!fstat(fd, &st) && st.st_size >= (off_t)sizeof(bspcacheheader_t))
+    {
+        // copy-on-write, as Mod_LeafPVS hands out non-const rows
+        data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fd, 0);
+        size = st.st_size;
+    }
+    close(fd); // the mapping keeps the file open
+
+    if(data == MAP_FAILED || !data)
+    {
+        return;
+    }
+#else
+    FILE* f = fopen(path, "rb");
+    if(!f)
+    {
+        return;
+    }
+
+    fseek(f, 0, SEEK_END);
+    const long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(len >= (long)sizeof(bspcacheheader_t) && (data = malloc(len)))
+    {
+        size = len;
+        if(fread(data, 1, size, f) != size)
+        {
+            free(data);
+            data = nullptr;
+        }
+    }
+    fclose(f);
+
+    if(!data)
+    {
+        return;
+    }
+#endif
+
+    mod->sidecar = data;
+    mod->sidecarsize = size;
+
+    const auto* h = (const bspcacheheader_t*)data;
+    const uint64_t surfsize = uint64_t(h->numsurfaces) * sizeof(bspcachesurf_t);
+    const uint64_t layoutsize =
+        uint64_t(h->numsurfaces) * 3 * sizeof(int32_t) + sizeof(lmalloc_t);
+    const uint64_t pvssize = uint64_t(h->numpvsrows) * h->pvsrowbytes;
+
+    if(memcmp(h->magic, "QBSC", 4) || h->version != BSPCACHE_VERSION ||
+        h->key != mod_sidecarkey || h->numsurfaces < 0 ||
+        h->numpvsrows < 0 || h->pvsrowbytes < 0 ||
+        (h->pvsofs & 7) || (h->pvsrowbytes & 7) ||
+        h->surfofs + surfsize > size || h->layoutofs + layoutsize > size ||
+        h->pvsofs + pvssize > size)
+    {
+        Mod_ReleaseSidecar(mod);
+        return;
+    }
+
+    mod_sidecar = h;
+}
+
+/*
+=================
+Mod_BeginSidecar -- looks for the sidecar of the BSP being loaded, once the
+entities are in
+=================
+*/
+static void Mod_BeginSidecar(qmodel_t* mod, const void* buffer, int size)
+{
+    Mod_ReleaseSidecar(mod);
+    mod_sidecar = nullptr;
+    mod_usesidecar = mod_bspcache.value && size >= BSPCACHE_MINSIZE;
+    if(!mod_usesidecar)
+    {
+        return;
+    }
+
+    const int32_t params[] = {BSPCACHE_VERSION,
+        (int32_t)mod_ignorelmscale.value, LMBLOCK_WIDTH, LMBLOCK_HEIGHT};
+    mod_sidecarkey = Hash64_Block(params, sizeof(params));
+    mod_sidecarkey = Hash64_Block(buffer, size, mod_sidecarkey);
+    if(mod->entities)
+    {
+        mod_sidecarkey =
+            Hash64_Block(mod->entities, strlen(mod->entities), mod_sidecarkey);
+    }
+
+    Mod_OpenSidecar(mod);
+}
+
+/*
+=================
+Mod_DropSidecar -- for when the sidecar turns out not to fit the model after
+all; it gets rewritten at the end of the load
+=================
+*/
+static void Mod_DropSidecar(qmodel_t* mod)
+{
+    Mod_ReleaseSidecar(mod);
+    mod_sidecar = nullptr;
+}
+
+/*
+=================
+Mod_WriteSidecar
+=================
+*/
+static void Mod_WriteSidecar(qmodel_t* mod, int numleafs)
+{
+    char path[MAX_OSPATH];
+    char temppath[MAX_OSPATH];
+
+    bspcacheheader_t header{};
+    memcpy(header.magic, "QBSC", 4);
+    header.version = BSPCACHE_VERSION;
+    header.key = mod_sidecarkey;
+    header.numsurfaces = mod->numsurfaces;
+    header.contentstransparent =
+        r_novis.value ? -1 : mod->contentstransparent;
+
+    std::vector<bspcachesurf_t> surfs(mod->numsurfaces);
+    std::vector<int32_t> layout(mod->numsurfaces * 3);
+    for(int i = 0; i < mod->numsurfaces; i++)
+    {
+        const msurface_t* surf = &mod->surfaces[i];
+        for(int j = 0; j < 3; j++)
+        {
+            surfs[i].mins[j] = surf->mins[j];
+            surfs[i].maxs[j] = surf->maxs[j];
+        }
+        for(int j = 0; j < 2; j++)
+        {
+            surfs[i].texturemins[j] = surf->texturemins[j];
+            surfs[i].extents[j] = surf->extents[j];
+        }
+        layout[i * 3 + 0] = surf->lightmaptexturenum;
+        layout[i * 3 + 1] = surf->light_s;
+        layout[i * 3 + 2] = surf->light_t;
+    }
+
+    // rows are padded like mod_pvscache's, for the word-wide ORs in
+    // SV_FatPVS
+    const int rowbytes = (((mod->numleafs + 7) >> 3) + 7) & ~7;
+    const double pvssize = double(numleafs) * rowbytes;
+    if(mod->visdata && pvssize <= mod_bspcache_pvs.value * 1024.0 * 1024.0)
+    {
+        header.numpvsrows = numleafs;
+        header.pvsrowbytes = rowbytes;
+    }
+
+    header.surfofs = sizeof(header);
+    header.layoutofs = header.surfofs + surfs.size() * sizeof(surfs[0]);
+    const uint64_t layoutend = header.layoutofs +
+                               layout.size() * sizeof(layout[0]) +
+                               sizeof(lmalloc_t);
+    header.pvsofs = (layoutend + 7) & ~7ull;
+
+    q_snprintf(path, sizeof(path), "%s/bspcache", com_gamedir);
+    Sys_mkdir(path);
+    Mod_SidecarPath(mod, path, sizeof(path));
+    q_snprintf(temppath, sizeof(temppath), "%s.tmp", path);
+
+    FILE* f = fopen(temppath, "wb");
+    if(!f)
+    {
+        return;
+    }
+
+    static const byte zeros[8] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(surfs.data(), sizeof(surfs[0]), surfs.size(), f) ==
+                  surfs.size() &&
+              fwrite(layout.data(), sizeof(layout[0]), layout.size(), f) ==
+                  layout.size() &&
+              fwrite(mod->lightmaplayout, sizeof(lmalloc_t), 1, f) == 1 &&
+              fwrite(zeros, header.pvsofs - layoutend, 1, f) <= 1;
+
+    std::vector<byte> row(rowbytes);
+    for(int i = 0; ok && i < header.numpvsrows; i++)
+    {
+        const byte* vis =
+            i ? Mod_DecompressVis(mod->leafs[i].compressed_vis, mod)
+              : Mod_NoVisPVS(mod);
+        memcpy(row.data(), vis, (mod->numleafs + 7) >> 3);
+        ok = fwrite(row.data(), rowbytes, 1, f) == 1;
+    }
+
+    ok = !fclose(f) && ok;
+
+#ifdef _WIN32
+    remove(path); // rename doesn't replace files here
+#endif
+    if(!ok || rename(temppath, path))
+    {
+        remove(temppath);
+        Con_DPrintf("Couldn't write %s\n", path);
+    }
+}
+
+/*
+=================
+Mod_FinishSidecar -- takes the lightmap layout and PVS from the sidecar, or
+works them out and writes a new one
+
+`numleafs` counts every leaf, where mod->numleafs is down to the visible
+leafs of the world by now.
+=================
+*/
+static void Mod_FinishSidecar(qmodel_t* mod, int numleafs)
+{
+    if(!mod_usesidecar)
+    {
+        return;
+    }
+
+    mod->lightmaplayout =
+        (lmalloc_t*)Hunk_AllocName(sizeof(lmalloc_t), loadname);
+
+    if(mod_sidecar)
+    {
+        const auto* layout =
+            (const int32_t*)((const byte*)mod_sidecar + mod_sidecar->layoutofs);
+        for(int i = 0; i < mod->numsurfaces; i++, layout += 3)
+        {
+            mod->surfaces[i].lightmaptexturenum = layout[0];
+            mod->surfaces[i].light_s = layout[1];
+            mod->surfaces[i].light_t = layout[2];
+        }
+        memcpy(mod->lightmaplayout, layout, sizeof(lmalloc_t));
+    }
+    else
+    {
+        GL_PackLightmaps(mod, *mod->lightmaplayout);
+        Mod_WriteSidecar(mod, numleafs);
+        Mod_OpenSidecar(mod); // for the PVS
+    }
+
+    if(mod_sidecar && mod_sidecar->numpvsrows == numleafs &&
+        mod_sidecar->pvsrowbytes >= (mod->numleafs + 7) >> 3)
+    {
+        mod->pvsrows = (byte*)mod->sidecar + mod_sidecar->pvsofs;
+        mod->pvsrowbytes = mod_sidecar->pvsrowbytes;
+        mod->numpvsrows = mod_sidecar->numpvsrows;
+    }
+
+    mod_sidecar = nullptr;
+}
+
 /*
 =================
 Mod_CheckFullbrights -- johnfitz
@@ -1373,6 +1922,8 @@ Mod_LoadVisibility
 */
 void Mod_LoadVisibility(lump_t* l)
 {
+    Mod_ClearPVSCache();
+
     loadmodel->viswarn = false;
     if(!l->filelen)
     {
@@ -1951,6 +2502,17 @@ void Mod_LoadFaces(lump_t* l, bool bsp2)
     loadmodel->surfaces = out;
     loadmodel->numsurfaces = count;
 
+    const bspcachesurf_t* cached = nullptr;
+    if(mod_sidecar && mod_sidecar->numsurfaces != count)
+    {
+        Mod_DropSidecar(loadmodel);
+    }
+    else if(mod_sidecar)
+    {
+        cached = (const bspcachesurf_t*)((const byte*)mod_sidecar +
+                                         mod_sidecar->surfofs);
+    }
+
     for(surfnum = 0; surfnum < count; surfnum++, out++)
     {
         if(bsp2)
@@ -2029,10 +2591,24 @@ void Mod_LoadFaces(lump_t* l, bool bsp2)
         out->texinfo = loadmodel->texinfo + texinfon;
         out->lmshift = shift;
 
-        CalcSurfaceExtents(out);
+        if(cached)
+        {
+            const bspcachesurf_t& c = cached[surfnum];
+            out->mins = qvec3(c.mins[0], c.mins[1], c.mins[2]);
+            out->maxs = qvec3(c.maxs[0], c.maxs[1], c.maxs[2]);
+            for(i = 0; i < 2; i++)
+            {
+                out->texturemins[i] = c.texturemins[i];
+                out->extents[i] = c.extents[i];
+            }
+        }
+        else
+        {
+            CalcSurfaceExtents(out);
 
-        Mod_CalcSurfaceBounds(
-            out); // johnfitz -- for per-surface frustum culling
+            Mod_CalcSurfaceBounds(
+                out); // johnfitz -- for per-surface frustum culling
+        }
 
         // lighting info
         if(lofs == -1)
@@ -3242,7 +3818,10 @@ void Mod_LoadBrushModel(qmodel_t* mod, void* buffer)
         ((int*)header)[i] = LittleLong(((int*)header)[i]);
     }
 
-    Q1BSPX_Setup(mod, (char*)buffer, com_filesize, header->lumps, HEADER_LUMPS);
+    // external entities may be loaded before the sidecar is looked for
+    const int filesize = com_filesize;
+
+    Q1BSPX_Setup(mod, (char*)buffer, filesize, header->lumps, HEADER_LUMPS);
 
     // load into heap
 
@@ -3256,6 +3835,7 @@ void Mod_LoadBrushModel(qmodel_t* mod, void* buffer)
     Mod_LoadEntities(
         &header->lumps[LUMP_ENTITIES]); // Spike: moved this earlier, so that we
                                         // can parse worldspawn keys earlier.
+    Mod_BeginSidecar(mod, buffer, filesize);
     Mod_LoadFaces(&header->lumps[LUMP_FACES], bsp2);
     Mod_LoadMarksurfaces(&header->lumps[LUMP_MARKSURFACES], bsp2);
     Mod_LoadVisibility(&header->lumps[LUMP_VISIBILITY]);
@@ -3268,7 +3848,18 @@ void Mod_LoadBrushModel(qmodel_t* mod, void* buffer)
 
     mod->numframes = 2; // regular and alternate animation
 
-    Mod_CheckWaterVis();
+    if(mod_sidecar && mod_sidecar->contentstransparent != -1 &&
+        !r_novis.value)
+    {
+        mod->contentstransparent = mod_sidecar->contentstransparent;
+    }
+    else
+    {
+        Mod_CheckWaterVis();
+    }
+
+    qmodel_t* const basemod = mod;
+    const int numleafs = mod->numleafs;
 
     //
     // set up the submodels (FIXME: this is confusing)
@@ -3344,6 +3935,8 @@ void Mod_LoadBrushModel(qmodel_t* mod, void* buffer)
             Mod_SetExtraFlags(mod);
         }
     }
+
+    Mod_FinishSidecar(basemod, numleafs);
 }
 
 /*
@@ -36,6 +36,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "bspfile.hpp"
 #include "modeleffects.hpp"
 
+#include <cstddef>
+
 /*
 
 d*_t structures are on-disk representations
@@ -87,6 +89,7 @@ typedef enum
 
 
 struct gltexture_t;
+struct lmalloc_t;
 
 struct texture_t
 {
@@ -591,6 +594,14 @@ struct qmodel_t
     int contentstransparent; // spike -- added this so we can disable glitchy
                              // wateralpha where its not supported.
 
+    // derived data from the BSP sidecar cache, see Mod_LoadSidecar
+    void* sidecar; // the mapped file, owned by the non-'*' model
+    std::size_t sidecarsize;
+    byte* pvsrows; // decompressed PVS of every leaf, or nullptr
+    int pvsrowbytes;
+    int numpvsrows;
+    lmalloc_t* lightmaplayout; // GL_PackLightmaps state after this model
+
     //
     // alias model
     //
@@ -620,10 +631,12 @@ qmodel_t* Mod_ForName(const char* name, bool crash);
 qmodel_t* Mod_ForName_WithFallback(const char* name, const char* fallback);
 void* Mod_Extradata(qmodel_t* mod); // handles caching
 void Mod_TouchModel(const char* name);
+bool Mod_NeedsLoad(const char* name);
 
 mleaf_t* Mod_PointInLeaf(const qvec3& p, qmodel_t* model);
 byte* Mod_LeafPVS(mleaf_t* leaf, qmodel_t* model);
 byte* Mod_NoVisPVS(qmodel_t* model);
+unsigned int Mod_PVSGeneration();
 
 void Mod_SetExtraFlags(qmodel_t* mod);
 
@@ -45,6 +45,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qcvm.hpp"
 #include "server.hpp"
 #include "view.hpp"
+#include "profiler.hpp"
 
 /*
 
@@ -1424,6 +1425,8 @@ refresh needs almost the entire 256k of stack space!
 */
 void SCR_UpdateScreen()
 {
+    QUAKE_PROFILE_ZONE("SCR_UpdateScreen");
+
     vid.numpages = (gl_triplebuffer.value) ? 3 : 2;
 
     if(scr_disabled_for_loading)
@@ -35,6 +35,33 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sys.hpp"
 #include "render.hpp"
 #include "srcformat.hpp"
+#include "tasks.hpp"
+#include "texproc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
 
 const int gl_solid_format = 3;
 const int gl_alpha_format = 4;
@@ -44,6 +71,8 @@ static cvar_t gl_texture_anisotropy = {
     "gl_texture_anisotropy", "1", CVAR_ARCHIVE};
 static cvar_t gl_max_size = {"gl_max_size", "0", CVAR_NONE};
 static cvar_t gl_picmip = {"gl_picmip", "0", CVAR_NONE};
+static cvar_t gl_texcache = {"gl_texcache", "1", CVAR_ARCHIVE};
+static cvar_t gl_texcache_size = {"gl_texcache_size", "256", CVAR_ARCHIVE};
 static GLint gl_hardware_maxsize;
 
 #define MAX_GLTEXTURES 2048
@@ -442,6 +471,62 @@ TexMgr_FrameUsage -- report texture memory usage for this frame
 ================================================================================
 */
 
+// a texture's identity for TexMgr_FindTexture; the name points into the
+// gltexture_t::name of one of the textures it maps to
+struct texkey_t
+{
+    qmodel_t* owner;
+    std::string_view name;
+
+    [[nodiscard]] bool operator==(const texkey_t& rhs) const noexcept
+    {
+        return owner == rhs.owner && name == rhs.name;
+    }
+};
+
+struct texkeyhash_t
+{
+    [[nodiscard]] std::size_t operator()(const texkey_t& key) const noexcept
+    {
+        return std::hash<std::string_view>{}(key.name) ^
+               (std::hash<qmodel_t*>{}(key.owner) * 31);
+    }
+};
+
+// active textures by owner and name; names aren't unique, so each key keeps
+// all of its textures, the most recently loaded one last
+static std::unordered_map<texkey_t, std::vector<gltexture_t*>, texkeyhash_t>
+    texmgr_index;
+
+/*
+================
+TexMgr_UnindexTexture
+================
+*/
+static void TexMgr_UnindexTexture(gltexture_t* glt)
+{
+    const auto it = texmgr_index.find({glt->owner, glt->name});
+    if(it == texmgr_index.end())
+    {
+        return;
+    }
+
+    std::vector<gltexture_t*>& textures = it->second;
+    textures.erase(std::remove(textures.begin(), textures.end(), glt),
+        textures.end());
+    if(textures.empty())
+    {
+        texmgr_index.erase(it);
+    }
+    else if(it->first.name.data() == glt->name)
+    {
+        // the key must not outlive the name it points into
+        auto node = texmgr_index.extract(it);
+        node.key().name = node.mapped().front()->name;
+        texmgr_index.insert(std::move(node));
+    }
+}
+
 /*
 ================
 TexMgr_FindTexture
@@ -449,16 +534,12 @@ TexMgr_FindTexture
 */
 [[nodiscard]] gltexture_t* TexMgr_FindTexture(qmodel_t* owner, const char* name)
 {
-    gltexture_t* glt;
-
     if(name)
     {
-        for(glt = active_gltextures; glt; glt = glt->next)
+        const auto it = texmgr_index.find({owner, name});
+        if(it != texmgr_index.end())
         {
-            if(glt->owner == owner && !strcmp(glt->name, name))
-            {
-                return glt;
-            }
+            return it->second.back();
         }
     }
 
@@ -490,6 +571,7 @@ TexMgr_NewTexture
 }
 
 static void GL_DeleteTexture(gltexture_t* texture);
+static void TexMgr_DropBatchedImage(gltexture_t* glt);
 
 // ericw -- workaround for preventing TexMgr_FreeTexture during
 // TexMgr_ReloadImages
@@ -515,6 +597,9 @@ void TexMgr_FreeTexture(gltexture_t* kill)
         return;
     }
 
+    TexMgr_UnindexTexture(kill);
+    TexMgr_DropBatchedImage(kill);
+
     if(active_gltextures == kill)
     {
         active_gltextures = kill->next;
@@ -755,6 +840,8 @@ void TexMgr_RecalcWarpImageSize()
     Hunk_FreeToLowMark(mark);
 }
 
+static void TexMgr_TexcacheClear_f();
+
 /*
 ================
 TexMgr_Init
@@ -788,6 +875,8 @@ void TexMgr_Init()
 
     Cvar_RegisterVariable(&gl_max_size);
     Cvar_RegisterVariable(&gl_picmip);
+    Cvar_RegisterVariable(&gl_texcache);
+    Cvar_RegisterVariable(&gl_texcache_size);
     Cvar_RegisterVariable(&gl_texture_anisotropy);
     Cvar_SetCallback(&gl_texture_anisotropy, &TexMgr_Anisotropy_f);
     gl_texturemode.string = glmodes[glmode_idx].name;
@@ -796,6 +885,7 @@ void TexMgr_Init()
     Cmd_AddCommand("gl_describetexturemodes", &TexMgr_DescribeTextureModes_f);
     Cmd_AddCommand("imagelist", &TexMgr_Imagelist_f);
     Cmd_AddCommand("imagedump", &TexMgr_Imagedump_f);
+    Cmd_AddCommand("texcache_clear", &TexMgr_TexcacheClear_f);
 
     // poll max size from hardware
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl_hardware_maxsize);
@@ -875,556 +965,753 @@ TexMgr_PadConditional -- only pad if a texture of that size would be padded.
 }
 
 /*
-================
-TexMgr_MipMapW
-================
+================================================================================
+
+    IMAGE PROCESSING
+
+================================================================================
 */
-static unsigned* TexMgr_MipMapW(unsigned* data, int width, int height)
+
+// The CPU side of loading an 8 or 32 bit image: everything that depends on
+// GL state or cvars is decided up front by TexMgr_PlanImage, so that
+// TexMgr_ProcessImage only touches its own buffers and can run on a worker.
+struct teximage_t
 {
-    int i;
-    int size;
-    byte* out;
-    byte* in;
+    gltexture_t* glt;
+    unsigned flags; // glt->flags when it was loaded
 
-    out = in = (byte*)data;
-    size = (width * height) >> 1;
+    const byte* data;
+    std::vector<byte> copy; // batched loads own their input
 
-    for(i = 0; i < size; i++, out += 4, in += 8)
-    {
-        out[0] = (in[0] + in[4]) >> 1;
-        out[1] = (in[1] + in[5]) >> 1;
-        out[2] = (in[2] + in[6]) >> 1;
-        out[3] = (in[3] + in[7]) >> 1;
-    }
+    // 8-bit input only
+    bool indexed;
+    const unsigned* palette;
+    byte padbyte;
 
-    return data;
-}
+    int width; // input size
+    int height;
+    int padwidth; // size after padding the 8-bit input, else the input size
+    int padheight;
+    int reswidth; // size after resampling to a power of two
+    int resheight;
+    int mipwidth; // size of level 0 after picmip, as uploaded
+    int mipheight;
+
+    // texture cache, see TexMgr_ProcessImage
+    const char* cachedir; // nullptr to skip the cache
+    char cachename[32];
+    bool cachehit;
+    std::size_t cachesize; // of the file read or written, if any
+    void* mapping;         // the cache file, while it is uploaded from
+
+    std::vector<unsigned> levels; // what gets uploaded, level 0 first
+    const unsigned* upload;       // levels, or the pixels in mapping
+};
+
+// images loaded between TexMgr_BeginBatch and TexMgr_EndBatch
+static std::vector<teximage_t> texmgr_batch;
+static int texmgr_batchdepth;
+
+/*
+================================================================================
+
+    TEXTURE CACHE
+
+Processed images are kept in <gamedir>/texcache, one file per image named
+after a hash of everything TexMgr_BuildImage depends on: the input pixels,
+the palette, the planned sizes and the flags that change the output. A hit
+skips the CPU work entirely and uploads straight from the mapped file. The
+directory is kept under gl_texcache_size megabytes by evicting the least
+recently used files, going by their modification time between sessions.
+
+================================================================================
+*/
+
+#define TEXCACHE_VERSION 1
+#define TEXCACHE_MINPIXELS (64 * 64) // smaller images are quicker to rebuild
+#define TEXCACHE_FLAGS (TEXPREF_ALPHA | TEXPREF_PREMULTIPLY | TEXPREF_MIPMAP)
+
+struct texcacheheader_t
+{
+    char magic[4]; // "QTXC"
+    uint32_t version;
+    uint64_t key;
+    uint32_t crc; // glt->source_crc
+    uint32_t flags;
+    int32_t mipwidth;
+    int32_t mipheight;
+    uint32_t pixels; // in all levels
+    uint32_t pad;
+};
+
+struct texcacheentry_t
+{
+    std::size_t size;
+    time_t lastuse;
+};
+
+// what is in the cache directory; main thread only
+static char texcache_dir[MAX_OSPATH];
+static std::unordered_map<std::string, texcacheentry_t> texcache_index;
+static std::size_t texcache_total;
 
 /*
 ================
-TexMgr_MipMapH
+TexMgr_IndexCacheFile
 ================
 */
-static unsigned* TexMgr_MipMapH(unsigned* data, int width, int height)
+static void TexMgr_IndexCacheFile(const char* name)
 {
-    int i;
-    int j;
-    byte* out;
-    byte* in;
+    char path[MAX_OSPATH];
+    struct stat st;
 
-    out = in = (byte*)data;
-    height >>= 1;
-    width <<= 2;
-
-    for(i = 0; i < height; i++, in += width)
+    q_snprintf(path, sizeof(path), "%s/%s", texcache_dir, name);
+    if(stat(path, &st))
     {
-        for(j = 0; j < width; j += 4, out += 4, in += 4)
-        {
-            out[0] = (in[0] + in[width + 0]) >> 1;
-            out[1] = (in[1] + in[width + 1]) >> 1;
-            out[2] = (in[2] + in[width + 2]) >> 1;
-            out[3] = (in[3] + in[width + 3]) >> 1;
-        }
+        return;
     }
 
-    return data;
+    texcache_index[name] = {(std::size_t)st.st_size, st.st_mtime};
+    texcache_total += st.st_size;
 }
 
 /*
 ================
-TexMgr_ResampleTexture -- bilinear resample
+TexMgr_CacheDir -- returns the cache directory of the current game, and
+indexes its contents the first time it is used
 ================
 */
-static unsigned* TexMgr_ResampleTexture(
-    unsigned* in, int inwidth, int inheight, bool alpha)
-{
-    byte* nwpx;
-    byte* nepx;
-    byte* swpx;
-    byte* sepx;
-    byte* dest;
-    unsigned xfrac;
-    unsigned yfrac;
-    unsigned x;
-    unsigned y;
-    unsigned modx;
-    unsigned mody;
-    unsigned imodx;
-    unsigned imody;
-    unsigned injump;
-    unsigned outjump;
-    unsigned* out;
-    int i;
-    int j;
-    int outwidth;
-    int outheight;
+static const char* TexMgr_CacheDir()
+{
+    char dir[MAX_OSPATH];
 
-    if(inwidth == TexMgr_Pad(inwidth) && inheight == TexMgr_Pad(inheight))
+    q_snprintf(dir, sizeof(dir), "%s/texcache", com_gamedir);
+    if(!strcmp(dir, texcache_dir))
     {
-        return in;
+        return texcache_dir;
     }
 
-    outwidth = TexMgr_Pad(inwidth);
-    outheight = TexMgr_Pad(inheight);
-    out = (unsigned*)Hunk_Alloc(outwidth * outheight * 4);
-
-    xfrac = ((inwidth - 1) << 16) / (outwidth - 1);
-    yfrac = ((inheight - 1) << 16) / (outheight - 1);
-    y = outjump = 0;
+    Sys_mkdir(dir);
+    q_strlcpy(texcache_dir, dir, sizeof(texcache_dir));
+    texcache_index.clear();
+    texcache_total = 0;
 
-    for(i = 0; i < outheight; i++)
+#ifdef _WIN32
+    WIN32_FIND_DATA fdat;
+    q_snprintf(dir, sizeof(dir), "%s/*.tex", texcache_dir);
+    const HANDLE fhnd = FindFirstFile(dir, &fdat);
+    if(fhnd != INVALID_HANDLE_VALUE)
     {
-        mody = (y >> 8) & 0xFF;
-        imody = 256 - mody;
-        injump = (y >> 16) * inwidth;
-        x = 0;
-
-        for(j = 0; j < outwidth; j++)
+        do
         {
-            modx = (x >> 8) & 0xFF;
-            imodx = 256 - modx;
-
-            nwpx = (byte*)(in + (x >> 16) + injump);
-            nepx = nwpx + 4;
-            swpx = nwpx + inwidth * 4;
-            sepx = swpx + 4;
-
-            dest = (byte*)(out + outjump + j);
-
-            dest[0] = (nwpx[0] * imodx * imody + nepx[0] * modx * imody +
-                          swpx[0] * imodx * mody + sepx[0] * modx * mody) >>
-                      16;
-            dest[1] = (nwpx[1] * imodx * imody + nepx[1] * modx * imody +
-                          swpx[1] * imodx * mody + sepx[1] * modx * mody) >>
-                      16;
-            dest[2] = (nwpx[2] * imodx * imody + nepx[2] * modx * imody +
-                          swpx[2] * imodx * mody + sepx[2] * modx * mody) >>
-                      16;
-            if(alpha)
-            {
-                dest[3] = (nwpx[3] * imodx * imody + nepx[3] * modx * imody +
-                              swpx[3] * imodx * mody + sepx[3] * modx * mody) >>
-                          16;
-            }
-            else
+            TexMgr_IndexCacheFile(fdat.cFileName);
+        } while(FindNextFile(fhnd, &fdat));
+        FindClose(fhnd);
+    }
+#else
+    DIR* dir_p = opendir(texcache_dir);
+    if(dir_p != nullptr)
+    {
+        struct dirent* dir_t;
+        while((dir_t = readdir(dir_p)) != nullptr)
+        {
+            if(!strcmp(COM_FileGetExtension(dir_t->d_name), "tex"))
             {
-                dest[3] = 255;
+                TexMgr_IndexCacheFile(dir_t->d_name);
             }
-
-            x += xfrac;
         }
-        outjump += outwidth;
-        y += yfrac;
+        closedir(dir_p);
     }
+#endif
 
-    return out;
+    return texcache_dir;
 }
 
 /*
-===============
-TexMgr_AlphaEdgeFix
-
-eliminate pink edges on sprites, etc.
-operates in place on 32bit data
+================
+TexMgr_UseCacheFile -- records that a cache file was just read or written
+================
+*/
+static void TexMgr_UseCacheFile(
+    const char* name, const std::size_t size, const bool touch)
+{
+    texcacheentry_t& entry = texcache_index[name];
+    texcache_total += size - entry.size;
+    entry.size = size;
+    entry.lastuse = time(nullptr);
+
+    // bump the modification time so that the next session sees it too
+    if(touch)
+    {
+        char path[MAX_OSPATH];
+        q_snprintf(path, sizeof(path), "%s/%s", texcache_dir, name);
+#ifdef _WIN32
+        _utime(path, nullptr);
+#else
+        utime(path, nullptr);
+#endif
+    }
+}
 
-spike -- small note that would be better to use premultiplied alpha to
-completely eliminate these skirts without the possibility of misbehaving.
-===============
+/*
+================
+TexMgr_TrimCache -- evicts the least recently used files until the cache
+fits in gl_texcache_size
+================
 */
-static void TexMgr_AlphaEdgeFix(byte* data, int width, int height)
+static void TexMgr_TrimCache()
 {
-    int i;
-    int j;
-    int n = 0;
-    int b;
-    int c[3] = {0, 0, 0};
-    int lastrow;
-    int thisrow;
-    int nextrow;
-    int lastpix;
-    int thispix;
-    int nextpix;
-    byte* dest = data;
-
-    for(i = 0; i < height; i++)
-    {
-        lastrow = width * 4 * ((i == 0) ? height - 1 : i - 1);
-        thisrow = width * 4 * i;
-        nextrow = width * 4 * ((i == height - 1) ? 0 : i + 1);
-
-        for(j = 0; j < width; j++, dest += 4)
-        {
-            if(dest[3])
-            {
-                // not transparent
-                continue;
-            }
+    const std::size_t limit =
+        (std::size_t)q_max(gl_texcache_size.value, 0.f) * 1024 * 1024;
+    if(texcache_total <= limit)
+    {
+        return;
+    }
 
-            lastpix = 4 * ((j == 0) ? width - 1 : j - 1);
-            thispix = 4 * j;
-            nextpix = 4 * ((j == width - 1) ? 0 : j + 1);
+    using entry_it = decltype(texcache_index)::iterator;
+    std::vector<std::pair<time_t, entry_it>> lru;
+    lru.reserve(texcache_index.size());
+    for(auto it = texcache_index.begin(); it != texcache_index.end(); ++it)
+    {
+        lru.emplace_back(it->second.lastuse, it);
+    }
+    std::sort(lru.begin(), lru.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
 
-            b = lastrow + lastpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = thisrow + lastpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = nextrow + lastpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = lastrow + thispix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = nextrow + thispix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = lastrow + nextpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = thisrow + nextpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
-            b = nextrow + nextpix;
-            if(data[b + 3])
-            {
-                c[0] += data[b];
-                c[1] += data[b + 1];
-                c[2] += data[b + 2];
-                n++;
-            }
+    for(const auto& [lastuse, it] : lru)
+    {
+        if(texcache_total <= limit)
+        {
+            break;
+        }
 
-            // average all non-transparent neighbors
-            if(n)
-            {
-                dest[0] = (byte)(c[0] / n);
-                dest[1] = (byte)(c[1] / n);
-                dest[2] = (byte)(c[2] / n);
+        char path[MAX_OSPATH];
+        q_snprintf(
+            path, sizeof(path), "%s/%s", texcache_dir, it->first.c_str());
+        remove(path);
+        texcache_total -= it->second.size;
+        texcache_index.erase(it);
+    }
+}
 
-                n = c[0] = c[1] = c[2] = 0;
-            }
+/*
+================
+TexMgr_TexcacheClear_f
+================
+*/
+static void TexMgr_TexcacheClear_f()
+{
+    char path[MAX_OSPATH];
+    int count = 0;
+
+    TexMgr_CacheDir();
+    for(const auto& [name, entry] : texcache_index)
+    {
+        q_snprintf(path, sizeof(path), "%s/%s", texcache_dir, name.c_str());
+        if(!remove(path))
+        {
+            count++;
         }
     }
+
+    Con_Printf("removed %i cached textures (%i KB)\n", count,
+        (int)(texcache_total / 1024));
+    texcache_index.clear();
+    texcache_total = 0;
 }
 
 /*
-===============
-TexMgr_PadEdgeFixW -- special case of AlphaEdgeFix for textures that only need
-it because they were padded
+================
+TexMgr_CacheHeader -- the header the image's cache file must have
+================
+*/
+static texcacheheader_t TexMgr_CacheHeader(const teximage_t& img)
+{
+    const int32_t params[] = {img.indexed, img.padbyte, img.width, img.height,
+        img.padwidth, img.padheight, img.reswidth, img.resheight,
+        img.mipwidth, img.mipheight, (int32_t)(img.flags & TEXCACHE_FLAGS)};
+    const std::size_t size = img.width * img.height * (img.indexed ? 1 : 4);
+
+    uint64_t key = Hash64_Block(params, sizeof(params), TEXCACHE_VERSION);
+    key = Hash64_Block(img.data, size, key);
+    if(img.indexed)
+    {
+        key = Hash64_Block(img.palette, 256 * sizeof(unsigned), key);
+    }
+
+    int w = img.mipwidth;
+    int h = img.mipheight;
+    uint32_t pixels = w * h;
+    while((img.flags & TEXPREF_MIPMAP) && (w > 1 || h > 1))
+    {
+        w = q_max(w >> 1, 1);
+        h = q_max(h >> 1, 1);
+        pixels += w * h;
+    }
+
+    texcacheheader_t header{};
+    memcpy(header.magic, "QTXC", 4);
+    header.version = TEXCACHE_VERSION;
+    header.key = key;
+    header.crc = img.glt->source_crc;
+    header.flags = img.flags & TEXCACHE_FLAGS;
+    header.mipwidth = img.mipwidth;
+    header.mipheight = img.mipheight;
+    header.pixels = pixels;
+    return header;
+}
 
-operates in place on 32bit data, and expects unpadded height and width values
-===============
+/*
+================
+TexMgr_ReadCache -- points img.upload at the cached levels, if they are there
+================
 */
-static void TexMgr_PadEdgeFixW(byte* data, int width, int height)
+static bool TexMgr_ReadCache(teximage_t& img, const texcacheheader_t& header)
 {
-    byte* src;
-    byte* dst;
-    int i;
-    int padw;
-    int padh;
+    char path[MAX_OSPATH];
+    const std::size_t size = sizeof(header) + header.pixels * 4ull;
 
-    padw = TexMgr_PadConditional(width);
-    padh = TexMgr_PadConditional(height);
+    q_snprintf(path, sizeof(path), "%s/%s", img.cachedir, img.cachename);
 
-    // copy last full column to first empty column, leaving alpha byte at zero
-    src = data + (width - 1) * 4;
-    for(i = 0; i < padh; i++)
+#ifndef _WIN32
+    const int fd = open(path, O_RDONLY);
+    if(fd == -1)
     {
-        src[4] = src[0];
-        src[5] = src[1];
-        src[6] = src[2];
-        src += padw * 4;
+        return false;
     }
 
-    // copy first full column to last empty column, leaving alpha byte at zero
-    src = data;
-    dst = data + (padw - 1) * 4;
-    for(i = 0; i < padh; i++)
+    struct stat st;
+    void* p = MAP_FAILED;
+    if(!fstat(fd, &st) && (std::size_t)st.st_size == size)
     {
-        dst[0] = src[0];
-        dst[1] = src[1];
-        dst[2] = src[2];
-        src += padw * 4;
-        dst += padw * 4;
+        p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
+    close(fd); // the mapping keeps the file open
+
+    if(p == MAP_FAILED)
+    {
+        return false;
+    }
+    if(memcmp(p, &header, sizeof(header)))
+    {
+        munmap(p, size);
+        return false;
+    }
+
+    img.mapping = p;
+    img.upload = (const unsigned*)((const byte*)p + sizeof(header));
+#else
+    FILE* f = fopen(path, "rb");
+    if(!f)
+    {
+        return false;
+    }
+
+    texcacheheader_t ondisk;
+    bool ok = fread(&ondisk, sizeof(ondisk), 1, f) == 1 &&
+              !memcmp(&ondisk, &header, sizeof(header));
+    if(ok)
+    {
+        img.levels.resize(header.pixels);
+        ok = fread(img.levels.data(), 4, header.pixels, f) == header.pixels &&
+             fgetc(f) == EOF;
+    }
+    fclose(f);
+
+    if(!ok)
+    {
+        img.levels.clear();
+        return false;
+    }
+
+    img.upload = img.levels.data();
+#endif
+
+    img.cachehit = true;
+    img.cachesize = size;
+    return true;
 }
 
 /*
-===============
-TexMgr_PadEdgeFixH -- special case of AlphaEdgeFix for textures that only need
-it because they were padded
-
-operates in place on 32bit data, and expects unpadded height and width values
-===============
+================
+TexMgr_WriteCache -- writes img.levels out under a temporary name, then
+renames it into place so that a half-written file is never picked up
+================
 */
-static void TexMgr_PadEdgeFixH(byte* data, int width, int height)
+static void TexMgr_WriteCache(teximage_t& img, const texcacheheader_t& header)
 {
-    byte* src;
-    byte* dst;
-    int i;
-    int padw;
-    int padh;
+    char path[MAX_OSPATH];
+    char temppath[MAX_OSPATH];
 
-    padw = TexMgr_PadConditional(width);
-    padh = TexMgr_PadConditional(height);
+    q_snprintf(path, sizeof(path), "%s/%s", img.cachedir, img.cachename);
+    q_snprintf(temppath, sizeof(temppath), "%s.%p", path, (void*)&img);
 
-    // copy last full row to first empty row, leaving alpha byte at zero
-    dst = data + height * padw * 4;
-    src = dst - padw * 4;
-    for(i = 0; i < padw; i++)
+    FILE* f = fopen(temppath, "wb");
+    if(!f)
     {
-        dst[0] = src[0];
-        dst[1] = src[1];
-        dst[2] = src[2];
-        src += 4;
-        dst += 4;
+        return;
     }
 
-    // copy first full row to last empty row, leaving alpha byte at zero
-    dst = data + (padh - 1) * padw * 4;
-    src = data;
-    for(i = 0; i < padw; i++)
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(img.levels.data(), 4, header.pixels, f) == header.pixels;
+    ok = !fclose(f) && ok;
+
+#ifdef _WIN32
+    remove(path); // rename doesn't replace files here
+#endif
+    if(!ok || rename(temppath, path))
     {
-        dst[0] = src[0];
-        dst[1] = src[1];
-        dst[2] = src[2];
-        src += 4;
-        dst += 4;
+        remove(temppath);
+        return;
     }
+
+    img.cachesize = sizeof(header) + header.pixels * 4ull;
 }
 
 /*
 ================
-TexMgr_8to32
+TexMgr_PlanImage -- works out the final size of the texture
 ================
 */
-static unsigned* TexMgr_8to32(byte* in, int pixels, unsigned int* usepal)
+static void TexMgr_PlanImage(teximage_t& img)
 {
-    int i;
-    unsigned* out;
-    unsigned* data;
+    gltexture_t* glt = img.glt;
+
+    img.flags = glt->flags;
+    img.reswidth = gl_texture_NPOT ? img.padwidth : TexMgr_Pad(img.padwidth);
+    img.resheight =
+        gl_texture_NPOT ? img.padheight : TexMgr_Pad(img.padheight);
 
-    out = data = (unsigned*)Hunk_Alloc(pixels * 4);
+    // mipmap down
+    const int picmip =
+        (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+    const int mipwidth = TexMgr_SafeTextureSize(img.reswidth >> picmip);
+    const int mipheight = TexMgr_SafeTextureSize(img.resheight >> picmip);
 
-    for(i = 0; i < pixels; i++)
+    for(img.mipwidth = img.reswidth; img.mipwidth > mipwidth;)
     {
-        *out++ = usepal[*in++];
+        img.mipwidth >>= 1;
     }
+    for(img.mipheight = img.resheight; img.mipheight > mipheight;)
+    {
+        img.mipheight >>= 1;
+    }
+
+    glt->width = img.mipwidth;
+    glt->height = img.mipheight;
 
-    return data;
+    if(gl_texcache.value && img.reswidth * img.resheight >= TEXCACHE_MINPIXELS)
+    {
+        img.cachedir = TexMgr_CacheDir();
+    }
 }
 
 /*
 ================
-TexMgr_PadImageW -- return image with width padded up to power-of-two dimentions
+TexMgr_BuildImage -- builds every level of the texture from the input
 ================
 */
-static byte* TexMgr_PadImageW(byte* in, int width, int height, byte padbyte)
+static void TexMgr_BuildImage(teximage_t& img)
 {
-    int i;
-    int j;
-    int outwidth;
-    byte* out;
-    byte* data;
+    using namespace quake::texproc;
+
+    const bool alpha = img.flags & TEXPREF_ALPHA;
+    int w = img.padwidth;
+    int h = img.padheight;
+    std::vector<unsigned> pixels(w * h);
+
+    if(img.indexed)
+    {
+        const byte* in = img.data;
+        std::vector<byte> padded;
+        if(img.padwidth != img.width)
+        {
+            padded.resize(img.padwidth * img.height);
+            padIndexedW(in, img.width, img.height, img.padwidth, img.padbyte,
+                padded.data());
+            in = padded.data();
+        }
+        if(img.padheight != img.height)
+        {
+            std::vector<byte> tall(img.padwidth * img.padheight);
+            padIndexedH(in, img.padwidth, img.height, img.padheight,
+                img.padbyte, tall.data());
+            padded = std::move(tall);
+            in = padded.data();
+        }
+
+        // convert to 32bit
+        expandIndexed(in, w * h, img.palette, pixels.data());
 
-    if(width == TexMgr_Pad(width))
+        // fix edges
+        if(alpha && !(img.flags & TEXPREF_PREMULTIPLY))
+        {
+            alphaEdgeFix((byte*)pixels.data(), w, h);
+        }
+        else
+        {
+            if(img.padwidth != img.width)
+            {
+                padEdgeFixW((byte*)pixels.data(), img.width, w, h);
+            }
+            if(img.padheight != img.height)
+            {
+                padEdgeFixH((byte*)pixels.data(), img.height, w, h);
+            }
+        }
+    }
+    else
     {
-        return in;
+        memcpy(pixels.data(), img.data, w * h * 4);
     }
 
-    outwidth = TexMgr_Pad(width);
+    // do this before any rescaling
+    if(img.flags & TEXPREF_PREMULTIPLY)
+    {
+        premultiply((byte*)pixels.data(), w * h);
+    }
 
-    out = data = (byte*)Hunk_Alloc(outwidth * height);
+    // resample up
+    if(img.reswidth != w || img.resheight != h)
+    {
+        std::vector<unsigned> resampled(img.reswidth * img.resheight);
+        resample(pixels.data(), w, h, resampled.data(), img.reswidth,
+            img.resheight, alpha);
+        pixels = std::move(resampled);
+        w = img.reswidth;
+        h = img.resheight;
+    }
 
-    for(i = 0; i < height; i++)
+    // mipmap down
+    while(w > img.mipwidth)
     {
-        for(j = 0; j < width; j++)
+        mipMapW(pixels.data(), w, h);
+        w >>= 1;
+        if(alpha)
         {
-            *out++ = *in++;
+            alphaEdgeFix((byte*)pixels.data(), w, h);
         }
-        for(; j < outwidth; j++)
+    }
+    while(h > img.mipheight)
+    {
+        mipMapH(pixels.data(), w, h);
+        h >>= 1;
+        if(alpha)
         {
-            *out++ = padbyte;
+            alphaEdgeFix((byte*)pixels.data(), w, h);
         }
     }
 
-    return data;
+    img.levels.reserve(w * h * 4 / 3 + 32);
+    img.levels.assign(pixels.begin(), pixels.begin() + w * h);
+
+    // build mipmaps
+    if(img.flags & TEXPREF_MIPMAP)
+    {
+        while(w > 1 || h > 1)
+        {
+            if(w > 1)
+            {
+                mipMapW(pixels.data(), w, h);
+                w >>= 1;
+            }
+            if(h > 1)
+            {
+                mipMapH(pixels.data(), w, h);
+                h >>= 1;
+            }
+            img.levels.insert(
+                img.levels.end(), pixels.begin(), pixels.begin() + w * h);
+        }
+    }
 }
 
 /*
 ================
-TexMgr_PadImageH -- return image with height padded up to power-of-two
-dimentions
+TexMgr_ProcessImage -- fetches the levels from the texture cache, or builds
+them and adds them to it
 ================
 */
-static byte* TexMgr_PadImageH(byte* in, int width, int height, byte padbyte)
+static void TexMgr_ProcessImage(teximage_t& img)
 {
-    int i;
-    int srcpix;
-    int dstpix;
-    byte* data;
-    byte* out;
-
-    if(height == TexMgr_Pad(height))
+    if(!img.cachedir)
     {
-        return in;
+        TexMgr_BuildImage(img);
+        img.upload = img.levels.data();
+        return;
     }
 
-    srcpix = width * height;
-    dstpix = width * TexMgr_Pad(height);
+    const texcacheheader_t header = TexMgr_CacheHeader(img);
+    q_snprintf(img.cachename, sizeof(img.cachename), "%08x%08x.tex",
+        (unsigned)(header.key >> 32), (unsigned)header.key);
 
-    out = data = (byte*)Hunk_Alloc(dstpix);
-
-    for(i = 0; i < srcpix; i++)
-    {
-        *out++ = *in++;
-    }
-    for(; i < dstpix; i++)
+    if(TexMgr_ReadCache(img, header))
     {
-        *out++ = padbyte;
+        return;
     }
 
-    return data;
+    TexMgr_BuildImage(img);
+    img.upload = img.levels.data();
+    TexMgr_WriteCache(img, header);
 }
 
-[[nodiscard]] static byte* TexMgr_PreMultiply32(
-    byte* in, size_t width, size_t height)
+/*
+================
+TexMgr_UploadImage
+================
+*/
+static void TexMgr_UploadImage(const teximage_t& img)
 {
-    size_t pixels = width * height;
-    byte* out = (byte*)Hunk_Alloc(pixels * 4);
-    byte* result = out;
-    while(pixels-- > 0)
+    gltexture_t* glt = img.glt;
+    const int internalformat =
+        (img.flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+    const unsigned* level = img.upload;
+    int w = img.mipwidth;
+    int h = img.mipheight;
+
+    // upload
+    GL_Bind(glt);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, w, h, 0, GL_RGBA,
+        GL_UNSIGNED_BYTE, level);
+
+    // upload mipmaps
+    if(img.flags & TEXPREF_MIPMAP)
     {
-        out[0] = (in[0] * in[3]) >> 8;
-        out[1] = (in[1] * in[3]) >> 8;
-        out[2] = (in[2] * in[3]) >> 8;
-        out[3] = in[3];
-        in += 4;
-        out += 4;
+        for(int miplevel = 1; w > 1 || h > 1; miplevel++)
+        {
+            level += w * h;
+            w = q_max(w >> 1, 1);
+            h = q_max(h >> 1, 1);
+            glTexImage2D(GL_TEXTURE_2D, miplevel, internalformat, w, h, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, level);
+        }
     }
-    return result;
+
+    // set filter modes
+    TexMgr_SetFilterModes(glt);
 }
 
 /*
 ================
-TexMgr_LoadImage32 -- handles 32bit source data
+TexMgr_FinishImage -- lets go of the cache file and accounts for it
 ================
 */
-static void TexMgr_LoadImage32(gltexture_t* glt, unsigned* data)
+static void TexMgr_FinishImage(teximage_t& img)
 {
-    int internalformat;
-    int miplevel;
-    int mipwidth;
-    int mipheight;
-    int picmip;
-
-    // do this before any rescaling
-    if(glt->flags & TEXPREF_PREMULTIPLY)
+    if(img.cachesize)
     {
-        data = (unsigned*)TexMgr_PreMultiply32(
-            (byte*)data, glt->width, glt->height);
+        TexMgr_UseCacheFile(img.cachename, img.cachesize, img.cachehit);
     }
 
-    if(!gl_texture_NPOT)
+#ifndef _WIN32
+    if(img.mapping)
     {
-        // resample up
-        data = TexMgr_ResampleTexture(
-            data, glt->width, glt->height, glt->flags & TEXPREF_ALPHA);
-        glt->width = TexMgr_Pad(glt->width);
-        glt->height = TexMgr_Pad(glt->height);
+        munmap(img.mapping, img.cachesize);
     }
+#endif
+    img.mapping = nullptr;
+}
 
-    // mipmap down
-    picmip =
-        (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
-    mipwidth = TexMgr_SafeTextureSize(glt->width >> picmip);
-    mipheight = TexMgr_SafeTextureSize(glt->height >> picmip);
-    while((int)glt->width > mipwidth)
+/*
+================
+TexMgr_SubmitImage -- processes and uploads the image, or queues it up
+================
+*/
+static void TexMgr_SubmitImage(teximage_t&& img)
+{
+    TexMgr_PlanImage(img);
+
+    if(texmgr_batchdepth)
     {
-        TexMgr_MipMapW(data, glt->width, glt->height);
-        glt->width >>= 1;
-        if(glt->flags & TEXPREF_ALPHA)
-        {
-            TexMgr_AlphaEdgeFix((byte*)data, glt->width, glt->height);
-        }
+        const int size = img.width * img.height * (img.indexed ? 1 : 4);
+        img.copy.assign(img.data, img.data + size);
+        img.data = img.copy.data();
+        texmgr_batch.push_back(std::move(img));
+        return;
     }
-    while((int)glt->height > mipheight)
+
+    TexMgr_ProcessImage(img);
+    TexMgr_UploadImage(img);
+    TexMgr_FinishImage(img);
+    TexMgr_TrimCache();
+}
+
+/*
+================
+TexMgr_BeginBatch
+================
+*/
+void TexMgr_BeginBatch()
+{
+    texmgr_batchdepth++;
+}
+
+/*
+================
+TexMgr_EndBatch -- processes the queued images in parallel and uploads them
+================
+*/
+void TexMgr_EndBatch()
+{
+    if(--texmgr_batchdepth > 0)
     {
-        TexMgr_MipMapH(data, glt->width, glt->height);
-        glt->height >>= 1;
-        if(glt->flags & TEXPREF_ALPHA)
-        {
-            TexMgr_AlphaEdgeFix((byte*)data, glt->width, glt->height);
-        }
+        return;
     }
 
-    // upload
-    GL_Bind(glt);
-    internalformat =
-        (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
-    glTexImage2D(GL_TEXTURE_2D, 0, internalformat, glt->width, glt->height, 0,
-        GL_RGBA, GL_UNSIGNED_BYTE, data);
+    quake::tasks::parallelFor(static_cast<int>(texmgr_batch.size()),
+        [](const int i) { TexMgr_ProcessImage(texmgr_batch[i]); });
 
-    // upload mipmaps
-    if(glt->flags & TEXPREF_MIPMAP)
+    for(teximage_t& img : texmgr_batch)
     {
-        mipwidth = glt->width;
-        mipheight = glt->height;
+        TexMgr_UploadImage(img);
+        TexMgr_FinishImage(img);
+    }
 
-        for(miplevel = 1; mipwidth > 1 || mipheight > 1; miplevel++)
-        {
-            if(mipwidth > 1)
-            {
-                TexMgr_MipMapW(data, mipwidth, mipheight);
-                mipwidth >>= 1;
-            }
-            if(mipheight > 1)
-            {
-                TexMgr_MipMapH(data, mipwidth, mipheight);
-                mipheight >>= 1;
-            }
-            glTexImage2D(GL_TEXTURE_2D, miplevel, internalformat, mipwidth,
-                mipheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        }
+    texmgr_batch.clear();
+    TexMgr_TrimCache();
+}
+
+/*
+================
+TexMgr_EndAllBatches -- for when a Host_Error unwound past TexMgr_EndBatch
+================
+*/
+void TexMgr_EndAllBatches()
+{
+    if(texmgr_batchdepth)
+    {
+        texmgr_batchdepth = 1;
+        TexMgr_EndBatch();
     }
+}
 
-    // set filter modes
-    TexMgr_SetFilterModes(glt);
+/*
+================
+TexMgr_DropBatchedImage -- forgets a queued image whose texture is freed
+================
+*/
+static void TexMgr_DropBatchedImage(gltexture_t* glt)
+{
+    const auto queued = [&](const teximage_t& img) { return img.glt == glt; };
+    texmgr_batch.erase(
+        std::remove_if(texmgr_batch.begin(), texmgr_batch.end(), queued),
+        texmgr_batch.end());
+}
+
+/*
+================
+TexMgr_LoadImage32 -- handles 32bit source data
+================
+*/
+static void TexMgr_LoadImage32(gltexture_t* glt, unsigned* data)
+{
+    teximage_t img{};
+    img.glt = glt;
+    img.data = (const byte*)data;
+    img.width = img.padwidth = glt->width;
+    img.height = img.padheight = glt->height;
+
+    TexMgr_SubmitImage(std::move(img));
 }
 
 
@@ -1584,8 +1871,6 @@ TexMgr_LoadImage8 -- handles 8bit source data, then passes it to LoadImage32
 static void TexMgr_LoadImage8(gltexture_t* glt, byte* data)
 {
     extern cvar_t gl_fullbrights;
-    bool padw = false;
-    bool padh = false;
     byte padbyte;
     unsigned int* usepal;
     int i;
@@ -1653,46 +1938,30 @@ static void TexMgr_LoadImage8(gltexture_t* glt, byte* data)
         padbyte = 255;
     }
 
+    teximage_t img{};
+    img.glt = glt;
+    img.data = data;
+    img.indexed = true;
+    img.palette = usepal;
+    img.padbyte = padbyte;
+    img.width = img.padwidth = glt->width;
+    img.height = img.padheight = glt->height;
+
     // pad each dimention, but only if it's not going to be downsampled
     // later
     if(glt->flags & TEXPREF_PAD)
     {
         if((int)glt->width < TexMgr_SafeTextureSize(glt->width))
         {
-            data = TexMgr_PadImageW(data, glt->width, glt->height, padbyte);
-            glt->width = TexMgr_Pad(glt->width);
-            padw = true;
+            img.padwidth = TexMgr_Pad(glt->width);
         }
         if((int)glt->height < TexMgr_SafeTextureSize(glt->height))
         {
-            data = TexMgr_PadImageH(data, glt->width, glt->height, padbyte);
-            glt->height = TexMgr_Pad(glt->height);
-            padh = true;
+            img.padheight = TexMgr_Pad(glt->height);
         }
     }
 
-    // convert to 32bit
-    data = (byte*)TexMgr_8to32(data, glt->width * glt->height, usepal);
-
-    // fix edges
-    if((glt->flags & TEXPREF_ALPHA) && !(glt->flags & TEXPREF_PREMULTIPLY))
-    {
-        TexMgr_AlphaEdgeFix(data, glt->width, glt->height);
-    }
-    else
-    {
-        if(padw)
-        {
-            TexMgr_PadEdgeFixW(data, glt->source_width, glt->source_height);
-        }
-        if(padh)
-        {
-            TexMgr_PadEdgeFixH(data, glt->source_width, glt->source_height);
-        }
-    }
-
-    // upload it
-    TexMgr_LoadImage32(glt, (unsigned*)data);
+    TexMgr_SubmitImage(std::move(img));
 }
 
 /*
@@ -1749,11 +2018,12 @@ TexMgr_LoadImage -- the one entry point for loading all textures
     else
     {
         glt = TexMgr_NewTexture();
+        glt->owner = owner;
+        q_strlcpy(glt->name, name, sizeof(glt->name));
+        texmgr_index[{glt->owner, glt->name}].push_back(glt);
     }
 
     // copy data
-    glt->owner = owner;
-    q_strlcpy(glt->name, name, sizeof(glt->name));
     glt->width = width;
     glt->height = height;
     glt->flags = flags;
@@ -1987,11 +2257,13 @@ void TexMgr_ReloadImages()
     // flag.
     in_reload_images = true;
 
+    TexMgr_BeginBatch();
     for(glt = active_gltextures; glt; glt = glt->next)
     {
         glGenTextures(1, &glt->texnum);
         TexMgr_ReloadImage(glt, -1, -1);
     }
+    TexMgr_EndBatch();
 
     in_reload_images = false;
 }
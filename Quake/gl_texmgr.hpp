@@ -114,6 +114,13 @@ void TexMgr_ReloadImage(gltexture_t* glt, int shirt, int pants);
 void TexMgr_ReloadImages();
 void TexMgr_ReloadNobrightImages();
 
+// 8 and 32 bit images loaded between these two calls are processed on the
+// worker pool at TexMgr_EndBatch, and only uploaded then. Their textures
+// already have their final size and flags. Batches nest.
+void TexMgr_BeginBatch();
+void TexMgr_EndBatch();
+void TexMgr_EndAllBatches();
+
 [[nodiscard]] int TexMgr_Pad(int s);
 [[nodiscard]] int TexMgr_SafeTextureSize(int s);
 [[nodiscard]] int TexMgr_PadConditional(int s);
@@ -369,6 +369,15 @@ struct lightmap_s
 extern struct lightmap_s* lightmap;
 extern int lightmap_count; // allocated lightmaps
 
+// where GL_PackLightmaps got to: lightmaps are filled one at a time, keeping
+// the height used in each column of the current one
+struct lmalloc_t
+{
+    int count; // lightmaps needed so far
+    int last;  // the one currently being filled
+    int allocated[LMBLOCK_WIDTH];
+};
+
 extern int gl_warpimagesize; // johnfitz -- for water warp
 
 extern bool r_drawflat_cheatsafe, r_fullbright_cheatsafe, r_lightmap_cheatsafe,
@@ -436,6 +445,7 @@ void R_DrawTextureChains_Water(
 
 void R_RenderDlights();
 void GL_BuildLightmaps();
+void GL_PackLightmaps(qmodel_t* model, lmalloc_t& state);
 void GL_DeleteBModelVertexBuffer();
 void GL_BuildBModelVertexBuffer();
 void GLMesh_LoadVertexBuffers();
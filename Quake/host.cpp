@@ -53,6 +53,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "input.hpp"
 #include "view.hpp"
 #include "developer.hpp"
+#include "tasks.hpp"
+#include "profiler.hpp"
 #include "qcvm.hpp"
 
 #include <csetjmp>
@@ -93,7 +95,7 @@ float host_netinterval;
 
 cvar_t host_framerate = {
     "host_framerate", "0", CVAR_NONE};                // set for slow motion
-cvar_t host_speeds = {"host_speeds", "0", CVAR_NONE}; // set for running times
+cvar_t host_speeds = {"host_speeds", "0", CVAR_NONE}; // see profiler.cpp
 cvar_t host_maxfps = {"host_maxfps", "72", CVAR_ARCHIVE};   // johnfitz
 cvar_t host_timescale = {"host_timescale", "0", CVAR_NONE}; // johnfitz
 cvar_t max_edicts = {
@@ -278,6 +280,7 @@ void Host_Error(const char* error, ...)
     }
 
     PR_SwitchQCVM(nullptr);
+    TexMgr_EndAllBatches(); // in case a model loader bailed out
 
     SCR_EndLoadingPlaque(); // reenable screen updates
 
@@ -429,6 +432,8 @@ void Host_InitLocal()
     Cvar_RegisterVariable(&sys_throttle);
     Cvar_RegisterVariable(&serverprofile);
 
+    quake::profiler::init();
+
     Cvar_RegisterVariable(&fraglimit);
     Cvar_RegisterVariable(&timelimit);
     Cvar_RegisterVariable(&teamplay);
@@ -608,6 +613,7 @@ void SV_DropClient(bool crash)
     host_client->netconnection = nullptr;
 
     SVFTE_DestroyFrames(host_client); // release any delta state
+    SV_DestroyLegacyFrames(host_client);
 
     // free the client (the body stays around)
     host_client->active = false;
@@ -854,6 +860,8 @@ Host_ServerFrame
 */
 void Host_ServerFrame()
 {
+    QUAKE_PROFILE_ZONE("Host_ServerFrame");
+
     int i;
     int active;   // johnfitz
     edict_t* ent; // johnfitz
@@ -928,9 +936,6 @@ Runs all active servers
 void _Host_Frame(double time) // QSS
 {
     static double accumtime = 0; // QSS
-    static double time1 = 0;
-    static double time2 = 0;
-    static double time3 = 0;
 
     {
         host_abortserver_setjmp_done = true;
@@ -971,6 +976,9 @@ void _Host_Frame(double time) // QSS
 
     NET_Poll();
 
+    // report autosaves that finished writing in the background
+    Host_PollSavegame();
+
     // QSS
     if(cl.sendprespawn)
     {
@@ -999,6 +1007,7 @@ void _Host_Frame(double time) // QSS
                     qcvm->num_edicts = qcvm->reserved_edicts = 1;
                     memset(
                         qcvm->edicts, 0, qcvm->num_edicts * qcvm->edict_size);
+                    ED_RebuildFreeList();
 
                     // set a few globals, if they exist
                     if(qcvm->extglobals.maxclients)
@@ -1109,20 +1118,10 @@ void _Host_Frame(double time) // QSS
     }
 
     // update video
-    if(host_speeds.value)
-    {
-        time1 = Sys_DoubleTime();
-    }
-
     SCR_UpdateScreen();
 
     CL_RunParticles(); // johnfitz -- seperated from rendering
 
-    if(host_speeds.value)
-    {
-        time2 = Sys_DoubleTime();
-    }
-
     // update audio
     BGM_Update(); // adds music raw samples and/or advances midi driver
     if(cls.signon == SIGNONS)
@@ -1137,16 +1136,6 @@ void _Host_Frame(double time) // QSS
 
     CDAudio_Update();
 
-    if(host_speeds.value)
-    {
-        int pass1 = (time1 - time3) * 1000;
-        time3 = Sys_DoubleTime();
-        int pass2 = (time2 - time1) * 1000;
-        int pass3 = (time3 - time2) * 1000;
-        Con_Printf("%3i tot %3i server %3i gfx %3i snd\n",
-            pass1 + pass2 + pass3, pass1, pass2, pass3);
-    }
-
     host_framecount++;
 }
 
@@ -1160,9 +1149,14 @@ void Host_Frame(double time) // QSS
     int c;
     int m;
 
+    const int framecount = host_framecount;
+
+    quake::profiler::beginFrame();
+
     if(!serverprofile.value)
     {
         _Host_Frame(time);
+        quake::profiler::endFrame(host_framecount != framecount);
         return;
     }
 
@@ -1170,6 +1164,8 @@ void Host_Frame(double time) // QSS
     _Host_Frame(time);
     time2 = Sys_DoubleTime();
 
+    quake::profiler::endFrame(host_framecount != framecount);
+
     timetotal += time2 - time1;
     timecount++;
 
@@ -1231,6 +1227,7 @@ void Host_Init()
     VR_InitCvars();
     COM_Init();
     COM_InitFilesystem();
+    quake::tasks::init();
     Host_InitLocal();
     W_LoadWadFile(); // johnfitz -- filename is now hard-coded for honesty
     if(cls.state != ca_dedicated)
@@ -1352,9 +1349,11 @@ void Host_Shutdown()
     // keep Con_Printf from trying to update the screen
     scr_disabled_for_loading = true;
 
+    Host_WaitSavegame();
     Host_WriteConfiguration();
 
     NET_Shutdown();
+    quake::tasks::shutdown();
 
     if(cls.state != ca_dedicated)
     {
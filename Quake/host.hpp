@@ -39,7 +39,9 @@ void Host_Shutdown();
 void Host_Callback_Notify(cvar_t* var); /* callback function for CVAR_NOTIFY */
 void Host_Warn(const char* error, ...) FUNC_PRINTF(1, 2);
 bool Host_MakeSavegame(const char* filename, const std::time_t* timestamp,
-    const bool printMessage);
+    const bool printMessage, const bool background = false);
+void Host_WaitSavegame();
+void Host_PollSavegame();
 
 [[noreturn]] void Host_Error(const char* error, ...) FUNC_PRINTF(1, 2);
 [[noreturn]] void Host_EndGame(const char* message, ...) FUNC_PRINTF(1, 2);
@@ -62,7 +62,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "glquake.hpp"
 #include "crc.hpp"
 
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
 
 #ifndef _WIN32
 #include <dirent.h>
@@ -1013,6 +1019,9 @@ void Host_Map_f()
 
     cls.demonum = -1; // stop demo loop in case this fails
 
+    // don't read an autosave that is still being written
+    Host_WaitSavegame();
+
     CL_Disconnect();
     Host_ShutdownServer(false);
 
@@ -1319,8 +1328,149 @@ void Host_SavegameComment(char* text)
     text[SAVEGAME_COMMENT_LENGTH] = '\0';
 }
 
-bool Host_MakeSavegame(
-    const char* filename, const std::time_t* timestamp, const bool printMessage)
+/*
+===============
+Savegame writing
+
+Host_MakeSavegame copies everything that goes into a savegame on the main
+thread. Formatting it and writing the file happens right away, or on
+savegame_thread for autosaves so that they don't cost a frame. Either way
+the file is written under a temporary name and then renamed over the old
+save, so a failed write never clobbers it.
+===============
+*/
+struct savegame_t
+{
+    char name[MAX_OSPATH];
+    std::string header;  // everything up to the globals
+    edsnapshot_t qc;     // globals and edicts
+    std::string trailer; // the extended savegame comment
+    bool printMessage;
+    bool ok;
+    double time; // spent formatting and writing
+};
+
+static std::unique_ptr<savegame_t> savegame_pending;
+static std::thread savegame_thread;
+static std::atomic<bool> savegame_done{false};
+
+static void Host_SaveAppend(std::string& out, const char* fmt, ...)
+    FUNC_PRINTF(2, 3);
+static void Host_SaveAppend(std::string& out, const char* fmt, ...)
+{
+    va_list argptr;
+    char buf[256];
+    int len;
+
+    va_start(argptr, fmt);
+    len = std::vsnprintf(buf, sizeof(buf), fmt, argptr);
+    va_end(argptr);
+
+    if(len < 0)
+    {
+        return;
+    }
+
+    if(len < (int)sizeof(buf))
+    {
+        out.append(buf, len);
+        return;
+    }
+
+    // too long for the stack buffer, format straight into the string
+    const std::size_t ofs = out.size();
+    out.resize(ofs + len + 1);
+    va_start(argptr, fmt);
+    std::vsnprintf(&out[ofs], len + 1, fmt, argptr);
+    va_end(argptr);
+    out.resize(ofs + len);
+}
+
+static void Host_WriteSavegame(savegame_t& save)
+{
+    const double start = Sys_DoubleTime();
+    char temppath[MAX_OSPATH + 4];
+    FILE* f;
+
+    q_snprintf(temppath, sizeof(temppath), "%s.tmp", save.name);
+
+    save.ok = false;
+    f = fopen(temppath, "w");
+    if(f)
+    {
+        fputs(save.header.c_str(), f);
+        ED_WriteSnapshot(f, save.qc);
+        fputs(save.trailer.c_str(), f);
+
+        save.ok = !ferror(f);
+        save.ok = !fclose(f) && save.ok;
+
+#ifdef _WIN32
+        if(save.ok)
+        {
+            remove(save.name); // rename doesn't replace files here
+        }
+#endif
+        if(!save.ok || rename(temppath, save.name))
+        {
+            remove(temppath);
+            save.ok = false;
+        }
+    }
+
+    save.time = Sys_DoubleTime() - start;
+}
+
+static void Host_FinishSavegame(const savegame_t& save)
+{
+    if(!save.ok)
+    {
+        Con_Printf("ERROR: couldn't write %s.\n", save.name);
+    }
+    else if(save.printMessage)
+    {
+        Con_Printf("done.\n");
+    }
+
+    Con_DPrintf("Savegame written in %.2f ms\n", save.time * 1000);
+}
+
+/*
+===============
+Host_WaitSavegame
+
+Blocks until a savegame being written in the background is on disk.
+===============
+*/
+void Host_WaitSavegame()
+{
+    if(!savegame_thread.joinable())
+    {
+        return;
+    }
+
+    savegame_thread.join();
+    Host_FinishSavegame(*savegame_pending);
+    savegame_pending.reset();
+}
+
+/*
+===============
+Host_PollSavegame
+
+Reports a background savegame once it is done, called every frame.
+===============
+*/
+void Host_PollSavegame()
+{
+    if(savegame_pending && savegame_done.load(std::memory_order_acquire))
+    {
+        Host_WaitSavegame();
+    }
+}
+
+bool Host_MakeSavegame(const char* filename, const std::time_t* timestamp,
+    const bool printMessage, const bool background)
 {
     if(!sv.active)
     {
@@ -1355,21 +1505,23 @@ bool Host_MakeSavegame(
         }
     }
 
-    char name[MAX_OSPATH];
-    q_snprintf(name, sizeof(name), "%s/%s", com_gamedir, filename);
-    COM_AddExtension(name, ".sav", sizeof(name));
+    // only one save in flight, and never two writers on the same file
+    Host_WaitSavegame();
+
+    const double start = Sys_DoubleTime();
+    auto save = std::make_unique<savegame_t>();
+    save->printMessage = printMessage;
+
+    q_snprintf(save->name, sizeof(save->name), "%s/%s", com_gamedir, filename);
+    COM_AddExtension(save->name, ".sav", sizeof(save->name));
 
     if(printMessage)
     {
-        Con_Printf("Saving game to %s...\n", name);
+        Con_Printf("Saving game to %s...\n", save->name);
     }
 
-    FILE* f = fopen(name, "w");
-    if(!f)
-    {
-        Con_Printf("ERROR: couldn't open.\n");
-        return false;
-    }
+    std::string& header = save->header;
+    std::string& trailer = save->trailer;
 
     if(timestamp != nullptr)
     {
@@ -1378,25 +1530,25 @@ bool Host_MakeSavegame(
         char buf[256];
         std::strftime(buf, sizeof(buf), "%F %T", ptm);
 
-        fprintf(f, "%s\n", buf);
+        Host_SaveAppend(header, "%s\n", buf);
     }
 
     // QSS
     PR_SwitchQCVM(&sv.qcvm);
 
-    fprintf(f, "%i\n", SAVEGAME_VERSION);
+    Host_SaveAppend(header, "%i\n", SAVEGAME_VERSION);
     char comment[SAVEGAME_COMMENT_LENGTH + 1];
     Host_SavegameComment(comment);
-    fprintf(f, "%s\n", comment);
+    Host_SaveAppend(header, "%s\n", comment);
 
     for(int i = 0; i < NUM_BASIC_SPAWN_PARMS; i++) // QSS
     {
-        fprintf(f, "%f\n", svs.clients->spawn_parms[i]);
+        Host_SaveAppend(header, "%f\n", svs.clients->spawn_parms[i]);
     }
 
-    fprintf(f, "%d\n", current_skill);
-    fprintf(f, "%s\n", sv.name);
-    fprintf(f, "%f\n", qcvm->time); // QSS
+    Host_SaveAppend(header, "%d\n", current_skill);
+    Host_SaveAppend(header, "%s\n", sv.name);
+    Host_SaveAppend(header, "%f\n", qcvm->time); // QSS
 
     // write the light styles
 
@@ -1404,20 +1556,15 @@ bool Host_MakeSavegame(
     {
         if(sv.lightstyles[i])
         {
-            fprintf(f, "%s\n", sv.lightstyles[i]);
+            Host_SaveAppend(header, "%s\n", sv.lightstyles[i]);
         }
         else
         {
-            fprintf(f, "m\n");
+            Host_SaveAppend(header, "m\n");
         }
     }
 
-    ED_WriteGlobals(f);
-    for(int i = 0; i < qcvm->num_edicts; i++) // QSS
-    {
-        ED_Write(f, EDICT_NUM(i));
-        fflush(f);
-    }
+    ED_SnapshotSave(save->qc);
 
     // QSS
     // add extra info (lightstyles, precaches, etc) in a way that's supposed to
@@ -1425,37 +1572,38 @@ bool Host_MakeSavegame(
     // support for late precaches it does NOT protect against spawnfunc precache
     // changes - we would need to include makestatics here too (and optionally
     // baselines, or just recalculate those).
-    fprintf(f, "/*\n");
-    fprintf(f, "// QuakeSpasm extended savegame\n");
+    Host_SaveAppend(trailer, "/*\n");
+    Host_SaveAppend(trailer, "// QuakeSpasm extended savegame\n");
     int i = 0;
     for(i = MAX_LIGHTSTYLES_VANILLA; i < MAX_LIGHTSTYLES; i++)
     {
         if(sv.lightstyles[i])
         {
-            fprintf(f, "sv.lightstyles %i \"%s\"\n", i, sv.lightstyles[i]);
+            Host_SaveAppend(trailer, "sv.lightstyles %i \"%s\"\n", i,
+                sv.lightstyles[i]);
         }
     }
     for(i = 1; i < MAX_MODELS; i++)
     {
         if(sv.model_precache[i])
         {
-            fprintf(
-                f, "sv.model_precache %i \"%s\"\n", i, sv.model_precache[i]);
+            Host_SaveAppend(trailer, "sv.model_precache %i \"%s\"\n", i,
+                sv.model_precache[i]);
         }
     }
     for(i = 1; i < MAX_SOUNDS; i++)
     {
         if(sv.sound_precache[i])
         {
-            fprintf(
-                f, "sv.sound_precache %i \"%s\"\n", i, sv.sound_precache[i]);
+            Host_SaveAppend(trailer, "sv.sound_precache %i \"%s\"\n", i,
+                sv.sound_precache[i]);
         }
     }
     for(i = 1; i < MAX_PARTICLETYPES; i++)
     {
         if(sv.particle_precache[i])
         {
-            fprintf(f, "sv.particle_precache %i \"%s\"\n", i,
+            Host_SaveAppend(trailer, "sv.particle_precache %i \"%s\"\n", i,
                 sv.particle_precache[i]);
         }
     }
@@ -1464,21 +1612,34 @@ bool Host_MakeSavegame(
     {
         if(svs.clients->spawn_parms[i])
         {
-            fprintf(
-                f, "spawnparm %i \"%f\"\n", i + 1, svs.clients->spawn_parms[i]);
+            Host_SaveAppend(trailer, "spawnparm %i \"%f\"\n", i + 1,
+                svs.clients->spawn_parms[i]);
         }
     }
 
-    fprintf(f, "*/\n");
+    Host_SaveAppend(trailer, "*/\n");
 
-    fclose(f);
+    PR_SwitchQCVM(nullptr);
 
-    if(printMessage)
+    Con_DPrintf("Savegame snapshot took %.2f ms on the main thread\n",
+        (Sys_DoubleTime() - start) * 1000);
+
+    if(!background)
     {
-        Con_Printf("done.\n");
+        Host_WriteSavegame(*save);
+        Host_FinishSavegame(*save);
+        return save->ok;
     }
 
-    PR_SwitchQCVM(nullptr);
+    savegame_pending = std::move(save);
+    savegame_done.store(false, std::memory_order_relaxed);
+    savegame_thread = std::thread(
+        []
+        {
+            Host_WriteSavegame(*savegame_pending);
+            savegame_done.store(true, std::memory_order_release);
+        });
+
     return true;
 }
 
@@ -1515,6 +1676,9 @@ bool Host_Loadgame(const char* filename, const bool hasTimestamp)
 
     cls.demonum = -1; // stop demo loop in case this fails
 
+    // don't read a savegame that is still being written
+    Host_WaitSavegame();
+
     char name[MAX_OSPATH];
     q_snprintf(name, sizeof(name), "%s/%s", com_gamedir, filename);
     COM_AddExtension(name, ".sav", sizeof(name));
@@ -1666,8 +1830,9 @@ bool Host_Loadgame(const char* filename, const bool hasTimestamp)
                     ext = COM_Parse(ext);
                     if(idx >= 1 && idx < MAX_MODELS)
                     {
-                        sv.model_precache[idx] = (const char*)Hunk_Strdup(
-                            com_token, "model_precache");
+                        SV_SetModelPrecache(idx,
+                            (const char*)Hunk_Strdup(
+                                com_token, "model_precache"));
                         sv.models[idx] =
                             Mod_ForName(sv.model_precache[idx], idx == 1);
                         // if (idx == 1)
@@ -1752,6 +1917,7 @@ bool Host_Loadgame(const char* filename, const bool hasTimestamp)
 
     qcvm->num_edicts = entnum;
     qcvm->time = time;
+    ED_RebuildFreeList();
 
     free(start);
     start = nullptr;
@@ -2327,6 +2493,13 @@ void Host_Spawn_f()
             &host_client->message, (host_client->lastmovemessage & 0xffff));
     }
 
+    if(host_client->legacyframes)
+    {
+        // not a snapshot, so there's no frame to ack or delta from
+        MSG_WriteLong(&host_client->message, 0);
+        MSG_WriteLong(&host_client->message, 0);
+    }
+
     for(i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
     {
         if(!client->knowntoqc)
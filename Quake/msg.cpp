@@ -195,6 +195,127 @@ void MSG_WriteVec3(sizebuf_t* sb, const qvec3& v, unsigned int flags)
     MSG_WriteCoord(sb, v[2], flags);
 }
 
+void MSG_WriteBits(
+    sizebuf_t* sb, msgbits_t& acc, unsigned int value, int count)
+{
+#ifdef PARANOID
+    if(count < 0 || count > 24)
+    {
+        Sys_Error("MSG_WriteBits: range error");
+    }
+#endif
+
+    acc.bits |= (value & ((1u << count) - 1)) << acc.count;
+    acc.count += count;
+
+    while(acc.count >= 8)
+    {
+        MSG_WriteByte(sb, acc.bits & 255);
+        acc.bits >>= 8;
+        acc.count -= 8;
+    }
+}
+
+void MSG_FlushBits(sizebuf_t* sb, msgbits_t& acc)
+{
+    if(acc.count > 0)
+    {
+        MSG_WriteByte(sb, acc.bits & 255);
+    }
+
+    acc.bits = 0;
+    acc.count = 0;
+}
+
+static unsigned int MSG_ZigZag(int value)
+{
+    return (static_cast<unsigned int>(value) << 1) ^
+           static_cast<unsigned int>(value >> 31);
+}
+
+static int MSG_VarBitsClass(unsigned int zigzag, const int (&widths)[4])
+{
+    for(int i = 0; i < 3; i++)
+    {
+        if(zigzag < (1u << widths[i]))
+        {
+            return i;
+        }
+    }
+
+    return 3;
+}
+
+void MSG_WriteVarBits(
+    sizebuf_t* sb, msgbits_t& acc, int value, const int (&widths)[4])
+{
+    const unsigned int zigzag = MSG_ZigZag(value);
+    const int c = MSG_VarBitsClass(zigzag, widths);
+
+    MSG_WriteBits(sb, acc, c, 2);
+    MSG_WriteBits(sb, acc, zigzag, widths[c]);
+}
+
+[[nodiscard]] int MSG_VarBitsSize(int value, const int (&widths)[4])
+{
+    return 2 + widths[MSG_VarBitsClass(MSG_ZigZag(value), widths)];
+}
+
+[[nodiscard]] float MSG_QuantizeCoord(float f, unsigned int flags)
+{
+    if(flags & PRFL_FLOATCOORD)
+    {
+        return f;
+    }
+
+    if(flags & PRFL_INT32COORD)
+    {
+        return Q_rint(f * 16) * (1.0 / 16.0);
+    }
+
+    if(flags & PRFL_24BITCOORD)
+    {
+        return (short)(int)f + (((int)(f * 255) % 255) & 255) * (1.0 / 255);
+    }
+
+    return (short)Q_rint(f * 8) * (1.0 / 8);
+}
+
+[[nodiscard]] float MSG_QuantizeAngle(float f, unsigned int flags)
+{
+    if(flags & PRFL_FLOATANGLE)
+    {
+        return f;
+    }
+
+    if(flags & PRFL_SHORTANGLE)
+    {
+        return (short)(Q_rint(f * 65536.0 / 360.0) & 65535) * (360.0 / 65536);
+    }
+
+    return (signed char)(Q_rint(f * 256.0 / 360.0) & 255) * (360.0 / 256);
+}
+
+[[nodiscard]] int MSG_PackCoord(float f)
+{
+    return Q_rint(f * 8);
+}
+
+[[nodiscard]] float MSG_UnpackCoord(int q)
+{
+    return q * (1.0 / 8);
+}
+
+[[nodiscard]] int MSG_PackAngle(float f)
+{
+    return Q_rint(f * 65536.0 / 360.0) & 65535;
+}
+
+[[nodiscard]] float MSG_UnpackAngle(int q)
+{
+    return (short)q * (360.0 / 65536);
+}
+
 //
 // reading functions
 //
@@ -446,3 +567,26 @@ int MSG_ReadEntity(unsigned int pext2)
     msg_readcount += length;
     return data;
 }
+
+[[nodiscard]] unsigned int MSG_ReadBits(msgbits_t& acc, int count)
+{
+    while(acc.count < count)
+    {
+        acc.bits |= (MSG_ReadByte() & 255u) << acc.count;
+        acc.count += 8;
+    }
+
+    const unsigned int value = acc.bits & ((1u << count) - 1);
+    acc.bits >>= count;
+    acc.count -= count;
+
+    return value;
+}
+
+[[nodiscard]] int MSG_ReadVarBits(msgbits_t& acc, const int (&widths)[4])
+{
+    const int c = MSG_ReadBits(acc, 2);
+    const unsigned int zigzag = MSG_ReadBits(acc, widths[c]);
+
+    return static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+}
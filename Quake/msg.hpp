@@ -44,6 +44,36 @@ void MSG_WriteAngle(sizebuf_t* sb, float f, unsigned int flags);
 void MSG_WriteAngle16(sizebuf_t* sb, float f, unsigned int flags);
 void MSG_WriteVec3(sizebuf_t* sb, const qvec3& v, unsigned int flags);
 
+// PEXTQVR_PACKED -- bit-level packing, least significant bit first. A run of
+// bit fields is flushed to a byte boundary before anything else is written.
+struct msgbits_t
+{
+    unsigned int bits;
+    int count;
+};
+
+void MSG_WriteBits(
+    sizebuf_t* sb, msgbits_t& acc, unsigned int value, int count);
+void MSG_FlushBits(sizebuf_t* sb, msgbits_t& acc);
+
+// Signed values in the smallest of four widths that fits, behind a 2-bit
+// selector.
+void MSG_WriteVarBits(
+    sizebuf_t* sb, msgbits_t& acc, int value, const int (&widths)[4]);
+[[nodiscard]] int MSG_VarBitsSize(int value, const int (&widths)[4]);
+
+// What MSG_ReadCoord/MSG_ReadAngle return for a value written with
+// MSG_WriteCoord/MSG_WriteAngle and the same flags.
+[[nodiscard]] float MSG_QuantizeCoord(float f, unsigned int flags);
+[[nodiscard]] float MSG_QuantizeAngle(float f, unsigned int flags);
+
+// The grids PEXTQVR_PACKED deltas are taken on: 1/8 unit for coords, 1/65536
+// of a turn for angles.
+[[nodiscard]] int MSG_PackCoord(float f);
+[[nodiscard]] float MSG_UnpackCoord(int q);
+[[nodiscard]] int MSG_PackAngle(float f);
+[[nodiscard]] float MSG_UnpackAngle(int q);
+
 struct entity_state_s;
 void MSG_WriteStaticOrBaseLine(sizebuf_t* buf, int idx,
     struct entity_state_s* state, unsigned int protocol_pext2,
@@ -65,3 +95,5 @@ void MSG_BeginReading();
 [[nodiscard]] qvec3 MSG_ReadVec3(unsigned int flags);
 [[nodiscard]] byte* MSG_ReadData(unsigned int length);
 [[nodiscard]] int MSG_ReadEntity(unsigned int pext2); // spike
+[[nodiscard]] unsigned int MSG_ReadBits(msgbits_t& acc, int count);
+[[nodiscard]] int MSG_ReadVarBits(msgbits_t& acc, const int (&widths)[4]);
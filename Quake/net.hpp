@@ -99,6 +99,10 @@ int NET_SendUnreliableMessage(struct qsocket_s* sock, sizebuf_t* data);
 int NET_SendToAll(sizebuf_t* data, double blocktime);
 // This is a reliable *blocking* send to all attached clients.
 
+void NET_Flush();
+// Drivers may queue up packets to send them in batches. Called once the
+// server has sent its messages for the frame.
+
 void NET_Close(struct qsocket_s* sock);
 // if a dead connection is returned by a get or send function, this function
 // should be called when it is convenient
@@ -35,13 +35,14 @@ net_driver_t net_drivers[] = {
         Loop_SearchForHosts, Loop_Connect, Loop_CheckNewConnections,
         Loop_GetAnyMessage, Loop_GetMessage, Loop_SendMessage,
         Loop_SendUnreliableMessage, Loop_CanSendMessage,
-        Loop_CanSendUnreliableMessage, Loop_Close, Loop_Shutdown},
+        Loop_CanSendUnreliableMessage, Loop_Close, Loop_Shutdown, nullptr},
 
     {"Datagram", false, Datagram_Init, Datagram_Listen, Datagram_QueryAddresses,
         Datagram_SearchForHosts, Datagram_Connect, Datagram_CheckNewConnections,
         Datagram_GetAnyMessage, Datagram_GetMessage, Datagram_SendMessage,
         Datagram_SendUnreliableMessage, Datagram_CanSendMessage,
-        Datagram_CanSendUnreliableMessage, Datagram_Close, Datagram_Shutdown}};
+        Datagram_CanSendUnreliableMessage, Datagram_Close, Datagram_Shutdown,
+        Datagram_Flush}};
 
 const int net_numdrivers = (sizeof(net_drivers) / sizeof(net_drivers[0]));
 
@@ -54,13 +55,13 @@ net_landriver_t net_landrivers[] = {
         UDP_Read, UDP_Write, UDP4_Broadcast, UDP_AddrToString,
         UDP4_StringToAddr, UDP_GetSocketAddr, UDP_GetNameFromAddr,
         UDP4_GetAddrFromName, UDP_AddrCompare, UDP_GetSocketPort,
-        UDP_SetSocketPort},
+        UDP_SetSocketPort, UDP_Flush},
     {"UDP6", false, 0, UDP6_Init, UDP6_Shutdown, UDP6_Listen, UDP6_GetAddresses,
         UDP6_OpenSocket, UDP_CloseSocket, UDP_Connect, UDP6_CheckNewConnections,
         UDP_Read, UDP_Write, UDP6_Broadcast, UDP_AddrToString,
         UDP6_StringToAddr, UDP_GetSocketAddr, UDP_GetNameFromAddr,
         UDP6_GetAddrFromName, UDP_AddrCompare, UDP_GetSocketPort,
-        UDP_SetSocketPort}};
+        UDP_SetSocketPort, UDP_Flush}};
 
 const int net_numlandrivers =
     (sizeof(net_landrivers) / sizeof(net_landrivers[0]));
@@ -55,6 +55,11 @@ struct qsockaddr
 
 #define NET_PROTOCOL_VERSION 3
 
+// QSS
+// appended to CCREQ_CONNECT after the proquake fields, and echoed back in
+// CCREP_ACCEPT, when both ends want the windowed reliable stream
+#define NET_EXT_SACK 0x4b434153 // "SACK"
+
 /**
 
 This is the network info/connection protocol.  It is used to find Quake
@@ -69,6 +74,11 @@ General notes:
 CCREQ_CONNECT
         string	game_name		"QUAKE"
         byte	net_protocol_version	NET_PROTOCOL_VERSION
+        byte	mod			1 (proquake)
+        byte	mod_version
+        byte	mod_flags
+        long	mod_password
+        long	extension		NET_EXT_SACK (optional)
 
 CCREQ_SERVER_INFO
         string	game_name		"QUAKE"
@@ -82,6 +92,10 @@ CCREQ_RULE_INFO
 
 CCREP_ACCEPT
         long	port
+        byte	mod			(optional from here on)
+        byte	mod_version
+        byte	mod_flags
+        long	extension		NET_EXT_SACK
 
 CCREP_REJECT
         string	reason
@@ -131,6 +145,8 @@ CCREP_RULE_INFO
 #define CCREP_RULE_INFO 0x85
 #define CCREP_RCON 0x86 // QSS
 
+struct netsack_t;
+
 typedef struct qsocket_s
 {
     struct qsocket_s* next;
@@ -178,6 +194,10 @@ typedef struct qsocket_s
     // QSS
     int pending_max_datagram; // don't change the mtu if we're resending, as
                               // that would confuse the peer.
+
+    netsack_t* sack; // windowed reliable state, if negotiated. malloced.
+
+    struct qsocket_s* hashnext; // virtual sockets in the same address bucket
 } qsocket_t;
 
 extern qsocket_t* net_activeSockets;
@@ -210,6 +230,7 @@ typedef struct
     int (*AddrCompare)(struct qsockaddr* addr1, struct qsockaddr* addr2);
     int (*GetSocketPort)(struct qsockaddr* addr);
     int (*SetSocketPort)(struct qsockaddr* addr, int port);
+    void (*Flush)(); // sends anything Write queued up, may be nullptr
 
     sys_socket_t listeningSock; // QSS
 } net_landriver_t;
@@ -236,6 +257,7 @@ typedef struct
     bool (*CanSendUnreliableMessage)(qsocket_t* sock);
     void (*Close)(qsocket_t* sock);
     void (*Shutdown)();
+    void (*Flush)(); // may be nullptr
 } net_driver_t;
 
 extern net_driver_t net_drivers[];
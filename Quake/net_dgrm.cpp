@@ -47,6 +47,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.hpp"
 #include "zone.hpp"
 
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
 // these two macros are to make the code more readable
 #define sfunc net_landrivers[sock->landriver]
 #define dfunc net_landrivers[net_landriverlevel]
@@ -82,6 +87,12 @@ cvar_t rcon_password = {"rcon_password", ""};
 extern cvar_t net_messagetimeout;
 extern cvar_t net_connecttimeout;
 
+// offer/accept the windowed reliable stream when connecting
+static cvar_t net_sack = {"net_sack", "1", CVAR_NONE};
+// simulated network conditions for testing, applied to outgoing game packets
+static cvar_t net_fakelag = {"net_fakelag", "0", CVAR_NONE};   // ms
+static cvar_t net_fakeloss = {"net_fakeloss", "0", CVAR_NONE}; // percent
+
 static struct
 {
     unsigned int length;
@@ -179,6 +190,430 @@ static void NET_Ban_f()
 }
 #endif // BAN_TEST
 
+/*
+===============================================================================
+
+SIMULATED LAG AND LOSS
+
+Game packets go out through Datagram_Write, which drops net_fakeloss percent
+of them and holds the rest back for net_fakelag milliseconds. Connecting to
+a listen server on the same machine with these set gives a repeatable way to
+compare how long the signon takes under bad conditions.
+
+===============================================================================
+*/
+
+struct fakepacket_t
+{
+    double time;
+    int landriver;
+    sys_socket_t socket;
+    struct qsockaddr addr;
+    std::vector<byte> data;
+};
+
+static std::deque<fakepacket_t> fakepackets;
+
+static int Datagram_Write(qsocket_t* sock, byte* data, int length)
+{
+    if(net_fakeloss.value > 0 && rand() % 1000 < net_fakeloss.value * 10)
+    {
+        return length;
+    }
+
+    if(net_fakelag.value > 0)
+    {
+        fakepacket_t& p = fakepackets.emplace_back();
+        p.time = net_time + net_fakelag.value / 1000.0;
+        p.landriver = sock->landriver;
+        p.socket = sock->socket;
+        p.addr = sock->addr;
+        p.data.assign(data, data + length);
+        return length;
+    }
+
+    return sfunc.Write(sock->socket, data, length, &sock->addr);
+}
+
+static void Datagram_FlushFakeLag()
+{
+    while(!fakepackets.empty() && fakepackets.front().time <= net_time)
+    {
+        fakepacket_t& p = fakepackets.front();
+        net_landrivers[p.landriver].Write(
+            p.socket, p.data.data(), p.data.size(), &p.addr);
+        fakepackets.pop_front();
+    }
+}
+
+static void Datagram_DropFakeLag(qsocket_t* sock)
+{
+    for(auto it = fakepackets.begin(); it != fakepackets.end();)
+    {
+        if(it->socket == sock->socket &&
+            !sfunc.AddrCompare(&it->addr, &sock->addr))
+        {
+            it = fakepackets.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/*
+===============================================================================
+
+SELECTIVELY ACKNOWLEDGED RELIABLE STREAM
+
+When both ends ask for NET_EXT_SACK while connecting, reliable messages are
+no longer sent one fragment per round trip. Up to NET_SACK_WINDOW fragments
+are kept in flight, acks carry the next sequence expected plus a bitmask of
+the fragments that arrived after it, and a lost fragment is resent after a
+timeout derived from the measured round trip time instead of a fixed
+second. Packet headers are the same as for the old stream.
+
+===============================================================================
+*/
+
+#define NET_SACK_WINDOW 32 // fragments in flight each way, fits the ack mask
+#define NET_SACK_FRAGMENT DATAGRAM_MTU
+#define NET_SACK_MINRTO 0.05
+#define NET_SACK_MAXRTO 1.0
+#define NET_SACK_MAXBACKOFF 4.0
+
+struct netsackfrag_t
+{
+    unsigned int sequence;
+    unsigned int pos; // stream position of the first byte
+    int length;
+    bool eom;
+    bool acked;
+    int sends;
+    double sendtime;
+};
+
+struct netsack_t
+{
+    // reliable bytes that aren't acked yet, stream[0] is at position base.
+    // twice the size of a message, so that the next one can be queued while
+    // the previous one is still in flight.
+    byte stream[NET_MAXMESSAGE * 2];
+    unsigned int base;
+    unsigned int cut; // bytes before this have been sent as fragments
+    unsigned int end;
+
+    netsackfrag_t frags[NET_SACK_WINDOW]; // in flight, oldest first
+    int numfrags;
+
+    double srtt;
+    double rttvar;
+    double rto;
+
+    // fragments received from receiveSequence on, indexed by sequence
+    struct
+    {
+        bool present;
+        bool eom;
+        int length;
+        byte data[NET_SACK_FRAGMENT];
+    } recv[NET_SACK_WINDOW];
+};
+
+static void Datagram_SackEnable(qsocket_t* sock)
+{
+    sock->sack = (netsack_t*)calloc(1, sizeof(netsack_t));
+    if(!sock->sack)
+    {
+        Sys_Error("Datagram_SackEnable: out of memory");
+    }
+    sock->sack->rto = NET_SACK_MAXRTO;
+}
+
+static bool Datagram_SackCanSend(const netsack_t* sack)
+{
+    return sack->cut == sack->end && sack->end - sack->base <= NET_MAXMESSAGE;
+}
+
+static int Datagram_SackSendFragment(qsocket_t* sock, netsackfrag_t& frag)
+{
+    netsack_t* sack = sock->sack;
+    const unsigned int packetLen = NET_HEADERSIZE + frag.length;
+
+    packetBuffer.length =
+        BigLong(packetLen | NETFLAG_DATA | (frag.eom ? NETFLAG_EOM : 0));
+    packetBuffer.sequence = BigLong(frag.sequence);
+    Q_memcpy(packetBuffer.data, sack->stream + (frag.pos - sack->base),
+        frag.length);
+
+    if(frag.sends++)
+    {
+        packetsReSent++;
+    }
+    else
+    {
+        packetsSent++;
+    }
+    frag.sendtime = net_time;
+    sock->lastSendTime = net_time;
+
+    return Datagram_Write(sock, (byte*)&packetBuffer, packetLen);
+}
+
+/*
+===================
+Datagram_SackTransmit
+
+Resends fragments whose timer ran out, then cuts and sends new ones from the
+queued reliable data while the window has room.
+===================
+*/
+static int Datagram_SackTransmit(qsocket_t* sock)
+{
+    netsack_t* sack = sock->sack;
+    const int maxlen = q_min(sock->pending_max_datagram, NET_SACK_FRAGMENT);
+    int ret = 1;
+    int i;
+
+    for(i = 0; i < sack->numfrags; i++)
+    {
+        netsackfrag_t& frag = sack->frags[i];
+        const double timeout = q_min(
+            sack->rto * (1 << q_min(frag.sends - 1, 4)), NET_SACK_MAXBACKOFF);
+
+        if(!frag.acked && net_time - frag.sendtime > timeout)
+        {
+            if(Datagram_SackSendFragment(sock, frag) == -1)
+            {
+                ret = -1;
+            }
+        }
+    }
+
+    while(sack->numfrags < NET_SACK_WINDOW && sack->cut != sack->end)
+    {
+        netsackfrag_t& frag = sack->frags[sack->numfrags++];
+
+        frag.sequence = sock->sendSequence++;
+        frag.pos = sack->cut;
+        frag.length = q_min(maxlen, (int)(sack->end - sack->cut));
+        frag.eom = frag.pos + frag.length == sack->end;
+        frag.acked = false;
+        frag.sends = 0;
+        sack->cut += frag.length;
+
+        if(Datagram_SackSendFragment(sock, frag) == -1)
+        {
+            ret = -1;
+        }
+    }
+
+    sock->canSend = Datagram_SackCanSend(sack);
+    return ret;
+}
+
+static void Datagram_SackMeasure(netsack_t* sack, const double rtt)
+{
+    // RFC 6298
+    if(!sack->srtt)
+    {
+        sack->srtt = rtt;
+        sack->rttvar = rtt / 2;
+    }
+    else
+    {
+        sack->rttvar = 0.75 * sack->rttvar + 0.25 * std::fabs(sack->srtt - rtt);
+        sack->srtt = 0.875 * sack->srtt + 0.125 * rtt;
+    }
+
+    sack->rto = CLAMP(
+        NET_SACK_MINRTO, sack->srtt + 4 * sack->rttvar, NET_SACK_MAXRTO);
+}
+
+/*
+===================
+Datagram_SackAck
+
+Everything before `sequence` has arrived, and bit n of `mask` is set if
+sequence + 1 + n has too.
+===================
+*/
+static void Datagram_SackAck(
+    qsocket_t* sock, const unsigned int sequence, const unsigned int mask)
+{
+    netsack_t* sack = sock->sack;
+    int newest = -1;
+    int done;
+    int i;
+
+    for(i = 0; i < sack->numfrags; i++)
+    {
+        netsackfrag_t& frag = sack->frags[i];
+        const int d = (int)(frag.sequence - sequence);
+
+        if(!frag.acked && (d < 0 || (d > 0 && (mask & (1u << (d - 1))))))
+        {
+            frag.acked = true;
+            if(frag.sends == 1)
+            {
+                // only unambiguous samples, see Karn's algorithm
+                Datagram_SackMeasure(sack, net_time - frag.sendtime);
+            }
+        }
+
+        if(frag.acked)
+        {
+            newest = i;
+        }
+    }
+
+    // a later fragment got through, so don't wait for the timer to resend
+    // the ones before it that are taking longer than usual
+    for(i = 0; i < newest; i++)
+    {
+        netsackfrag_t& frag = sack->frags[i];
+        if(!frag.acked && sack->srtt &&
+            net_time - frag.sendtime > sack->srtt * 1.25)
+        {
+            Datagram_SackSendFragment(sock, frag);
+        }
+    }
+
+    for(done = 0; done < sack->numfrags && sack->frags[done].acked; done++)
+    {
+    }
+
+    if(done)
+    {
+        sack->numfrags -= done;
+        memmove(sack->frags, sack->frags + done,
+            sack->numfrags * sizeof(netsackfrag_t));
+
+        const unsigned int base =
+            sack->numfrags ? sack->frags[0].pos : sack->cut;
+        memmove(sack->stream, sack->stream + (base - sack->base),
+            sack->end - base);
+        sack->base = base;
+    }
+
+    sock->ackSequence =
+        sack->numfrags ? sack->frags[0].sequence : sock->sendSequence;
+    Datagram_SackTransmit(sock);
+}
+
+/*
+===================
+Datagram_SackReceive
+
+Stores a reliable fragment and acks everything that has arrived so far.
+===================
+*/
+static void Datagram_SackReceive(qsocket_t* sock, const unsigned int sequence,
+    const bool eom, const byte* data, const int length)
+{
+    netsack_t* sack = sock->sack;
+    unsigned int next;
+    unsigned int mask;
+    unsigned int i;
+
+    if(sequence - sock->receiveSequence < NET_SACK_WINDOW &&
+        length <= NET_SACK_FRAGMENT &&
+        !sack->recv[sequence % NET_SACK_WINDOW].present)
+    {
+        auto& slot = sack->recv[sequence % NET_SACK_WINDOW];
+        slot.present = true;
+        slot.eom = eom;
+        slot.length = length;
+        Q_memcpy(slot.data, data, length);
+    }
+    else
+    {
+        receivedDuplicateCount++;
+    }
+
+    next = sock->receiveSequence;
+    while(next - sock->receiveSequence < NET_SACK_WINDOW &&
+          sack->recv[next % NET_SACK_WINDOW].present)
+    {
+        next++;
+    }
+
+    mask = 0;
+    for(i = 1; i <= 32 && next + i - sock->receiveSequence < NET_SACK_WINDOW;
+        i++)
+    {
+        if(sack->recv[(next + i) % NET_SACK_WINDOW].present)
+        {
+            mask |= 1u << (i - 1);
+        }
+    }
+
+    packetBuffer.length = BigLong((NET_HEADERSIZE + 4) | NETFLAG_ACK);
+    packetBuffer.sequence = BigLong(next);
+    *((int*)packetBuffer.data) = BigLong(mask);
+    Datagram_Write(sock, (byte*)&packetBuffer, NET_HEADERSIZE + 4);
+}
+
+/*
+===================
+Datagram_SackDeliver
+
+Reassembles the next message from the fragments received in order.
+Returns 1 when it is ready in net_message, 0 if more fragments are needed
+and -1 if it is too big.
+===================
+*/
+static int Datagram_SackDeliver(qsocket_t* sock)
+{
+    netsack_t* sack = sock->sack;
+
+    while(true)
+    {
+        auto& slot = sack->recv[sock->receiveSequence % NET_SACK_WINDOW];
+        if(!slot.present)
+        {
+            return 0;
+        }
+
+        slot.present = false;
+        sock->receiveSequence++;
+
+        if(sock->receiveMessageLength + slot.length >
+            (int)sizeof(sock->receiveMessage))
+        {
+            Con_Printf("Over-sized reliable\n");
+            return -1;
+        }
+
+        Q_memcpy(sock->receiveMessage + sock->receiveMessageLength, slot.data,
+            slot.length);
+        sock->receiveMessageLength += slot.length;
+
+        if(slot.eom)
+        {
+            if(sock->receiveMessageLength > net_message.maxsize)
+            {
+                Con_Printf("Over-sized reliable\n");
+                return -1;
+            }
+
+            SZ_Clear(&net_message);
+            SZ_Write(
+                &net_message, sock->receiveMessage, sock->receiveMessageLength);
+            sock->receiveMessageLength = 0;
+            return 1;
+        }
+    }
+}
+
+static unsigned int Datagram_SackMask(const unsigned int length)
+{
+    // packetBuffer holds an ack, see Datagram_SackReceive
+    return length >= NET_HEADERSIZE + 4 ? BigLong(*((int*)packetBuffer.data))
+                                        : 0;
+}
+
 
 int Datagram_SendMessage(qsocket_t* sock, sizebuf_t* data)
 {
@@ -197,6 +632,25 @@ int Datagram_SendMessage(qsocket_t* sock, sizebuf_t* data)
         Sys_Error("SendMessage: called with canSend == false\n");
 #endif
 
+    // QSS
+    if(sock->sack)
+    {
+        netsack_t* sack = sock->sack;
+
+        if(data->cursize > NET_MAXMESSAGE ||
+            sack->end - sack->base + data->cursize > sizeof(sack->stream))
+        {
+            Con_Printf("Datagram_SendMessage: message too big %u\n",
+                data->cursize);
+            return -1;
+        }
+
+        Q_memcpy(sack->stream + (sack->end - sack->base), data->data,
+            data->cursize);
+        sack->end += data->cursize;
+        return Datagram_SackTransmit(sock);
+    }
+
     Q_memcpy(sock->sendMessage, data->data, data->cursize);
     sock->sendMessageLength = data->cursize;
 
@@ -225,8 +679,7 @@ int Datagram_SendMessage(qsocket_t* sock, sizebuf_t* data)
 
     sock->canSend = false;
 
-    if(sfunc.Write(
-           sock->socket, (byte*)&packetBuffer, packetLen, &sock->addr) == -1)
+    if(Datagram_Write(sock, (byte*)&packetBuffer, packetLen) == -1)
     {
         return -1;
     }
@@ -262,8 +715,7 @@ static int SendMessageNext(qsocket_t* sock)
 
     sock->sendNext = false;
 
-    if(sfunc.Write(
-           sock->socket, (byte*)&packetBuffer, packetLen, &sock->addr) == -1)
+    if(Datagram_Write(sock, (byte*)&packetBuffer, packetLen) == -1)
     {
         return -1;
     }
@@ -299,8 +751,7 @@ static int ReSendMessage(qsocket_t* sock)
 
     sock->sendNext = false;
 
-    if(sfunc.Write(
-           sock->socket, (byte*)&packetBuffer, packetLen, &sock->addr) == -1)
+    if(Datagram_Write(sock, (byte*)&packetBuffer, packetLen) == -1)
     {
         return -1;
     }
@@ -313,6 +764,13 @@ static int ReSendMessage(qsocket_t* sock)
 
 bool Datagram_CanSendMessage(qsocket_t* sock)
 {
+    // QSS
+    if(sock->sack)
+    {
+        Datagram_SackTransmit(sock);
+        return sock->canSend;
+    }
+
     if(sock->sendNext)
     {
         SendMessageNext(sock);
@@ -349,8 +807,7 @@ int Datagram_SendUnreliableMessage(qsocket_t* sock, sizebuf_t* data)
     packetBuffer.sequence = BigLong(sock->unreliableSendSequence++);
     Q_memcpy(packetBuffer.data, data->data, data->cursize);
 
-    if(sfunc.Write(
-           sock->socket, (byte*)&packetBuffer, packetLen, &sock->addr) == -1)
+    if(Datagram_Write(sock, (byte*)&packetBuffer, packetLen) == -1)
     {
         return -1;
     }
@@ -419,6 +876,13 @@ bool Datagram_ProcessPacket(unsigned int length, qsocket_t* sock)
 
     if(flags & NETFLAG_ACK)
     {
+        // QSS
+        if(sock->sack)
+        {
+            Datagram_SackAck(sock, sequence, Datagram_SackMask(length));
+            return false;
+        }
+
         if(sequence != (sock->sendSequence - 1))
         {
             Con_DPrintf("Stale ACK received\n");
@@ -454,10 +918,23 @@ bool Datagram_ProcessPacket(unsigned int length, qsocket_t* sock)
 
     if(flags & NETFLAG_DATA)
     {
+        // QSS
+        if(sock->sack)
+        {
+            Datagram_SackReceive(sock, sequence, flags & NETFLAG_EOM,
+                packetBuffer.data, length - NET_HEADERSIZE);
+            if(Datagram_SackDeliver(sock) != 1)
+            {
+                return false;
+            }
+
+            messagesReceived++;
+            return true; // parse this reliable!
+        }
+
         packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
         packetBuffer.sequence = BigLong(sequence);
-        sfunc.Write(
-            sock->socket, (byte*)&packetBuffer, NET_HEADERSIZE, &sock->addr);
+        Datagram_Write(sock, (byte*)&packetBuffer, NET_HEADERSIZE);
 
         if(sequence != sock->receiveSequence)
         {
@@ -501,11 +978,102 @@ bool Datagram_ProcessPacket(unsigned int length, qsocket_t* sock)
     return false;
 }
 
+/*
+===============================================================================
+
+VIRTUAL SOCKET LOOKUP
+
+Every remote client shares the listening socket, so packets read from it are
+matched to their qsocket by address. The virtual sockets are kept in a hash
+table on the address to make that cost the same for any number of players.
+
+===============================================================================
+*/
+
+#define NET_ADDRHASH 256
+
+static qsocket_t* addrhash[NET_ADDRHASH];
+
+static unsigned int Datagram_AddrHash(const struct qsockaddr* addr)
+{
+    const byte* key;
+    int length;
+    unsigned short port;
+    unsigned int hash = 2166136261u; // FNV-1a
+    int i;
+
+    if(addr->qsa_family == AF_INET)
+    {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)addr;
+        key = (const byte*)&in->sin_addr;
+        length = sizeof(in->sin_addr);
+        port = in->sin_port;
+    }
+    else if(addr->qsa_family == AF_INET6)
+    {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+        key = (const byte*)&in6->sin6_addr;
+        length = sizeof(in6->sin6_addr);
+        port = in6->sin6_port;
+    }
+    else
+    {
+        return 0; // AddrCompare still sorts them out
+    }
+
+    for(i = 0; i < length; i++)
+    {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    hash = (hash ^ (port & 0xff)) * 16777619u;
+    hash = (hash ^ (port >> 8)) * 16777619u;
+
+    return hash % NET_ADDRHASH;
+}
+
+static void Datagram_HashSocket(qsocket_t* sock)
+{
+    qsocket_t** bucket = &addrhash[Datagram_AddrHash(&sock->addr)];
+    sock->hashnext = *bucket;
+    *bucket = sock;
+}
+
+static void Datagram_UnhashSocket(qsocket_t* sock)
+{
+    qsocket_t** link = &addrhash[Datagram_AddrHash(&sock->addr)];
+
+    for(; *link; link = &(*link)->hashnext)
+    {
+        if(*link == sock)
+        {
+            *link = sock->hashnext;
+            break;
+        }
+    }
+    sock->hashnext = nullptr;
+}
+
 qsocket_t* Datagram_GetAnyMessage()
 {
     qsocket_t* s;
     struct qsockaddr addr;
     int length;
+
+    Datagram_FlushFakeLag();
+
+    // QSS
+    // messages that were completed by a fragment which arrived out of order
+    for(s = net_activeSockets; s; s = s->next)
+    {
+        if(s->driver == net_driverlevel && s->isvirtual && !s->disconnected &&
+            s->sack && Datagram_SackDeliver(s) == 1)
+        {
+            messagesReceived++;
+            s->lastMessageTime = net_time;
+            return s;
+        }
+    }
+
     for(net_landriverlevel = 0; net_landriverlevel < net_numlandrivers;
         net_landriverlevel++)
     {
@@ -542,7 +1110,7 @@ qsocket_t* Datagram_GetAnyMessage()
             }
 
             // figure out which qsocket it was for
-            for(s = net_activeSockets; s; s = s->next)
+            for(s = addrhash[Datagram_AddrHash(&addr)]; s; s = s->hashnext)
             {
                 if(s->driver != net_driverlevel)
                 {
@@ -581,16 +1149,24 @@ qsocket_t* Datagram_GetAnyMessage()
             continue;
         }
 
-        if(!s->canSend)
+        // QSS
+        if(s->sack)
         {
-            if((net_time - s->lastSendTime) > 1.0)
-            {
-                ReSendMessage(s);
-            }
+            Datagram_SackTransmit(s);
         }
-        if(s->sendNext)
+        else
         {
-            SendMessageNext(s);
+            if(!s->canSend)
+            {
+                if((net_time - s->lastSendTime) > 1.0)
+                {
+                    ReSendMessage(s);
+                }
+            }
+            if(s->sendNext)
+            {
+                SendMessageNext(s);
+            }
         }
 
         if(net_time - s->lastMessageTime > ((!s->ackSequence)
@@ -624,7 +1200,20 @@ int Datagram_GetMessage(qsocket_t* sock)
     unsigned int sequence;
     unsigned int count;
 
-    if(!sock->canSend)
+    Datagram_FlushFakeLag();
+
+    // QSS
+    if(sock->sack)
+    {
+        Datagram_SackTransmit(sock);
+
+        ret = Datagram_SackDeliver(sock);
+        if(ret)
+        {
+            return ret;
+        }
+    }
+    else if(!sock->canSend)
     {
         if((net_time - sock->lastSendTime) > 1.0)
         {
@@ -706,6 +1295,13 @@ int Datagram_GetMessage(qsocket_t* sock)
 
         if(flags & NETFLAG_ACK)
         {
+            // QSS
+            if(sock->sack)
+            {
+                Datagram_SackAck(sock, sequence, Datagram_SackMask(length));
+                continue;
+            }
+
             if(sequence != (sock->sendSequence - 1))
             {
                 Con_DPrintf("Stale ACK received\n");
@@ -743,10 +1339,22 @@ int Datagram_GetMessage(qsocket_t* sock)
 
         if(flags & NETFLAG_DATA)
         {
+            // QSS
+            if(sock->sack)
+            {
+                Datagram_SackReceive(sock, sequence, flags & NETFLAG_EOM,
+                    packetBuffer.data, length - NET_HEADERSIZE);
+                ret = Datagram_SackDeliver(sock);
+                if(ret)
+                {
+                    break;
+                }
+                continue;
+            }
+
             packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
             packetBuffer.sequence = BigLong(sequence);
-            sfunc.Write(
-                sock->socket, (byte*)&packetBuffer, NET_HEADERSIZE, &readaddr);
+            Datagram_Write(sock, (byte*)&packetBuffer, NET_HEADERSIZE);
 
             if(sequence != sock->receiveSequence)
             {
@@ -792,7 +1400,7 @@ int Datagram_GetMessage(qsocket_t* sock)
         }
     }
 
-    if(sock->sendNext)
+    if(sock->sendNext && !sock->sack)
     {
         SendMessageNext(sock);
     }
@@ -806,6 +1414,12 @@ static void PrintStats(qsocket_t* s)
     Con_Printf("canSend = %4u   \n", s->canSend);
     Con_Printf("sendSeq = %4u   ", s->sendSequence);
     Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
+    if(s->sack)
+    {
+        Con_Printf("inFlight = %4i   ", s->sack->numfrags);
+        Con_Printf("srtt = %4.0fms   ", s->sack->srtt * 1000);
+        Con_Printf("rto = %4.0fms\n", s->sack->rto * 1000);
+    }
     Con_Printf("\n");
 }
 
@@ -1246,6 +1860,9 @@ int Datagram_Init()
     myDriverLevel = net_driverlevel;
 
     Cmd_AddCommand("net_stats", NET_Stats_f);
+    Cvar_RegisterVariable(&net_sack);
+    Cvar_RegisterVariable(&net_fakelag);
+    Cvar_RegisterVariable(&net_fakeloss);
 
     if(safemode || COM_CheckParm("-nolan"))
     {
@@ -1301,9 +1918,26 @@ void Datagram_Shutdown()
 }
 
 
+void Datagram_Flush()
+{
+    for(net_landriverlevel = 0; net_landriverlevel < net_numlandrivers;
+        net_landriverlevel++)
+    {
+        if(dfunc.initialized && dfunc.Flush)
+        {
+            dfunc.Flush();
+        }
+    }
+}
+
 void Datagram_Close(qsocket_t* sock)
 {
+    Datagram_DropFakeLag(sock);
+
     // QSS
+    // Datagram_Listen may have turned it non-virtual while still hashed
+    Datagram_UnhashSocket(sock);
+
     if(sock->isvirtual)
     {
         sock->isvirtual = false;
@@ -1340,6 +1974,7 @@ void Datagram_Listen(bool state)
             {
                 if(s->isvirtual)
                 {
+                    Datagram_UnhashSocket(s);
                     s->isvirtual = false;
                     s->socket = INVALID_SOCKET;
                 }
@@ -1394,6 +2029,7 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
     int ret;
     int plnum;
     int mod; //, mod_ver, mod_flags, mod_passwd;	//proquake extensions
+    int netext;
 
     control = BigLong(*((int*)data));
     if(control == -1)
@@ -1737,6 +2373,16 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
 	(void)mod_flags;
 	(void)mod_passwd;
 #endif
+    // QSS
+    // our own extensions follow the proquake fields
+    (void)MSG_ReadByte(); // mod_ver
+    (void)MSG_ReadByte(); // mod_flags
+    (void)MSG_ReadLong(); // mod_passwd
+    netext = MSG_ReadLong();
+    if(msg_badread)
+    {
+        netext = 0;
+    }
 
 #ifdef BAN_TEST
     // check for a ban
@@ -1789,14 +2435,19 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
                 MSG_WriteByte(&net_message, CCREP_ACCEPT);
                 dfunc.GetSocketAddr(s->socket, &newaddr);
                 MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
-                if(s->proquake_angle_hack)
+                if(s->proquake_angle_hack || s->sack)
                 {
-                    MSG_WriteByte(&net_message, 1); // proquake
+                    // proquake
+                    MSG_WriteByte(&net_message, s->proquake_angle_hack);
                     MSG_WriteByte(&net_message,
                         30); // ver 30 should be safe. 34 screws with our
                              // single-server-socket stuff.
                     MSG_WriteByte(&net_message, 0); // no flags
                 }
+                if(s->sack)
+                {
+                    MSG_WriteLong(&net_message, NET_EXT_SACK);
+                }
                 *((int*)net_message.data) = BigLong(
                     NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
                 dfunc.Write(acceptsock, net_message.data, net_message.cursize,
@@ -1867,6 +2518,10 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
     }
 
     sock->proquake_angle_hack = (mod == 1);
+    if(net_sack.value && netext == NET_EXT_SACK)
+    {
+        Datagram_SackEnable(sock);
+    }
 
     // everything is allocated, just fill in the details
     sock->isvirtual = true;
@@ -1875,6 +2530,7 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
     sock->addr = *clientaddr;
     Q_strcpy(sock->trueaddress, dfunc.AddrToString(clientaddr, false));
     Q_strcpy(sock->maskedaddress, dfunc.AddrToString(clientaddr, true));
+    Datagram_HashSocket(sock);
 
     // send him back the info about the server connection he has been allocated
     SZ_Clear(&net_message);
@@ -1884,13 +2540,18 @@ static void _Datagram_ServerControlPacket(sys_socket_t acceptsock,
     dfunc.GetSocketAddr(sock->socket, &newaddr);
     MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
     //	MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
-    if(sock->proquake_angle_hack)
+    if(sock->proquake_angle_hack || sock->sack)
     {
-        MSG_WriteByte(&net_message, 1);  // proquake
+        // proquake
+        MSG_WriteByte(&net_message, sock->proquake_angle_hack);
         MSG_WriteByte(&net_message, 30); // ver 30 should be safe. 34 screws
                                          // with our single-server-socket stuff.
         MSG_WriteByte(&net_message, 0);
     }
+    if(sock->sack)
+    {
+        MSG_WriteLong(&net_message, NET_EXT_SACK);
+    }
     *((int*)net_message.data) =
         BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
     dfunc.Write(acceptsock, net_message.data, net_message.cursize, clientaddr);
@@ -2518,6 +3179,10 @@ static qsocket_t* _Datagram_Connect(struct qsockaddr* serveraddr)
             MSG_WriteByte(&net_message, 0);  /*flags*/
             MSG_WriteLong(&net_message,
                 0); // strtoul(password.string, NULL, 0)); /*password*/
+            if(net_sack.value)
+            {
+                MSG_WriteLong(&net_message, NET_EXT_SACK);
+            }
         }
         *((int*)net_message.data) =
             BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
@@ -2674,6 +3339,12 @@ static qsocket_t* _Datagram_Connect(struct qsockaddr* serveraddr)
         byte flags = (msg_readcount < net_message.cursize) ? MSG_ReadByte() : 0;
         (void)ver;
 
+        if(msg_readcount + 4 <= net_message.cursize &&
+            MSG_ReadLong() == NET_EXT_SACK && net_sack.value)
+        {
+            Datagram_SackEnable(sock);
+        }
+
         if(mod == 1 /*MOD_PROQUAKE*/)
         {
             if(flags & 1 /*CHEATFREE*/)
@@ -36,3 +36,4 @@ bool Datagram_CanSendMessage(qsocket_t* sock);
 bool Datagram_CanSendUnreliableMessage(qsocket_t* sock);
 void Datagram_Close(qsocket_t* sock);
 void Datagram_Shutdown();
+void Datagram_Flush();
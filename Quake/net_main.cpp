@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.hpp"
 #include "sys.hpp"
 #include "client.hpp"
+#include "profiler.hpp"
 
 qsocket_t* net_activeSockets = nullptr;
 qsocket_t* net_freeSockets = nullptr;
@@ -147,6 +148,8 @@ qsocket_t* NET_NewQSocket()
     sock->receiveMessageLength = 0;
     sock->pending_max_datagram = 1024; // QSS
     sock->proquake_angle_hack = false; // QSS
+    sock->sack = nullptr;
+    sock->hashnext = nullptr;
 
     return sock;
 }
@@ -178,6 +181,9 @@ void NET_FreeQSocket(qsocket_t* sock)
         }
     }
 
+    free(sock->sack);
+    sock->sack = nullptr;
+
     // add it to free list
     sock->next = net_freeSockets;
     net_freeSockets = sock;
@@ -893,6 +899,19 @@ bool NET_CanSendMessage(qsocket_t* sock)
 }
 
 
+void NET_Flush()
+{
+    for(net_driverlevel = 0; net_driverlevel < net_numdrivers;
+        net_driverlevel++)
+    {
+        if(net_drivers[net_driverlevel].initialized &&
+            net_drivers[net_driverlevel].Flush)
+        {
+            net_drivers[net_driverlevel].Flush();
+        }
+    }
+}
+
 int NET_SendToAll(sizebuf_t* data, double blocktime)
 {
     double start;
@@ -972,6 +991,7 @@ int NET_SendToAll(sizebuf_t* data, double blocktime)
             break;
         }
     }
+    NET_Flush();
     return count;
 }
 
@@ -1121,6 +1141,8 @@ static PollProcedure* pollProcedureList = nullptr;
 
 void NET_Poll()
 {
+    QUAKE_PROFILE_ZONE("NET_Poll");
+
     PollProcedure* pp;
 
     SetNetTime();
@@ -52,6 +52,215 @@ static struct in6_addr myAddrv6;
 
 //=============================================================================
 
+/*
+Batched I/O for the accept sockets
+
+Every remote client of a server shares the accept socket, so reading it one
+recvfrom at a time and writing it one sendto per client per frame costs a
+syscall per packet. On Linux, UDP_Read fills a queue of up to UDP_BATCH
+packets with a single recvmmsg and hands them out one at a time, and
+UDP_Write queues packets for the accept sockets until UDP_Flush (or a read,
+or a full queue) sends them all with a single sendmmsg.
+*/
+
+#if defined(__linux__)
+#define UDP_MMSG
+#endif
+
+#ifdef UDP_MMSG
+
+#define UDP_BATCH 32
+#define UDP_MAXPACKET 65536                          // anything udp can carry
+#define UDP_MAXBATCHED (DATAGRAM_MTU + NET_HEADERSIZE) // bigger is sent alone
+
+struct udprecv_t
+{
+    int count;
+    int next;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct qsockaddr addrs[UDP_BATCH];
+    byte (*data)[UDP_MAXPACKET]; // allocated by the first read, see below
+};
+
+struct udpsend_t
+{
+    sys_socket_t socket;
+    int count;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct qsockaddr addrs[UDP_BATCH];
+    byte data[UDP_BATCH][UDP_MAXBATCHED];
+};
+
+// one of each for net_acceptsocket4 and net_acceptsocket6
+static udprecv_t udprecv[2];
+static udpsend_t udpsend[2];
+
+static int UDP_BatchIndex(sys_socket_t socketid)
+{
+    if(socketid == INVALID_SOCKET)
+    {
+        return -1;
+    }
+    if(socketid == net_acceptsocket4)
+    {
+        return 0;
+    }
+    if(socketid == net_acceptsocket6)
+    {
+        return 1;
+    }
+    return -1;
+}
+
+static void UDP_FlushBatch(udpsend_t* batch)
+{
+    int sent = 0;
+
+    while(sent < batch->count)
+    {
+        int ret = sendmmsg(
+            batch->socket, batch->msgs + sent, batch->count - sent, 0);
+        if(ret == SOCKET_ERROR)
+        {
+            // skip the packet that failed, as sendto would have
+            int err = SOCKETERRNO;
+            if(err != NET_EWOULDBLOCK)
+            {
+                const char* to = UDP_AddrToString(&batch->addrs[sent], false);
+                Con_SafePrintf(
+                    "UDP_Flush, sendmmsg: %s (%s)\n", socketerror(err), to);
+            }
+            ret = 1;
+        }
+        sent += ret;
+    }
+
+    batch->count = 0;
+}
+
+void UDP_Flush()
+{
+    for(udpsend_t& batch : udpsend)
+    {
+        UDP_FlushBatch(&batch);
+    }
+}
+
+static void UDP_ResetBatch(sys_socket_t socketid)
+{
+    const int i = UDP_BatchIndex(socketid);
+    if(i != -1)
+    {
+        UDP_FlushBatch(&udpsend[i]);
+        udprecv[i].count = udprecv[i].next = 0;
+        free(udprecv[i].data);
+        udprecv[i].data = nullptr;
+    }
+}
+
+static int UDP_ReadBatch(udprecv_t* batch, sys_socket_t socketid, byte* buf,
+    int len, struct qsockaddr* addr)
+{
+    int i;
+
+    if(batch->next == batch->count)
+    {
+        // the peers may be waiting on anything we queued before they reply
+        UDP_Flush();
+
+        batch->count = batch->next = 0;
+
+        // only a listening server reads the accept sockets, so clients
+        // don't carry the buffers around
+        if(!batch->data)
+        {
+            const int size = sizeof(*batch->data) * UDP_BATCH;
+            batch->data = (byte(*)[UDP_MAXPACKET])malloc(size);
+            if(!batch->data)
+            {
+                Sys_Error("UDP_ReadBatch: malloc() failed on %d bytes", size);
+            }
+        }
+
+        for(i = 0; i < UDP_BATCH; i++)
+        {
+            batch->iov[i].iov_base = batch->data[i];
+            batch->iov[i].iov_len = UDP_MAXPACKET;
+            memset(&batch->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+            batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+            batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct qsockaddr);
+            batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+            batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int ret =
+            recvmmsg(socketid, batch->msgs, UDP_BATCH, MSG_DONTWAIT, nullptr);
+        if(ret == SOCKET_ERROR)
+        {
+            int err = SOCKETERRNO;
+            if(err == NET_EWOULDBLOCK || err == NET_ECONNREFUSED)
+            {
+                return 0;
+            }
+            Con_SafePrintf("UDP_Read, recvmmsg: %s\n", socketerror(err));
+            return -1;
+        }
+        batch->count = ret;
+
+        if(!batch->count)
+        {
+            return 0;
+        }
+    }
+
+    i = batch->next++;
+    len = q_min(len, (int)batch->msgs[i].msg_len);
+    memcpy(buf, batch->data[i], len);
+    memcpy(addr, &batch->addrs[i], sizeof(struct qsockaddr));
+    return len;
+}
+
+static bool UDP_WriteBatch(udpsend_t* batch, sys_socket_t socketid, byte* buf,
+    int len, struct qsockaddr* addr, socklen_t addrsize)
+{
+    if(len > (int)UDP_MAXBATCHED)
+    {
+        // keep the order, then let the caller send it directly
+        UDP_FlushBatch(batch);
+        return false;
+    }
+
+    if(batch->count == UDP_BATCH)
+    {
+        UDP_FlushBatch(batch);
+    }
+
+    const int i = batch->count++;
+    batch->socket = socketid;
+    memcpy(batch->data[i], buf, len);
+    memcpy(&batch->addrs[i], addr, addrsize);
+    batch->iov[i].iov_base = batch->data[i];
+    batch->iov[i].iov_len = len;
+    memset(&batch->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+    batch->msgs[i].msg_hdr.msg_namelen = addrsize;
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    return true;
+}
+
+#else
+
+void UDP_Flush()
+{
+}
+
+#endif // UDP_MMSG
+
+//=============================================================================
+
 sys_socket_t UDP4_Init()
 {
     int err;
@@ -202,6 +411,9 @@ ErrorReturn:
 
 int UDP_CloseSocket(sys_socket_t socketid)
 {
+#ifdef UDP_MMSG
+    UDP_ResetBatch(socketid);
+#endif
     if(socketid == net_broadcastsocket4)
     {
         net_broadcastsocket4 = INVALID_SOCKET;
@@ -298,6 +510,13 @@ sys_socket_t UDP4_CheckNewConnections()
         return INVALID_SOCKET;
     }
 
+#ifdef UDP_MMSG
+    if(udprecv[0].next != udprecv[0].count)
+    {
+        return net_acceptsocket4;
+    }
+#endif
+
     if(ioctl(net_acceptsocket4, FIONREAD, &available) == -1)
     {
         int err = SOCKETERRNO;
@@ -319,6 +538,15 @@ int UDP_Read(sys_socket_t socketid, byte* buf, int len, struct qsockaddr* addr)
     socklen_t addrlen = sizeof(struct qsockaddr);
     int ret;
 
+#ifdef UDP_MMSG
+    const int batch = UDP_BatchIndex(socketid);
+    if(batch != -1)
+    {
+        return UDP_ReadBatch(&udprecv[batch], socketid, buf, len, addr);
+    }
+    UDP_Flush();
+#endif
+
     ret = recvfrom(socketid, buf, len, 0, (struct sockaddr*)addr, &addrlen);
     if(ret == SOCKET_ERROR)
     {
@@ -395,6 +623,15 @@ int UDP_Write(sys_socket_t socketid, byte* buf, int len, struct qsockaddr* addr)
                    // doesn't exactly match the address family
     }
 
+#ifdef UDP_MMSG
+    const int batch = UDP_BatchIndex(socketid);
+    if(batch != -1 &&
+        UDP_WriteBatch(&udpsend[batch], socketid, buf, len, addr, addrsize))
+    {
+        return len;
+    }
+#endif
+
     ret = sendto(socketid, buf, len, 0, (struct sockaddr*)addr, addrsize);
     if(!addr->qsa_family)
     {
@@ -809,6 +1046,13 @@ sys_socket_t UDP6_CheckNewConnections()
         return INVALID_SOCKET;
     }
 
+#ifdef UDP_MMSG
+    if(udprecv[1].next != udprecv[1].count)
+    {
+        return net_acceptsocket6;
+    }
+#endif
+
     if(ioctl(net_acceptsocket6, FIONREAD, &available) == -1)
     {
         int err = SOCKETERRNO;
@@ -43,6 +43,7 @@ int UDP_AddrCompare(struct qsockaddr* addr1, struct qsockaddr* addr2);
 int UDP_GetSocketPort(struct qsockaddr* addr);
 int UDP_SetSocketPort(struct qsockaddr* addr, int port);
 int UDP4_GetAddresses(qhostaddr_t* addresses, int maxaddresses);
+void UDP_Flush();
 
 
 sys_socket_t UDP6_Init();
@@ -65,4 +66,5 @@ int UDP_AddrCompare(struct qsockaddr* addr1, struct qsockaddr* addr2);
 int UDP_GetSocketPort(struct qsockaddr* addr);
 int UDP_SetSocketPort(struct qsockaddr* addr, int port);
 int UDP6_GetAddresses(qhostaddr_t* addresses, int maxaddresses);
+void UDP_Flush();
 // ---
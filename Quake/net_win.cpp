@@ -34,13 +34,14 @@ net_driver_t net_drivers[] = {
         Loop_SearchForHosts, Loop_Connect, Loop_CheckNewConnections,
         Loop_GetAnyMessage, Loop_GetMessage, Loop_SendMessage,
         Loop_SendUnreliableMessage, Loop_CanSendMessage,
-        Loop_CanSendUnreliableMessage, Loop_Close, Loop_Shutdown},
+        Loop_CanSendUnreliableMessage, Loop_Close, Loop_Shutdown, nullptr},
 
     {"Datagram", false, Datagram_Init, Datagram_Listen, Datagram_QueryAddresses,
         Datagram_SearchForHosts, Datagram_Connect, Datagram_CheckNewConnections,
         Datagram_GetAnyMessage, Datagram_GetMessage, Datagram_SendMessage,
         Datagram_SendUnreliableMessage, Datagram_CanSendMessage,
-        Datagram_CanSendUnreliableMessage, Datagram_Close, Datagram_Shutdown}};
+        Datagram_CanSendUnreliableMessage, Datagram_Close, Datagram_Shutdown,
+        Datagram_Flush}};
 
 const int net_numdrivers = (sizeof(net_drivers) / sizeof(net_drivers[0]));
 
@@ -54,21 +55,21 @@ net_landriver_t net_landrivers[] = {
         WINS_Connect, WINIPv4_CheckNewConnections, WINS_Read, WINS_Write,
         WINIPv4_Broadcast, WINS_AddrToString, WINIPv4_StringToAddr,
         WINS_GetSocketAddr, WINIPv4_GetNameFromAddr, WINIPv4_GetAddrFromName,
-        WINS_AddrCompare, WINS_GetSocketPort, WINS_SetSocketPort},
+        WINS_AddrCompare, WINS_GetSocketPort, WINS_SetSocketPort, nullptr},
 #ifdef IPPROTO_IPV6
     {"Winsock IPv6", false, 0, WINIPv6_Init, WINIPv6_Shutdown, WINIPv6_Listen,
         WINIPv6_GetAddresses, WINIPv6_OpenSocket, WINS_CloseSocket,
         WINS_Connect, WINIPv6_CheckNewConnections, WINS_Read, WINS_Write,
         WINIPv6_Broadcast, WINS_AddrToString, WINIPv6_StringToAddr,
         WINS_GetSocketAddr, WINIPv6_GetNameFromAddr, WINIPv6_GetAddrFromName,
-        WINS_AddrCompare, WINS_GetSocketPort, WINS_SetSocketPort},
+        WINS_AddrCompare, WINS_GetSocketPort, WINS_SetSocketPort, nullptr},
 #endif
     {"Winsock IPX", false, 0, WIPX_Init, WIPX_Shutdown, WIPX_Listen,
         WIPX_GetAddresses, WIPX_OpenSocket, WIPX_CloseSocket, WIPX_Connect,
         WIPX_CheckNewConnections, WIPX_Read, WIPX_Write, WIPX_Broadcast,
         WIPX_AddrToString, WIPX_StringToAddr, WIPX_GetSocketAddr,
         WIPX_GetNameFromAddr, WIPX_GetAddrFromName, WIPX_AddrCompare,
-        WIPX_GetSocketPort, WIPX_SetSocketPort}};
+        WIPX_GetSocketPort, WIPX_SetSocketPort, nullptr}};
 
 const int net_numlandrivers =
     (sizeof(net_landrivers) / sizeof(net_landrivers[0]));
@@ -354,17 +354,8 @@ static void PF_sv_setmodel()
     const char* m = G_STRING(OFS_PARM1);
 
     // check to see if model was properly precached
-    int i;
-    const char** check;
-    for(i = 0, check = sv.model_precache; *check; i++, check++)
-    {
-        if(!strcmp(*check, m))
-        {
-            break;
-        }
-    }
-
-    if(!*check)
+    int i = SV_FindModelPrecache(m);
+    if(i == -1)
     {
         // Spike: so that func_illusionaries work with custom models even in
         // vanilla.
@@ -380,8 +371,10 @@ static void PF_sv_setmodel()
         }
         i = SV_Precache_Model(m);
     }
-    e->v.model = PR_SetEngineString(*check);
+    e->v.model = PR_SetEngineString(sv.model_precache[i]);
     e->v.modelindex = i; // SV_ModelIndex (m);
+    e->visiblemodelstr = e->v.model;
+    e->visiblemodel = sv.model_precache[i][0] != '\0';
 
     qmodel_t* mod = sv.models[(int)e->v.modelindex]; // Mod_ForName (m, true);
 
@@ -1637,6 +1630,11 @@ static void PF_sv_precache_sound()
 
 int SV_Precache_Model(const char* s)
 {
+    if(const int found = SV_FindModelPrecache(s); found != -1)
+    {
+        return found;
+    }
+
     size_t i;
     for(i = 0; i < MAX_MODELS; i++)
     {
@@ -1650,14 +1648,10 @@ int SV_Precache_Model(const char* s)
                 MSG_WriteString(&sv.reliable_datagram, s);
             }
 
-            sv.model_precache[i] = s;
+            SV_SetModelPrecache(i, s);
             sv.models[i] = Mod_ForName(s, i == 1);
             return i;
         }
-        if(!strcmp(sv.model_precache[i], s))
-        {
-            return i;
-        }
     }
     return 0;
 }
@@ -1671,6 +1665,11 @@ static void PF_sv_precache_model()
     G_INT(OFS_RETURN) = G_INT(OFS_PARM0);
     PR_CheckEmptyString(s);
 
+    if(SV_FindModelPrecache(s) != -1)
+    {
+        return;
+    }
+
     for(i = 0; i < MAX_MODELS; i++)
     {
         if(!sv.model_precache[i])
@@ -1687,15 +1686,10 @@ static void PF_sv_precache_model()
                 MSG_WriteString(&sv.reliable_datagram, s);
             }
 
-            sv.model_precache[i] = s;
+            SV_SetModelPrecache(i, s);
             sv.models[i] = Mod_ForName(s, i == 1);
             return;
         }
-
-        if(!strcmp(sv.model_precache[i], s))
-        {
-            return;
-        }
     }
     PR_RunError("PF_precache_model: overflow");
 }
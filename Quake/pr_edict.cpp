@@ -35,8 +35,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.hpp"
 #include "world.hpp"
 #include "qcvm.hpp"
+#include "pr_profiler.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 
 int type_size[8] = {
     1, // ev_void
@@ -75,6 +78,83 @@ void ED_ClearEdict(edict_t* e)
 {
     memset(&e->v, 0, qcvm->progs->entityfields * 4);
     e->free = false;
+    e->visiblemodelstr = 0;
+    e->visiblemodel = false;
+}
+
+/*
+=================
+ED_IsQueuedFree
+
+Entries are not removed when an edict is reused or freed again, so they
+have to be validated against the edict when they reach the front.
+=================
+*/
+static bool ED_IsQueuedFree(const freeedict_t& f)
+{
+    if(f.num < qcvm->reserved_edicts || f.num >= qcvm->num_edicts)
+    {
+        return false;
+    }
+
+    const edict_t* e = EDICT_NUM(f.num);
+    return e->free && e->freetime == f.freetime;
+}
+
+/*
+=================
+ED_RebuildFreeList
+
+Refills the free queue from the free edicts, oldest first. Needed whenever
+edicts are freed or reused behind ED_Free's back, e.g. by loading a game.
+=================
+*/
+void ED_RebuildFreeList()
+{
+    if(!qcvm->freeedicts)
+    {
+        qcvm->freeedicts =
+            (freeedict_t*)malloc(qcvm->max_edicts * sizeof(freeedict_t));
+    }
+
+    qcvm->freeedicts_head = 0;
+    qcvm->freeedicts_count = 0;
+
+    for(int i = qcvm->reserved_edicts; i < qcvm->num_edicts; i++)
+    {
+        const edict_t* e = EDICT_NUM(i);
+        if(e->free)
+        {
+            qcvm->freeedicts[qcvm->freeedicts_count++] = {i, e->freetime};
+        }
+    }
+
+    std::stable_sort(qcvm->freeedicts,
+        qcvm->freeedicts + qcvm->freeedicts_count,
+        [](const freeedict_t& a, const freeedict_t& b)
+        { return a.freetime < b.freetime; });
+}
+
+/*
+=================
+ED_PushFree
+
+=================
+*/
+static void ED_PushFree(edict_t* e)
+{
+    if(!qcvm->freeedicts || qcvm->freeedicts_count == qcvm->max_edicts)
+    {
+        // full of stale entries, `e` is picked up by the rebuild
+        ED_RebuildFreeList();
+        return;
+    }
+
+    const int tail =
+        (qcvm->freeedicts_head + qcvm->freeedicts_count) % qcvm->max_edicts;
+
+    qcvm->freeedicts[tail] = {NUM_FOR_EDICT(e), e->freetime};
+    ++qcvm->freeedicts_count;
 }
 
 /*
@@ -86,25 +166,46 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+Freed edicts are queued in the order they were freed, so only the front of
+the queue has to be checked: if it was freed too recently, so were all the
+others.
 =================
 */
 edict_t* ED_Alloc()
 {
-    int i;
     edict_t* e;
 
-    for(i = qcvm->reserved_edicts; i < qcvm->num_edicts; i++)
+    while(qcvm->freeedicts_count > 0)
     {
-        e = EDICT_NUM(i);
+        const freeedict_t& f = qcvm->freeedicts[qcvm->freeedicts_head];
+
+        if(!ED_IsQueuedFree(f))
+        {
+            qcvm->freeedicts_head =
+                (qcvm->freeedicts_head + 1) % qcvm->max_edicts;
+            --qcvm->freeedicts_count;
+            continue;
+        }
+
+        e = EDICT_NUM(f.num);
+
         // the first couple seconds of server time can involve a lot of
         // freeing and allocating, so relax the replacement policy
-        if(e->free && (e->freetime < 2 || qcvm->time - e->freetime > 0.5))
+        if(!(e->freetime < 2 || qcvm->time - e->freetime > 0.5))
         {
-            ED_ClearEdict(e);
-            return e;
+            break;
         }
+
+        qcvm->freeedicts_head = (qcvm->freeedicts_head + 1) % qcvm->max_edicts;
+        --qcvm->freeedicts_count;
+
+        ED_ClearEdict(e);
+        return e;
     }
 
+    const int i = qcvm->num_edicts;
+
     if(i == qcvm->max_edicts)
     {
         // johnfitz -- use qcvm->max_edicts instead of
@@ -150,6 +251,8 @@ void ED_Free(edict_t* ed)
     ed->alpha = ENTALPHA_DEFAULT; // johnfitz -- reset alpha for next entity
 
     ed->freetime = qcvm->time;
+
+    ED_PushFree(ed);
 }
 
 //===========================================================================
@@ -510,12 +613,72 @@ void ED_Print(edict_t* ed)
 
 /*
 =============
-ED_Write
+ED_SnapshotString
+
+Copies `str` into the snapshot, cut where PR_UglyValueString would cut it.
+=============
+*/
+static int ED_SnapshotString(edsnapshot_t& snap, const char* str)
+{
+    const int ofs = snap.strings.size();
+
+    snap.strings.append(str, strnlen(str, 1023));
+    snap.strings.push_back('\0');
+    return ofs;
+}
+
+/*
+=============
+ED_SnapshotPair
+
+Captures everything PR_UglyValueString needs from QC memory to print `val`.
+=============
+*/
+static void ED_SnapshotPair(
+    edsnapshot_t& snap, std::vector<edsnapshot_t::pair_t>& pairs,
+    const int key, const int type, const eval_t* val)
+{
+    edsnapshot_t::pair_t& p = pairs.emplace_back();
+    ddef_t* def;
+
+    p.key = key;
+    p.type = type & ~DEF_SAVEGLOBAL;
+    p.value._int = val->_int;
+
+    switch(p.type)
+    {
+        case ev_string:
+            p.value._int = ED_SnapshotString(snap, PR_GetString(val->string));
+            break;
+        case ev_entity:
+            p.value._int = NUM_FOR_EDICT(PROG_TO_EDICT(val->edict));
+            break;
+        case ev_function:
+            p.value._int = ED_SnapshotString(
+                snap, PR_GetString(qcvm->functions[val->function].s_name));
+            break;
+        case ev_field:
+            def = ED_FieldAtOfs(val->_int);
+            p.value._int =
+                ED_SnapshotString(snap, def ? PR_GetString(def->s_name) : "");
+            break;
+        case ev_vector:
+            p.value.vector[1] = val->vector[1];
+            p.value.vector[2] = val->vector[2];
+            break;
+        default: break;
+    }
+}
+
+/*
+=============
+ED_SnapshotEdict
 
 For savegames
 =============
 */
-void ED_Write(FILE* f, edict_t* ed)
+static void ED_SnapshotEdict(
+    edsnapshot_t& snap, std::vector<int>& fieldkeys, edict_t* ed)
 {
     ddef_t* d;
     int* v;
@@ -523,12 +686,11 @@ void ED_Write(FILE* f, edict_t* ed)
     int j;
     const char* name;
     int type;
-
-    fprintf(f, "{\n");
+    const std::size_t first = snap.pairs.size();
 
     if(ed->free)
     {
-        fprintf(f, "}\n");
+        snap.edicts.push_back(0);
         return;
     }
 
@@ -558,19 +720,25 @@ void ED_Write(FILE* f, edict_t* ed)
             continue;
         }
 
-        fprintf(f, "\"%s\" ", name);
-        fprintf(f, "\"%s\"\n", PR_UglyValueString(d->type, (eval_t*)v));
+        if(fieldkeys[i] == -1)
+        {
+            fieldkeys[i] = ED_SnapshotString(snap, name);
+        }
+        ED_SnapshotPair(snap, snap.pairs, fieldkeys[i], d->type, (eval_t*)v);
     }
 
     // johnfitz -- save entity alpha manually when progs.dat doesn't know about
     // alpha
     if(qcvm->extfields.alpha < 0 && ed->alpha != ENTALPHA_DEFAULT)
     {
-        fprintf(f, "\"alpha\" \"%f\"\n", ENTALPHA_TOSAVE(ed->alpha));
+        eval_t alpha;
+        alpha._float = ENTALPHA_TOSAVE(ed->alpha);
+        ED_SnapshotPair(snap, snap.pairs, ED_SnapshotString(snap, "alpha"),
+            ev_float, &alpha);
     }
     // johnfitz
 
-    fprintf(f, "}\n");
+    snap.edicts.push_back(snap.pairs.size() - first);
 }
 
 void ED_PrintNum(int ent)
@@ -673,6 +841,7 @@ static void ED_Count()
     int models;
     int solid;
     int step;
+    int freed;
 
     if(!sv.active)
     {
@@ -681,12 +850,13 @@ static void ED_Count()
 
     PR_SwitchQCVM(&sv.qcvm);
 
-    active = models = solid = step = 0;
+    active = models = solid = step = freed = 0;
     for(i = 0; i < qcvm->num_edicts; i++)
     {
         ent = EDICT_NUM(i);
         if(ent->free)
         {
+            freed++;
             continue;
         }
         active++;
@@ -709,6 +879,8 @@ static void ED_Count()
     Con_Printf("view      :%3i\n", models);
     Con_Printf("touch     :%3i\n", solid);
     Con_Printf("step      :%3i\n", step);
+    Con_Printf("free      :%3i\n", freed);
+    Con_Printf("freelist  :%3i\n", qcvm->freeedicts_count);
 
     PR_SwitchQCVM(nullptr);
 }
@@ -725,17 +897,25 @@ FIXME: need to tag constants, doesn't really work
 
 /*
 =============
-ED_WriteGlobals
+ED_SnapshotSave
+
+Captures the saved globals and every edict of the current VM into `snap`,
+resolving strings and edict numbers, so that ED_WriteSnapshot can print them
+later on any thread.
 =============
 */
-void ED_WriteGlobals(FILE* f)
+void ED_SnapshotSave(edsnapshot_t& snap)
 {
     ddef_t* def;
     int i;
     const char* name;
     int type;
 
-    fprintf(f, "{\n");
+    snap.strings.clear();
+    snap.globals.clear();
+    snap.pairs.clear();
+    snap.edicts.clear();
+
     for(i = 0; i < qcvm->progs->numglobaldefs; i++)
     {
         def = &qcvm->globaldefs[i];
@@ -753,13 +933,86 @@ void ED_WriteGlobals(FILE* f)
         }
 
         name = PR_GetString(def->s_name);
-        fprintf(f, "\"%s\" ", name);
-        fprintf(f, "\"%s\"\n",
-            PR_UglyValueString(type, (eval_t*)&qcvm->globals[def->ofs]));
+        ED_SnapshotPair(snap, snap.globals, ED_SnapshotString(snap, name),
+            type, (eval_t*)&qcvm->globals[def->ofs]);
+    }
+
+    std::vector<int> fieldkeys(qcvm->progs->numfielddefs, -1);
+    snap.edicts.reserve(qcvm->num_edicts);
+    for(i = 0; i < qcvm->num_edicts; i++)
+    {
+        ED_SnapshotEdict(snap, fieldkeys, EDICT_NUM(i));
+    }
+}
+
+/*
+=============
+ED_WritePairs
+
+Prints pairs the way PR_UglyValueString formats their values.
+=============
+*/
+static void ED_WritePairs(FILE* f, const edsnapshot_t& snap,
+    const edsnapshot_t::pair_t* pairs, const int count)
+{
+    char line[1024];
+    const char* strings = snap.strings.c_str();
+    const char* value;
+
+    fprintf(f, "{\n");
+    for(int i = 0; i < count; i++)
+    {
+        const edsnapshot_t::pair_t& p = pairs[i];
+
+        value = line;
+        switch(p.type)
+        {
+            case ev_string:
+            case ev_function:
+            case ev_field: value = strings + p.value._int; break;
+            case ev_entity:
+            case ev_ext_integer:
+                q_snprintf(line, sizeof(line), "%i", p.value._int);
+                break;
+            case ev_void: value = "void"; break;
+            case ev_float:
+                q_snprintf(line, sizeof(line), "%f", p.value._float);
+                break;
+            case ev_vector:
+                q_snprintf(line, sizeof(line), "%f %f %f", p.value.vector[0],
+                    p.value.vector[1], p.value.vector[2]);
+                break;
+            default:
+                q_snprintf(line, sizeof(line), "bad type %i", p.type);
+                break;
+        }
+
+        fprintf(f, "\"%s\" ", strings + p.key);
+        fprintf(f, "\"%s\"\n", value);
     }
     fprintf(f, "}\n");
 }
 
+/*
+=============
+ED_WriteSnapshot
+
+Writes the globals and edicts of a savegame. Only reads `snap`, so it is safe
+to call off the main thread.
+=============
+*/
+void ED_WriteSnapshot(FILE* f, const edsnapshot_t& snap)
+{
+    const edsnapshot_t::pair_t* pairs = snap.pairs.data();
+
+    ED_WritePairs(f, snap, snap.globals.data(), snap.globals.size());
+    for(const int count : snap.edicts)
+    {
+        ED_WritePairs(f, snap, pairs, count);
+        pairs += count;
+    }
+}
+
 /*
 =============
 ED_ParseGlobals
@@ -1250,6 +1503,9 @@ void ED_LoadFromFile(const char* data)
     }
 
     Con_DPrintf("%i entities inhibited\n", inhibit);
+
+    // some edicts may have been left free without going through ED_Free
+    ED_RebuildFreeList();
 }
 
 globalvars_t* pr_global_struct;
@@ -1271,8 +1527,13 @@ void PR_ClearProgs(qcvm_t* vm)
     if(qcvm->knownstrings)
     {
         Z_Free((void*)qcvm->knownstrings);
+        Z_Free(qcvm->freeknownstrings);
+        Z_Free(qcvm->knownstringshash);
     }
     free(qcvm->edicts); // ericw -- sv.edicts switched to use malloc()
+    free(qcvm->freeedicts);
+    free(qcvm->pstatements);
+    PR_FreeProfiler(qcvm);
     memset(qcvm, 0, sizeof(*qcvm));
 
     qcvm = nullptr;
@@ -1489,6 +1750,8 @@ bool PR_LoadProgs(
     PR_SetEngineString("");
     PR_EnableExtensions(qcvm->globaldefs);
 
+    PR_PredecodeStatements();
+
     return true;
 }
 
@@ -1504,6 +1767,9 @@ void PR_Init()
     Cmd_AddCommand("edicts", ED_PrintEdicts);
     Cmd_AddCommand("edictcount", ED_Count);
     Cmd_AddCommand("profile", PR_Profile_f);
+    Cmd_AddCommand("pr_benchmark", PR_Benchmark_f);
+    Cmd_AddCommand("pr_opstats", PR_OpStats_f);
+    Cmd_AddCommand("pr_profiler", PR_Profiler_f);
     Cmd_AddCommand("pr_dumpplatform", PR_DumpPlatform_f);
     Cvar_RegisterVariable(&nomonsters);
     Cvar_RegisterVariable(&gamecfg);
@@ -1516,6 +1782,8 @@ void PR_Init()
     Cvar_RegisterVariable(&saved2);
     Cvar_RegisterVariable(&saved3);
     Cvar_RegisterVariable(&saved4);
+    Cvar_RegisterVariable(&pr_threaded);
+    Cvar_RegisterVariable(&pr_fuse);
 
     PR_InitExtensions();
 }
@@ -1548,6 +1816,85 @@ int NUM_FOR_EDICT(edict_t* e)
 
 #define PR_STRING_ALLOCSLOTS 256
 
+/*
+The engine strings in qcvm->knownstrings are indexed by pointer through an
+open-addressing hash table with linear probing, kept at most half full, so
+that PR_SetEngineString doesn't have to search the whole array. Cleared
+slots are pushed on a stack and reused first.
+*/
+
+static unsigned int PR_HashStringPointer(const char* s)
+{
+    const auto p = reinterpret_cast<std::uintptr_t>(s);
+    return static_cast<unsigned int>((p >> 3) * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+// Returns the hash table position holding `s`, or the empty one to put it in.
+static int PR_FindStringHashPos(const char* s)
+{
+    const int mask = qcvm->knownstringshashsize - 1;
+    int pos = PR_HashStringPointer(s) & mask;
+
+    while(qcvm->knownstringshash[pos] &&
+          qcvm->knownstrings[qcvm->knownstringshash[pos] - 1] != s)
+    {
+        pos = (pos + 1) & mask;
+    }
+
+    return pos;
+}
+
+static void PR_HashString(int slot)
+{
+    const int pos = PR_FindStringHashPos(qcvm->knownstrings[slot]);
+
+    // keep the lowest slot if the same pointer was registered twice
+    if(!qcvm->knownstringshash[pos])
+    {
+        qcvm->knownstringshash[pos] = slot + 1;
+    }
+}
+
+static void PR_UnhashString(int slot)
+{
+    const int mask = qcvm->knownstringshashsize - 1;
+    int pos = PR_FindStringHashPos(qcvm->knownstrings[slot]);
+
+    if(qcvm->knownstringshash[pos] != slot + 1)
+    {
+        return;
+    }
+
+    // backward shift deletion, so that no tombstones are needed
+    int next = pos;
+    while(true)
+    {
+        qcvm->knownstringshash[pos] = 0;
+
+        while(true)
+        {
+            next = (next + 1) & mask;
+            if(!qcvm->knownstringshash[next])
+            {
+                return;
+            }
+
+            const int nextslot = qcvm->knownstringshash[next] - 1;
+            const int home =
+                PR_HashStringPointer(qcvm->knownstrings[nextslot]) & mask;
+
+            // move the entry back only if `pos` lies on its probe path
+            if(((next - home) & mask) >= ((next - pos) & mask))
+            {
+                break;
+            }
+        }
+
+        qcvm->knownstringshash[pos] = qcvm->knownstringshash[next];
+        pos = next;
+    }
+}
+
 static void PR_AllocStringSlots()
 {
     qcvm->maxknownstrings += PR_STRING_ALLOCSLOTS;
@@ -1555,6 +1902,47 @@ static void PR_AllocStringSlots()
         qcvm->maxknownstrings);
     qcvm->knownstrings = (const char**)Z_Realloc(
         (void*)qcvm->knownstrings, qcvm->maxknownstrings * sizeof(char*));
+    qcvm->freeknownstrings = (int*)Z_Realloc(
+        qcvm->freeknownstrings, qcvm->maxknownstrings * sizeof(int));
+
+    // rehash everything into a table with twice as many positions as slots
+    if(qcvm->knownstringshash)
+    {
+        Z_Free(qcvm->knownstringshash);
+    }
+
+    qcvm->knownstringshashsize = 1;
+    while(qcvm->knownstringshashsize < qcvm->maxknownstrings * 2)
+    {
+        qcvm->knownstringshashsize <<= 1;
+    }
+
+    qcvm->knownstringshash =
+        (int*)Z_Malloc(qcvm->knownstringshashsize * sizeof(int));
+
+    for(int i = 0; i < qcvm->numknownstrings; i++)
+    {
+        if(qcvm->knownstrings[i])
+        {
+            PR_HashString(i);
+        }
+    }
+}
+
+// Returns a cleared slot if there is one, otherwise appends a new one.
+static int PR_NewStringSlot()
+{
+    if(qcvm->numfreeknownstrings > 0)
+    {
+        return qcvm->freeknownstrings[--qcvm->numfreeknownstrings];
+    }
+
+    if(qcvm->numknownstrings >= qcvm->maxknownstrings)
+    {
+        PR_AllocStringSlots();
+    }
+
+    return qcvm->numknownstrings++;
 }
 
 const char* PR_GetString(int num)
@@ -1587,18 +1975,20 @@ void PR_ClearEngineString(int num)
     if(num < 0 && num >= -qcvm->numknownstrings)
     {
         num = -1 - num;
-        qcvm->knownstrings[num] = nullptr;
-        if(qcvm->freeknownstrings > num)
+
+        if(!qcvm->knownstrings[num])
         {
-            qcvm->freeknownstrings = num;
+            return; // already cleared, and thus already on the free stack
         }
+
+        PR_UnhashString(num);
+        qcvm->knownstrings[num] = nullptr;
+        qcvm->freeknownstrings[qcvm->numfreeknownstrings++] = num;
     }
 }
 
 int PR_SetEngineString(const char* s)
 {
-    int i;
-
     if(!s)
     {
         return 0;
@@ -1613,63 +2003,34 @@ int PR_SetEngineString(const char* s)
         return (int)(s - qcvm->strings);
     }
 #endif
-    for(i = 0; i < qcvm->numknownstrings; i++)
+    if(qcvm->knownstringshash)
     {
-        if(qcvm->knownstrings[i] == s)
+        const int pos = PR_FindStringHashPos(s);
+        if(qcvm->knownstringshash[pos])
         {
-            return -1 - i;
+            return -qcvm->knownstringshash[pos];
         }
     }
+
     // new unknown engine string
     // Con_DPrintf ("PR_SetEngineString: new engine string %p\n", s);
-    for(i = qcvm->freeknownstrings;; i++)
-    {
-        if(i < qcvm->numknownstrings)
-        {
-            if(qcvm->knownstrings[i])
-            {
-                continue;
-            }
-        }
-        else
-        {
-            if(i >= qcvm->maxknownstrings)
-            {
-                PR_AllocStringSlots();
-            }
-            qcvm->numknownstrings++;
-        }
-        break;
-    }
-    qcvm->freeknownstrings = i + 1;
+    const int i = PR_NewStringSlot();
     qcvm->knownstrings[i] = s;
+    PR_HashString(i);
     return -1 - i;
 }
 
 int PR_AllocString(int size, char** ptr)
 {
-    int i;
-
     if(!size)
     {
         return 0;
     }
-    for(i = 0; i < qcvm->numknownstrings; i++)
-    {
-        if(!qcvm->knownstrings[i])
-        {
-            break;
-        }
-    }
-    //	if (i >= qcvm->numknownstrings)
-    //	{
-    if(i >= qcvm->maxknownstrings)
-    {
-        PR_AllocStringSlots();
-    }
-    qcvm->numknownstrings++;
-    //	}
+
+    const int i = PR_NewStringSlot();
     qcvm->knownstrings[i] = (char*)Hunk_AllocName(size, "string");
+    PR_HashString(i);
+
     if(ptr)
     {
         *ptr = (char*)qcvm->knownstrings[i];
@@ -27,6 +27,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "progs.hpp"
 #include "server.hpp"
 #include "qcvm.hpp"
+#include "cmd.hpp"
+#include "cvar.hpp"
+#include "sys.hpp"
+#include "pr_profiler.hpp"
+#include "profiler.hpp"
 
 static const char* pr_opnames[] = {"DONE",
 
@@ -285,6 +290,12 @@ static int PR_EnterFunction(dfunction_t* f)
     }
 
     qcvm->xfunction = f;
+
+    if(pr_profiling)
+    {
+        PR_ProfileEnter(f);
+    }
+
     return f->first_statement - 1; // offset the s++
 }
 
@@ -303,6 +314,11 @@ static int PR_LeaveFunction()
         Host_Error("prog stack underflow");
     }
 
+    if(pr_profiling)
+    {
+        PR_ProfileLeave();
+    }
+
     // Restore locals from the stack
     c = qcvm->xfunction->locals;
     qcvm->localstack_used -= c;
@@ -324,43 +340,176 @@ static int PR_LeaveFunction()
 }
 
 
+/*
+==============================================================================
+
+OPCODE STATISTICS
+
+While enabled, PR_ExecuteProgram uses the switch interpreter, which counts
+every executed opcode and every pair of adjacent statements executed one
+after the other. The pairs are what the superinstructions of the threaded
+interpreter are chosen from.
+
+==============================================================================
+*/
+
+#define PR_NUMSTATOPS (OP_BITOR + 2) // the last one counts unknown opcodes
+
+static bool pr_opstats_active;
+static unsigned long long pr_opcounts[PR_NUMSTATOPS];
+static unsigned long long pr_oppaircounts[PR_NUMSTATOPS * PR_NUMSTATOPS];
+
+static int PR_StatOp(const dstatement_t* st)
+{
+    return st->op <= OP_BITOR ? st->op : OP_BITOR + 1;
+}
+
+static const char* PR_StatOpName(int op)
+{
+    return op <= OP_BITOR ? pr_opnames[op] : "<unknown>";
+}
+
+/*
+============
+PR_CountStatement
+============
+*/
+static void PR_CountStatement(const dstatement_t* st, const dstatement_t* prev)
+{
+    const int op = PR_StatOp(st);
+    pr_opcounts[op]++;
+
+    if(prev && st == prev + 1)
+    {
+        pr_oppaircounts[PR_StatOp(prev) * PR_NUMSTATOPS + op]++;
+    }
+}
+
+/*
+============
+PR_OpStats_f
+============
+*/
+void PR_OpStats_f()
+{
+    const char* cmd = Cmd_Argc() > 1 ? Cmd_Argv(1) : "";
+
+    if(!strcmp(cmd, "start") || !strcmp(cmd, "clear"))
+    {
+        memset(pr_opcounts, 0, sizeof(pr_opcounts));
+        memset(pr_oppaircounts, 0, sizeof(pr_oppaircounts));
+        pr_opstats_active = pr_opstats_active || !strcmp(cmd, "start");
+        return;
+    }
+
+    if(!strcmp(cmd, "stop"))
+    {
+        pr_opstats_active = false;
+        return;
+    }
+
+    if(*cmd)
+    {
+        Con_Printf("usage: pr_opstats [start | stop | clear]\n");
+        return;
+    }
+
+    const int top = 20;
+
+    unsigned long long total = 0;
+    for(int i = 0; i < PR_NUMSTATOPS; i++)
+    {
+        total += pr_opcounts[i];
+    }
+
+    if(!total)
+    {
+        Con_Printf("no statements counted%s\n",
+            pr_opstats_active ? "" : ", use \"pr_opstats start\"");
+        return;
+    }
+
+    Con_Printf("%llu statements (%s)\n", total,
+        pr_opstats_active ? "counting" : "stopped");
+
+    // selection of the most frequent entries, without disturbing the counts
+    static bool shown[PR_NUMSTATOPS * PR_NUMSTATOPS];
+
+    memset(shown, 0, sizeof(shown));
+    Con_Printf("opcodes:\n");
+    for(int n = 0; n < top; n++)
+    {
+        int best = -1;
+        for(int i = 0; i < PR_NUMSTATOPS; i++)
+        {
+            if(!shown[i] && pr_opcounts[i] &&
+                (best < 0 || pr_opcounts[i] > pr_opcounts[best]))
+            {
+                best = i;
+            }
+        }
+
+        if(best < 0)
+        {
+            break;
+        }
+
+        shown[best] = true;
+        Con_Printf("%12llu %5.1f%% %s\n", pr_opcounts[best],
+            100.0 * pr_opcounts[best] / total, PR_StatOpName(best));
+    }
+
+    memset(shown, 0, sizeof(shown));
+    Con_Printf("adjacent pairs:\n");
+    for(int n = 0; n < top; n++)
+    {
+        int best = -1;
+        for(int i = 0; i < PR_NUMSTATOPS * PR_NUMSTATOPS; i++)
+        {
+            const unsigned long long c = pr_oppaircounts[i];
+            if(!shown[i] && c &&
+                (best < 0 || c > pr_oppaircounts[best]))
+            {
+                best = i;
+            }
+        }
+
+        if(best < 0)
+        {
+            break;
+        }
+
+        shown[best] = true;
+        Con_Printf("%12llu %5.1f%% %s -> %s\n", pr_oppaircounts[best],
+            100.0 * pr_oppaircounts[best] / total,
+            PR_StatOpName(best / PR_NUMSTATOPS),
+            PR_StatOpName(best % PR_NUMSTATOPS));
+    }
+}
+
+
 /*
 ====================
-PR_ExecuteProgram
+PR_ExecuteSwitch
 
-The interpretation main loop
+The interpretation main loop, dispatching on the original statements
 ====================
 */
 #define OPA ((eval_t*)&qcvm->globals[(unsigned short)st->a])
 #define OPB ((eval_t*)&qcvm->globals[(unsigned short)st->b])
 #define OPC ((eval_t*)&qcvm->globals[(unsigned short)st->c])
 
-void PR_ExecuteProgram(func_t fnum)
+static void PR_ExecuteSwitch(dfunction_t* f)
 {
     eval_t* ptr;
     dstatement_t* st;
-    dfunction_t* f;
+    dstatement_t* prevst = nullptr;
     dfunction_t* newf;
     int profile;
     int startprofile;
     edict_t* ed;
     int exitdepth;
 
-    if(!fnum || fnum >= qcvm->progs->numfunctions)
-    {
-        if(pr_global_struct->self)
-        {
-            ED_Print(PROG_TO_EDICT(pr_global_struct->self));
-        }
-        Host_Error("PR_ExecuteProgram: NULL function");
-    }
-
-    f = &qcvm->functions[fnum];
-
-    // FIXME: if this is a builtin, then we're going to crash.
-
-    qcvm->trace = false;
-
     // make a stack frame
     exitdepth = qcvm->depth;
 
@@ -382,6 +531,12 @@ void PR_ExecuteProgram(func_t fnum)
             PR_PrintStatement(st);
         }
 
+        if(pr_opstats_active)
+        {
+            PR_CountStatement(st, prevst);
+            prevst = st;
+        }
+
         switch(st->op)
         {
             case OP_ADD_F: OPC->_float = OPA->_float + OPB->_float; break;
@@ -561,6 +716,7 @@ void PR_ExecuteProgram(func_t fnum)
             case OP_CALL7:
             case OP_CALL8:
                 qcvm->xfunction->profile += profile - startprofile;
+                qcvm->statementsrun += profile - startprofile;
                 startprofile = profile;
                 qcvm->xstatement = st - qcvm->statements;
                 qcvm->argc = st->op - OP_CALL0;
@@ -577,7 +733,16 @@ void PR_ExecuteProgram(func_t fnum)
                     {
                         i = 0; // just invoke the fixme builtin.
                     }
-                    qcvm->builtins[i]();
+                    if(pr_profiling)
+                    {
+                        PR_ProfileEnter(newf);
+                        qcvm->builtins[i]();
+                        PR_ProfileLeave();
+                    }
+                    else
+                    {
+                        qcvm->builtins[i]();
+                    }
                     break;
                 }
                 // Normal function
@@ -587,6 +752,7 @@ void PR_ExecuteProgram(func_t fnum)
             case OP_DONE:
             case OP_RETURN:
                 qcvm->xfunction->profile += profile - startprofile;
+                qcvm->statementsrun += profile - startprofile;
                 startprofile = profile;
                 qcvm->xstatement = st - qcvm->statements;
                 qcvm->globals[OFS_RETURN] =
@@ -621,3 +787,748 @@ void PR_ExecuteProgram(func_t fnum)
 #undef OPA
 #undef OPB
 #undef OPC
+
+/*
+==============================================================================
+
+PREDECODED EXECUTION
+
+When the progs are loaded, the statements are copied into an array of
+prstatement_t with their operands already resolved to global pointers, so
+that the threaded core does not have to index qcvm->globals on every access.
+Entry i of qcvm->pstatements always corresponds to statement i of
+qcvm->statements, which keeps xstatement, branch offsets, pr_trace output and
+PR_RunError line reporting unchanged.
+
+The threaded core dispatches with computed goto, which needs the GCC "labels
+as values" extension. Other compilers only get the switch interpreter.
+
+PR_FuseStatements then replaces the opcode of the first statement of some
+common adjacent pairs with an engine-private superinstruction, which executes
+both statements with a single dispatch and without reloading the value the
+first one produced. The second statement is left untouched, so branching to
+it still works and nothing visible to QC debugging changes; the fused handler
+still counts, traces and reports both statements separately.
+
+==============================================================================
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PR_COMPUTED_GOTO
+#endif
+
+cvar_t pr_threaded = {"pr_threaded", "1", CVAR_NONE};
+cvar_t pr_fuse = {"pr_fuse", "1", CVAR_NONE}; // applied when progs are loaded
+
+// statements whose result is commonly tested by the IF/IFNOT right after them
+#define PR_FUSED_BRANCHES(X) \
+    X(LOAD_F)                \
+    X(EQ_F)                  \
+    X(NE_F)                  \
+    X(EQ_E)                  \
+    X(NE_E)                  \
+    X(LT)                    \
+    X(LE)                    \
+    X(GT)                    \
+    X(GE)                    \
+    X(NOT_F)                 \
+    X(NOT_ENT)
+
+// engine-private opcodes, only found in qcvm->pstatements
+enum
+{
+    PROP_BAD = OP_BITOR + 1, // any opcode the engine does not know about
+
+#define PR_FUSED_BRANCH_ENUM(name) PROP_##name##_IF, PROP_##name##_IFNOT,
+    PR_FUSED_BRANCHES(PR_FUSED_BRANCH_ENUM)
+#undef PR_FUSED_BRANCH_ENUM
+
+    PROP_ADDRESS_STOREP, // ADDRESS, then STOREP_F/ENT/FLD/S/FNC through it
+    PROP_ADDRESS_STOREP_V,
+
+    PROP_NUMOPS
+};
+
+struct prstatement_t
+{
+    eval_t* a;
+    eval_t* b;
+    eval_t* c;
+    int jump;          // branch offset of IF, IFNOT and GOTO
+    unsigned short op; // OP_* or PROP_*
+};
+
+/*
+====================
+PR_FusedOpcode
+
+Returns the superinstruction executing `st` and `next`, or 0 if there is none
+====================
+*/
+static int PR_FusedOpcode(const dstatement_t& st, const dstatement_t& next)
+{
+    if(next.op == OP_IF || next.op == OP_IFNOT)
+    {
+        if(next.a != st.c)
+        {
+            return 0; // not testing the first statement's result
+        }
+
+        const bool ifnot = next.op == OP_IFNOT;
+        switch(st.op)
+        {
+#define PR_FUSED_BRANCH_CASE(name) \
+    case OP_##name: return ifnot ? PROP_##name##_IFNOT : PROP_##name##_IF;
+            PR_FUSED_BRANCHES(PR_FUSED_BRANCH_CASE)
+#undef PR_FUSED_BRANCH_CASE
+        }
+
+        return 0;
+    }
+
+    if(st.op == OP_ADDRESS && next.b == st.c)
+    {
+        switch(next.op)
+        {
+            case OP_STOREP_F:
+            case OP_STOREP_ENT:
+            case OP_STOREP_FLD:
+            case OP_STOREP_S:
+            case OP_STOREP_FNC: return PROP_ADDRESS_STOREP;
+            case OP_STOREP_V: return PROP_ADDRESS_STOREP_V;
+        }
+    }
+
+    return 0;
+}
+
+/*
+====================
+PR_FuseStatements
+====================
+*/
+static void PR_FuseStatements()
+{
+    const int numstatements = qcvm->progs->numstatements;
+    int numfused = 0;
+
+    for(int i = 0; i + 1 < numstatements; i++)
+    {
+        const int op =
+            PR_FusedOpcode(qcvm->statements[i], qcvm->statements[i + 1]);
+        if(op)
+        {
+            qcvm->pstatements[i].op = op;
+            numfused++;
+        }
+    }
+
+    Con_DPrintf("fused %d of %d statements\n", numfused, numstatements);
+}
+
+/*
+====================
+PR_PredecodeStatements
+====================
+*/
+void PR_PredecodeStatements()
+{
+    const int numstatements = qcvm->progs->numstatements;
+
+    free(qcvm->pstatements);
+    qcvm->pstatements =
+        (prstatement_t*)malloc(numstatements * sizeof(prstatement_t));
+    if(!qcvm->pstatements)
+    {
+        Sys_Error("PR_PredecodeStatements: out of memory on %d statements",
+            numstatements);
+    }
+
+    for(int i = 0; i < numstatements; i++)
+    {
+        const dstatement_t& st = qcvm->statements[i];
+        prstatement_t& pst = qcvm->pstatements[i];
+
+        pst.op = st.op < PROP_BAD ? st.op : (unsigned short)PROP_BAD;
+        pst.a = (eval_t*)&qcvm->globals[(unsigned short)st.a];
+        pst.b = (eval_t*)&qcvm->globals[(unsigned short)st.b];
+        pst.c = (eval_t*)&qcvm->globals[(unsigned short)st.c];
+        pst.jump = st.op == OP_GOTO ? st.a : st.b;
+    }
+
+    if(pr_fuse.value)
+    {
+        PR_FuseStatements();
+    }
+}
+
+#ifdef PR_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+/*
+====================
+PR_ExecuteThreaded
+
+Same semantics as PR_ExecuteSwitch, on the predecoded statements
+====================
+*/
+static void PR_ExecuteThreaded(dfunction_t* f)
+{
+    // must follow the order of the OP_* and PROP_* enumerations
+    static const void* const dispatch[] = {&&op_DONE, &&op_MUL_F,
+        &&op_MUL_V, &&op_MUL_FV, &&op_MUL_VF, &&op_DIV_F, &&op_ADD_F,
+        &&op_ADD_V, &&op_SUB_F, &&op_SUB_V,
+
+        &&op_EQ_F, &&op_EQ_V, &&op_EQ_S, &&op_EQ_E, &&op_EQ_FNC,
+
+        &&op_NE_F, &&op_NE_V, &&op_NE_S, &&op_NE_E, &&op_NE_FNC,
+
+        &&op_LE, &&op_GE, &&op_LT, &&op_GT,
+
+        &&op_LOAD_F, &&op_LOAD_V, &&op_LOAD_S, &&op_LOAD_ENT, &&op_LOAD_FLD,
+        &&op_LOAD_FNC,
+
+        &&op_ADDRESS,
+
+        &&op_STORE_F, &&op_STORE_V, &&op_STORE_S, &&op_STORE_ENT,
+        &&op_STORE_FLD, &&op_STORE_FNC,
+
+        &&op_STOREP_F, &&op_STOREP_V, &&op_STOREP_S, &&op_STOREP_ENT,
+        &&op_STOREP_FLD, &&op_STOREP_FNC,
+
+        &&op_RETURN, &&op_NOT_F, &&op_NOT_V, &&op_NOT_S, &&op_NOT_ENT,
+        &&op_NOT_FNC, &&op_IF, &&op_IFNOT, &&op_CALL0, &&op_CALL1,
+        &&op_CALL2, &&op_CALL3, &&op_CALL4, &&op_CALL5, &&op_CALL6,
+        &&op_CALL7, &&op_CALL8, &&op_STATE, &&op_GOTO, &&op_AND, &&op_OR,
+
+        &&op_BITAND, &&op_BITOR,
+
+        &&op_BAD,
+
+#define PR_FUSED_BRANCH_LABELS(name) &&op_##name##_IF, &&op_##name##_IFNOT,
+        PR_FUSED_BRANCHES(PR_FUSED_BRANCH_LABELS)
+#undef PR_FUSED_BRANCH_LABELS
+
+        &&op_ADDRESS_STOREP, &&op_ADDRESS_STOREP_V};
+
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == PROP_NUMOPS);
+
+    prstatement_t* const base = qcvm->pstatements;
+    prstatement_t* pst;
+    eval_t* ptr;
+    dfunction_t* newf;
+    edict_t* ed;
+    int profile;
+    int startprofile;
+
+#define PR_NEXT()                                                   \
+    do                                                              \
+    {                                                               \
+        pst++; /* next statement */                                 \
+        if(++profile > 0x10000000) /* spike -- was decimal 100000 */ \
+        {                                                           \
+            goto runaway;                                           \
+        }                                                           \
+        if(qcvm->trace)                                             \
+        {                                                           \
+            PR_PrintStatement(&qcvm->statements[pst - base]);       \
+        }                                                           \
+        goto* dispatch[pst->op];                                    \
+    } while(false)
+
+// moves on to the second statement of a superinstruction
+#define PR_NEXT_FUSED()                                             \
+    do                                                              \
+    {                                                               \
+        pst++; /* next statement */                                 \
+        if(++profile > 0x10000000) /* spike -- was decimal 100000 */ \
+        {                                                           \
+            goto runaway;                                           \
+        }                                                           \
+        if(qcvm->trace)                                             \
+        {                                                           \
+            PR_PrintStatement(&qcvm->statements[pst - base]);       \
+        }                                                           \
+    } while(false)
+
+#define OPA (pst->a)
+#define OPB (pst->b)
+#define OPC (pst->c)
+
+    // make a stack frame
+    const int exitdepth = qcvm->depth;
+
+    pst = &base[PR_EnterFunction(f)];
+    startprofile = profile = 0;
+
+    PR_NEXT();
+
+op_ADD_F:
+    OPC->_float = OPA->_float + OPB->_float;
+    PR_NEXT();
+op_ADD_V:
+    OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
+    OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
+    OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
+    PR_NEXT();
+
+op_SUB_F:
+    OPC->_float = OPA->_float - OPB->_float;
+    PR_NEXT();
+op_SUB_V:
+    OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
+    OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
+    OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
+    PR_NEXT();
+
+op_MUL_F:
+    OPC->_float = OPA->_float * OPB->_float;
+    PR_NEXT();
+op_MUL_V:
+    OPC->_float = OPA->vector[0] * OPB->vector[0] +
+                  OPA->vector[1] * OPB->vector[1] +
+                  OPA->vector[2] * OPB->vector[2];
+    PR_NEXT();
+op_MUL_FV:
+    OPC->vector[0] = OPA->_float * OPB->vector[0];
+    OPC->vector[1] = OPA->_float * OPB->vector[1];
+    OPC->vector[2] = OPA->_float * OPB->vector[2];
+    PR_NEXT();
+op_MUL_VF:
+    OPC->vector[0] = OPB->_float * OPA->vector[0];
+    OPC->vector[1] = OPB->_float * OPA->vector[1];
+    OPC->vector[2] = OPB->_float * OPA->vector[2];
+    PR_NEXT();
+
+op_DIV_F:
+    OPC->_float = OPA->_float / OPB->_float;
+    PR_NEXT();
+
+op_BITAND:
+    OPC->_float = (int)OPA->_float & (int)OPB->_float;
+    PR_NEXT();
+
+op_BITOR:
+    OPC->_float = (int)OPA->_float | (int)OPB->_float;
+    PR_NEXT();
+
+op_GE:
+    OPC->_float = OPA->_float >= OPB->_float;
+    PR_NEXT();
+op_LE:
+    OPC->_float = OPA->_float <= OPB->_float;
+    PR_NEXT();
+op_GT:
+    OPC->_float = OPA->_float > OPB->_float;
+    PR_NEXT();
+op_LT:
+    OPC->_float = OPA->_float < OPB->_float;
+    PR_NEXT();
+op_AND:
+    OPC->_float = OPA->_float && OPB->_float;
+    PR_NEXT();
+op_OR:
+    OPC->_float = OPA->_float || OPB->_float;
+    PR_NEXT();
+
+op_NOT_F:
+    OPC->_float = !OPA->_float;
+    PR_NEXT();
+op_NOT_V:
+    OPC->_float = !OPA->vector[0] && !OPA->vector[1] && !OPA->vector[2];
+    PR_NEXT();
+op_NOT_S:
+    OPC->_float = !OPA->string || !*PR_GetString(OPA->string);
+    PR_NEXT();
+op_NOT_FNC:
+    OPC->_float = !OPA->function;
+    PR_NEXT();
+op_NOT_ENT:
+    OPC->_float = (PROG_TO_EDICT(OPA->edict) == qcvm->edicts);
+    PR_NEXT();
+
+op_EQ_F:
+    OPC->_float = OPA->_float == OPB->_float;
+    PR_NEXT();
+op_EQ_V:
+    OPC->_float = (OPA->vector[0] == OPB->vector[0]) &&
+                  (OPA->vector[1] == OPB->vector[1]) &&
+                  (OPA->vector[2] == OPB->vector[2]);
+    PR_NEXT();
+op_EQ_S:
+    OPC->_float =
+        !strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
+    PR_NEXT();
+op_EQ_E:
+    OPC->_float = OPA->_int == OPB->_int;
+    PR_NEXT();
+op_EQ_FNC:
+    OPC->_float = OPA->function == OPB->function;
+    PR_NEXT();
+
+op_NE_F:
+    OPC->_float = OPA->_float != OPB->_float;
+    PR_NEXT();
+op_NE_V:
+    OPC->_float = (OPA->vector[0] != OPB->vector[0]) ||
+                  (OPA->vector[1] != OPB->vector[1]) ||
+                  (OPA->vector[2] != OPB->vector[2]);
+    PR_NEXT();
+op_NE_S:
+    OPC->_float = strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
+    PR_NEXT();
+op_NE_E:
+    OPC->_float = OPA->_int != OPB->_int;
+    PR_NEXT();
+op_NE_FNC:
+    OPC->_float = OPA->function != OPB->function;
+    PR_NEXT();
+
+op_STORE_F:
+op_STORE_ENT:
+op_STORE_FLD: // integers
+op_STORE_S:
+op_STORE_FNC: // pointers
+    OPB->_int = OPA->_int;
+    PR_NEXT();
+op_STORE_V:
+    OPB->vector[0] = OPA->vector[0];
+    OPB->vector[1] = OPA->vector[1];
+    OPB->vector[2] = OPA->vector[2];
+    PR_NEXT();
+
+op_STOREP_F:
+op_STOREP_ENT:
+op_STOREP_FLD: // integers
+op_STOREP_S:
+op_STOREP_FNC: // pointers
+    ptr = (eval_t*)((byte*)qcvm->edicts + OPB->_int);
+    ptr->_int = OPA->_int;
+    PR_NEXT();
+op_STOREP_V:
+    ptr = (eval_t*)((byte*)qcvm->edicts + OPB->_int);
+    ptr->vector[0] = OPA->vector[0];
+    ptr->vector[1] = OPA->vector[1];
+    ptr->vector[2] = OPA->vector[2];
+    PR_NEXT();
+
+op_ADDRESS:
+    ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+    NUM_FOR_EDICT(ed); // Make sure it's in range
+#endif
+    if(ed == (edict_t*)qcvm->edicts && sv.state == ss_active)
+    {
+        qcvm->xstatement = pst - base;
+        PR_RunError("assignment to world entity");
+    }
+    OPC->_int = (byte*)((int*)&ed->v + OPB->_int) - (byte*)qcvm->edicts;
+    PR_NEXT();
+
+op_LOAD_F:
+op_LOAD_FLD:
+op_LOAD_ENT:
+op_LOAD_S:
+op_LOAD_FNC:
+    ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+    NUM_FOR_EDICT(ed); // Make sure it's in range
+#endif
+    OPC->_int = ((eval_t*)((int*)&ed->v + OPB->_int))->_int;
+    PR_NEXT();
+
+op_LOAD_V:
+    ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+    NUM_FOR_EDICT(ed); // Make sure it's in range
+#endif
+    ptr = (eval_t*)((int*)&ed->v + OPB->_int);
+    OPC->vector[0] = ptr->vector[0];
+    OPC->vector[1] = ptr->vector[1];
+    OPC->vector[2] = ptr->vector[2];
+    PR_NEXT();
+
+op_IFNOT:
+    if(!OPA->_int)
+    {
+        pst += pst->jump - 1; /* -1 to offset the pst++ */
+    }
+    PR_NEXT();
+
+op_IF:
+    if(OPA->_int)
+    {
+        pst += pst->jump - 1; /* -1 to offset the pst++ */
+    }
+    PR_NEXT();
+
+op_GOTO:
+    pst += pst->jump - 1; /* -1 to offset the pst++ */
+    PR_NEXT();
+
+op_CALL0:
+op_CALL1:
+op_CALL2:
+op_CALL3:
+op_CALL4:
+op_CALL5:
+op_CALL6:
+op_CALL7:
+op_CALL8:
+    qcvm->xfunction->profile += profile - startprofile;
+    qcvm->statementsrun += profile - startprofile;
+    startprofile = profile;
+    qcvm->xstatement = pst - base;
+    qcvm->argc = pst->op - OP_CALL0;
+    if(!OPA->function)
+    {
+        PR_RunError("NULL function");
+    }
+    newf = &qcvm->functions[OPA->function];
+    if(newf->first_statement < 0)
+    {
+        // Built-in function
+        int i = -newf->first_statement;
+        if(i >= qcvm->numbuiltins)
+        {
+            i = 0; // just invoke the fixme builtin.
+        }
+        if(pr_profiling)
+        {
+            PR_ProfileEnter(newf);
+            qcvm->builtins[i]();
+            PR_ProfileLeave();
+        }
+        else
+        {
+            qcvm->builtins[i]();
+        }
+        PR_NEXT();
+    }
+    // Normal function
+    pst = &base[PR_EnterFunction(newf)];
+    PR_NEXT();
+
+op_DONE:
+op_RETURN:
+    qcvm->xfunction->profile += profile - startprofile;
+    qcvm->statementsrun += profile - startprofile;
+    startprofile = profile;
+    qcvm->xstatement = pst - base;
+    qcvm->globals[OFS_RETURN] = (&OPA->_float)[0];
+    qcvm->globals[OFS_RETURN + 1] = (&OPA->_float)[1];
+    qcvm->globals[OFS_RETURN + 2] = (&OPA->_float)[2];
+    pst = &base[PR_LeaveFunction()];
+    if(qcvm->depth == exitdepth)
+    {
+        // Done
+        return;
+    }
+    PR_NEXT();
+
+op_STATE:
+    ed = PROG_TO_EDICT(pr_global_struct->self);
+    ed->v.nextthink = pr_global_struct->time + 0.1;
+    ed->v.frame = OPA->_float;
+    ed->v.think = OPB->function;
+    PR_NEXT();
+
+    // superinstructions, see PR_FuseStatements. `cond` is the _int view of
+    // the first statement's result, which is what IF/IFNOT test.
+#define PR_FUSED_BRANCH_HANDLERS(name, result)     \
+    op_##name##_IF:                                 \
+    {                                               \
+        OPC->_float = (result);                     \
+        const int cond = OPC->_int;                 \
+        PR_NEXT_FUSED();                            \
+        if(cond)                                    \
+        {                                           \
+            pst += pst->jump - 1;                   \
+        }                                           \
+        PR_NEXT();                                  \
+    }                                               \
+    op_##name##_IFNOT:                              \
+    {                                               \
+        OPC->_float = (result);                     \
+        const int cond = OPC->_int;                 \
+        PR_NEXT_FUSED();                            \
+        if(!cond)                                   \
+        {                                           \
+            pst += pst->jump - 1;                   \
+        }                                           \
+        PR_NEXT();                                  \
+    }
+
+    PR_FUSED_BRANCH_HANDLERS(EQ_F, OPA->_float == OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(NE_F, OPA->_float != OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(EQ_E, OPA->_int == OPB->_int)
+    PR_FUSED_BRANCH_HANDLERS(NE_E, OPA->_int != OPB->_int)
+    PR_FUSED_BRANCH_HANDLERS(LT, OPA->_float < OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(LE, OPA->_float <= OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(GT, OPA->_float > OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(GE, OPA->_float >= OPB->_float)
+    PR_FUSED_BRANCH_HANDLERS(NOT_F, !OPA->_float)
+    PR_FUSED_BRANCH_HANDLERS(NOT_ENT, PROG_TO_EDICT(OPA->edict) == qcvm->edicts)
+#undef PR_FUSED_BRANCH_HANDLERS
+
+op_LOAD_F_IF:
+op_LOAD_F_IFNOT:
+{
+    ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+    NUM_FOR_EDICT(ed); // Make sure it's in range
+#endif
+    const int cond = ((eval_t*)((int*)&ed->v + OPB->_int))->_int;
+    OPC->_int = cond;
+    const bool taken = pst->op == PROP_LOAD_F_IF ? cond : !cond;
+    PR_NEXT_FUSED();
+    if(taken)
+    {
+        pst += pst->jump - 1;
+    }
+    PR_NEXT();
+}
+
+op_ADDRESS_STOREP:
+op_ADDRESS_STOREP_V:
+{
+    ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+    NUM_FOR_EDICT(ed); // Make sure it's in range
+#endif
+    if(ed == (edict_t*)qcvm->edicts && sv.state == ss_active)
+    {
+        qcvm->xstatement = pst - base;
+        PR_RunError("assignment to world entity");
+    }
+    ptr = (eval_t*)((int*)&ed->v + OPB->_int);
+    OPC->_int = (byte*)ptr - (byte*)qcvm->edicts;
+    const bool vector = pst->op == PROP_ADDRESS_STOREP_V;
+    PR_NEXT_FUSED();
+    if(vector)
+    {
+        ptr->vector[0] = OPA->vector[0];
+        ptr->vector[1] = OPA->vector[1];
+        ptr->vector[2] = OPA->vector[2];
+    }
+    else
+    {
+        ptr->_int = OPA->_int;
+    }
+    PR_NEXT();
+}
+
+op_BAD:
+    qcvm->xstatement = pst - base;
+    PR_RunError("Bad opcode %i", qcvm->statements[pst - base].op);
+
+runaway:
+    qcvm->xstatement = pst - base;
+    PR_RunError("runaway loop error");
+
+#undef PR_NEXT
+#undef PR_NEXT_FUSED
+#undef OPA
+#undef OPB
+#undef OPC
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+/*
+====================
+PR_ExecuteProgram
+====================
+*/
+void PR_ExecuteProgram(func_t fnum)
+{
+    QUAKE_PROFILE_ZONE("QC");
+
+    if(!fnum || fnum >= qcvm->progs->numfunctions)
+    {
+        if(pr_global_struct->self)
+        {
+            ED_Print(PROG_TO_EDICT(pr_global_struct->self));
+        }
+        Host_Error("PR_ExecuteProgram: NULL function");
+    }
+
+    dfunction_t* f = &qcvm->functions[fnum];
+
+    // FIXME: if this is a builtin, then we're going to crash.
+
+    qcvm->trace = false;
+
+#ifdef PR_COMPUTED_GOTO
+    if(pr_threaded.value && qcvm->pstatements && !pr_opstats_active)
+    {
+        PR_ExecuteThreaded(f);
+        return;
+    }
+#endif
+
+    PR_ExecuteSwitch(f);
+}
+
+/*
+============
+PR_Benchmark_f
+
+Runs a server progs function a number of times with each interpreter core.
+The function is called as is, so it should be free of side effects.
+============
+*/
+void PR_Benchmark_f()
+{
+    if(Cmd_Argc() < 2)
+    {
+        Con_Printf("usage: pr_benchmark <function> [iterations]\n");
+        return;
+    }
+
+    if(!sv.active)
+    {
+        return;
+    }
+
+    PR_SwitchQCVM(&sv.qcvm);
+
+    dfunction_t* f = ED_FindFunction(Cmd_Argv(1));
+    if(!f || f->first_statement < 0)
+    {
+        Con_Printf("pr_benchmark: no QC function \"%s\"\n", Cmd_Argv(1));
+        PR_SwitchQCVM(nullptr);
+        return;
+    }
+
+    const int iterations = Cmd_Argc() > 2 ? q_max(1, atoi(Cmd_Argv(2))) : 1000;
+
+    double start = Sys_DoubleTime();
+    for(int i = 0; i < iterations; i++)
+    {
+        qcvm->trace = false;
+        PR_ExecuteSwitch(f);
+    }
+    const double switchtime = Sys_DoubleTime() - start;
+    Con_Printf("switch:   %9.3f ms (%.3f us/call)\n", switchtime * 1000.0,
+        switchtime * 1000000.0 / iterations);
+
+#ifdef PR_COMPUTED_GOTO
+    start = Sys_DoubleTime();
+    for(int i = 0; i < iterations; i++)
+    {
+        qcvm->trace = false;
+        PR_ExecuteThreaded(f);
+    }
+    const double threadedtime = Sys_DoubleTime() - start;
+    Con_Printf("threaded: %9.3f ms (%.3f us/call), %.2fx\n",
+        threadedtime * 1000.0, threadedtime * 1000000.0 / iterations,
+        threadedtime > 0.0 ? switchtime / threadedtime : 0.0);
+#else
+    Con_Printf("threaded: not available in this build\n");
+#endif
+
+    PR_SwitchQCVM(nullptr);
+}
@@ -3255,6 +3255,7 @@ static void PF_fopen()
             if(file)
             {
                 fseek(file, 0, SEEK_END);
+                COM_InvalidateFileIndex(); // so mode 0 can find it
             }
             break;
         case 2: // write
@@ -3271,6 +3272,10 @@ static void PF_fopen()
                 sl++;
             }
             file = fopen(name, "wb");
+            if(file)
+            {
+                COM_InvalidateFileIndex(); // so mode 0 can find it
+            }
             break;
     }
     if(!file)
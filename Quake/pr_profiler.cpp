@@ -0,0 +1,381 @@
+/*
+Copyright (C) 2020-2021 Vittorio Romeo
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "pr_profiler.hpp"
+
+#include "quakedef.hpp"
+#include "cmd.hpp"
+#include "common.hpp"
+#include "console.hpp"
+#include "progs.hpp"
+#include "qcvm.hpp"
+#include "server.hpp"
+#include "sys.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+bool pr_profiling;
+
+// bumped by "pr_profiler start" and "pr_profiler clear", so that every VM
+// drops its data lazily
+static int pr_profilegeneration;
+
+namespace
+{
+
+struct prfuncstats_t
+{
+    unsigned long long calls;
+    unsigned long long statements; // exclusive
+    double inclusive;              // seconds, recursion counted once
+    double exclusive;              // seconds
+    int active;                    // activations currently on the stack
+};
+
+struct prframe_t
+{
+    int func;
+    int node;
+    double start;
+    double childtime;
+    unsigned long long startstatements;
+    unsigned long long childstatements;
+};
+
+// node of the call tree the collapsed stacks are made of
+struct prcallnode_t
+{
+    int parent;
+    int func;
+    double exclusive;
+};
+
+} // namespace
+
+struct prprofiler_t
+{
+    int generation;
+    std::vector<prfuncstats_t> funcs; // indexed like qcvm->functions
+    std::vector<prframe_t> frames;
+    std::vector<prcallnode_t> nodes; // 0 is the root
+    std::unordered_map<std::uint64_t, int> children; // (parent, func) -> node
+};
+
+/*
+===============
+PR_GetProfiler
+===============
+*/
+static prprofiler_t* PR_GetProfiler()
+{
+    prprofiler_t* p = qcvm->profiler;
+    if(p && p->generation == pr_profilegeneration)
+    {
+        return p;
+    }
+
+    if(!p)
+    {
+        p = qcvm->profiler = new prprofiler_t;
+    }
+
+    p->generation = pr_profilegeneration;
+    p->funcs.assign(qcvm->progs->numfunctions, prfuncstats_t{});
+    p->frames.clear();
+    p->nodes.assign(1, prcallnode_t{-1, -1, 0.0});
+    p->children.clear();
+
+    return p;
+}
+
+/*
+===============
+PR_ProfileNode
+===============
+*/
+static int PR_ProfileNode(prprofiler_t* p, int parent, int func)
+{
+    const std::uint64_t key =
+        (static_cast<std::uint64_t>(parent) << 32) |
+        static_cast<std::uint32_t>(func);
+
+    const auto [it, inserted] =
+        p->children.try_emplace(key, static_cast<int>(p->nodes.size()));
+    if(inserted)
+    {
+        p->nodes.push_back({parent, func, 0.0});
+    }
+
+    return it->second;
+}
+
+/*
+===============
+PR_ProfileEnter
+===============
+*/
+void PR_ProfileEnter(dfunction_t* f)
+{
+    prprofiler_t* p = PR_GetProfiler();
+    const int func = f - qcvm->functions;
+
+    // a new outermost call: drop whatever an aborted run (PR_RunError)
+    // left on the stack
+    if(qcvm->depth == 1 && f->first_statement >= 0)
+    {
+        for(const prframe_t& fr : p->frames)
+        {
+            p->funcs[fr.func].active--;
+        }
+        p->frames.clear();
+    }
+
+    const int parent = p->frames.empty() ? 0 : p->frames.back().node;
+
+    prfuncstats_t& fs = p->funcs[func];
+    fs.calls++;
+    fs.active++;
+
+    p->frames.push_back({func, PR_ProfileNode(p, parent, func),
+        Sys_DoubleTime(), 0.0, qcvm->statementsrun, 0});
+}
+
+/*
+===============
+PR_ProfileLeave
+===============
+*/
+void PR_ProfileLeave()
+{
+    prprofiler_t* p = qcvm->profiler;
+    if(!p || p->generation != pr_profilegeneration || p->frames.empty())
+    {
+        return; // entered before profiling started
+    }
+
+    const prframe_t fr = p->frames.back();
+    p->frames.pop_back();
+
+    const double inclusive = Sys_DoubleTime() - fr.start;
+    const unsigned long long statements =
+        qcvm->statementsrun - fr.startstatements;
+
+    prfuncstats_t& fs = p->funcs[fr.func];
+    if(--fs.active == 0)
+    {
+        fs.inclusive += inclusive;
+    }
+    fs.exclusive += inclusive - fr.childtime;
+    fs.statements += statements - fr.childstatements;
+
+    p->nodes[fr.node].exclusive += inclusive - fr.childtime;
+
+    if(!p->frames.empty())
+    {
+        p->frames.back().childtime += inclusive;
+        p->frames.back().childstatements += statements;
+    }
+}
+
+/*
+===============
+PR_FreeProfiler
+===============
+*/
+void PR_FreeProfiler(qcvm_t* vm)
+{
+    delete vm->profiler;
+    vm->profiler = nullptr;
+}
+
+/*
+===============
+PR_ProfileFunctionName
+===============
+*/
+static const char* PR_ProfileFunctionName(int func)
+{
+    const dfunction_t* f = &qcvm->functions[func];
+    return f->first_statement < 0 ? va("#%s", PR_GetString(f->s_name))
+                                  : PR_GetString(f->s_name);
+}
+
+/*
+===============
+PR_ProfileDump
+===============
+*/
+static void PR_ProfileDump(const prprofiler_t* p, int count)
+{
+    std::vector<int> order;
+    double total = 0.0;
+
+    for(int i = 0; i < (int)p->funcs.size(); i++)
+    {
+        if(p->funcs[i].calls)
+        {
+            order.push_back(i);
+            total += p->funcs[i].exclusive;
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return p->funcs[a].exclusive > p->funcs[b].exclusive;
+    });
+
+    Con_Printf("%10s %12s %10s %10s  %s\n", "calls", "statements",
+        "incl ms", "excl ms", "function (#builtin)");
+
+    for(int i = 0; i < (int)order.size() && i < count; i++)
+    {
+        const prfuncstats_t& fs = p->funcs[order[i]];
+        Con_Printf("%10llu %12llu %10.2f %10.2f  %s\n", fs.calls,
+            fs.statements, fs.inclusive * 1000.0, fs.exclusive * 1000.0,
+            PR_ProfileFunctionName(order[i]));
+    }
+
+    Con_Printf("%d functions, %.2f ms total\n", (int)order.size(),
+        total * 1000.0);
+}
+
+/*
+===============
+PR_ProfileWriteFlamegraph
+
+One "outer;inner;leaf microseconds" line per call path, the collapsed stack
+format flamegraph.pl and speedscope read.
+===============
+*/
+static void PR_ProfileWriteFlamegraph(const prprofiler_t* p, const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if(!f)
+    {
+        Con_Printf("ERROR: couldn't open %s\n", path);
+        return;
+    }
+
+    std::vector<const char*> names;
+    int lines = 0;
+
+    for(const prcallnode_t& node : p->nodes)
+    {
+        const long long us = static_cast<long long>(node.exclusive * 1e6);
+        if(node.func < 0 || us <= 0)
+        {
+            continue;
+        }
+
+        names.clear();
+        for(const prcallnode_t* n = &node; n->func >= 0;
+            n = &p->nodes[n->parent])
+        {
+            names.push_back(PR_GetString(qcvm->functions[n->func].s_name));
+        }
+
+        for(auto it = names.rbegin(); it != names.rend(); ++it)
+        {
+            fprintf(f, it == names.rbegin() ? "%s" : ";%s", *it);
+        }
+        fprintf(f, " %lld\n", us);
+        lines++;
+    }
+
+    fclose(f);
+    Con_Printf("Wrote %d stacks to %s\n", lines, path);
+}
+
+/*
+===============
+PR_Profiler_f
+===============
+*/
+void PR_Profiler_f()
+{
+    const char* cmd = Cmd_Argc() > 1 ? Cmd_Argv(1) : "";
+
+    if(!strcmp(cmd, "start"))
+    {
+        pr_profilegeneration++;
+        pr_profiling = true;
+        return;
+    }
+
+    if(!strcmp(cmd, "stop"))
+    {
+        pr_profiling = false;
+        return;
+    }
+
+    if(!strcmp(cmd, "clear"))
+    {
+        pr_profilegeneration++;
+        return;
+    }
+
+    const bool flamegraph = !strcmp(cmd, "flamegraph");
+    if(!flamegraph && *cmd && !isdigit(*cmd))
+    {
+        Con_Printf(
+            "usage: pr_profiler [start | stop | clear | <count> | flamegraph "
+            "<file>]\n");
+        return;
+    }
+
+    if(!sv.active)
+    {
+        return;
+    }
+
+    PR_SwitchQCVM(&sv.qcvm);
+
+    const prprofiler_t* p = qcvm->profiler;
+    if(!p || p->generation != pr_profilegeneration)
+    {
+        Con_Printf("no profile recorded%s\n",
+            pr_profiling ? "" : ", use \"pr_profiler start\"");
+    }
+    else if(flamegraph)
+    {
+        const char* filename = Cmd_Argc() > 2 ? Cmd_Argv(2) : "qcprofile.txt";
+        if(strstr(filename, ".."))
+        {
+            Con_Printf("Relative pathnames are not allowed.\n");
+        }
+        else
+        {
+            char path[MAX_OSPATH];
+            q_snprintf(path, sizeof(path), "%s/%s", com_gamedir, filename);
+            PR_ProfileWriteFlamegraph(p, path);
+        }
+    }
+    else
+    {
+        PR_ProfileDump(p, *cmd ? atoi(cmd) : 20);
+    }
+
+    PR_SwitchQCVM(nullptr);
+}
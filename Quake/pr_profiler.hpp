@@ -0,0 +1,17 @@
+#pragma once
+
+struct dfunction_t;
+struct qcvm_t;
+
+// Instrumenting profiler for QC functions and builtins. The interpreter only
+// calls the hooks while `pr_profiling` is set, so it costs a branch per call
+// when disabled.
+
+extern bool pr_profiling;
+
+// Called when `f`, a QC function or a builtin, starts and stops running.
+void PR_ProfileEnter(dfunction_t* f);
+void PR_ProfileLeave();
+
+void PR_FreeProfiler(qcvm_t* vm);
+void PR_Profiler_f();
@@ -0,0 +1,390 @@
+/*
+Copyright (C) 2020-2021 Vittorio Romeo
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "profiler.hpp"
+
+#include "quakedef.hpp"
+#include "cmd.hpp"
+#include "common.hpp"
+#include "console.hpp"
+#include "cvar.hpp"
+#include "sys.hpp"
+#include "json.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern cvar_t host_speeds;
+
+cvar_t host_profile = {"host_profile", "0", CVAR_NONE};
+
+namespace quake::profiler
+{
+
+bool enabled;
+
+namespace
+{
+
+using usec = std::int64_t;
+
+// how many frames the percentiles and the trace export cover
+constexpr int maxFrames = 256;
+
+// zones past this are still added to the totals, but not to the trace
+constexpr std::size_t maxEventsPerFrame = 8192;
+
+constexpr std::size_t noEvent = static_cast<std::size_t>(-1);
+
+struct Event
+{
+    int zone;
+    int depth;
+    usec start;
+    usec duration;
+};
+
+struct Frame
+{
+    int number;
+    usec start;
+    usec duration;
+    std::vector<Event> events;
+    std::vector<usec> totals; // per zone, recursion counted once
+    std::vector<int> calls;   // per zone
+};
+
+struct OpenZone
+{
+    int zone;
+    usec start;
+    std::size_t event; // index in `current.events`, or `noEvent`
+};
+
+std::vector<const char*> zoneNames;
+std::vector<int> zoneDepth; // open instances of each zone
+
+Frame current;
+std::vector<OpenZone> openZones;
+
+std::vector<Frame> frames; // ring buffer
+int frameHead;             // next slot to write
+int frameCount;
+int frameNumber;
+
+[[nodiscard]] usec now() noexcept
+{
+    return static_cast<usec>(Sys_DoubleTime() * 1e6);
+}
+
+[[nodiscard]] const Frame& nthFrame(const int i) noexcept
+{
+    // oldest first
+    return frames[(frameHead - frameCount + i + maxFrames) % maxFrames];
+}
+
+[[nodiscard]] usec zoneTotal(const Frame& frame, const int zone) noexcept
+{
+    return zone < static_cast<int>(frame.totals.size()) ? frame.totals[zone]
+                                                         : 0;
+}
+
+[[nodiscard]] usec percentile(std::vector<usec>& values, const int p)
+{
+    const std::size_t n =
+        std::min(values.size() - 1, values.size() * p / 100);
+    std::nth_element(values.begin(), values.begin() + n, values.end());
+    return values[n];
+}
+
+void printHostSpeeds(const Frame& frame)
+{
+    static const int gfxZones[] = {registerZone("SCR_UpdateScreen"),
+        registerZone("CL_RunParticles")};
+    static const int sndZone = registerZone("S_Update");
+
+    usec gfx = 0;
+    for(const int zone : gfxZones)
+    {
+        gfx += zoneTotal(frame, zone);
+    }
+
+    const usec snd = zoneTotal(frame, sndZone);
+    const usec server = frame.duration - gfx - snd;
+
+    Con_Printf("%6.2f tot %6.2f server %6.2f gfx %6.2f snd\n",
+        frame.duration / 1000.0, server / 1000.0, gfx / 1000.0, snd / 1000.0);
+}
+
+/*
+===============
+Host_ProfileDump_f
+===============
+*/
+void Host_ProfileDump_f()
+{
+    if(!frameCount)
+    {
+        Con_Printf("no frames recorded, set host_profile 1\n");
+        return;
+    }
+
+    struct Row
+    {
+        const char* name;
+        double calls;
+        usec p50, p99, max;
+    };
+
+    std::vector<Row> rows;
+    std::vector<usec> values(frameCount);
+
+    const auto addRow = [&](const char* name, const double calls) {
+        const usec max = *std::max_element(values.begin(), values.end());
+        const usec p50 = percentile(values, 50);
+        const usec p99 = percentile(values, 99);
+        rows.push_back({name, calls, p50, p99, max});
+    };
+
+    for(int i = 0; i < frameCount; i++)
+    {
+        values[i] = nthFrame(i).duration;
+    }
+    addRow("frame", 1.0);
+
+    for(int zone = 0; zone < static_cast<int>(zoneNames.size()); zone++)
+    {
+        long long calls = 0;
+        for(int i = 0; i < frameCount; i++)
+        {
+            const Frame& frame = nthFrame(i);
+            values[i] = zoneTotal(frame, zone);
+            if(zone < static_cast<int>(frame.calls.size()))
+            {
+                calls += frame.calls[zone];
+            }
+        }
+
+        if(calls)
+        {
+            addRow(zoneNames[zone], static_cast<double>(calls) / frameCount);
+        }
+    }
+
+    std::sort(rows.begin() + 1, rows.end(),
+        [](const Row& a, const Row& b) { return a.p99 > b.p99; });
+
+    Con_Printf("%-24s %8s %9s %9s %9s\n", "zone (last frames, us)",
+        "calls/f", "p50", "p99", "max");
+    for(const Row& row : rows)
+    {
+        Con_Printf("%-24s %8.2f %9lld %9lld %9lld\n", row.name, row.calls,
+            (long long)row.p50, (long long)row.p99, (long long)row.max);
+    }
+    Con_Printf("%d frames\n", frameCount);
+}
+
+/*
+===============
+Host_ProfileTrace_f
+
+Writes the recorded frames in the Chrome trace event format, for
+chrome://tracing, Perfetto or speedscope.
+===============
+*/
+void Host_ProfileTrace_f()
+{
+    if(!frameCount)
+    {
+        Con_Printf("no frames recorded, set host_profile 1\n");
+        return;
+    }
+
+    const char* filename = Cmd_Argc() > 1 ? Cmd_Argv(1) : "frametrace.json";
+    if(strstr(filename, ".."))
+    {
+        Con_Printf("Relative pathnames are not allowed.\n");
+        return;
+    }
+
+    using nlohmann::json;
+
+    json events = json::array();
+    for(int i = 0; i < frameCount; i++)
+    {
+        const Frame& frame = nthFrame(i);
+
+        events.push_back({{"name", "frame"}, {"ph", "X"}, {"pid", 0},
+            {"tid", 0}, {"ts", frame.start}, {"dur", frame.duration},
+            {"args", {{"frame", frame.number}}}});
+
+        for(const Event& e : frame.events)
+        {
+            events.push_back({{"name", zoneNames[e.zone]}, {"ph", "X"},
+                {"pid", 0}, {"tid", 0}, {"ts", e.start},
+                {"dur", e.duration}});
+        }
+    }
+
+    const json trace = {
+        {"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}};
+    const std::string text = trace.dump();
+
+    char path[MAX_OSPATH];
+    q_snprintf(path, sizeof(path), "%s/%s", com_gamedir, filename);
+
+    FILE* f = fopen(path, "w");
+    if(!f)
+    {
+        Con_Printf("ERROR: couldn't open %s\n", path);
+        return;
+    }
+
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+
+    Con_Printf("Wrote %d frames to %s\n", frameCount, path);
+}
+
+} // namespace
+
+void init()
+{
+    Cvar_RegisterVariable(&host_profile);
+    Cmd_AddCommand("host_profile_dump", Host_ProfileDump_f);
+    Cmd_AddCommand("host_profile_trace", Host_ProfileTrace_f);
+
+    frames.resize(maxFrames);
+}
+
+int registerZone(const char* name)
+{
+    for(int i = 0; i < static_cast<int>(zoneNames.size()); i++)
+    {
+        if(!strcmp(zoneNames[i], name))
+        {
+            return i;
+        }
+    }
+
+    zoneNames.push_back(name);
+    zoneDepth.push_back(0);
+    return static_cast<int>(zoneNames.size()) - 1;
+}
+
+void beginZone(const int zone)
+{
+    if(zone >= static_cast<int>(current.totals.size()))
+    {
+        current.totals.resize(zoneNames.size());
+        current.calls.resize(zoneNames.size());
+    }
+
+    const usec start = now();
+
+    std::size_t event = noEvent;
+    if(current.events.size() < maxEventsPerFrame)
+    {
+        event = current.events.size();
+        current.events.push_back(
+            {zone, static_cast<int>(openZones.size()), start, 0});
+    }
+
+    openZones.push_back({zone, start, event});
+    zoneDepth[zone]++;
+    current.calls[zone]++;
+}
+
+void endZone()
+{
+    if(openZones.empty())
+    {
+        return;
+    }
+
+    const OpenZone z = openZones.back();
+    openZones.pop_back();
+
+    const usec duration = now() - z.start;
+    if(z.event != noEvent)
+    {
+        current.events[z.event].duration = duration;
+    }
+
+    if(--zoneDepth[z.zone] == 0)
+    {
+        current.totals[z.zone] += duration;
+    }
+}
+
+void beginFrame()
+{
+    enabled = host_profile.value || host_speeds.value;
+    if(!enabled)
+    {
+        return;
+    }
+
+    current.start = now();
+    current.events.clear();
+    current.totals.assign(zoneNames.size(), 0);
+    current.calls.assign(zoneNames.size(), 0);
+}
+
+void endFrame(const bool keep)
+{
+    if(!enabled)
+    {
+        return;
+    }
+
+    // zones skipped by a longjmp out of Host_Error are closed here
+    while(!openZones.empty())
+    {
+        endZone();
+    }
+
+    enabled = false;
+
+    if(!keep || frames.empty())
+    {
+        return;
+    }
+
+    current.number = frameNumber++;
+    current.duration = now() - current.start;
+
+    if(host_speeds.value)
+    {
+        printHostSpeeds(current);
+    }
+
+    // swap rather than copy so the slot's vectors are reused next frame
+    std::swap(frames[frameHead], current);
+    frameHead = (frameHead + 1) % maxFrames;
+    frameCount = std::min(frameCount + 1, maxFrames);
+}
+
+} // namespace quake::profiler
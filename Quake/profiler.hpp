@@ -0,0 +1,60 @@
+#pragma once
+
+// Scoped-zone frame profiler. Zones nest, are timed in microseconds and are
+// kept for the last few hundred host frames, which is what the percentiles,
+// the console dump and the Chrome trace export work from. Zones must only be
+// opened on the main thread; when profiling is off a zone costs one branch.
+
+namespace quake::profiler
+{
+
+// Set at the start of a host frame from `host_profile` and `host_speeds`.
+extern bool enabled;
+
+void init();
+
+// Returns a stable id for `name`, which must outlive the profiler (a string
+// literal). Registering the same name twice yields the same id.
+[[nodiscard]] int registerZone(const char* name);
+
+void beginZone(const int zone);
+void endZone();
+
+// Bracket one call of `_Host_Frame`. Frames that did not run (e.g. throttled
+// by `Host_FilterTime`) are dropped by passing `false` to `endFrame`.
+void beginFrame();
+void endFrame(const bool keep);
+
+class ScopedZone
+{
+private:
+    bool _active;
+
+public:
+    explicit ScopedZone(const int zone) noexcept : _active{enabled}
+    {
+        if(_active)
+        {
+            beginZone(zone);
+        }
+    }
+
+    ~ScopedZone()
+    {
+        if(_active)
+        {
+            endZone();
+        }
+    }
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+};
+
+} // namespace quake::profiler
+
+// Times the rest of the enclosing scope as zone `name`.
+#define QUAKE_PROFILE_ZONE(name)                                              \
+    static const int quakeProfileZoneId =                                     \
+        ::quake::profiler::registerZone(name);                                \
+    const ::quake::profiler::ScopedZone quakeProfileZone{quakeProfileZoneId}
@@ -31,6 +31,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sizebuf.hpp"
 #include "protocol.hpp"
 
+#include <string>
+#include <vector>
+
 union eval_t
 {
     string_t string;
@@ -80,15 +83,36 @@ int PR_AllocString(int bufferlength, char** ptr);
 void PR_ClearEngineString(int num);
 
 void PR_Profile_f();
+void PR_Benchmark_f();
+void PR_OpStats_f();
+void PR_PredecodeStatements();
 
 edict_t* ED_Alloc();
 void ED_Free(edict_t* ed);
+void ED_RebuildFreeList();
+
+// QC state of a savegame, copied out of the VM so that it can be written
+// without touching it
+struct edsnapshot_t
+{
+    struct pair_t
+    {
+        int key;  // offset of the name in strings
+        int type; // etype_t
+        eval_t value; // string, function and field values are offsets too
+    };
+
+    std::string strings;
+    std::vector<pair_t> globals;
+    std::vector<pair_t> pairs;
+    std::vector<int> edicts; // number of pairs of each edict
+};
 
 void ED_Print(edict_t* ed);
-void ED_Write(FILE* f, edict_t* ed);
+void ED_SnapshotSave(edsnapshot_t& snap);
+void ED_WriteSnapshot(FILE* f, const edsnapshot_t& snap);
 const char* ED_ParseEdict(const char* data, edict_t* ent);
 
-void ED_WriteGlobals(FILE* f);
 const char* ED_ParseGlobals(const char* data);
 
 void ED_LoadFromFile(const char* data);
@@ -151,6 +175,8 @@ struct edict_t;
 
 extern cvar_t pr_checkextension; // if 0, extensions are disabled (unless they'd
                                  // be fatal, but they're still spammy)
+extern cvar_t pr_threaded; // use the predecoded computed-goto interpreter
+extern cvar_t pr_fuse;     // fuse common statement pairs when loading progs
 
 #define CSIE_KEYDOWN 0
 #define CSIE_KEYUP 1
@@ -50,6 +50,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
     (('F' << 0) + ('T' << 8) + ('E' << 16) + \
         ('2' << 24)) // fte extensions, provides extensions to the underlying
                      // base protocol (like 666 or even 15).
+#define PROTOCOL_QUAKEVR_PEXT                \
+    (('Q' << 0) + ('V' << 8) + ('R' << 16) + \
+        ('X' << 24)) // our own extensions to PROTOCOL_QUAKEVR
 
 #define PROTOCOL_QUAKEVR 8682
 
@@ -110,6 +113,22 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define PEXT2_SUPPORTED_SERVER \
     (PEXT2_VOICECHAT | PEXT2_REPLACEMENTDELTAS | PEXT2_PREDINFO)
 
+// PROTOCOL_QUAKEVR_PEXT flags, negotiated through 'cmd pext' like the fte ones
+#define PEXTQVR_ACKDELTAS \
+    0x00000001 // svc_time starts a numbered frame, acked with clcdp_ackframe,
+               // and U_ACKED updates delta from the client's copy of an
+               // acked frame instead of the baseline
+#define PEXTQVR_PACKED \
+    0x00000002 // U_ACKED updates send origins and angles as bit-packed
+               // deltas on the MSG_PackCoord/MSG_PackAngle grids, after the
+               // rest of the update. needs PEXTQVR_ACKDELTAS
+#define PEXTQVR_SUPPORTED_CLIENT (PEXTQVR_ACKDELTAS | PEXTQVR_PACKED)
+#define PEXTQVR_SUPPORTED_SERVER (PEXTQVR_ACKDELTAS | PEXTQVR_PACKED)
+
+// PEXTQVR_PACKED field widths, see MSG_WriteVarBits
+inline constexpr int PACKED_COORD_WIDTHS[4] = {4, 8, 12, 24};
+inline constexpr int PACKED_ANGLE_WIDTHS[4] = {3, 6, 10, 16};
+
 
 // if the high bit of the servercmd is set, the low bits are fast update flags:
 #define U_MOREBITS (1 << 0)
@@ -144,7 +163,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
     (1 << 20) // 1 byte, for PROTOCOL_RMQ PRFL_EDICTSCALE, currently read but
               // ignored
 #define U_MODELOFFSET (1 << 21)
-#define U_UNUSED22 (1 << 22)
+#define U_ACKED \
+    (1 << 22) // PEXTQVR_ACKDELTAS, fields that aren't sent come from the acked
+              // frame named by svc_time rather than from the baseline
 #define U_EXTEND2 (1 << 23) // another byte to follow, future expansion
 // johnfitz
 
@@ -31,6 +31,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef_macros.hpp"
 #include "cvar.hpp"
 
+#include <string>
+#include <vector>
+
 /* !!! if this is changed, it must be changed in asm_i386.h too !!! */
 typedef struct
 {
@@ -52,6 +55,7 @@ typedef struct
     int speed;
     int width;
     int stereo;
+    int streamed; /* decoded on demand, data holds no samples	*/
     byte data[1]; /* variable sized	*/
 } sfxcache_t;
 
@@ -114,6 +118,8 @@ void S_UnblockSound();
 
 sfx_t* S_PrecacheSound(const char* sample);
 void S_TouchSound(const char* sample);
+bool S_NeedsLoad(const char* sample);
+void S_PredecodeSounds(const std::vector<std::string>& samples);
 void S_PaintChannels(int endtime);
 void S_InitPaintChannels();
 
@@ -185,6 +191,7 @@ extern cvar_t snd_mixspeed;
 extern cvar_t snd_filterquality;
 extern cvar_t sfxvolume;
 extern cvar_t loadas8bit;
+extern cvar_t snd_streamsize;
 
 #define MAX_RAW_SAMPLES 8192
 extern portable_samplepair_t s_rawsamples[MAX_RAW_SAMPLES];
@@ -194,6 +201,12 @@ extern cvar_t bgmvolume;
 void S_LocalSound(const char* name);
 sfxcache_t* S_LoadSound(sfx_t* s);
 
+/* returns the samples of a streamed sfx from ch->pos on, at least count */
+byte* S_StreamSamples(channel_t* ch, sfxcache_t* sc, int count);
+/* closes the streams of channels that no longer play them */
+void S_UpdateSfxStreams();
+void S_CloseSfxStreams();
+
 wavinfo_t GetWavinfo(const char* name, byte* wav, int wavlength);
 
 void SND_InitScaletable();
@@ -4,11 +4,22 @@
 #include "areanode.hpp"
 #include "edict.hpp"
 
+// entry of the queue of freed edicts, in the order they were freed
+struct freeedict_t
+{
+    int num;
+    float freetime; // stale if it no longer matches the edict's freetime
+};
+
+struct prstatement_t; // predecoded dstatement_t, see PR_PredecodeStatements
+struct prprofiler_t;  // see pr_profiler.cpp
+
 struct qcvm_t
 {
     dprograms_t* progs;
     dfunction_t* functions;
     dstatement_t* statements;
+    prstatement_t* pstatements; // parallel to statements, malloced
     float* globals;    /* same as pr_global_struct */
     ddef_t* fielddefs; // yay reflection.
 
@@ -22,6 +33,9 @@ struct qcvm_t
     bool trace;
     dfunction_t* xfunction;
     int xstatement;
+    unsigned long long statementsrun; // counted at calls and returns
+
+    prprofiler_t* profiler; // created on demand by PR_ProfileEnter
 
     unsigned short crc;
 
@@ -35,7 +49,10 @@ struct qcvm_t
     const char** knownstrings;
     int maxknownstrings;
     int numknownstrings;
-    int freeknownstrings;
+    int* freeknownstrings; // stack of cleared slots below numknownstrings
+    int numfreeknownstrings;
+    int* knownstringshash; // open addressing, pointer -> slot + 1 (0 = empty)
+    int knownstringshashsize;
     ddef_t* globaldefs;
 
     unsigned char* knownzone;
@@ -62,6 +79,11 @@ struct qcvm_t
     struct qmodel_t* (*GetModel)(
         int modelindex); // returns the model for the given index, or null.
 
+    // ring buffer of max_edicts entries, see ED_Alloc
+    freeedict_t* freeedicts;
+    int freeedicts_head;
+    int freeedicts_count;
+
     // originally from world.c
     areanode_t areanodes[AREA_NODES];
     int numareanodes;
@@ -44,8 +44,7 @@ int lightmap_bytes;
 #define MAX_SANITY_LIGHTMAPS (1u << 20)
 struct lightmap_s* lightmap;
 int lightmap_count;
-int last_lightmap_allocated;
-int allocated[LMBLOCK_WIDTH];
+static lmalloc_t lightmap_alloc;
 
 unsigned blocklights[LMBLOCK_WIDTH * LMBLOCK_HEIGHT *
                      3]; // johnfitz -- was 18*18, added lit support (*3) and
@@ -809,10 +808,10 @@ void R_RenderDynamicLightmaps(qmodel_t* model, msurface_t* fa)
 
 /*
 ========================
-AllocBlock -- returns a texture number and the position inside it
+GL_PackLightmapBlock -- returns a lightmap number and the position inside it
 ========================
 */
-int AllocBlock(int w, int h, int* x, int* y)
+static int GL_PackLightmapBlock(lmalloc_t& state, int w, int h, int* x, int* y)
 {
     int i;
     int j;
@@ -825,23 +824,15 @@ int AllocBlock(int w, int h, int* x, int* y)
     // 3+ seconds of load time on a level with 180 lightmaps), at a cost
     // of not quite packing lightmaps as tightly vs. not doing this
     // (uses ~5% more lightmaps)
-    for(decltype(MAX_SANITY_LIGHTMAPS) texnum = last_lightmap_allocated;
+    for(decltype(MAX_SANITY_LIGHTMAPS) texnum = state.last;
         texnum < MAX_SANITY_LIGHTMAPS; texnum++)
     {
-        if(texnum == static_cast<GLuint>(lightmap_count))
+        if(texnum == static_cast<GLuint>(state.count))
         {
-            lightmap_count++;
-            lightmap = (struct lightmap_s*)realloc(
-                lightmap, sizeof(*lightmap) * lightmap_count);
-            memset(&lightmap[texnum], 0, sizeof(lightmap[texnum]));
-            /* FIXME: we leave 'gaps' in malloc()ed data,  CRC_Block()
-             * later accesses that uninitialized data and valgrind
-             * complains for it. use calloc() ? */
-            lightmap[texnum].data =
-                (byte*)malloc(4 * LMBLOCK_WIDTH * LMBLOCK_HEIGHT);
+            state.count++;
             // as we're only tracking one texture, we don't need
             // multiple copies of allocated any more.
-            memset(allocated, 0, sizeof(allocated));
+            memset(state.allocated, 0, sizeof(state.allocated));
         }
         best = LMBLOCK_HEIGHT;
 
@@ -851,13 +842,13 @@ int AllocBlock(int w, int h, int* x, int* y)
 
             for(j = 0; j < w; j++)
             {
-                if(allocated[i + j] >= best)
+                if(state.allocated[i + j] >= best)
                 {
                     break;
                 }
-                if(allocated[i + j] > best2)
+                if(state.allocated[i + j] > best2)
                 {
-                    best2 = allocated[i + j];
+                    best2 = state.allocated[i + j];
                 }
             }
             if(j == w)
@@ -875,17 +866,68 @@ int AllocBlock(int w, int h, int* x, int* y)
 
         for(i = 0; i < w; i++)
         {
-            allocated[*x + i] = best + h;
+            state.allocated[*x + i] = best + h;
         }
 
-        last_lightmap_allocated = texnum;
+        state.last = texnum;
         return texnum;
     }
 
-    Sys_Error("AllocBlock: full");
+    Sys_Error("GL_PackLightmapBlock: full");
     return 0; // johnfitz -- shut up compiler
 }
 
+/*
+========================
+GL_PackLightmaps -- places every lightmapped surface of the model
+
+Only decides where the lightmaps go, so it doesn't need a GL context.
+========================
+*/
+void GL_PackLightmaps(qmodel_t* model, lmalloc_t& state)
+{
+    for(int i = 0; i < model->numsurfaces; i++)
+    {
+        msurface_t* surf = &model->surfaces[i];
+
+        // johnfitz -- rewritten to use SURF_DRAWTILED instead of
+        // the sky/water flags
+        if(surf->flags & SURF_DRAWTILED)
+        {
+            continue;
+        }
+
+        const int smax = (surf->extents[0] >> surf->lmshift) + 1;
+        const int tmax = (surf->extents[1] >> surf->lmshift) + 1;
+        surf->lightmaptexturenum = GL_PackLightmapBlock(
+            state, smax, tmax, &surf->light_s, &surf->light_t);
+    }
+}
+
+/*
+========================
+GL_AllocLightmaps -- grows the lightmap array to `count` blank lightmaps
+========================
+*/
+static void GL_AllocLightmaps(int count)
+{
+    if(count <= lightmap_count)
+    {
+        return;
+    }
+
+    lightmap =
+        (struct lightmap_s*)realloc(lightmap, sizeof(*lightmap) * count);
+    for(int i = lightmap_count; i < count; i++)
+    {
+        memset(&lightmap[i], 0, sizeof(lightmap[i]));
+        /* FIXME: we leave 'gaps' in malloc()ed data,  CRC_Block()
+         * later accesses that uninitialized data and valgrind
+         * complains for it. use calloc() ? */
+        lightmap[i].data = (byte*)malloc(4 * LMBLOCK_WIDTH * LMBLOCK_HEIGHT);
+    }
+    lightmap_count = count;
+}
 
 mvertex_t* r_pcurrentvertbase;
 qmodel_t* currentmodel;
@@ -899,15 +941,8 @@ GL_CreateSurfaceLightmap
 */
 void GL_CreateSurfaceLightmap(qmodel_t* model, msurface_t* surf)
 {
-    int smax;
-    int tmax;
     byte* base;
 
-    smax = (surf->extents[0] >> surf->lmshift) + 1;
-    tmax = (surf->extents[1] >> surf->lmshift) + 1;
-
-    surf->lightmaptexturenum =
-        AllocBlock(smax, tmax, &surf->light_s, &surf->light_t);
     base = lightmap[surf->lightmaptexturenum].data;
     base += (surf->light_t * LMBLOCK_WIDTH + surf->light_s) * lightmap_bytes;
     R_BuildLightMap(model, surf, base, LMBLOCK_WIDTH * lightmap_bytes);
@@ -1018,8 +1053,8 @@ void GL_BuildLightmaps()
     }
     free(lightmap);
     lightmap = nullptr;
-    last_lightmap_allocated = 0;
     lightmap_count = 0;
+    memset(&lightmap_alloc, 0, sizeof(lightmap_alloc));
 
     gl_lightmap_format = GL_RGBA; // FIXME: hardcoded for now!
 
@@ -1043,6 +1078,19 @@ void GL_BuildLightmaps()
         }
         r_pcurrentvertbase = m->vertexes;
         currentmodel = m;
+
+        // the first model's layout may have come with it, see
+        // Mod_LoadSidecar
+        if(!lightmap_alloc.count && m->lightmaplayout)
+        {
+            lightmap_alloc = *m->lightmaplayout;
+        }
+        else
+        {
+            GL_PackLightmaps(m, lightmap_alloc);
+        }
+        GL_AllocLightmaps(lightmap_alloc.count);
+
         for(i = 0; i < m->numsurfaces; i++)
         {
             // johnfitz -- rewritten to use SURF_DRAWTILED instead of
@@ -37,6 +37,7 @@ Foundation, Inc., 59 Temple Place - Suite 430, Boston, MA  02111-1307, USA.
 #include "zone.hpp"
 #include "client.hpp"
 #include "gl_texmgr.hpp"
+#include "profiler.hpp"
 
 
 #include <algorithm>
@@ -2045,6 +2046,8 @@ R_DrawParticles
 */
 void CL_RunParticles()
 {
+    QUAKE_PROFILE_ZONE("CL_RunParticles");
+
     if(!r_particles.value)
     {
         return;
@@ -201,14 +201,8 @@ void doAutosave() noexcept
     char name[64];
     q_snprintf(name, sizeof(name), "auto%d", idx);
 
-    if(Host_MakeSavegame(name, &now, vr_autosave_show_message.value))
-    {
-        if(vr_autosave_show_message.value)
-        {
-            Con_Printf("Successfully created autosave.\n");
-        }
-    }
-    else
+    // written in the background, Host_PollSavegame reports when it's done
+    if(!Host_MakeSavegame(name, &now, vr_autosave_show_message.value, true))
     {
         if(vr_autosave_show_message.value)
         {
@@ -35,6 +35,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "modeleffects.hpp"
 #include "serverdefines.hpp"
 
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 struct qmodel_t;
@@ -81,6 +83,7 @@ struct server_t
     char name[64];      // map name
     char modelname[64]; // maps/<name>.bsp, for model_precache[0]
     const char* model_precache[MAX_MODELS]; // nullptr terminated
+    std::unordered_map<std::string_view, int> model_precache_index;
     qmodel_t* models[MAX_MODELS];
     const char* sound_precache[MAX_SOUNDS]; // nullptr terminated
     const char* lightstyles[MAX_LIGHTSTYLES];
@@ -153,6 +156,19 @@ struct server_t
 };
 
 #define NUM_PING_TIMES 16
+#define NUM_LEGACY_FRAMES 64 // PEXTQVR_ACKDELTAS frames kept for deltas
+
+// kinds of data counted for net_bandwidth
+enum
+{
+    SVBW_RELIABLE,   // client->message
+    SVBW_CLIENTDATA, // svc_time, damage, clientdata and stats
+    SVBW_ENTITIES,
+    SVBW_DATAGRAM, // sounds, particles and other unreliable events
+    SVBW_VOICE,
+    SVBW_DOWNLOAD,
+    SVBW_COUNT
+};
 #define NUM_BASIC_SPAWN_PARMS 16
 #define NUM_TOTAL_SPAWN_PARMS 64
 
@@ -249,6 +265,24 @@ struct client_t
     int lastacksequence;
     int lastmovemessage;
 
+    unsigned int protocol_pextqvr;
+    struct legacyframe_s
+    {
+        // what the client will have for every entity sent in this frame,
+        // in server units. same order as they were written.
+        int sequence;
+        entity_num_state_s* ents;
+        int numents;
+        int maxents;
+    } * legacyframes; // NUM_LEGACY_FRAMES, indexed by sequence
+    int legacysequence; // frame being sent
+    int legacybase;     // frame the current one deltas from, or 0
+    int legacyacked;    // newest frame the client said it got
+
+    // bytes sent since the last net_bandwidth
+    unsigned int netbytes[SVBW_COUNT];
+    unsigned int netframes;
+
     // QSS
     client_voip_t voip; // spike -- for voip
     struct
@@ -300,11 +334,15 @@ void SV_DropClient(bool crash);
 
 void SVFTE_Ack(client_t* client, int sequence);
 void SVFTE_DestroyFrames(client_t* client);
+void SV_DestroyLegacyFrames(client_t* client);
+void SV_AckFrame(client_t* client, int sequence);
 void SV_BuildEntityState(edict_t* ent, entity_state_t* state);
 void SV_SendClientMessages();
 void SV_ClearDatagram();
 
 int SV_ModelIndex(const char* name);
+void SV_SetModelPrecache(int i, const char* name);
+int SV_FindModelPrecache(const char* name);
 
 void SV_SetIdealPitch();
 
@@ -316,6 +354,7 @@ void SV_AddClientToServer(struct qsocket_s* ret);
 void SV_ClientPrintf(const char* fmt, ...) FUNC_PRINTF(1, 2);
 void SV_BroadcastPrintf(const char* fmt, ...) FUNC_PRINTF(1, 2);
 
+void SV_InitPhysics();
 void SV_Physics();
 
 bool SV_CheckBottom(edict_t* ent);
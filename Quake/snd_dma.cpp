@@ -64,6 +64,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "gl_model.hpp"
 #include "client.hpp"
 #include "snd_voip.hpp"
+#include "profiler.hpp"
 
 static void S_Play();
 static void S_PlayVol();
@@ -114,6 +115,8 @@ cvar_t sfxvolume = {"volume", "0.7", CVAR_ARCHIVE};
 
 cvar_t precache = {"precache", "1", CVAR_NONE};
 cvar_t loadas8bit = {"loadas8bit", "0", CVAR_NONE};
+// sounds that decode to more than this many KB are streamed, 0 = never
+cvar_t snd_streamsize = {"snd_streamsize", "512", CVAR_ARCHIVE};
 
 cvar_t sndspeed = {"sndspeed", "11025", CVAR_NONE};
 cvar_t snd_mixspeed = {"snd_mixspeed", "44100", CVAR_NONE};
@@ -216,6 +219,7 @@ void S_Init()
     Cvar_RegisterVariable(&sfxvolume);
     Cvar_RegisterVariable(&precache);
     Cvar_RegisterVariable(&loadas8bit);
+    Cvar_RegisterVariable(&snd_streamsize);
     Cvar_RegisterVariable(&bgmvolume);
     Cvar_RegisterVariable(&ambient_level);
     Cvar_RegisterVariable(&ambient_fade);
@@ -303,6 +307,7 @@ void S_Shutdown()
     sound_started = 0;
     snd_blocked = 0;
 
+    S_CloseSfxStreams();
     S_CodecShutdown();
 
     SNDDMA_Shutdown();
@@ -377,6 +382,31 @@ void S_TouchSound(const char* name)
     Cache_Check(&sfx->cache);
 }
 
+/*
+==================
+S_NeedsLoad
+
+True if precaching `name` would read it from disk.
+==================
+*/
+bool S_NeedsLoad(const char* name)
+{
+    if(!sound_started || nosound.value || !precache.value)
+    {
+        return false;
+    }
+
+    for(int i = 0; i < num_sfx; i++)
+    {
+        if(!Q_strcmp(known_sfx[i].name, name))
+        {
+            return !Cache_Check(&known_sfx[i].cache);
+        }
+    }
+
+    return true;
+}
+
 /*
 ==================
 S_PrecacheSound
@@ -938,6 +968,8 @@ Called once each time through the main loop
 void S_Update(const qvec3& origin, const qvec3& forward, const qvec3& right,
     const qvec3& up)
 {
+    QUAKE_PROFILE_ZONE("S_Update");
+
     int i;
     int j;
     int total;
@@ -1214,7 +1246,7 @@ static void S_SoundList()
         {
             continue;
         }
-        size = sc->length * sc->width * (sc->stereo + 1);
+        size = sc->streamed ? 0 : sc->length * sc->width * (sc->stereo + 1);
         total += size;
         if(sc->loopstart >= 0)
         {
@@ -1224,8 +1256,9 @@ static void S_SoundList()
         {
             Con_SafePrintf(" "); // johnfitz -- was Con_Printf
         }
-        Con_SafePrintf("(%2db) %6i : %s\n", sc->width * 8, size,
-            sfx->name); // johnfitz -- was Con_Printf
+        Con_SafePrintf("(%2db) %6i : %s%s\n", sc->width * 8, size,
+            sfx->name,
+            sc->streamed ? " (streamed)" : ""); // johnfitz -- was Con_Printf
     }
     Con_Printf(
         "%i sounds, %i bytes\n", num_sfx, total); // johnfitz -- added count
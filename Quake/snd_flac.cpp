@@ -230,6 +230,7 @@ static void flac_meta_func(const FLAC__StreamDecoder* decoder,
         ff->info->bits = metadata->data.stream_info.bits_per_sample;
         ff->info->width = ff->info->bits / 8;
         ff->info->channels = metadata->data.stream_info.channels;
+        ff->info->samples = metadata->data.stream_info.total_samples;
         ff->info->blocksize = metadata->data.stream_info.max_blocksize;
         ff->info->dataofs = 0; /* got the STREAMINFO metadata */
     }
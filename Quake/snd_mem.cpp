@@ -29,6 +29,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // QSS
 #include "snd_codec.hpp"
+#include "tasks.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /*
 ================
@@ -151,12 +156,484 @@ static void ResampleSfx(sfx_t* sfx, int inrate, int inwidth, byte* data)
 
 //=============================================================================
 
+/*
+===============================================================================
+
+SFX streaming
+
+Sounds that would decode to more than snd_streamsize KB only keep their
+sfxcache_t header in the cache. Each channel playing one gets a slot here
+which decodes the file through its codec into a small window of output
+samples, resampled the same way as ResampleSfx, as the mixer asks for them.
+
+===============================================================================
+*/
+
+#define MAX_SFX_STREAMS 16
+#define SFXSTREAM_SAMPLES 4096 // output samples kept per stream
+#define SFXSTREAM_FRAMES 1024  // source frames decoded per read
+
+struct sfxstream_t
+{
+    snd_stream_t* stream; // nullptr when the slot is free
+    int chan;             // index into snd_channels
+    sfx_t* sfx;
+    int fracstep;
+    int framesize; // bytes per source frame
+    int winpos;    // output sample at the start of window
+    int wincount;
+    int srcbase; // source frame at the start of src
+    int srccount;
+    bool eof;
+    alignas(short) byte window[SFXSTREAM_SAMPLES * 2];
+    alignas(short) byte src[SFXSTREAM_FRAMES * 4];
+};
+
+static sfxstream_t sfx_streams[MAX_SFX_STREAMS];
+
+static snd_stream_t* S_OpenSfxStream(const char* name)
+{
+    char namebuffer[256];
+    snd_stream_t* stream;
+
+    q_snprintf(namebuffer, sizeof(namebuffer), "sound/%s", name);
+    stream = S_CodecOpenStreamExt(namebuffer);
+
+    // QSS
+    if(!stream)
+    {
+        stream = S_CodecOpenStreamExt(name);
+    }
+
+    return stream;
+}
+
+static void S_CloseSfxStream(sfxstream_t& st)
+{
+    S_CodecCloseStream(st.stream);
+    st.stream = nullptr;
+    st.sfx = nullptr;
+}
+
+void S_CloseSfxStreams()
+{
+    for(sfxstream_t& st : sfx_streams)
+    {
+        if(st.stream)
+        {
+            S_CloseSfxStream(st);
+        }
+    }
+}
+
+void S_UpdateSfxStreams()
+{
+    for(sfxstream_t& st : sfx_streams)
+    {
+        if(st.stream && (st.chan >= total_channels ||
+                            snd_channels[st.chan].sfx != st.sfx))
+        {
+            S_CloseSfxStream(st);
+        }
+    }
+}
+
+static void S_ReadSfxStream(sfxstream_t& st)
+{
+    int bytes;
+
+    st.srcbase += st.srccount;
+    bytes = S_CodecReadStream(
+        st.stream, SFXSTREAM_FRAMES * st.framesize, st.src);
+    st.srccount = bytes > 0 ? bytes / st.framesize : 0;
+    st.eof = !st.srccount;
+}
+
+/*
+================
+S_FillSfxStream
+
+Decodes output samples until the window is full, picking source samples with
+the same fixed point stepping as ResampleSfx. Past the end of the file the
+window is padded with silence.
+================
+*/
+static void S_FillSfxStream(sfxstream_t& st, int width)
+{
+    const int inwidth = st.stream->info.width;
+    const bool stereo = st.stream->info.channels == 2;
+    const byte* in;
+    long long srcsample;
+    int sample;
+
+    for(; st.wincount < SFXSTREAM_SAMPLES; st.wincount++)
+    {
+        srcsample = ((long long)(st.winpos + st.wincount) * st.fracstep) >> 8;
+        while(!st.eof && srcsample >= st.srcbase + st.srccount)
+        {
+            S_ReadSfxStream(st);
+        }
+
+        sample = 0;
+        if(srcsample >= st.srcbase && srcsample < st.srcbase + st.srccount)
+        {
+            in = st.src + (srcsample - st.srcbase) * st.framesize;
+            if(inwidth == 2)
+            {
+                sample = ((const short*)in)[0];
+                if(stereo)
+                {
+                    sample = (sample + ((const short*)in)[1]) / 2;
+                }
+            }
+            else
+            {
+                sample = (int)(in[0] - 128) << 8;
+                if(stereo)
+                {
+                    sample = (sample + ((int)(in[1] - 128) << 8)) / 2;
+                }
+            }
+        }
+
+        if(width == 2)
+        {
+            ((short*)st.window)[st.wincount] = sample;
+        }
+        else
+        {
+            ((signed char*)st.window)[st.wincount] = sample >> 8;
+        }
+    }
+}
+
+/*
+================
+S_StreamSamples
+
+Returns the samples of streamed sound `sc` from ch->pos on, at least `count`
+of them, or nullptr if the channel can't be streamed.
+================
+*/
+byte* S_StreamSamples(channel_t* ch, sfxcache_t* sc, int count)
+{
+    const int chan = ch - snd_channels;
+    sfxstream_t* st = nullptr;
+    int keep;
+
+    for(sfxstream_t& it : sfx_streams)
+    {
+        if(it.stream && it.chan == chan && it.sfx == ch->sfx)
+        {
+            st = &it;
+            break;
+        }
+    }
+
+    if(!st)
+    {
+        S_UpdateSfxStreams();
+        for(sfxstream_t& it : sfx_streams)
+        {
+            if(!it.stream)
+            {
+                st = &it;
+                break;
+            }
+        }
+
+        if(!st)
+        {
+            Con_DPrintf("S_StreamSamples: no free stream for %s\n",
+                ch->sfx->name);
+            return nullptr;
+        }
+
+        st->stream = S_OpenSfxStream(ch->sfx->name);
+        if(!st->stream)
+        {
+            return nullptr;
+        }
+
+        const snd_info_t& info = st->stream->info;
+        if((info.width != 1 && info.width != 2) ||
+            (info.channels != 1 && info.channels != 2))
+        {
+            S_CloseSfxStream(*st);
+            return nullptr;
+        }
+
+        const float stepscale = (float)info.rate / shm->speed;
+        st->chan = chan;
+        st->sfx = ch->sfx;
+        st->fracstep = stepscale * 256;
+        st->framesize = info.width * info.channels;
+        st->winpos = st->wincount = 0;
+        st->srcbase = st->srccount = 0;
+        st->eof = false;
+    }
+
+    if(ch->pos < st->winpos)
+    {
+        // looped or restarted, decode again from the top
+        S_CodecRewindStream(st->stream);
+        st->winpos = ch->pos;
+        st->wincount = 0;
+        st->srcbase = st->srccount = 0;
+        st->eof = false;
+    }
+    else if(ch->pos + count > st->winpos + st->wincount)
+    {
+        // slide the window up to ch->pos, keeping what is still ahead
+        keep = st->winpos + st->wincount - ch->pos;
+        if(keep > 0)
+        {
+            memmove(st->window,
+                st->window + (ch->pos - st->winpos) * sc->width,
+                keep * sc->width);
+            st->wincount = keep;
+        }
+        else
+        {
+            st->wincount = 0;
+        }
+        st->winpos = ch->pos;
+    }
+
+    S_FillSfxStream(*st, sc->width);
+    return st->window + (ch->pos - st->winpos) * sc->width;
+}
+
 /*
 ==============
-S_LoadSound
+S_ShouldStreamSfx
+
+True if a sound would decode to more than snd_streamsize KB.
 ==============
 */
-sfxcache_t* S_LoadSound(sfx_t* s)
+static bool S_ShouldStreamSfx(int rate, int width, int samples)
+{
+    if(snd_streamsize.value <= 0 || samples <= 0 || (width != 1 && width != 2))
+    {
+        return false;
+    }
+
+    const float stepscale = (float)rate / shm->speed;
+    const int outwidth = loadas8bit.value ? 1 : width;
+    const int length = samples / stepscale;
+    return (double)length * outwidth > snd_streamsize.value * 1024;
+}
+
+/*
+==============
+S_StreamSfx
+
+Sets `s` up to be streamed if it would decode to more than snd_streamsize
+KB. Returns nullptr if it should be loaded whole instead.
+==============
+*/
+static sfxcache_t* S_StreamSfx(
+    sfx_t* s, int rate, int width, int samples, int loopstart)
+{
+    float stepscale;
+    int outwidth;
+    int length;
+    sfxcache_t* sc;
+
+    if(!S_ShouldStreamSfx(rate, width, samples))
+    {
+        return nullptr;
+    }
+
+    stepscale = (float)rate / shm->speed;
+    outwidth = loadas8bit.value ? 1 : width;
+    length = samples / stepscale;
+
+    sc = (sfxcache_t*)Cache_Alloc(&s->cache, sizeof(sfxcache_t), s->name);
+    if(!sc)
+    {
+        return nullptr;
+    }
+
+    sc->length = length;
+    sc->loopstart = loopstart != -1 ? (int)(loopstart / stepscale) : -1;
+    sc->speed = shm->speed;
+    sc->width = outwidth;
+    sc->stereo = 0;
+    sc->streamed = 1;
+
+    return sc;
+}
+
+//=============================================================================
+
+#define MAX_SFX_DECODED (32 * 1024 * 1024) // bytes held by S_PredecodeSounds
+
+// compressed sounds decoded by S_PredecodeSounds, waiting for S_LoadSound
+struct sfxdecoded_t
+{
+    snd_info_t info;
+    void* data;
+    int size;
+};
+
+static std::unordered_map<std::string, sfxdecoded_t> sfx_decoded;
+
+/*
+==============
+S_DecodeSfx
+
+Decodes up to 16 MB of `stream` into a malloc'd buffer, sized from the
+length the codec reports when it knows it. Returns the decoded size, or -1
+with `*data` cleared on failure. Only touches the stream, so it may run on a
+worker.
+==============
+*/
+static int S_DecodeSfx(snd_stream_t* stream, void** data)
+{
+    const snd_info_t& info = stream->info;
+    const int maxsize = 1024 * 1024 * 16;
+    const int64_t length =
+        (int64_t)info.samples * info.width * info.channels;
+    const int decodedsize =
+        length > 0 && length < maxsize ? (int)length : maxsize;
+
+    *data = malloc(decodedsize);
+    if(!*data)
+    {
+        return -1;
+    }
+
+    const int res = S_CodecReadStream(stream, decodedsize, *data);
+    if(res <= 0)
+    {
+        free(*data);
+        *data = nullptr;
+        return -1;
+    }
+
+    if(res < decodedsize)
+    {
+        if(void* shrunk = realloc(*data, res))
+        {
+            *data = shrunk;
+        }
+    }
+
+    return res;
+}
+
+/*
+==============
+S_CacheDecodedSfx
+
+Resamples `size` bytes decoded by S_DecodeSfx into the cache of `s`, and
+frees them.
+==============
+*/
+static sfxcache_t* S_CacheDecodedSfx(
+    sfx_t* s, const snd_info_t& info, int size, void* data)
+{
+    const int res = size / (info.width * info.channels);
+
+    sfxcache_t* sc =
+        (sfxcache_t*)Cache_Alloc(&s->cache, res + sizeof(sfxcache_t), s->name);
+    if(!sc)
+    {
+        free(data);
+        return nullptr;
+    }
+
+    sc->length = res / info.channels;
+    sc->loopstart = -1;
+    sc->speed = info.rate;
+    sc->width = info.width;
+    sc->stereo = info.channels - 1;
+    sc->streamed = 0;
+
+    ResampleSfx(s, sc->speed, sc->width, static_cast<byte*>(data));
+    free(data);
+    return sc;
+}
+
+/*
+==============
+S_PredecodeSounds
+
+Decodes the Ogg Vorbis and Opus sounds among `samples` on the worker pool,
+for S_LoadSound to pick up. Their read paths don't print, unlike the mp3 and
+flac ones, so those and wavs (which are only resampled) still load serially.
+Sounds of unknown length, or past MAX_SFX_DECODED bytes in total, are left
+to S_LoadSound too.
+==============
+*/
+void S_PredecodeSounds(const std::vector<std::string>& samples)
+{
+    for(auto& [name, decoded] : sfx_decoded)
+    {
+        free(decoded.data);
+    }
+    sfx_decoded.clear();
+
+    struct job_t
+    {
+        const std::string* name;
+        snd_stream_t* stream;
+        void* data;
+        int size;
+    };
+
+    std::vector<job_t> jobs;
+    int64_t total = 0;
+    for(const std::string& name : samples)
+    {
+        const char* ext = COM_FileGetExtension(name.c_str());
+        if(q_strcasecmp(ext, "ogg") && q_strcasecmp(ext, "opus"))
+        {
+            continue;
+        }
+
+        snd_stream_t* stream = S_OpenSfxStream(name.c_str());
+        if(!stream)
+        {
+            continue;
+        }
+
+        const snd_info_t& info = stream->info;
+        const int64_t size =
+            (int64_t)info.samples * info.width * info.channels;
+        if(info.samples <= 0 || total + size > MAX_SFX_DECODED ||
+            S_ShouldStreamSfx(info.rate, info.width, info.samples))
+        {
+            S_CodecCloseStream(stream);
+            continue;
+        }
+
+        total += size;
+        jobs.push_back({&name, stream, nullptr, 0});
+    }
+
+    quake::tasks::parallelFor(static_cast<int>(jobs.size()), [&](int i) {
+        jobs[i].size = S_DecodeSfx(jobs[i].stream, &jobs[i].data);
+    });
+
+    for(job_t& job : jobs)
+    {
+        if(job.data)
+        {
+            sfx_decoded[*job.name] = {job.stream->info, job.data, job.size};
+        }
+
+        S_CodecCloseStream(job.stream);
+    }
+}
+
+/*
+==============
+S_LoadSoundFile
+==============
+*/
+static sfxcache_t* S_LoadSoundFile(sfx_t* s)
 {
     char namebuffer[256];
     byte* data;
@@ -166,13 +643,6 @@ sfxcache_t* S_LoadSound(sfx_t* s)
     sfxcache_t* sc;
     byte stackbuf[1 * 1024]; // avoid dirtying the cache heap
 
-    // see if still in memory
-    sc = (sfxcache_t*)Cache_Check(&s->cache);
-    if(sc)
-    {
-        return sc;
-    }
-
     //	Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
 
     // load it in
@@ -186,53 +656,53 @@ sfxcache_t* S_LoadSound(sfx_t* s)
         // support streaming anything but music.
         // FIXME: I hate depending on extensions for this sort of thing. Its not
         // a very quakey thing to do.
-        snd_stream_t* stream = S_CodecOpenStreamExt(namebuffer);
-        if(!stream)
+        const auto it = sfx_decoded.find(s->name);
+        if(it != sfx_decoded.end())
         {
-            stream = S_CodecOpenStreamExt(s->name);
+            const sfxdecoded_t decoded = it->second;
+            sfx_decoded.erase(it);
+            return S_CacheDecodedSfx(
+                s, decoded.info, decoded.size, decoded.data);
         }
+
+        snd_stream_t* stream = S_OpenSfxStream(s->name);
         if(stream)
         {
-            size_t decodedsize = 1024 * 1024 * 16;
-            void* decoded = malloc(decodedsize);
-            int res = S_CodecReadStream(stream, decodedsize, decoded);
-            int len;
-            S_CodecCloseStream(stream);
-
-            res /= stream->info.width * stream->info.channels;
+            sc = S_StreamSfx(s, stream->info.rate, stream->info.width,
+                stream->info.samples, -1);
+            if(sc)
+            {
+                S_CodecCloseStream(stream);
+                return sc;
+            }
 
-            stepscale = (float)stream->info.rate / shm->speed;
-            len = res / stepscale;
-            len = len * stream->info.width; // * info.channels;
+            void* decoded;
+            const int size = S_DecodeSfx(stream, &decoded);
+            const snd_info_t info = stream->info;
+            S_CodecCloseStream(stream);
 
-            sc = (sfxcache_t*)Cache_Alloc(
-                &s->cache, res + sizeof(sfxcache_t), s->name);
-            if(!sc)
+            if(size < 0)
             {
+                Con_Printf("Couldn't decode %s\n", s->name);
                 return nullptr;
             }
 
-            sc->length = res / stream->info.channels;
-            sc->loopstart = -1;
-            sc->speed = stream->info.rate;
-            sc->width = stream->info.width;
-            sc->stereo = stream->info.channels - 1;
-
-            ResampleSfx(s, sc->speed, sc->width, static_cast<byte*>(decoded));
-            free(decoded);
-            return sc;
+            return S_CacheDecodedSfx(s, info, size, decoded);
         }
     }
 
 
     // Con_Printf ("loading %s\n",namebuffer);
 
-    data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), nullptr);
+    // the wav parser and ResampleSfx only read the file
+    data =
+        COM_LoadStackFileView(namebuffer, stackbuf, sizeof(stackbuf), nullptr);
 
     // QSS
     if(!data)
     {
-        data = COM_LoadStackFile(s->name, stackbuf, sizeof(stackbuf), nullptr);
+        data =
+            COM_LoadStackFileView(s->name, stackbuf, sizeof(stackbuf), nullptr);
     }
 
     if(!data)
@@ -266,6 +736,13 @@ sfxcache_t* S_LoadSound(sfx_t* s)
         return nullptr;
     }
 
+    sc = S_StreamSfx(
+        s, info.rate, info.width, info.samples / info.channels, info.loopstart);
+    if(sc)
+    {
+        return sc;
+    }
+
     sc = (sfxcache_t*)Cache_Alloc(&s->cache, len + sizeof(sfxcache_t), s->name);
     if(!sc)
     {
@@ -281,12 +758,35 @@ sfxcache_t* S_LoadSound(sfx_t* s)
 
     // QSS
     sc->stereo = info.channels - 1;
+    sc->streamed = 0;
 
     ResampleSfx(s, sc->speed, sc->width, data + info.dataofs);
 
     return sc;
 }
 
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t* S_LoadSound(sfx_t* s)
+{
+    // see if still in memory
+    sfxcache_t* sc = (sfxcache_t*)Cache_Check(&s->cache);
+    if(sc)
+    {
+        return sc;
+    }
+
+    const double start = Sys_DoubleTime();
+    sc = S_LoadSoundFile(s);
+    COM_AddLoadStat(LOADSTAT_SOUND, Sys_DoubleTime() - start,
+        sc && !sc->streamed ? sc->length * sc->width * (sc->stereo + 1) : 0);
+
+    return sc;
+}
+
 
 
 /*
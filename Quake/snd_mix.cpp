@@ -391,9 +391,9 @@ CHANNEL MIXING
 */
 
 static void SND_PaintChannelFrom8(
-    channel_t* ch, sfxcache_t* sc, int endtime, int paintbufferstart);
+    channel_t* ch, const byte* data, int endtime, int paintbufferstart);
 static void SND_PaintChannelFrom16(
-    channel_t* ch, sfxcache_t* sc, int endtime, int paintbufferstart);
+    channel_t* ch, const byte* data, int endtime, int paintbufferstart);
 
 void S_PaintChannels(int endtime)
 {
@@ -403,6 +403,7 @@ void S_PaintChannels(int endtime)
     int count;
     channel_t* ch;
     sfxcache_t* sc;
+    byte* data;
 
     snd_vol = sfxvolume.value * 256;
 
@@ -453,17 +454,31 @@ void S_PaintChannels(int endtime)
 
                 if(count > 0)
                 {
+                    if(sc->streamed)
+                    {
+                        data = S_StreamSamples(ch, sc, count);
+                        if(!data)
+                        {
+                            ch->sfx = nullptr;
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        data = sc->data + ch->pos * sc->width;
+                    }
+
                     // the last param to SND_PaintChannelFrom is the index
                     // to start painting to in the paintbuffer, usually 0.
                     if(sc->width == 1)
                     {
                         SND_PaintChannelFrom8(
-                            ch, sc, count, ltime - paintedtime);
+                            ch, data, count, ltime - paintedtime);
                     }
                     else
                     {
                         SND_PaintChannelFrom16(
-                            ch, sc, count, ltime - paintedtime);
+                            ch, data, count, ltime - paintedtime);
                     }
 
                     ltime += count;
@@ -534,6 +549,8 @@ void S_PaintChannels(int endtime)
         S_TransferPaintBuffer(end);
         paintedtime = end;
     }
+
+    S_UpdateSfxStreams();
 }
 
 void SND_InitScaletable()
@@ -561,12 +578,12 @@ void SND_InitScaletable()
 
 
 static void SND_PaintChannelFrom8(
-    channel_t* ch, sfxcache_t* sc, int count, int paintbufferstart)
+    channel_t* ch, const byte* data, int count, int paintbufferstart)
 {
-    int data;
+    int sample;
     int* lscale;
     int* rscale;
-    unsigned char* sfx;
+    const unsigned char* sfx;
     int i;
 
     if(ch->leftvol > 255)
@@ -580,44 +597,44 @@ static void SND_PaintChannelFrom8(
 
     lscale = snd_scaletable[ch->leftvol >> 3];
     rscale = snd_scaletable[ch->rightvol >> 3];
-    sfx = (unsigned char*)sc->data + ch->pos;
+    sfx = data;
 
     for(i = 0; i < count; i++)
     {
-        data = sfx[i];
-        paintbuffer[paintbufferstart + i].left += lscale[data];
-        paintbuffer[paintbufferstart + i].right += rscale[data];
+        sample = sfx[i];
+        paintbuffer[paintbufferstart + i].left += lscale[sample];
+        paintbuffer[paintbufferstart + i].right += rscale[sample];
     }
 
     ch->pos += count;
 }
 
 static void SND_PaintChannelFrom16(
-    channel_t* ch, sfxcache_t* sc, int count, int paintbufferstart)
+    channel_t* ch, const byte* data, int count, int paintbufferstart)
 {
-    int data;
+    int sample;
     int left;
     int right;
     int leftvol;
     int rightvol;
-    signed short* sfx;
+    const signed short* sfx;
     int i;
 
     leftvol = ch->leftvol * snd_vol;
     rightvol = ch->rightvol * snd_vol;
     leftvol /= 256;
     rightvol /= 256;
-    sfx = (signed short*)sc->data + ch->pos;
+    sfx = (const signed short*)data;
 
     for(i = 0; i < count; i++)
     {
-        data = sfx[i];
+        sample = sfx[i];
         // this was causing integer overflow as observed in quakespasm
         // with the warpspasm mod moved >>8 to left/right volume above.
         //	left = (data * leftvol) >> 8;
         //	right = (data * rightvol) >> 8;
-        left = data * leftvol;
-        right = data * rightvol;
+        left = sample * leftvol;
+        right = sample * rightvol;
         paintbuffer[paintbufferstart + i].left += left;
         paintbuffer[paintbufferstart + i].right += right;
     }
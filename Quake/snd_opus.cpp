@@ -136,6 +136,10 @@ static bool S_OPUS_CodecOpenStream(snd_stream_t* stream)
     /* op_read() yields 16-bit output using native endian ordering: */
     stream->info.bits = 16;
     stream->info.width = 2;
+    {
+        const ogg_int64_t total = op_pcm_total(opFile, -1);
+        stream->info.samples = total > 0 ? (int)total : 0;
+    }
 
     return true;
 _fail:
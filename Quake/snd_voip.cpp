@@ -1166,6 +1166,7 @@ void S_RawAudio(int sourceid, byte* data, unsigned int speed,
         newcache->width = width;
         newcache->loopstart = -1;
         newcache->length = 0;
+        newcache->streamed = 0;
         newcache = nullptr;
 
         // Con_Printf("Added new raw stream\n");
@@ -124,6 +124,11 @@ static bool S_VORBIS_CodecOpenStream(snd_stream_t* stream)
     stream->info.channels = ovf_info->channels;
     stream->info.bits = VORBIS_SAMPLEBITS;
     stream->info.width = VORBIS_SAMPLEWIDTH;
+    /* seekable, so the length is known; 0 when it isn't */
+    {
+        const ogg_int64_t total = ov_pcm_total(ovFile, -1);
+        stream->info.samples = total > 0 ? (int)total : 0;
+    }
 
     return true;
 _fail:
@@ -40,8 +40,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "snd_voip.hpp"
 #include "qcvm.hpp"
 #include "client.hpp"
+#include "tasks.hpp"
+#include "profiler.hpp"
 
 #include <algorithm>
+#include <cstdint>
 
 server_t sv;
 server_static_t svs;
@@ -745,9 +748,37 @@ static void MSGFTE_WriteEntityUpdate(unsigned int bits, entity_state_t* state,
     */
 }
 
-static client_t::entity_num_state_s* snapshot_entstate;
-static size_t snapshot_numents;
-static size_t snapshot_maxents;
+// Per-client state used while building and writing a datagram. Everything a
+// snapshot build writes to lives here or in the client itself, so that the
+// entity part of several clients' datagrams can be written concurrently.
+struct sv_snapshotctx_t
+{
+    byte buf[MAX_DATAGRAM + 1000 /* QSS */];
+    sizebuf_t msg;
+    bool begun;         // SV_BeginClientDatagram already ran this frame
+    bool writeentities; // SV_WriteClientEntities still has to run
+
+    std::vector<byte> pvs; // copy of the client's fat PVS
+
+    // SV_FindVisibleEdicts
+    std::vector<unsigned int> stamp; // per edict, == stampgen when visible
+    unsigned int stampgen;
+    std::vector<int> visible;
+
+    // SVFTE_BuildSnapshotForClient, swapped with client->previousentities
+    client_t::entity_num_state_s* entstate;
+    size_t numents;
+    size_t maxents;
+
+    // devstats and warnings, reported from the main thread
+    bool packetoverflow;
+    int packetsize;
+    int packetmaxsize;
+};
+
+static std::vector<sv_snapshotctx_t> sv_snapshotctxs;
+
+cvar_t sv_parallelsnapshots = {"sv_parallelsnapshots", "1", CVAR_NONE};
 
 void SVFTE_DestroyFrames(client_t* client)
 {
@@ -872,6 +903,86 @@ void SVFTE_Ack(client_t* client, int sequence)
         host_client->num_pings++;
     }
 }
+
+void SV_DestroyLegacyFrames(client_t* client)
+{
+    if(client->legacyframes)
+    {
+        for(int i = 0; i < NUM_LEGACY_FRAMES; i++)
+        {
+            free(client->legacyframes[i].ents);
+        }
+        free(client->legacyframes);
+    }
+    client->legacyframes = nullptr;
+    client->legacybase = 0;
+    client->legacyacked = 0;
+}
+
+static void SV_SetupLegacyFrames(client_t* client)
+{
+    // legacysequence keeps counting across maps, so that a stale ack from the
+    // previous one can't match any of the new frames
+    SV_DestroyLegacyFrames(client);
+
+    if(client->protocol_pextqvr & PEXTQVR_ACKDELTAS)
+    {
+        client->legacyframes = (client_t::legacyframe_s*)calloc(
+            NUM_LEGACY_FRAMES, sizeof(*client->legacyframes));
+    }
+}
+
+/*
+=============
+SV_BeginLegacyFrame
+
+Numbers the next PEXTQVR_ACKDELTAS frame, and picks the newest frame the
+client acked that we still have to delta it from.
+=============
+*/
+static void SV_BeginLegacyFrame(client_t* client)
+{
+    const int sequence = ++client->legacysequence;
+    const int acked = client->legacyacked;
+
+    client->legacybase = 0;
+    if(acked > 0 && sequence - acked < NUM_LEGACY_FRAMES &&
+        client->legacyframes[acked % NUM_LEGACY_FRAMES].sequence == acked)
+    {
+        client->legacybase = acked;
+    }
+
+    client_t::legacyframe_s* frame =
+        &client->legacyframes[sequence % NUM_LEGACY_FRAMES];
+    frame->sequence = sequence;
+    frame->numents = 0;
+}
+
+void SV_AckFrame(client_t* client, int sequence)
+{
+    if(client->protocol_pext2 & PEXT2_REPLACEMENTDELTAS)
+    {
+        SVFTE_Ack(client, sequence);
+    }
+    else if(!client->legacyframes)
+    {
+        return;
+    }
+    else if(sequence < 0)
+    {
+        // the client lost a frame we delta from. send from the baselines
+        // until it acks one we haven't sent yet, ignoring acks in flight
+        client->legacyacked = client->legacysequence;
+        client->legacyframes[client->legacysequence % NUM_LEGACY_FRAMES]
+            .sequence = 0;
+    }
+    else if(sequence > client->legacyacked &&
+            sequence <= client->legacysequence)
+    {
+        client->legacyacked = sequence;
+    }
+}
+
 static void SVFTE_WriteStats(client_t* client, sizebuf_t* msg)
 {
     int statsi[MAX_CL_STATS];
@@ -944,7 +1055,7 @@ static void SVFTE_WriteStats(client_t* client, sizebuf_t* msg)
         }
     }
 }
-static void SVFTE_CalcEntityDeltas(client_t* client)
+static void SVFTE_CalcEntityDeltas(client_t* client, sv_snapshotctx_t& ctx)
 {
     client_t::entity_num_state_s *olds, *news, *oldstop, *newstop;
 
@@ -968,8 +1079,8 @@ static void SVFTE_CalcEntityDeltas(client_t* client)
         client->pendingentities_bits[0] = UF_REMOVE;
     }
 
-    news = snapshot_entstate;
-    newstop = news + snapshot_numents;
+    news = ctx.entstate;
+    newstop = news + ctx.numents;
     olds = client->previousentities;
     oldstop = olds + client->numpreviousentities;
 
@@ -1017,17 +1128,17 @@ static void SVFTE_CalcEntityDeltas(client_t* client)
     olds = client->previousentities;
     oldstop = olds + client->maxpreviousentities;
 
-    client->previousentities = snapshot_entstate;
-    client->numpreviousentities = snapshot_numents;
-    client->maxpreviousentities = snapshot_maxents;
+    client->previousentities = ctx.entstate;
+    client->numpreviousentities = ctx.numents;
+    client->maxpreviousentities = ctx.maxents;
 
-    snapshot_entstate = olds;
-    snapshot_numents = 0;
-    snapshot_maxents = oldstop - olds;
+    ctx.entstate = olds;
+    ctx.numents = 0;
+    ctx.maxents = oldstop - olds;
 }
 
-static void SVFTE_WriteEntitiesToClient(
-    client_t* client, sizebuf_t* msg, size_t overflowsize)
+static void SVFTE_WriteEntitiesToClient(client_t* client, sizebuf_t* msg,
+    size_t overflowsize, sv_snapshotctx_t& ctx)
 {
     client_t::entity_num_state_s *state, *stateend;
     unsigned int bits, logbits;
@@ -1155,14 +1266,8 @@ static void SVFTE_WriteEntitiesToClient(
     // updating the first N entities.
     client->snapshotresume = (entnum < client->numpendingentities ? entnum : 0);
 
-
-    if(msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
-    {
-        Con_DWarning(
-            "%i byte packet exceeds standard limit of 1024.\n", msg->cursize);
-    }
-    dev_stats.packetsize = msg->cursize;
-    dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
+    ctx.packetsize = msg->cursize;
+    ctx.packetmaxsize = msg->maxsize;
 }
 
 /*
@@ -1247,26 +1352,337 @@ void SV_BuildEntityState(edict_t* ent, entity_state_t* state)
 
 byte* SV_FatPVS(const qvec3& org, qmodel_t* worldmodel);
 
-static void SVFTE_BuildSnapshotForClient(client_t* client)
+/*
+==============================================================================
+
+ENTITY VISIBILITY INDEX
+
+Built once per frame before any snapshot is written. Every edict that could be
+networked is recorded in edict order, and the ones touching a usable number of
+leafs are additionally bucketed by leaf, so that each client only has to test
+the occupied leafs against its PVS instead of every leaf of every edict.
+
+==============================================================================
+*/
+
+enum : unsigned char
+{
+    VISENT_MODEL = 1 << 0,   // has a visible model
+    VISENT_EMIT = 1 << 1,    // has an FTE emiteffect
+    VISENT_SPECIAL = 1 << 2, // viewmodelforclient or tag_entity is set
+};
+
+struct sv_visent_t
+{
+    int num;
+    unsigned char flags;
+};
+
+static struct
+{
+    bool valid;
+    std::vector<sv_visent_t> ents; // candidates, in edict order
+    std::vector<int> leafs;        // occupied leafs
+    std::vector<int> leafstart;    // per world leaf, into leafents
+    std::vector<int> leafend;      // per world leaf, into leafents
+    std::vector<int> leafents;     // edict numbers bucketed by leaf
+} sv_visindex;
+
+/*
+=============
+SV_EdictHasVisibleModel
+
+The model string is only looked at again when `v.model` changes.
+=============
+*/
+static bool SV_EdictHasVisibleModel(edict_t* ent)
+{
+    if(!ent->v.modelindex)
+    {
+        return false;
+    }
+
+    if(ent->v.model != ent->visiblemodelstr)
+    {
+        ent->visiblemodelstr = ent->v.model;
+        ent->visiblemodel = PR_GetString(ent->v.model)[0] != '\0';
+    }
+
+    return ent->visiblemodel;
+}
+
+/*
+=============
+SV_InvalidateVisIndex
+=============
+*/
+static void SV_InvalidateVisIndex()
+{
+    sv_visindex.valid = false;
+}
+
+/*
+=============
+SV_BuildVisIndex
+=============
+*/
+static void SV_BuildVisIndex()
+{
+    auto& vi = sv_visindex;
+
+    vi.valid = true;
+    vi.ents.clear();
+    vi.leafs.clear();
+    vi.leafents.clear();
+
+    const int numleafs = qcvm->worldmodel ? qcvm->worldmodel->numleafs : 0;
+    vi.leafend.assign(numleafs, 0);
+
+    size_t numbucketed = 0;
+
+    edict_t* ent = NEXT_EDICT(qcvm->edicts);
+    for(int e = 1; e < qcvm->num_edicts; e++, ent = NEXT_EDICT(ent))
+    {
+        unsigned char flags = 0;
+
+        if(SV_EdictHasVisibleModel(ent))
+        {
+            flags |= VISENT_MODEL;
+        }
+
+        if(GetEdictFieldValue(ent, qcvm->extfields.emiteffectnum)->_float)
+        {
+            flags |= VISENT_EMIT;
+        }
+
+        if(!flags)
+        {
+            continue;
+        }
+
+        // johnfitz -- alpha
+        // refreshed here rather than while writing, as the latter may happen
+        // on several threads at once
+        if(eval_t* val = GetEdictFieldValue(ent, qcvm->extfields.alpha))
+        {
+            ent->alpha = ENTALPHA_ENCODE(val->_float);
+        }
+
+        const eval_t* vm =
+            GetEdictFieldValue(ent, qcvm->extfields.viewmodelforclient);
+        const eval_t* tag = GetEdictFieldValue(ent, qcvm->extfields.tag_entity);
+        if((vm && vm->edict) || (tag && tag->edict))
+        {
+            flags |= VISENT_SPECIAL;
+        }
+
+        vi.ents.push_back({e, flags});
+
+        if(ent->num_leafs == 0 || ent->num_leafs >= MAX_ENT_LEAFS)
+        {
+            continue;
+        }
+
+        for(unsigned int i = 0; i < ent->num_leafs; i++)
+        {
+            if(vi.leafend[ent->leafnums[i]]++ == 0)
+            {
+                vi.leafs.push_back(ent->leafnums[i]);
+            }
+        }
+
+        numbucketed += ent->num_leafs;
+    }
+
+    // counting sort of the (leaf, edict) pairs, keeping edict order
+    vi.leafstart.resize(numleafs);
+    int offset = 0;
+    for(const int leaf : vi.leafs)
+    {
+        vi.leafstart[leaf] = offset;
+        offset += vi.leafend[leaf];
+        vi.leafend[leaf] = vi.leafstart[leaf];
+    }
+
+    vi.leafents.resize(numbucketed);
+    for(const sv_visent_t& ve : vi.ents)
+    {
+        const edict_t* ed = EDICT_NUM(ve.num);
+        if(ed->num_leafs == 0 || ed->num_leafs >= MAX_ENT_LEAFS)
+        {
+            continue;
+        }
+
+        for(unsigned int i = 0; i < ed->num_leafs; i++)
+        {
+            vi.leafents[vi.leafend[ed->leafnums[i]]++] = ve.num;
+        }
+    }
+}
+
+/*
+=============
+SV_EdictTouchesPVS
+
+Slow path, used for edicts that are not bucketed in the index.
+=============
+*/
+static bool SV_EdictTouchesPVS(const edict_t* ent, const byte* pvs)
+{
+    for(unsigned int i = 0; i < ent->num_leafs; i++)
+    {
+        if(pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i] & 7)))
+        {
+            return true;
+        }
+    }
+
+    // ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
+    //
+    // if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible from too many
+    // leafs for us to say whether it's in the PVS, so don't try to vis cull
+    // it. this commonly happens with rotators, because they often have huge
+    // bboxes spanning the entire map, or really tall lifts, etc.
+    return ent->num_leafs >= MAX_ENT_LEAFS;
+}
+
+/*
+=============
+SV_FindVisibleEdicts
+
+Fills `ctx.visible` with the numbers of the edicts below `maxedict` that
+should be sent to `client`, in edict order. The client's own edict is always
+included. `fte` selects the replacement deltas rules (emiteffect,
+viewmodelforclient and tag_entity) over the vanilla ones. Only reads the
+index, which SV_BeginClientDatagram makes sure is up to date.
+=============
+*/
+static const std::vector<int>& SV_FindVisibleEdicts(client_t* client,
+    sv_snapshotctx_t& ctx, unsigned int maxedict, bool fte)
+{
+    const auto& vi = sv_visindex;
+    const byte* pvs = ctx.pvs.data();
+
+    // mark everything in the occupied leafs the client can see
+    if(++ctx.stampgen == 0)
+    {
+        std::fill(ctx.stamp.begin(), ctx.stamp.end(), 0);
+        ctx.stampgen = 1;
+    }
+
+    for(const int leaf : vi.leafs)
+    {
+        if(!(pvs[leaf >> 3] & (1 << (leaf & 7))))
+        {
+            continue;
+        }
+
+        for(int i = vi.leafstart[leaf]; i < vi.leafend[leaf]; i++)
+        {
+            ctx.stamp[vi.leafents[i]] = ctx.stampgen;
+        }
+    }
+
+    const int clentnum = NUM_FOR_EDICT(client->edict);
+    const int proged = EDICT_TO_PROG(client->edict);
+    bool clentadded = static_cast<unsigned int>(clentnum) >= maxedict;
+
+    ctx.visible.clear();
+    for(const sv_visent_t& ve : vi.ents)
+    {
+        if(static_cast<unsigned int>(ve.num) >= maxedict)
+        {
+            break;
+        }
+
+        if(!clentadded && ve.num >= clentnum)
+        {
+            // `clent` is ALWAYS sent
+            ctx.visible.push_back(clentnum);
+            clentadded = true;
+
+            if(ve.num == clentnum)
+            {
+                continue;
+            }
+        }
+
+        edict_t* ent = EDICT_NUM(ve.num);
+
+        if(!fte)
+        {
+            if(!(ve.flags & VISENT_MODEL))
+            {
+                continue;
+            }
+        }
+        else if(ve.flags & VISENT_SPECIAL)
+        {
+            const eval_t* val =
+                GetEdictFieldValue(ent, qcvm->extfields.viewmodelforclient);
+            if(val && val->edict == proged)
+            {
+                ctx.visible.push_back(ve.num);
+                continue;
+            }
+
+            if(val && val->edict)
+            {
+                continue;
+            }
+
+            // attached entities should use the pvs of the parent rather than
+            // the child (because the child will typically be bugging out
+            // around '0 0 0', so won't be useful)
+            edict_t* parent = ent;
+            while((val = GetEdictFieldValue(
+                       parent, qcvm->extfields.tag_entity)) &&
+                  val->edict)
+            {
+                parent = PROG_TO_EDICT(val->edict);
+            }
+
+            if(!parent->num_leafs || SV_EdictTouchesPVS(parent, pvs))
+            {
+                ctx.visible.push_back(ve.num);
+            }
+
+            continue;
+        }
+        else if(!ent->num_leafs)
+        {
+            ctx.visible.push_back(ve.num);
+            continue;
+        }
+
+        if(ent->num_leafs < MAX_ENT_LEAFS
+                ? ctx.stamp[ve.num] == ctx.stampgen
+                : SV_EdictTouchesPVS(ent, pvs))
+        {
+            ctx.visible.push_back(ve.num);
+        }
+    }
+
+    if(!clentadded)
+    {
+        ctx.visible.push_back(clentnum);
+    }
+
+    return ctx.visible;
+}
+
+static void SVFTE_BuildSnapshotForClient(
+    client_t* client, sv_snapshotctx_t& ctx)
 {
-    unsigned int e, i;
-    byte* pvs;
-    qvec3 org;
-    edict_t *ent, *parent;
     unsigned int maxentities = client->limit_entities;
     edict_t* clent = client->edict;
     eval_t* val;
     unsigned char eflags;
     int proged = EDICT_TO_PROG(clent);
 
-    client_t::entity_num_state_s* ents = snapshot_entstate;
+    client_t::entity_num_state_s* ents = ctx.entstate;
     size_t numents = 0;
-    size_t maxents = snapshot_maxents;
-    int emiteffect;
-
-    // find the client's PVS
-    org = clent->v.origin + clent->v.view_ofs;
-    pvs = SV_FatPVS(org, qcvm->worldmodel);
+    size_t maxents = ctx.maxents;
 
     if(maxentities > (unsigned int)qcvm->num_edicts)
     {
@@ -1274,68 +1690,18 @@ static void SVFTE_BuildSnapshotForClient(client_t* client)
     }
 
     // send over all entities (excpet the client) that touch the pvs
-    ent = NEXT_EDICT(qcvm->edicts);
-    for(e = 1; e < maxentities; e++, ent = NEXT_EDICT(ent))
+    for(const int e : SV_FindVisibleEdicts(client, ctx, maxentities, true))
     {
+        edict_t* ent = EDICT_NUM(e);
+
         eflags = 0;
-        emiteffect =
-            GetEdictFieldValue(ent, qcvm->extfields.emiteffectnum)->_float;
-        if(ent != clent) // clent is ALLWAYS sent
+        if(ent != clent)
         {
-            // ignore ents without visible models
-            if((!ent->v.modelindex || !PR_GetString(ent->v.model)[0]) &&
-                !emiteffect)
-            {
-                continue;
-            }
-
             val = GetEdictFieldValue(ent, qcvm->extfields.viewmodelforclient);
             if(val && val->edict == proged)
             {
                 eflags |= EFLAGS_VIEWMODEL;
             }
-            else if(val && val->edict)
-            {
-                continue;
-            }
-            else
-            {
-                // attached entities should use the pvs of the parent rather
-                // than the child (because the child will typically be bugging
-                // out around '0 0 0', so won't be useful)
-                parent = ent;
-                while((val = GetEdictFieldValue(
-                           parent, qcvm->extfields.tag_entity)) &&
-                      val->edict)
-                {
-                    parent = PROG_TO_EDICT(val->edict);
-                }
-                if(parent->num_leafs)
-                {
-                    // ignore if not touching a PV leaf
-                    for(i = 0; i < parent->num_leafs; i++)
-                    {
-                        if(pvs[parent->leafnums[i] >> 3] &
-                            (1 << (parent->leafnums[i] & 7)))
-                        {
-                            break;
-                        }
-                    }
-
-                    // ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
-                    //
-                    // if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible
-                    // from too many leafs for us to say whether it's in the
-                    // PVS, so don't try to vis cull it. this commonly happens
-                    // with rotators, because they often have huge bboxes
-                    // spanning the entire map, or really tall lifts, etc.
-                    if(i == parent->num_leafs &&
-                        parent->num_leafs < MAX_ENT_LEAFS)
-                    {
-                        continue; // not visible
-                    }
-                }
-            }
         }
 
         // okay, we care about this entity.
@@ -1382,9 +1748,9 @@ static void SVFTE_BuildSnapshotForClient(client_t* client)
         numents++;
     }
 
-    snapshot_entstate = ents;
-    snapshot_numents = numents;
-    snapshot_maxents = maxents;
+    ctx.entstate = ents;
+    ctx.numents = numents;
+    ctx.maxents = maxents;
 }
 
 void MSG_WriteStaticOrBaseLine(sizebuf_t* buf, int idx, entity_state_t* state,
@@ -1592,7 +1958,49 @@ static void SV_Protocol_f()
 
 /*
 ===============
-SV_Init
+SV_Bandwidth_f
+
+Average bytes per frame sent to each client since the last call, by kind.
+===============
+*/
+static void SV_Bandwidth_f()
+{
+    if(!sv.active)
+    {
+        Con_Printf("Not running a server\n");
+        return;
+    }
+
+    Con_Printf("%-16s %6s %6s %6s %6s %6s %6s %6s\n", "name", "reliab",
+        "client", "ents", "dgram", "voice", "dload", "total");
+
+    client_t* client = svs.clients;
+    for(int i = 0; i < svs.maxclients; i++, client++)
+    {
+        if(!client->active || !client->netconnection)
+        {
+            continue;
+        }
+
+        const unsigned int frames = std::max(client->netframes, 1u);
+        unsigned int total = 0;
+
+        Con_Printf("%-16.16s", client->name);
+        for(int k = 0; k < SVBW_COUNT; k++)
+        {
+            Con_Printf(" %6u", client->netbytes[k] / frames);
+            total += client->netbytes[k];
+            client->netbytes[k] = 0;
+        }
+        Con_Printf(" %6u\n", total / frames);
+
+        client->netframes = 0;
+    }
+}
+
+/*
+===============
+SV_Init
 ===============
 */
 void SV_Init()
@@ -1667,6 +2075,12 @@ void SV_Init()
 
     Cmd_AddCommand_ClientCommand("pext", SV_Pext_f);
     Cmd_AddCommand("sv_protocol", &SV_Protocol_f); // johnfitz
+    Cmd_AddCommand("net_bandwidth", &SV_Bandwidth_f);
+
+    Cvar_RegisterVariable(&sv_parallelsnapshots);
+
+    SV_InitAreaNodes();
+    SV_InitPhysics();
 
     for(i = 0; i < MAX_MODELS; i++)
     {
@@ -1972,6 +2386,7 @@ void SV_SendServerinfo(client_t* client)
         // server disabled pext completely, don't bother trying.
         // make sure we try reenabling it again on the next map though. mwahaha.
         client->pextknown = false;
+        client->protocol_pextqvr = 0;
     }
     else if(!client->pextknown)
     {
@@ -2094,6 +2509,11 @@ retry:
             client->protocol_pext2); // active extensions that the client needs
                                      // to look out for
     }
+    if(client->protocol_pextqvr)
+    {
+        MSG_WriteLong(&client->message, PROTOCOL_QUAKEVR_PEXT);
+        MSG_WriteLong(&client->message, client->protocol_pextqvr);
+    }
     MSG_WriteLong(&client->message,
         sv.protocol); // johnfitz -- sv.protocol instead of PROTOCOL_VERSION
     if(sv.protocol == PROTOCOL_RMQ)
@@ -2158,6 +2578,7 @@ retry:
     client->sendsignon = true;
 
     SVFTE_SetupFrames(client);
+    SV_SetupLegacyFrames(client);
 
     if(client->message.overflowed && client->limit_sounds > 64 && cantruncate)
     {
@@ -2248,6 +2669,14 @@ void SV_Pext_f()
         {
             Con_Printf("  Replacement Stats ('predinfo')\n");
         }
+        if(cl.protocol_pextqvr & PEXTQVR_ACKDELTAS)
+        {
+            Con_Printf("  Acked Entity Deltas\n");
+        }
+        if(cl.protocol_pextqvr & PEXTQVR_PACKED)
+        {
+            Con_Printf("  Packed Entity Deltas\n");
+        }
         if(cl.protocol == PROTOCOL_NETQUAKE)
         {
             Con_Printf("  vanilla(15)\n");
@@ -2285,6 +2714,15 @@ void SV_Pext_f()
             {
                 host_client->protocol_pext2 = value & PEXT2_SUPPORTED_SERVER;
             }
+            else if(key == PROTOCOL_QUAKEVR_PEXT)
+            {
+                host_client->protocol_pextqvr =
+                    value & PEXTQVR_SUPPORTED_SERVER;
+                if(!(host_client->protocol_pextqvr & PEXTQVR_ACKDELTAS))
+                {
+                    host_client->protocol_pextqvr &= ~PEXTQVR_PACKED;
+                }
+            }
             // else some other extension that we don't know
         }
 
@@ -2349,6 +2787,7 @@ void SV_ConnectClient(int clientnum)
 
     client->pextknown = false;
     client->protocol_pext2 = 0;
+    client->protocol_pextqvr = 0;
 
     if(sv.loadgame)
     {
@@ -2447,37 +2886,107 @@ crosses a waterline.
 =============================================================================
 */
 
-static int fatbytes;
-static byte* fatpvs;
-static int fatpvs_capacity;
+#define MAX_FATPVS_LEAFS 64
+#define MAX_FATPVS_CACHE 32
 
-void SV_AddToFatPVS(const qvec3& org, mnode_t* node,
-    qmodel_t* worldmodel) // johnfitz -- added worldmodel as a parameter
+// A fat PVS only depends on the set of leafs near the view origin, so the
+// last few are kept around and reused while clients stay in the same leafs.
+struct fatpvs_t
 {
-    int i;
+    const qmodel_t* model;
+    unsigned int generation;
+    int numleafs; // -1 if not reusable
+    mleaf_t* leafs[MAX_FATPVS_LEAFS];
+    unsigned int lastused;
+
     byte* pvs;
-    mplane_t* plane;
-    float d;
+    int capacity;
+};
+
+static fatpvs_t fatpvs_cache[MAX_FATPVS_CACHE];
+static unsigned int fatpvs_usecount;
+
+static int fatpvs_numleafs;
+static mleaf_t* fatpvs_leafs[MAX_FATPVS_LEAFS];
+static bool fatpvs_overflow;
 
+static void SV_FindFatPVSLeafs(const qvec3& org, mnode_t* node)
+{
     while(true)
     {
-        // if this is a leaf, accumulate the pvs bits
+        // if this is a leaf, remember it
         if(node->contents < 0)
         {
             if(node->contents != CONTENTS_SOLID)
             {
-                pvs = Mod_LeafPVS((mleaf_t*)node,
-                    worldmodel); // johnfitz -- worldmodel as a parameter
-                for(i = 0; i < fatbytes; i++)
+                if(fatpvs_numleafs == MAX_FATPVS_LEAFS)
                 {
-                    fatpvs[i] |= pvs[i];
+                    fatpvs_overflow = true;
+                    return;
                 }
+
+                fatpvs_leafs[fatpvs_numleafs++] = (mleaf_t*)node;
+            }
+            return;
+        }
+
+        const mplane_t* plane = node->plane;
+        const float d = DotProduct(org, plane->normal) - plane->dist;
+        if(d > 8)
+        {
+            node = node->children[0];
+        }
+        else if(d < -8)
+        {
+            node = node->children[1];
+        }
+        else
+        {
+            // go down both
+            SV_FindFatPVSLeafs(org, node->children[0]);
+            node = node->children[1];
+        }
+    }
+}
+
+static void SV_AddToFatPVS(byte* fatpvs, const byte* pvs, const int fatbytes)
+{
+    int i = 0;
+
+    for(; i + 8 <= fatbytes; i += 8)
+    {
+        std::uint64_t a;
+        std::uint64_t b;
+        memcpy(&a, fatpvs + i, 8);
+        memcpy(&b, pvs + i, 8);
+        a |= b;
+        memcpy(fatpvs + i, &a, 8);
+    }
+
+    for(; i < fatbytes; i++)
+    {
+        fatpvs[i] |= pvs[i];
+    }
+}
+
+static void SV_AddNodeToFatPVS(const qvec3& org, mnode_t* node,
+    qmodel_t* worldmodel, byte* fatpvs, const int fatbytes)
+{
+    while(true)
+    {
+        // if this is a leaf, accumulate the pvs bits
+        if(node->contents < 0)
+        {
+            if(node->contents != CONTENTS_SOLID)
+            {
+                SV_AddToFatPVS(fatpvs,
+                    Mod_LeafPVS((mleaf_t*)node, worldmodel), fatbytes);
             }
             return;
         }
 
-        plane = node->plane;
-        d = DotProduct(org, plane->normal) - plane->dist;
+        const mplane_t* plane = node->plane;
+        const float d = DotProduct(org, plane->normal) - plane->dist;
         if(d > 8)
         {
             node = node->children[0];
@@ -2489,41 +2998,100 @@ void SV_AddToFatPVS(const qvec3& org, mnode_t* node,
         else
         {
             // go down both
-            SV_AddToFatPVS(org, node->children[0],
-                worldmodel); // johnfitz -- worldmodel as a parameter
+            SV_AddNodeToFatPVS(
+                org, node->children[0], worldmodel, fatpvs, fatbytes);
             node = node->children[1];
         }
     }
 }
 
+static fatpvs_t* SV_FindCachedFatPVS(const qmodel_t* worldmodel)
+{
+    const unsigned int generation = Mod_PVSGeneration();
+
+    for(fatpvs_t& f : fatpvs_cache)
+    {
+        if(f.model == worldmodel && f.generation == generation &&
+            f.numleafs == fatpvs_numleafs &&
+            !memcmp(f.leafs, fatpvs_leafs, fatpvs_numleafs * sizeof(mleaf_t*)))
+        {
+            return &f;
+        }
+    }
+
+    return nullptr;
+}
+
 /*
 =============
 SV_FatPVS
 
 Calculates a PVS that is the inclusive or of all leafs within 8 pixels of
-the given point.
+the given point. The result stays valid until MAX_FATPVS_CACHE other fat
+PVSs have been computed.
 =============
 */
 byte* SV_FatPVS(const qvec3& org,
     qmodel_t* worldmodel) // johnfitz -- added worldmodel as a parameter
 {
-    fatbytes = (worldmodel->numleafs + 7) >>
-               3; // ericw -- was +31, assumed to be a bug/typo
-    if(fatpvs == nullptr || fatbytes > fatpvs_capacity)
+    fatpvs_numleafs = 0;
+    fatpvs_overflow = false;
+    SV_FindFatPVSLeafs(org, worldmodel->nodes);
+
+    ++fatpvs_usecount;
+
+    fatpvs_t* f = fatpvs_overflow ? nullptr : SV_FindCachedFatPVS(worldmodel);
+    if(f)
     {
-        fatpvs_capacity = fatbytes;
-        fatpvs = (byte*)realloc(fatpvs, fatpvs_capacity);
-        if(!fatpvs)
+        f->lastused = fatpvs_usecount;
+        return f->pvs;
+    }
+
+    // replace the least recently used entry
+    f = &fatpvs_cache[0];
+    for(fatpvs_t& other : fatpvs_cache)
+    {
+        if(other.lastused < f->lastused)
+        {
+            f = &other;
+        }
+    }
+
+    const int fatbytes = (worldmodel->numleafs + 7) >>
+                         3; // ericw -- was +31, assumed to be a bug/typo
+    if(f->pvs == nullptr || fatbytes > f->capacity)
+    {
+        f->capacity = fatbytes;
+        f->pvs = (byte*)realloc(f->pvs, f->capacity);
+        if(!f->pvs)
         {
-            Sys_Error(
-                "SV_FatPVS: realloc() failed on %d bytes", fatpvs_capacity);
+            Sys_Error("SV_FatPVS: realloc() failed on %d bytes", f->capacity);
         }
     }
 
-    Q_memset(fatpvs, 0, fatbytes);
-    SV_AddToFatPVS(org, worldmodel->nodes,
-        worldmodel); // johnfitz -- worldmodel as a parameter
-    return fatpvs;
+    f->model = worldmodel;
+    f->generation = Mod_PVSGeneration();
+    f->numleafs = fatpvs_overflow ? -1 : fatpvs_numleafs;
+    memcpy(f->leafs, fatpvs_leafs, fatpvs_numleafs * sizeof(mleaf_t*));
+    f->lastused = fatpvs_usecount;
+
+    Q_memset(f->pvs, 0, fatbytes);
+
+    if(fatpvs_overflow)
+    {
+        // too many leafs to remember, walk the tree again to get all of them
+        SV_AddNodeToFatPVS(
+            org, worldmodel->nodes, worldmodel, f->pvs, fatbytes);
+        return f->pvs;
+    }
+
+    for(int i = 0; i < fatpvs_numleafs; i++)
+    {
+        SV_AddToFatPVS(
+            f->pvs, Mod_LeafPVS(fatpvs_leafs[i], worldmodel), fatbytes);
+    }
+
+    return f->pvs;
 }
 
 /*
@@ -2557,197 +3125,462 @@ bool SV_VisibleToClient(edict_t* client, edict_t* test, qmodel_t* worldmodel)
 
 /*
 =============
-SV_WriteEntitiesToClient
+SV_DeltaBits
 
+The U_ bits for the fields of `ent` that differ from `from`. With `packed`
+origins and angles are compared on the PEXTQVR_PACKED grids.
 =============
 */
-void SV_WriteEntitiesToClient(client_t* client, sizebuf_t* msg)
+static int SV_DeltaBits(
+    const edict_t* ent, const entity_state_t& from, const bool packed)
 {
-    const unsigned int maxedict = std::min(
-        static_cast<unsigned int>(qcvm->num_edicts), client->limit_entities);
-
-    // try to avoid sounds getting lost. flickering entities are weird, but
-    // missing sounds+particles are just eerie.
-    const int maxsize =
-        msg->maxsize - client->datagram.cursize - sv.datagram.cursize;
-
-    // find the client's PVS
-    const edict_t* clent = client->edict;
-    const qvec3 org = clent->v.origin + clent->v.view_ofs;
-    const byte* pvs = SV_FatPVS(org, qcvm->worldmodel);
+    int bits = 0;
 
-    // send over all entities (excpet the client) that touch the pvs
-    edict_t* ent = NEXT_EDICT(qcvm->edicts);
-    for(unsigned int e = 1; e < maxedict; e++, ent = NEXT_EDICT(ent))
+    for(int i = 0; i < 3; i++)
     {
-        if(ent != clent) // `clent` is ALWAYS sent
+        if(packed)
         {
-            // ignore ents without visible models
-            if(!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
+            if(MSG_PackCoord(ent->v.origin[i]) != MSG_PackCoord(from.origin[i]))
             {
-                continue;
+                bits |= U_ORIGIN1 << i;
             }
+            continue;
+        }
 
-            /*
-            // johnfitz -- don't send model>255 entities if protocol is 15
-            if((unsigned int)ent->v.modelindex >= client->limit_models)
-            {
-                continue;
-            }
-            */
+        float miss = ent->v.origin[i] - from.origin[i];
+        if(miss < -0.1 || miss > 0.1)
+        {
+            bits |= U_ORIGIN1 << i;
+        }
+    }
 
-            // ignore if not touching a PV leaf
-            unsigned int i = 0;
-            for(; i < ent->num_leafs; i++)
-            {
-                if(pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i] & 7)))
-                {
-                    break;
-                }
-            }
+    const auto turned = [&](const int i) {
+        return packed ? MSG_PackAngle(ent->v.angles[i]) !=
+                            MSG_PackAngle(from.angles[i])
+                      : ent->v.angles[i] != from.angles[i];
+    };
 
-            // ericw -- added ent->num_leafs < MAX_ENT_LEAFS
-            // condition.
-            //
-            // if ent->num_leafs == MAX_ENT_LEAFS, the ent is
-            // visible from too many leafs for us to say whether
-            // it's in the PVS, so don't try to vis cull it. this
-            // commonly happens with rotators, because they often
-            // have huge bboxes spanning the entire map, or really
-            // tall lifts, etc.
-            if(i == ent->num_leafs && ent->num_leafs < MAX_ENT_LEAFS)
-            {
-                continue; // not visible
-            }
-        }
+    if(turned(0))
+    {
+        bits |= U_ANGLE1;
+    }
 
-        // johnfitz -- max size for protocol 15 is 18 bytes, not 16 as
-        // originally assumed here.  And, for protocol 85 the max size is
-        // actually 24 bytes.
-        if(msg->cursize + 24 > maxsize)
-        {
-            // johnfitz -- less spammy overflow message
-            if(!dev_overflows.packetsize ||
-                dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime)
-            {
-                Con_Printf("Packet overflow!\n");
-                dev_overflows.packetsize = realtime;
-            }
+    if(turned(1))
+    {
+        bits |= U_ANGLE2;
+    }
 
-            goto stats;
-            // johnfitz
-        }
+    if(turned(2))
+    {
+        bits |= U_ANGLE3;
+    }
 
-        // don't send invisible entities unless they have effects
-        if(ent->alpha == ENTALPHA_ZERO && !ent->v.effects)
-        {
-            continue;
-        }
-        // johnfitz
+    if(ent->v.model_scale != from.model_scale)
+    {
+        bits |= U_SCALE;
+    }
 
-        // send an update
-        int bits = 0;
+    if(ent->v.model_scale_origin != from.model_scale_origin)
+    {
+        bits |= U_SCALE;
+    }
 
-        for(int i = 0; i < 3; i++)
-        {
-            float miss = ent->v.origin[i] - ent->baseline.origin[i];
-            if(miss < -0.1 || miss > 0.1)
-            {
-                bits |= U_ORIGIN1 << i;
-            }
-        }
+    if(from.colormap != ent->v.colormap)
+    {
+        bits |= U_COLORMAP;
+    }
+
+    if(from.skin != ent->v.skin)
+    {
+        bits |= U_SKIN;
+    }
 
-        if(ent->v.angles[0] != ent->baseline.angles[0])
+    if(from.frame != ent->v.frame)
+    {
+        bits |= U_FRAME;
+    }
+
+    if(from.effects != ent->v.effects)
+    {
+        bits |= U_EFFECTS;
+    }
+
+    if(from.modelindex != ent->v.modelindex)
+    {
+        bits |= U_MODEL;
+    }
+
+    // johnfitz -- alpha, refreshed by SV_BuildVisIndex
+    // johnfitz -- PROTOCOL_QUAKEVR
+    if(from.alpha != ent->alpha)
+    {
+        bits |= U_ALPHA;
+    }
+
+    if(from.model_offset != ent->v.model_offset)
+    {
+        bits |= U_MODELOFFSET;
+    }
+
+    if(bits & U_FRAME && (int)ent->v.frame & 0xFF00)
+    {
+        bits |= U_FRAME2;
+    }
+
+    if(bits & U_MODEL && (int)ent->v.modelindex & 0xFF00)
+    {
+        bits |= U_MODEL2;
+    }
+
+    return bits;
+}
+
+static constexpr int sv_anglebits[3] = {U_ANGLE1, U_ANGLE2, U_ANGLE3};
+
+/*
+=============
+SV_PackedAngleDelta
+
+The PEXTQVR_PACKED delta that takes angle `from` to `to`, the short way round.
+=============
+*/
+static int SV_PackedAngleDelta(const float to, const float from)
+{
+    return (short)(MSG_PackAngle(to) - MSG_PackAngle(from));
+}
+
+/*
+=============
+SV_PackedSize
+
+Bits of the PEXTQVR_PACKED block of an update with `bits` from `from`.
+=============
+*/
+static int SV_PackedSize(
+    const edict_t* ent, const entity_state_t& from, const int bits)
+{
+    int size = 0;
+
+    for(int i = 0; i < 3; i++)
+    {
+        if(bits & (U_ORIGIN1 << i))
         {
-            bits |= U_ANGLE1;
+            size += MSG_VarBitsSize(MSG_PackCoord(ent->v.origin[i]) -
+                                        MSG_PackCoord(from.origin[i]),
+                PACKED_COORD_WIDTHS);
         }
+    }
 
-        if(ent->v.angles[1] != ent->baseline.angles[1])
+    for(int i = 0; i < 3; i++)
+    {
+        if(bits & sv_anglebits[i])
         {
-            bits |= U_ANGLE2;
+            size += MSG_VarBitsSize(
+                SV_PackedAngleDelta(ent->v.angles[i], from.angles[i]),
+                PACKED_ANGLE_WIDTHS);
         }
+    }
+
+    return size;
+}
+
+/*
+=============
+SV_UpdateSize
+
+Bytes that SV_WriteEntitiesToClient writes for an update with `bits`, not
+counting the entity number. `packedbits` is the size of the PEXTQVR_PACKED
+block, or -1 if the update isn't packed.
+=============
+*/
+static int SV_UpdateSize(int bits, const int packedbits)
+{
+    const unsigned int flags = sv.protocolflags;
+    const int coord = (flags & (PRFL_FLOATCOORD | PRFL_INT32COORD)) ? 4
+                      : (flags & PRFL_24BITCOORD)                    ? 3
+                                                                     : 2;
+    const int angle = (flags & PRFL_FLOATANGLE)   ? 4
+                      : (flags & PRFL_SHORTANGLE) ? 2
+                                                  : 1;
+
+    int size = 1 + (bits >= 256) + (bits >= 65536) + (bits >= 16777216);
+
+    if(packedbits >= 0)
+    {
+        size += (packedbits + 7) / 8;
+        bits &= ~(U_ORIGIN1 | U_ORIGIN2 | U_ORIGIN3 | U_ANGLE1 | U_ANGLE2 |
+                  U_ANGLE3);
+    }
+
+    for(const int bit : {U_MODEL, U_FRAME, U_COLORMAP, U_SKIN, U_EFFECTS,
+            U_ALPHA, U_FRAME2, U_MODEL2, U_LERPFINISH})
+    {
+        size += (bits & bit) ? 1 : 0;
+    }
+
+    for(const int bit : {U_ORIGIN1, U_ORIGIN2, U_ORIGIN3})
+    {
+        size += (bits & bit) ? coord : 0;
+    }
+
+    for(const int bit : {U_ANGLE1, U_ANGLE2, U_ANGLE3})
+    {
+        size += (bits & bit) ? angle : 0;
+    }
+
+    size += (bits & U_SCALE) ? coord * 6 : 0;
+    size += (bits & U_MODELOFFSET) ? coord * 3 : 0;
 
-        if(ent->v.angles[2] != ent->baseline.angles[2])
+    return size;
+}
+
+/*
+=============
+SV_FindLegacyState
+
+The state the client has for entity `e` as of the frame it acked, if it
+was sent in that frame.
+=============
+*/
+static const entity_state_t* SV_FindLegacyState(
+    const client_t::legacyframe_s* frame, const unsigned int e)
+{
+    const client_t::entity_num_state_s* begin = frame->ents;
+    const client_t::entity_num_state_s* end = frame->ents + frame->numents;
+
+    const auto* it = std::lower_bound(begin, end, e,
+        [](const client_t::entity_num_state_s& s, const unsigned int num)
+        { return s.num < num; });
+
+    return (it != end && it->num == e) ? &it->state : nullptr;
+}
+
+/*
+=============
+SV_RecordLegacyState
+
+Remembers what the client will have for entity `e` once it applies an update
+with `bits` on top of `from`. PEXTQVR_PACKED deltas are taken from these, so
+with `exact` origins and angles are kept as the client decoded them.
+=============
+*/
+static void SV_RecordLegacyState(client_t::legacyframe_s* frame,
+    const unsigned int e, const edict_t* ent, const entity_state_t& from,
+    const int bits, const bool exact)
+{
+    if(frame->numents == frame->maxents)
+    {
+        frame->maxents += 64;
+        const int size = sizeof(*frame->ents) * frame->maxents;
+        frame->ents =
+            (client_t::entity_num_state_s*)realloc(frame->ents, size);
+        if(!frame->ents)
         {
-            bits |= U_ANGLE3;
+            Sys_Error("SV_RecordLegacyState: realloc() failed on %d bytes",
+                size);
         }
+    }
+
+    client_t::entity_num_state_s& to = frame->ents[frame->numents++];
+    to.num = e;
+    to.state = from;
 
-        if(ent->v.model_scale != ent->baseline.model_scale)
+    for(int i = 0; i < 3; i++)
+    {
+        if(bits & (U_ORIGIN1 << i))
         {
-            bits |= U_SCALE;
+            to.state.origin[i] = ent->v.origin[i];
         }
+    }
+
+    if(bits & U_ANGLE1)
+    {
+        to.state.angles[0] = ent->v.angles[0];
+    }
+
+    if(bits & U_ANGLE2)
+    {
+        to.state.angles[1] = ent->v.angles[1];
+    }
+
+    if(bits & U_ANGLE3)
+    {
+        to.state.angles[2] = ent->v.angles[2];
+    }
+
+    if(bits & U_SCALE)
+    {
+        to.state.model_scale = ent->v.model_scale;
+        to.state.model_scale_origin = ent->v.model_scale_origin;
+    }
 
-        if(ent->v.model_scale_origin != ent->baseline.model_scale_origin)
+    if(bits & U_MODELOFFSET)
+    {
+        to.state.model_offset = ent->v.model_offset;
+    }
+
+    if(bits & U_COLORMAP)
+    {
+        to.state.colormap = ent->v.colormap;
+    }
+
+    if(bits & U_SKIN)
+    {
+        to.state.skin = ent->v.skin;
+    }
+
+    if(bits & U_FRAME)
+    {
+        to.state.frame = ent->v.frame;
+    }
+
+    if(bits & U_EFFECTS)
+    {
+        to.state.effects = ent->v.effects;
+    }
+
+    if(bits & U_MODEL)
+    {
+        to.state.modelindex = ent->v.modelindex;
+    }
+
+    if(bits & U_ALPHA)
+    {
+        to.state.alpha = ent->alpha;
+    }
+
+    if(!exact)
+    {
+        return;
+    }
+
+    qvec3& org = to.state.origin;
+    qvec3& ang = to.state.angles;
+    for(int i = 0; i < 3; i++)
+    {
+        if(!(bits & U_ACKED))
         {
-            bits |= U_SCALE;
+            // sent, or left at the baseline, with the legacy encoding
+            org[i] = MSG_QuantizeCoord(org[i], sv.protocolflags);
+            ang[i] = MSG_QuantizeAngle(ang[i], sv.protocolflags);
+            continue;
         }
 
-        if(ent->v.movetype == MOVETYPE_STEP)
+        if(bits & (U_ORIGIN1 << i))
         {
-            bits |= U_STEP; // don't mess up the step animation
+            org[i] = MSG_UnpackCoord(MSG_PackCoord(org[i]));
         }
 
-        if(ent->baseline.colormap != ent->v.colormap)
+        if(bits & sv_anglebits[i])
         {
-            bits |= U_COLORMAP;
+            ang[i] = MSG_UnpackAngle(MSG_PackAngle(ang[i]));
         }
+    }
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+With PEXTQVR_ACKDELTAS each entity is deltaed from whichever is cheaper, its
+baseline or its state in the last frame the client acked.
+=============
+*/
+static void SV_WriteEntitiesToClient(
+    client_t* client, sizebuf_t* msg, sv_snapshotctx_t& ctx)
+{
+    const unsigned int maxedict = std::min(
+        static_cast<unsigned int>(qcvm->num_edicts), client->limit_entities);
+
+    // try to avoid sounds getting lost. flickering entities are weird, but
+    // missing sounds+particles are just eerie.
+    const int maxsize =
+        msg->maxsize - client->datagram.cursize - sv.datagram.cursize;
 
-        if(ent->baseline.skin != ent->v.skin)
+    client_t::legacyframe_s* frame = nullptr;
+    const client_t::legacyframe_s* acked = nullptr;
+    const bool pack = client->protocol_pextqvr & PEXTQVR_PACKED;
+    if(client->legacyframes)
+    {
+        frame = &client->legacyframes[client->legacysequence %
+                                      NUM_LEGACY_FRAMES];
+        if(client->legacybase)
         {
-            bits |= U_SKIN;
+            acked = &client->legacyframes[client->legacybase %
+                                          NUM_LEGACY_FRAMES];
         }
+    }
 
-        if(ent->baseline.frame != ent->v.frame)
-        {
-            bits |= U_FRAME;
-        }
+    // send over all entities (excpet the client) that touch the pvs
+    for(const int e : SV_FindVisibleEdicts(client, ctx, maxedict, false))
+    {
+        edict_t* ent = EDICT_NUM(e);
 
-        if(ent->baseline.effects != ent->v.effects)
+        /*
+        // johnfitz -- don't send model>255 entities if protocol is 15
+        if((unsigned int)ent->v.modelindex >= client->limit_models)
         {
-            bits |= U_EFFECTS;
+            continue;
         }
+        */
 
-        if(ent->baseline.modelindex != ent->v.modelindex)
+        // don't send invisible entities unless they have effects
+        if(ent->alpha == ENTALPHA_ZERO && !ent->v.effects)
         {
-            bits |= U_MODEL;
+            continue;
         }
+        // johnfitz
 
-        // johnfitz -- alpha
-        // TODO: find a cleaner place to put this code
-        if(eval_t* val = GetEdictFieldValue(ent, qcvm->extfields.alpha))
-        {
-            ent->alpha = ENTALPHA_ENCODE(val->_float);
-        }
+        // send an update
+        int flags = 0;
 
-        // johnfitz -- PROTOCOL_QUAKEVR
-        if(ent->baseline.alpha != ent->alpha)
+        if(ent->v.movetype == MOVETYPE_STEP)
         {
-            bits |= U_ALPHA;
+            flags |= U_STEP; // don't mess up the step animation
         }
 
-        if(ent->baseline.model_scale != ent->v.model_scale)
+        if(ent->sendinterval)
         {
-            bits |= U_SCALE;
+            flags |= U_LERPFINISH;
         }
 
-        if(ent->baseline.model_offset != ent->v.model_offset)
-        {
-            bits |= U_MODELOFFSET;
-        }
+        const entity_state_t* from = &ent->baseline;
+        int bits = SV_DeltaBits(ent, *from, false) | flags;
+        int size = SV_UpdateSize(bits, -1);
+        bool packed = false;
 
-        if(bits & U_FRAME && (int)ent->v.frame & 0xFF00)
+        if(acked)
         {
-            bits |= U_FRAME2;
+            const entity_state_t* state = SV_FindLegacyState(acked, e);
+            if(state)
+            {
+                const int ackedbits =
+                    SV_DeltaBits(ent, *state, pack) | flags | U_ACKED;
+                const int packedbits =
+                    pack ? SV_PackedSize(ent, *state, ackedbits) : -1;
+                const int ackedsize = SV_UpdateSize(ackedbits, packedbits);
+                if(ackedsize < size)
+                {
+                    from = state;
+                    bits = ackedbits;
+                    size = ackedsize;
+                    packed = pack;
+                }
+            }
         }
 
-        if(bits & U_MODEL && (int)ent->v.modelindex & 0xFF00)
+        // the exact size rather than a worst case, as an overflow would
+        // Host_Error on a worker thread. +3 for the entity number and the
+        // U_MOREBITS byte U_LONGENTITY may need
+        if(msg->cursize + size + 3 > maxsize)
         {
-            bits |= U_MODEL2;
+            ctx.packetoverflow = true;
+            break;
         }
 
-        if(ent->sendinterval)
+        if(frame)
         {
-            bits |= U_LERPFINISH;
+            SV_RecordLegacyState(frame, e, ent, *from, bits, pack);
         }
 
         if(bits >= 65536)
@@ -2826,12 +3659,12 @@ void SV_WriteEntitiesToClient(client_t* client, sizebuf_t* msg)
             MSG_WriteByte(msg, ent->v.effects);
         }
 
-        if(bits & U_ORIGIN1)
+        if(!packed && (bits & U_ORIGIN1))
         {
             MSG_WriteCoord(msg, ent->v.origin[0], sv.protocolflags);
         }
 
-        if(bits & U_ANGLE1)
+        if(!packed && (bits & U_ANGLE1))
         {
             MSG_WriteAngle(msg, ent->v.angles[0], sv.protocolflags);
         }
@@ -2841,12 +3674,12 @@ void SV_WriteEntitiesToClient(client_t* client, sizebuf_t* msg)
             MSG_WriteCoord(msg, ent->v.model_scale[0], sv.protocolflags);
         }
 
-        if(bits & U_ORIGIN2)
+        if(!packed && (bits & U_ORIGIN2))
         {
             MSG_WriteCoord(msg, ent->v.origin[1], sv.protocolflags);
         }
 
-        if(bits & U_ANGLE2)
+        if(!packed && (bits & U_ANGLE2))
         {
             MSG_WriteAngle(msg, ent->v.angles[1], sv.protocolflags);
         }
@@ -2856,12 +3689,12 @@ void SV_WriteEntitiesToClient(client_t* client, sizebuf_t* msg)
             MSG_WriteCoord(msg, ent->v.model_scale[1], sv.protocolflags);
         }
 
-        if(bits & U_ORIGIN3)
+        if(!packed && (bits & U_ORIGIN3))
         {
             MSG_WriteCoord(msg, ent->v.origin[2], sv.protocolflags);
         }
 
-        if(bits & U_ANGLE3)
+        if(!packed && (bits & U_ANGLE3))
         {
             MSG_WriteAngle(msg, ent->v.angles[2], sv.protocolflags);
         }
@@ -2903,21 +3736,38 @@ void SV_WriteEntitiesToClient(client_t* client, sizebuf_t* msg)
                 msg, (byte)(Q_rint((ent->v.nextthink - qcvm->time) * 255)));
         }
         // johnfitz
-    }
 
-    // johnfitz -- devstats
-stats:
-    if(msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
-    {
-        Con_DWarning(
-            "%i byte packet exceeds standard limit of 1024 (max = "
-            "%d).\n",
-            msg->cursize, msg->maxsize);
+        if(packed)
+        {
+            msgbits_t acc{};
+
+            for(int i = 0; i < 3; i++)
+            {
+                if(bits & (U_ORIGIN1 << i))
+                {
+                    MSG_WriteVarBits(msg, acc,
+                        MSG_PackCoord(ent->v.origin[i]) -
+                            MSG_PackCoord(from->origin[i]),
+                        PACKED_COORD_WIDTHS);
+                }
+            }
+
+            for(int i = 0; i < 3; i++)
+            {
+                if(bits & sv_anglebits[i])
+                {
+                    MSG_WriteVarBits(msg, acc,
+                        SV_PackedAngleDelta(ent->v.angles[i], from->angles[i]),
+                        PACKED_ANGLE_WIDTHS);
+                }
+            }
+
+            MSG_FlushBits(msg, acc);
+        }
     }
 
-    dev_stats.packetsize = msg->cursize;
-    dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
-    // johnfitz
+    ctx.packetsize = msg->cursize;
+    ctx.packetmaxsize = msg->maxsize;
 }
 
 /*
@@ -3385,87 +4235,213 @@ void SV_WriteClientdataToMessage(client_t* client, sizebuf_t* msg)
 
 /*
 =======================
-SV_SendClientDatagram
+SV_ReportPacketStats
 =======================
 */
-bool SV_SendClientDatagram(client_t* client)
+static void SV_ReportPacketStats(sv_snapshotctx_t& ctx)
 {
-    byte buf[MAX_DATAGRAM + 1000 /* QSS */];
-    sizebuf_t msg;
+    // johnfitz -- less spammy overflow message
+    if(ctx.packetoverflow)
+    {
+        if(!dev_overflows.packetsize ||
+            dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime)
+        {
+            Con_Printf("Packet overflow!\n");
+            dev_overflows.packetsize = realtime;
+        }
 
-    // QSS
-    if(!client->netconnection)
+        ctx.packetoverflow = false;
+    }
+
+    // johnfitz -- devstats
+    if(ctx.packetsize > 1024 && dev_peakstats.packetsize <= 1024)
     {
-        // botclient, shouldn't be sent anything.
-        SZ_Clear(&client->datagram);
-        return true;
+        Con_DWarning(
+            "%i byte packet exceeds standard limit of 1024 (max = "
+            "%d).\n",
+            ctx.packetsize, ctx.packetmaxsize);
+    }
+
+    dev_stats.packetsize = ctx.packetsize;
+    dev_peakstats.packetsize = q_max(ctx.packetsize, dev_peakstats.packetsize);
+    // johnfitz
+}
+
+/*
+=======================
+SV_SnapshotContext
+=======================
+*/
+static sv_snapshotctx_t& SV_SnapshotContext(client_t* client)
+{
+    const size_t slot = client - svs.clients;
+    if(sv_snapshotctxs.size() <= slot)
+    {
+        sv_snapshotctxs.resize(svs.maxclientslimit);
     }
 
+    return sv_snapshotctxs[slot];
+}
+
+/*
+=======================
+SV_BeginClientDatagram
+
+Writes everything that comes before the entities and may touch QC state
+(damage, client data, stats), and captures the client's PVS. Main thread only.
+=======================
+*/
+static void SV_BeginClientDatagram(client_t* client, sv_snapshotctx_t& ctx)
+{
+    sizebuf_t& msg = ctx.msg;
+
     msg.allowoverflow = false; // QSS
-    msg.data = buf;
+    msg.data = ctx.buf;
     msg.maxsize = client->limit_unreliable;
     msg.cursize = 0;
 
+    ctx.writeentities = false;
+
     if(client->download.file)
     {
         msg.maxsize /= 2; // make sure there's space for download data
     }
 
     host_client = client;
-    if(client->spawned)
+    if(!client->spawned)
     {
-        sv_player = client->edict;
+        return;
+    }
 
-        if(client->protocol_pext2 & PEXT2_REPLACEMENTDELTAS)
-        {
-            SV_WriteDamageToMessage(client->edict, &msg);
+    sv_player = client->edict;
 
-            if(!(client->protocol_pext2 & PEXT2_PREDINFO))
-            {
-                SV_WriteClientdataToMessage(client, &msg);
-            }
-            else
-            {
-                SVFTE_WriteStats(client, &msg);
-            }
+    const bool fte = client->protocol_pext2 & PEXT2_REPLACEMENTDELTAS;
+    if(fte)
+    {
+        SV_WriteDamageToMessage(client->edict, &msg);
 
-            if(!client->snapshotresume)
-            {
-                SVFTE_BuildSnapshotForClient(client);
-                SVFTE_CalcEntityDeltas(client);
-            }
-            SVFTE_WriteEntitiesToClient(
-                client, &msg, sizeof(buf)); // must always write some data, or
-                                            // the stats will break
-
-            // this delta protocol doesn't wipe old state just because there's a
-            // new packet. the server isn't required to sync with the client
-            // frames either so we can just spam multiple packets to keep our
-            // udp data under the MTU
-            while(client->snapshotresume)
-            {
-                NET_SendUnreliableMessage(client->netconnection, &msg);
-                SZ_Clear(&msg);
-                SVFTE_WriteEntitiesToClient(client, &msg, sizeof(buf));
-            }
+        if(!(client->protocol_pext2 & PEXT2_PREDINFO))
+        {
+            SV_WriteClientdataToMessage(client, &msg);
         }
         else
         {
-            MSG_WriteByte(&msg, svc_time);
-            MSG_WriteFloat(&msg, qcvm->time);
+            SVFTE_WriteStats(client, &msg);
+        }
+    }
+    else
+    {
+        MSG_WriteByte(&msg, svc_time);
+        MSG_WriteFloat(&msg, qcvm->time);
+
+        if(client->protocol_pext2 & PEXT2_PREDINFO)
+        {
+            MSG_WriteShort(&msg, (client->lastmovemessage & 0xffff));
+        }
 
-            if(client->protocol_pext2 & PEXT2_PREDINFO)
-            {
-                MSG_WriteShort(&msg, (client->lastmovemessage & 0xffff));
-            }
+        if(client->legacyframes)
+        {
+            SV_BeginLegacyFrame(client);
+            MSG_WriteLong(&msg, client->legacysequence);
+            MSG_WriteLong(&msg, client->legacybase);
+        }
 
-            // add the client specific data to the datagram
-            SV_WriteDamageToMessage(client->edict, &msg);
-            SV_WriteClientdataToMessage(client, &msg);
+        // add the client specific data to the datagram
+        SV_WriteDamageToMessage(client->edict, &msg);
+        SV_WriteClientdataToMessage(client, &msg);
+    }
+
+    client->netbytes[SVBW_CLIENTDATA] += msg.cursize;
+    ctx.writeentities = true;
+
+    if(fte && client->snapshotresume)
+    {
+        return; // still flushing the previous snapshot, no new one needed
+    }
+
+    if(!sv_visindex.valid)
+    {
+        SV_BuildVisIndex();
+    }
 
-            SV_WriteEntitiesToClient(client, &msg);
+    if(ctx.stamp.size() < static_cast<size_t>(qcvm->num_edicts))
+    {
+        ctx.stamp.assign(qcvm->max_edicts, 0);
+        ctx.stampgen = 0;
+    }
+
+    // find the client's PVS
+    const edict_t* clent = client->edict;
+    const qvec3 org = clent->v.origin + clent->v.view_ofs;
+    const byte* pvs = SV_FatPVS(org, qcvm->worldmodel);
+    ctx.pvs.assign(pvs, pvs + ((qcvm->worldmodel->numleafs + 7) >> 3));
+}
+
+/*
+=======================
+SV_WriteClientEntities
+
+Builds the client's entity snapshot and writes it to the datagram started by
+SV_BeginClientDatagram. Only reads shared server state, so it may run on a
+worker thread for several clients at once.
+=======================
+*/
+static void SV_WriteClientEntities(client_t* client, sv_snapshotctx_t& ctx)
+{
+    const int start = ctx.msg.cursize;
+
+    if(client->protocol_pext2 & PEXT2_REPLACEMENTDELTAS)
+    {
+        if(!client->snapshotresume)
+        {
+            SVFTE_BuildSnapshotForClient(client, ctx);
+            SVFTE_CalcEntityDeltas(client, ctx);
+        }
+
+        // must always write some data, or the stats will break
+        SVFTE_WriteEntitiesToClient(client, &ctx.msg, sizeof(ctx.buf), ctx);
+    }
+    else
+    {
+        SV_WriteEntitiesToClient(client, &ctx.msg, ctx);
+    }
+
+    client->netbytes[SVBW_ENTITIES] += ctx.msg.cursize - start;
+}
+
+/*
+=======================
+SV_FinishClientDatagram
+
+Appends the private and server datagrams, voice and download data to the
+datagram and sends it. Main thread only.
+=======================
+*/
+static bool SV_FinishClientDatagram(client_t* client, sv_snapshotctx_t& ctx)
+{
+    sizebuf_t& msg = ctx.msg;
+
+    host_client = client;
+    if(client->spawned)
+    {
+        sv_player = client->edict;
+        SV_ReportPacketStats(ctx);
+
+        // this delta protocol doesn't wipe old state just because there's a
+        // new packet. the server isn't required to sync with the client
+        // frames either so we can just spam multiple packets to keep our
+        // udp data under the MTU
+        while(client->snapshotresume)
+        {
+            NET_SendUnreliableMessage(client->netconnection, &msg);
+            SZ_Clear(&msg);
+            SVFTE_WriteEntitiesToClient(client, &msg, sizeof(ctx.buf), ctx);
+            client->netbytes[SVBW_ENTITIES] += msg.cursize;
+            SV_ReportPacketStats(ctx);
         }
 
+        const int start = msg.cursize;
+
         // copy the private datagram if there is space
         if(msg.cursize + client->datagram.cursize < msg.maxsize &&
             !client->datagram.overflowed)
@@ -3480,12 +4456,18 @@ bool SV_SendClientDatagram(client_t* client)
         {
             SZ_Write(&msg, sv.datagram.data, sv.datagram.cursize);
         }
+
+        client->netbytes[SVBW_DATAGRAM] += msg.cursize - start;
     }
 
+    int start = msg.cursize;
     SV_VoiceSendPacket(client, &msg);
+    client->netbytes[SVBW_VOICE] += msg.cursize - start;
 
+    start = msg.cursize;
     msg.maxsize = client->limit_unreliable;
     Host_AppendDownloadData(client, &msg);
+    client->netbytes[SVBW_DOWNLOAD] += msg.cursize - start;
 
 
     // send the datagram
@@ -3493,12 +4475,83 @@ bool SV_SendClientDatagram(client_t* client)
         NET_SendUnreliableMessage(client->netconnection, &msg) == -1)
     {
         SV_DropClient(false); // if the message couldn't send, kick off
+        SV_InvalidateVisIndex();
         return false;
     }
 
     return true;
 }
 
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+bool SV_SendClientDatagram(client_t* client)
+{
+    // QSS
+    if(!client->netconnection)
+    {
+        // botclient, shouldn't be sent anything.
+        SZ_Clear(&client->datagram);
+        return true;
+    }
+
+    sv_snapshotctx_t& ctx = SV_SnapshotContext(client);
+    client->netframes++;
+
+    if(!ctx.begun)
+    {
+        SV_BeginClientDatagram(client, ctx);
+    }
+    ctx.begun = false;
+
+    if(ctx.writeentities)
+    {
+        SV_WriteClientEntities(client, ctx);
+        ctx.writeentities = false;
+    }
+
+    return SV_FinishClientDatagram(client, ctx);
+}
+
+/*
+=======================
+SV_WriteClientEntitiesParallel
+
+Starts the datagram of every spawned client and writes their entities across
+the worker pool. SV_SendClientMessages then only has to finish and send them.
+=======================
+*/
+static void SV_WriteClientEntitiesParallel()
+{
+    static std::vector<client_t*> clients;
+    clients.clear();
+
+    client_t* client = svs.clients;
+    for(int i = 0; i < svs.maxclients; i++, client++)
+    {
+        if(!client->active || !client->netconnection || !client->spawned)
+        {
+            continue;
+        }
+
+        sv_snapshotctx_t& ctx = SV_SnapshotContext(client);
+        SV_BeginClientDatagram(client, ctx);
+        ctx.begun = true;
+        if(ctx.writeentities)
+        {
+            clients.push_back(client);
+        }
+    }
+
+    quake::tasks::parallelFor(static_cast<int>(clients.size()), [](int i) {
+        sv_snapshotctx_t& ctx = SV_SnapshotContext(clients[i]);
+        SV_WriteClientEntities(clients[i], ctx);
+        ctx.writeentities = false;
+    });
+}
+
 /*
 =======================
 SV_UpdateToReliableMessages
@@ -3713,11 +4766,26 @@ SV_SendClientMessages
 */
 void SV_SendClientMessages()
 {
+    QUAKE_PROFILE_ZONE("SV_SendClientMessages");
+
     int i;
 
     // update frags, names, etc
     SV_UpdateToReliableMessages();
 
+    // entities may have moved or changed models since the last frame
+    SV_InvalidateVisIndex();
+
+    for(sv_snapshotctx_t& ctx : sv_snapshotctxs)
+    {
+        ctx.begun = false;
+    }
+
+    if(sv_parallelsnapshots.value && quake::tasks::numWorkers() > 0)
+    {
+        SV_WriteClientEntitiesParallel();
+    }
+
     // build individual updates
     for(i = 0, host_client = svs.clients; i < svs.maxclients;
         i++, host_client++)
@@ -3807,6 +4875,7 @@ void SV_SendClientMessages()
         {
             SZ_Clear(&host_client->message);
             SV_DropClient(false);
+            SV_InvalidateVisIndex();
             continue;
         }
 
@@ -3821,9 +4890,12 @@ void SV_SendClientMessages()
             if(host_client->dropasap)
             {
                 SV_DropClient(false); // went to another level
+                SV_InvalidateVisIndex();
             }
             else
             {
+                host_client->netbytes[SVBW_RELIABLE] +=
+                    host_client->message.cursize;
                 if(NET_SendMessage(
                        host_client->netconnection, &host_client->message) == -1)
                 {
@@ -3840,6 +4912,7 @@ void SV_SendClientMessages()
         }
     }
 
+    NET_Flush();
 
     // clear muzzle flashes
     SV_CleanupEnts();
@@ -3854,6 +4927,43 @@ SERVER SPAWNING
 ==============================================================================
 */
 
+/*
+================
+SV_SetModelPrecache
+
+Stores `name` in sv.model_precache[i]. It must stay valid for the lifetime of
+the server, like every other precache string.
+================
+*/
+void SV_SetModelPrecache(const int i, const char* name)
+{
+    // a restored savegame may overwrite slots set up by SV_SpawnServer
+    if(const char* old = sv.model_precache[i])
+    {
+        const auto it = sv.model_precache_index.find(old);
+        if(it != sv.model_precache_index.end() && it->second == i)
+        {
+            sv.model_precache_index.erase(it);
+        }
+    }
+
+    sv.model_precache[i] = name;
+    sv.model_precache_index.emplace(name, i); // the first slot wins
+}
+
+/*
+================
+SV_FindModelPrecache
+
+Returns the model_precache slot of `name`, or -1.
+================
+*/
+int SV_FindModelPrecache(const char* name)
+{
+    const auto it = sv.model_precache_index.find(name);
+    return it != sv.model_precache_index.end() ? it->second : -1;
+}
+
 /*
 ================
 SV_ModelIndex
@@ -3867,16 +4977,8 @@ int SV_ModelIndex(const char* name)
         return 0;
     }
 
-    int i;
-    for(i = 0; i < MAX_MODELS && sv.model_precache[i]; ++i)
-    {
-        if(!strcmp(sv.model_precache[i], name))
-        {
-            return i;
-        }
-    }
-
-    if(i == MAX_MODELS || !sv.model_precache[i])
+    const int i = SV_FindModelPrecache(name);
+    if(i == -1)
     {
         Sys_Error("SV_ModelIndex: model %s not precached", name);
     }
@@ -4055,6 +5157,10 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
     Con_DPrintf("SpawnServer: %s\n", server);
     svs.changelevel_issued = false; // now safe to issue another
 
+    // pick up maps and assets added to the game directory since the last load
+    COM_InvalidateFileIndex();
+    COM_BeginLoadStats();
+
     //
     // tell all connected clients that we are going to a new level
     //
@@ -4119,6 +5225,7 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
     memset(qcvm->edicts, 0,
         qcvm->num_edicts * qcvm->edict_size); // ericw -- qcvm->edicts
                                               // switched to use malloc()
+    ED_RebuildFreeList();
     for(int i = 0; i < svs.maxclients; i++)
     {
         edict_t* ent = EDICT_NUM(i + 1);
@@ -4135,7 +5242,15 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
     q_strlcpy(sv.name, server, sizeof(sv.name));
     q_snprintf(sv.modelname, sizeof(sv.modelname), "maps/%s.bsp", server);
 
+    // read the map and its sidecar files in parallel
+    if(Mod_NeedsLoad(sv.modelname))
+    {
+        const std::string base = std::string{"maps/"} + server;
+        COM_Prefetch({sv.modelname, base + ".lit", base + ".ent"});
+    }
+
     qcvm->worldmodel = Mod_ForName(sv.modelname, false);
+    COM_ClearPrefetch();
     if(!qcvm->worldmodel || qcvm->worldmodel->type != mod_brush)
     {
         Con_Printf("Couldn't spawn server %s\n", sv.modelname);
@@ -4155,8 +5270,8 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
     sv.initializeWorldTexts();
 
     sv.sound_precache[0] = dummy;
-    sv.model_precache[0] = dummy;
-    sv.model_precache[1] = sv.modelname;
+    SV_SetModelPrecache(0, dummy);
+    SV_SetModelPrecache(1, sv.modelname);
     if(qcvm->worldmodel->numsubmodels > MAX_MODELS)
     {
         Con_Printf("too many inline models %s\n", sv.modelname);
@@ -4165,7 +5280,7 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
     }
     for(int i = 1; i < qcvm->worldmodel->numsubmodels; i++)
     {
-        sv.model_precache[1 + i] = localmodels[i];
+        SV_SetModelPrecache(1 + i, localmodels[i]);
         sv.models[i + 1] = Mod_ForName(localmodels[i], false);
     }
 
@@ -4205,6 +5320,9 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
 
     ED_LoadFromFile(qcvm->worldmodel->entities);
 
+    // now that the level's entities are known, fit the areanode tree to them
+    SV_RebalanceWorld();
+
     sv.active = true;
 
     SV_Precache_Model("progs/player.mdl"); // Spike -- SV_CreateBaseline depends
@@ -4265,5 +5383,10 @@ void SV_SpawnServer(const char* server, const SpawnServerSrc src)
         VR_OnSpawnServer();
     }
 
+    if(isDedicated)
+    {
+        COM_EndLoadStats(); // a local client ends it in CL_CheckDownloads
+    }
+
     Con_DPrintf("Server spawned.\n");
 }
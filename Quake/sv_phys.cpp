@@ -33,6 +33,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakeglm.hpp"
 #include "sys.hpp"
 #include "qcvm.hpp"
+#include "tasks.hpp"
+#include "cmd.hpp"
+#include "profiler.hpp"
 
 #include <algorithm>
 #include <tuple>
@@ -70,6 +73,7 @@ cvar_t sv_gameplayfix_spawnbeforethinks = {
 cvar_t sv_sound_watersplash = {
     "sv_sound_watersplash", "misc/h2ohit1.wav", CVAR_NONE};
 cvar_t sv_sound_land = {"sv_sound_land", "demon/dland2.wav", CVAR_NONE};
+cvar_t sv_physics_parallel = {"sv_physics_parallel", "1", CVAR_NONE};
 
 
 #define MOVE_EPSILON 0.01
@@ -1634,6 +1638,188 @@ void SV_Physics_Step(edict_t* ent)
 
 //============================================================================
 
+// Timing and prefetch counters reported by `sv_physstats`.
+static struct
+{
+    unsigned long long frames;
+    unsigned long long prefetched;
+    double prefetchtime;
+    double totaltime;
+} sv_physstats;
+
+/*
+=============
+SV_PrefetchTossMove
+
+Runs on a worker thread. Predicts the world traces SV_Physics_Toss will make
+for this edict, assuming nothing else touches it before its turn: the ground
+check from each bottom corner, then the move itself. Wrong guesses are
+harmless, as they simply never match in SV_Move.
+=============
+*/
+static void SV_PrefetchTossMove(const int entnum)
+{
+    edict_t* ent = EDICT_NUM(entnum);
+
+    const bool fly = ent->v.movetype == MOVETYPE_FLY ||
+                     ent->v.movetype == MOVETYPE_FLYMISSILE;
+
+    const eval_t* val = GetEdictFieldValue(ent, qcvm->extfields.gravity);
+    const float gravity = (val && val->_float) ? val->_float : 1.0;
+    const float gravityDelta = fly ? 0.f : SV_AddGravityImpl(gravity);
+
+    const float frametime = static_cast<float>(host_frametime);
+
+    // ground check, see `quake::util::checkGroundCollision`
+    {
+        qvec3 vel = ent->v.velocity;
+        vel[2] -= gravityDelta;
+
+        const qvec3 move = vel * frametime;
+        const qvec3 bottomOrigin = ent->v.origin + ent->v.mins[2];
+
+        const auto prefetchCorner = [&](const qvec3& offset)
+        {
+            const qvec3 pos = bottomOrigin + offset;
+            SV_PrefetchWorldTrace(
+                entnum, pos, vec3_zero, vec3_zero, pos + move);
+            return false;
+        };
+
+        if(ent->v.mins == vec3_zero && ent->v.maxs == vec3_zero)
+        {
+            prefetchCorner(vec3_zero);
+        }
+        else
+        {
+            (void)quake::util::anyXYCorner(*ent, prefetchCorner);
+        }
+    }
+
+    // the move itself, see `SV_CheckVelocity` and `SV_PushEntity`
+    {
+        qvec3 vel = ent->v.velocity;
+
+        for(int i = 0; i < 3; i++)
+        {
+            if(IS_NAN(vel[i]) || IS_NAN(ent->v.origin[i]))
+            {
+                return;
+            }
+
+            vel[i] = std::clamp(vel[i], float(-sv_maxvelocity.value),
+                float(sv_maxvelocity.value));
+        }
+
+        vel[2] -= gravityDelta;
+
+        const qvec3 push = vel * frametime;
+        SV_PrefetchWorldTrace(entnum, ent->v.origin - push, ent->v.mins,
+            ent->v.maxs, ent->v.origin + push);
+    }
+}
+
+/*
+=============
+SV_PrefetchTossMoves
+
+Collects the toss, bounce and fly edicts that will not think this frame and
+predicts their world traces in parallel.
+=============
+*/
+static void SV_PrefetchTossMoves(const int entity_cap)
+{
+    static std::vector<int> candidates;
+    candidates.clear();
+
+    edict_t* ent = EDICT_NUM(svs.maxclients + 1);
+    for(int i = svs.maxclients + 1; i < entity_cap; i++, ent = NEXT_EDICT(ent))
+    {
+        if(ent->free)
+        {
+            continue;
+        }
+
+        if(ent->v.movetype != MOVETYPE_TOSS &&
+            ent->v.movetype != MOVETYPE_BOUNCE &&
+            ent->v.movetype != MOVETYPE_FLY &&
+            ent->v.movetype != MOVETYPE_FLYMISSILE)
+        {
+            continue;
+        }
+
+        // thinking runs QC first, which usually changes the move
+        const auto thinksNow = [&](const float nextthink, const func_t think)
+        {
+            return think && nextthink > 0 &&
+                   nextthink <= qcvm->time + host_frametime;
+        };
+
+        if(thinksNow(ent->v.nextthink, ent->v.think) ||
+            thinksNow(ent->v.nextthink2, ent->v.think2))
+        {
+            continue;
+        }
+
+        candidates.push_back(i);
+    }
+
+    if(candidates.size() < 2 || !SV_BeginWorldTracePrefetch())
+    {
+        return;
+    }
+
+    quake::tasks::parallelFor(int(candidates.size()),
+        [](const int i) { SV_PrefetchTossMove(candidates[i]); });
+
+    sv_physstats.prefetched += candidates.size();
+}
+
+/*
+=============
+SV_PhysStats_f
+
+=============
+*/
+static void SV_PhysStats_f()
+{
+    unsigned long long lookups;
+    unsigned long long hits;
+
+    const bool reset = Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset");
+    SV_WorldTracePrefetchStats(lookups, hits, reset);
+
+    const double frames = sv_physstats.frames ? sv_physstats.frames : 1;
+
+    Con_Printf("parallel    : %s, %d workers\n",
+        sv_physics_parallel.value ? "on" : "off", quake::tasks::numWorkers());
+    Con_Printf("frames      : %llu\n", sv_physstats.frames);
+    Con_Printf("SV_Physics  : %.3f ms/frame\n",
+        sv_physstats.totaltime * 1000.0 / frames);
+    Con_Printf("prefetch    : %.3f ms/frame, %.1f edicts/frame\n",
+        sv_physstats.prefetchtime * 1000.0 / frames,
+        double(sv_physstats.prefetched) / frames);
+    Con_Printf("world traces: %llu, %llu prefetched (%.1f%%)\n", lookups, hits,
+        lookups ? 100.0 * double(hits) / double(lookups) : 0.0);
+
+    if(reset)
+    {
+        memset(&sv_physstats, 0, sizeof(sv_physstats));
+    }
+}
+
+/*
+=============
+SV_InitPhysics
+
+=============
+*/
+void SV_InitPhysics()
+{
+    Cvar_RegisterVariable(&sv_physics_parallel);
+    Cmd_AddCommand("sv_physstats", SV_PhysStats_f);
+}
+
 /*
 ================
 SV_Physics
@@ -1642,10 +1828,14 @@ SV_Physics
 */
 void SV_Physics()
 {
+    QUAKE_PROFILE_ZONE("SV_Physics");
+
     int i;
     int entity_cap; // For sv_freezenonclients
     edict_t* ent;
 
+    const double starttime = Sys_DoubleTime();
+
     // let the progs know that a new frame has started
     pr_global_struct->self = EDICT_TO_PROG(qcvm->edicts);
     pr_global_struct->other = EDICT_TO_PROG(qcvm->edicts);
@@ -1669,6 +1859,18 @@ void SV_Physics()
         entity_cap = qcvm->num_edicts;
     }
 
+    // the world part of projectile traces can be done ahead of time in
+    // parallel, everything else still runs below in edict order
+    const bool prefetch =
+        sv_physics_parallel.value && quake::tasks::numWorkers() > 0;
+
+    if(prefetch)
+    {
+        const double prefetchstart = Sys_DoubleTime();
+        SV_PrefetchTossMoves(entity_cap);
+        sv_physstats.prefetchtime += Sys_DoubleTime() - prefetchstart;
+    }
+
     // for (i=0 ; i<qcvm->num_edicts ; i++, ent = NEXT_EDICT(ent))
     for(i = 0; i < entity_cap; i++, ent = NEXT_EDICT(ent))
     {
@@ -1715,6 +1917,8 @@ void SV_Physics()
         }
     }
 
+    SV_EndWorldTracePrefetch();
+
     if(pr_global_struct->force_retouch)
     {
         pr_global_struct->force_retouch--;
@@ -1724,4 +1928,7 @@ void SV_Physics()
     {
         qcvm->time += host_frametime;
     }
+
+    ++sv_physstats.frames;
+    sv_physstats.totaltime += Sys_DoubleTime() - starttime;
 }
@@ -40,6 +40,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.hpp"
 #include "snd_voip.hpp"
 #include "qcvm.hpp"
+#include "profiler.hpp"
 
 #include <iostream>
 #include <unordered_map>
@@ -901,6 +902,12 @@ bool SV_ReadClientMessage()
                 break;
             }
 
+            case clcdp_ackframe:
+            {
+                SV_AckFrame(host_client, MSG_ReadLong());
+                break;
+            }
+
             case clcfte_voicechat:
             {
                 SV_VoiceReadPacket(host_client);
@@ -920,6 +927,8 @@ SV_RunClients
 */
 void SV_RunClients()
 {
+    QUAKE_PROFILE_ZONE("SV_RunClients");
+
     int i;
 
     // receive from clients first
@@ -0,0 +1,206 @@
+/*
+Copyright (C) 2020-2021 Vittorio Romeo
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "tasks.hpp"
+
+#include "common.hpp"
+#include "console.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quake::tasks
+{
+
+namespace
+{
+
+constexpr int maxWorkers = 16;
+
+struct pool
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // current batch, guarded by `mutex` except for the atomics
+    const std::function<void(int)>* job{nullptr};
+    int count{0};
+    unsigned int generation{0};
+    int busy{0};
+    bool quit{false};
+
+    std::atomic<int> next{0};
+    bool inBatch{false};
+};
+
+[[nodiscard]] pool& thePool() noexcept
+{
+    static pool p;
+    return p;
+}
+
+void drain(pool& p, const std::function<void(int)>& f, const int count)
+{
+    for(int i = p.next.fetch_add(1, std::memory_order_relaxed); i < count;
+        i = p.next.fetch_add(1, std::memory_order_relaxed))
+    {
+        f(i);
+    }
+}
+
+void workerLoop(pool& p)
+{
+    unsigned int seen = 0;
+
+    while(true)
+    {
+        const std::function<void(int)>* job;
+        int count;
+
+        {
+            std::unique_lock lock{p.mutex};
+            p.wake.wait(lock, [&] { return p.quit || p.generation != seen; });
+
+            if(p.quit)
+            {
+                return;
+            }
+
+            seen = p.generation;
+            job = p.job;
+            count = p.count;
+
+            if(job == nullptr)
+            {
+                // woke up after the batch had already been completed
+                continue;
+            }
+
+            ++p.busy;
+        }
+
+        drain(p, *job, count);
+
+        {
+            std::lock_guard lock{p.mutex};
+            if(--p.busy == 0)
+            {
+                p.done.notify_one();
+            }
+        }
+    }
+}
+
+} // namespace
+
+void init()
+{
+    pool& p = thePool();
+
+    int n = int(std::thread::hardware_concurrency()) - 1;
+
+    const int i = COM_CheckParm("-workers");
+    if(i && i < com_argc - 1)
+    {
+        n = atoi(com_argv[i + 1]);
+    }
+
+    n = std::clamp(n, 0, maxWorkers);
+
+    p.workers.reserve(n);
+    for(int w = 0; w < n; ++w)
+    {
+        p.workers.emplace_back([&p] { workerLoop(p); });
+    }
+
+    Con_Printf("Task pool: %d worker threads\n", n);
+}
+
+void shutdown()
+{
+    pool& p = thePool();
+
+    {
+        std::lock_guard lock{p.mutex};
+        p.quit = true;
+    }
+
+    p.wake.notify_all();
+
+    for(std::thread& t : p.workers)
+    {
+        t.join();
+    }
+
+    p.workers.clear();
+}
+
+[[nodiscard]] int numWorkers() noexcept
+{
+    return int(thePool().workers.size());
+}
+
+void parallelFor(const int count, const std::function<void(int)>& f)
+{
+    pool& p = thePool();
+
+    if(count <= 1 || p.workers.empty() || p.inBatch)
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            f(i);
+        }
+
+        return;
+    }
+
+    p.inBatch = true;
+
+    {
+        std::lock_guard lock{p.mutex};
+        p.job = &f;
+        p.count = count;
+        p.next.store(0, std::memory_order_relaxed);
+        ++p.generation;
+    }
+
+    p.wake.notify_all();
+
+    // the calling thread helps out instead of idling
+    drain(p, f, count);
+
+    {
+        // workers that woke up late find no indices left and leave at once
+        std::unique_lock lock{p.mutex};
+        p.done.wait(lock, [&] { return p.busy == 0; });
+        p.job = nullptr;
+    }
+
+    p.inBatch = false;
+}
+
+} // namespace quake::tasks
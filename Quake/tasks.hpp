@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+
+// Small fixed-size worker pool for data-parallel engine work. Jobs must not
+// touch QC state, the hunk/zone allocators, or anything else that is only
+// safe on the main thread.
+
+namespace quake::tasks
+{
+
+void init();
+void shutdown();
+
+// Number of worker threads, not counting the main thread. Zero means that
+// everything runs inline on the caller.
+[[nodiscard]] int numWorkers() noexcept;
+
+// Invokes `f(i)` for every `i` in `[0, count)`, spreading the indices over
+// the workers and the calling thread, and returns once all of them are done.
+// Must be called from the main thread; nested calls run serially.
+void parallelFor(const int count, const std::function<void(int)>& f);
+
+} // namespace quake::tasks
@@ -0,0 +1,332 @@
+/*
+Copyright (C) 2020-2021 Vittorio Romeo
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "texproc.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXPROC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace quake::texproc
+{
+
+namespace
+{
+
+#ifdef TEXPROC_SSE2
+// Per-byte (a + b) >> 1, without the rounding of _mm_avg_epu8, so that the
+// vector paths match the scalar ones bit for bit.
+[[nodiscard]] __m128i averageFloor(const __m128i a, const __m128i b) noexcept
+{
+    const __m128i half =
+        _mm_and_si128(_mm_srli_epi16(_mm_xor_si128(a, b), 1),
+            _mm_set1_epi8(0x7F));
+    return _mm_add_epi8(_mm_and_si128(a, b), half);
+}
+#endif
+
+[[nodiscard]] unsigned char averageFloor(
+    const unsigned char a, const unsigned char b) noexcept
+{
+    return (a + b) >> 1;
+}
+
+} // namespace
+
+void expandIndexed(const unsigned char* in, const int pixels,
+    const unsigned* palette, unsigned* out) noexcept
+{
+    int i = 0;
+    for(; i + 4 <= pixels; i += 4)
+    {
+        out[i + 0] = palette[in[i + 0]];
+        out[i + 1] = palette[in[i + 1]];
+        out[i + 2] = palette[in[i + 2]];
+        out[i + 3] = palette[in[i + 3]];
+    }
+    for(; i < pixels; i++)
+    {
+        out[i] = palette[in[i]];
+    }
+}
+
+void padIndexedW(const unsigned char* in, const int width, const int height,
+    const int outwidth, const unsigned char padbyte,
+    unsigned char* out) noexcept
+{
+    for(int i = 0; i < height; i++, in += width, out += outwidth)
+    {
+        std::memcpy(out, in, width);
+        std::memset(out + width, padbyte, outwidth - width);
+    }
+}
+
+void padIndexedH(const unsigned char* in, const int width, const int height,
+    const int outheight, const unsigned char padbyte,
+    unsigned char* out) noexcept
+{
+    std::memcpy(out, in, width * height);
+    std::memset(out + width * height, padbyte, width * (outheight - height));
+}
+
+void premultiply(unsigned char* data, const std::size_t pixels) noexcept
+{
+    std::size_t i = 0;
+
+#ifdef TEXPROC_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphamask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+    const auto premultiply2 = [&](const __m128i px) {
+        const __m128i alpha = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128i color = _mm_srli_epi16(_mm_mullo_epi16(px, alpha), 8);
+        return _mm_or_si128(_mm_andnot_si128(alphamask, color),
+            _mm_and_si128(alphamask, px));
+    };
+
+    for(; i + 4 <= pixels; i += 4)
+    {
+        unsigned char* p = data + i * 4;
+        const __m128i px = _mm_loadu_si128((const __m128i*)p);
+        const __m128i lo = premultiply2(_mm_unpacklo_epi8(px, zero));
+        const __m128i hi = premultiply2(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for(unsigned char* p = data + i * 4; i < pixels; i++, p += 4)
+    {
+        p[0] = (p[0] * p[3]) >> 8;
+        p[1] = (p[1] * p[3]) >> 8;
+        p[2] = (p[2] * p[3]) >> 8;
+    }
+}
+
+void resample(const unsigned* in, const int inwidth, const int inheight,
+    unsigned* out, const int outwidth, const int outheight,
+    const bool alpha) noexcept
+{
+    const unsigned xfrac = ((inwidth - 1) << 16) / (outwidth - 1);
+    const unsigned yfrac = ((inheight - 1) << 16) / (outheight - 1);
+    unsigned y = 0;
+
+    for(int i = 0; i < outheight; i++, y += yfrac)
+    {
+        const unsigned mody = (y >> 8) & 0xFF;
+        const unsigned imody = 256 - mody;
+        const unsigned injump = (y >> 16) * inwidth;
+        unsigned x = 0;
+
+        for(int j = 0; j < outwidth; j++, x += xfrac)
+        {
+            const unsigned modx = (x >> 8) & 0xFF;
+            const unsigned imodx = 256 - modx;
+
+            const unsigned char* nwpx =
+                (const unsigned char*)(in + (x >> 16) + injump);
+            const unsigned char* nepx = nwpx + 4;
+            const unsigned char* swpx = nwpx + inwidth * 4;
+            const unsigned char* sepx = swpx + 4;
+
+            unsigned char* dest = (unsigned char*)(out + i * outwidth + j);
+
+            const int channels = alpha ? 4 : 3;
+            for(int c = 0; c < channels; c++)
+            {
+                dest[c] = (nwpx[c] * imodx * imody + nepx[c] * modx * imody +
+                              swpx[c] * imodx * mody + sepx[c] * modx * mody) >>
+                          16;
+            }
+
+            if(!alpha)
+            {
+                dest[3] = 255;
+            }
+        }
+    }
+}
+
+void mipMapW(unsigned* data, const int width, const int height) noexcept
+{
+    const int size = (width * height) >> 1;
+    int i = 0;
+
+#ifdef TEXPROC_SSE2
+    // output pixel i averages input pixels 2i and 2i+1; the stores never
+    // overtake the loads, so this works in place
+    for(; i + 4 <= size; i += 4)
+    {
+        const __m128 a = _mm_castsi128_ps(
+            _mm_loadu_si128((const __m128i*)(data + i * 2)));
+        const __m128 b = _mm_castsi128_ps(
+            _mm_loadu_si128((const __m128i*)(data + i * 2 + 4)));
+        const __m128i even =
+            _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m128i odd =
+            _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128((__m128i*)(data + i), averageFloor(even, odd));
+    }
+#endif
+
+    unsigned char* out = (unsigned char*)(data + i);
+    const unsigned char* in = (const unsigned char*)(data + i * 2);
+    for(; i < size; i++, out += 4, in += 8)
+    {
+        out[0] = averageFloor(in[0], in[4]);
+        out[1] = averageFloor(in[1], in[5]);
+        out[2] = averageFloor(in[2], in[6]);
+        out[3] = averageFloor(in[3], in[7]);
+    }
+}
+
+void mipMapH(unsigned* data, const int width, const int height) noexcept
+{
+    for(int row = 0; row < height >> 1; row++)
+    {
+        unsigned* out = data + row * width;
+        const unsigned* top = data + row * 2 * width;
+        const unsigned* bottom = top + width;
+        int j = 0;
+
+#ifdef TEXPROC_SSE2
+        for(; j + 4 <= width; j += 4)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(top + j));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(bottom + j));
+            _mm_storeu_si128((__m128i*)(out + j), averageFloor(a, b));
+        }
+#endif
+
+        for(; j < width; j++)
+        {
+            const unsigned char* t = (const unsigned char*)(top + j);
+            const unsigned char* b = (const unsigned char*)(bottom + j);
+            unsigned char* o = (unsigned char*)(out + j);
+            o[0] = averageFloor(t[0], b[0]);
+            o[1] = averageFloor(t[1], b[1]);
+            o[2] = averageFloor(t[2], b[2]);
+            o[3] = averageFloor(t[3], b[3]);
+        }
+    }
+}
+
+void alphaEdgeFix(unsigned char* data, const int width, const int height)
+{
+    unsigned char* dest = data;
+
+    for(int i = 0; i < height; i++)
+    {
+        const int rows[3] = {width * 4 * ((i == 0) ? height - 1 : i - 1),
+            width * 4 * i, width * 4 * ((i == height - 1) ? 0 : i + 1)};
+
+        for(int j = 0; j < width; j++, dest += 4)
+        {
+            if(dest[3])
+            {
+                // not transparent
+                continue;
+            }
+
+            const int pixels[3] = {4 * ((j == 0) ? width - 1 : j - 1), 4 * j,
+                4 * ((j == width - 1) ? 0 : j + 1)};
+
+            int n = 0;
+            int c[3] = {0, 0, 0};
+            for(const int row : rows)
+            {
+                for(const int pixel : pixels)
+                {
+                    const unsigned char* src = data + row + pixel;
+                    if(src != dest && src[3])
+                    {
+                        c[0] += src[0];
+                        c[1] += src[1];
+                        c[2] += src[2];
+                        n++;
+                    }
+                }
+            }
+
+            // average all non-transparent neighbors
+            if(n)
+            {
+                dest[0] = (unsigned char)(c[0] / n);
+                dest[1] = (unsigned char)(c[1] / n);
+                dest[2] = (unsigned char)(c[2] / n);
+            }
+        }
+    }
+}
+
+void padEdgeFixW(unsigned char* data, const int width, const int padwidth,
+    const int padheight) noexcept
+{
+    // copy last full column to first empty column, leaving alpha byte at zero
+    unsigned char* src = data + (width - 1) * 4;
+    for(int i = 0; i < padheight; i++, src += padwidth * 4)
+    {
+        src[4] = src[0];
+        src[5] = src[1];
+        src[6] = src[2];
+    }
+
+    // copy first full column to last empty column, leaving alpha byte at zero
+    src = data;
+    unsigned char* dst = data + (padwidth - 1) * 4;
+    for(int i = 0; i < padheight;
+        i++, src += padwidth * 4, dst += padwidth * 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+void padEdgeFixH(unsigned char* data, const int height, const int padwidth,
+    const int padheight) noexcept
+{
+    // copy last full row to first empty row, leaving alpha byte at zero
+    unsigned char* dst = data + height * padwidth * 4;
+    unsigned char* src = dst - padwidth * 4;
+    for(int i = 0; i < padwidth; i++, src += 4, dst += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+
+    // copy first full row to last empty row, leaving alpha byte at zero
+    dst = data + (padheight - 1) * padwidth * 4;
+    src = data;
+    for(int i = 0; i < padwidth; i++, src += 4, dst += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+} // namespace quake::texproc
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+// CPU-side texture processing used by the texture manager before upload.
+// Everything here is a pure function over caller-owned buffers: no GL, no
+// hunk and no globals, so it is safe to run on the worker pool and can be
+// exercised without a GL context. 32-bit pixels are RGBA bytes in memory.
+
+namespace quake::texproc
+{
+
+// Expands `pixels` palette indices into 32-bit colors.
+void expandIndexed(const unsigned char* in, const int pixels,
+    const unsigned* palette, unsigned* out) noexcept;
+
+// Copies a `width`x`height` 8-bit image into `out`, which is `outwidth` or
+// `outheight` wide/tall, filling the new columns/rows with `padbyte`.
+void padIndexedW(const unsigned char* in, const int width, const int height,
+    const int outwidth, const unsigned char padbyte,
+    unsigned char* out) noexcept;
+void padIndexedH(const unsigned char* in, const int width, const int height,
+    const int outheight, const unsigned char padbyte,
+    unsigned char* out) noexcept;
+
+// Multiplies the color channels by alpha, in place.
+void premultiply(unsigned char* data, const std::size_t pixels) noexcept;
+
+// Bilinear resample of `in` into `out`; with `alpha` unset the result is
+// opaque.
+void resample(const unsigned* in, const int inwidth, const int inheight,
+    unsigned* out, const int outwidth, const int outheight,
+    const bool alpha) noexcept;
+
+// Halve the width or height of the image in place by averaging pixel pairs.
+// The result is packed at the start of `data`.
+void mipMapW(unsigned* data, const int width, const int height) noexcept;
+void mipMapH(unsigned* data, const int width, const int height) noexcept;
+
+// Gives fully transparent pixels the average color of their opaque
+// neighbours, wrapping at the edges, so that filtering doesn't bleed the
+// transparent color (usually pink) into the visible ones. In place.
+void alphaEdgeFix(unsigned char* data, const int width, const int height);
+
+// Special cases of alphaEdgeFix for images that only need it because they
+// were padded from `width`x`height` to `padwidth`x`padheight`.
+void padEdgeFixW(unsigned char* data, const int width, const int padwidth,
+    const int padheight) noexcept;
+void padEdgeFixH(unsigned char* data, const int height, const int padwidth,
+    const int padheight) noexcept;
+
+} // namespace quake::texproc
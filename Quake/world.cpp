@@ -34,8 +34,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sys.hpp"
 #include "areanode.hpp"
 #include "qcvm.hpp"
+#include "cmd.hpp"
+#include "cvar.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
 
 /*
 
@@ -228,15 +232,69 @@ ENTITY AREA CHECKING
 ===============================================================================
 */
 
+cvar_t sv_areanode_adaptive = {"sv_areanode_adaptive", "1", CVAR_NONE};
+cvar_t sv_areanode_cellsize = {"sv_areanode_cellsize", "512", CVAR_NONE};
+cvar_t sv_areanode_leafedicts = {"sv_areanode_leafedicts", "8", CVAR_NONE};
 
+// Counters used by `sv_areastats` and `sv_areabench`.
+static struct
+{
+    unsigned long long traces;
+    unsigned long long tracenodes;
+    unsigned long long traceedicts;
+    unsigned long long touches;
+    unsigned long long touchnodes;
+} sv_areastats;
+
+/*
+===============
+SV_AreaNodeDepth
+
+Picks the depth of the areanode tree so that leaves are roughly
+`sv_areanode_cellsize` units wide and hold about `sv_areanode_leafedicts`
+edicts each. The legacy fixed depth is used if adaptive sizing is disabled.
+===============
+*/
+static int SV_AreaNodeDepth(
+    const qvec3& mins, const qvec3& maxs, const int numedicts)
+{
+    if(!sv_areanode_adaptive.value)
+    {
+        return AREA_MIN_DEPTH;
+    }
+
+    int depth = AREA_MIN_DEPTH;
+
+    // every split halves the horizontal area of a node
+    const float cellsize = q_max(sv_areanode_cellsize.value, 64.f);
+    const double area = double(maxs[0] - mins[0]) * double(maxs[1] - mins[1]);
+    while(depth < AREA_MAX_DEPTH &&
+          area / double(1 << depth) > double(cellsize) * cellsize)
+    {
+        ++depth;
+    }
+
+    const int leafedicts = q_max(int(sv_areanode_leafedicts.value), 1);
+    while(depth < AREA_MAX_DEPTH && numedicts / (1 << depth) > leafedicts)
+    {
+        ++depth;
+    }
+
+    return depth;
+}
 
 /*
 ===============
 SV_CreateAreaNode
 
+If `centers` is not empty, the node is split at the median of the edict
+centers along its longest horizontal axis (clamped to the middle half of the
+node), so that crowded regions get smaller cells. Otherwise the node is split
+in half.
 ===============
 */
-areanode_t* SV_CreateAreaNode(int depth, const qvec3& mins, const qvec3& maxs)
+static areanode_t* SV_CreateAreaNode(const int depth, const int maxdepth,
+    const qvec3& mins, const qvec3& maxs, qvec3* centers, const int numcenters)
 {
     // QSS
     areanode_t* anode = &qcvm->areanodes[qcvm->numareanodes];
@@ -245,7 +303,7 @@ areanode_t* SV_CreateAreaNode(int depth, const qvec3& mins, const qvec3& maxs)
     ClearLink(&anode->trigger_edicts);
     ClearLink(&anode->solid_edicts);
 
-    if(depth == AREA_DEPTH)
+    if(depth == maxdepth)
     {
         anode->axis = -1;
         anode->children[0] = anode->children[1] = nullptr;
@@ -262,17 +320,39 @@ areanode_t* SV_CreateAreaNode(int depth, const qvec3& mins, const qvec3& maxs)
         anode->axis = 1;
     }
 
-    anode->dist = 0.5f * (maxs[anode->axis] + mins[anode->axis]);
+    const int axis = anode->axis;
+    anode->dist = 0.5f * (maxs[axis] + mins[axis]);
+
+    int numbelow = 0;
+    if(numcenters > 1)
+    {
+        const int half = numcenters / 2;
+        std::nth_element(centers, centers + half, centers + numcenters,
+            [axis](const qvec3& a, const qvec3& b)
+            { return a[axis] < b[axis]; });
+
+        const float quarter = 0.25f * size[axis];
+        anode->dist = CLAMP(mins[axis] + quarter, centers[half][axis],
+            maxs[axis] - quarter);
+
+        // the clamp may have moved the split, so partition again
+        const float dist = anode->dist;
+        qvec3* const above = std::partition(centers, centers + numcenters,
+            [axis, dist](const qvec3& c) { return c[axis] < dist; });
+        numbelow = int(above - centers);
+    }
 
     const qvec3& mins1 = mins;
     qvec3 mins2 = mins;
     qvec3 maxs1 = maxs;
     const qvec3& maxs2 = maxs;
 
-    maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+    maxs1[axis] = mins2[axis] = anode->dist;
 
-    anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-    anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+    anode->children[0] = SV_CreateAreaNode(depth + 1, maxdepth, mins2, maxs2,
+        centers + numbelow, numcenters - numbelow);
+    anode->children[1] = SV_CreateAreaNode(
+        depth + 1, maxdepth, mins1, maxs1, centers, numbelow);
 
     return anode;
 }
@@ -287,9 +367,111 @@ void SV_ClearWorld()
 {
     SV_InitBoxHull();
 
+    const qvec3& mins = qcvm->worldmodel->mins;
+    const qvec3& maxs = qcvm->worldmodel->maxs;
+
+    memset(qcvm->areanodes, 0, sizeof(qcvm->areanodes));
+    qcvm->numareanodes = 0;
+    SV_CreateAreaNode(
+        0, SV_AreaNodeDepth(mins, maxs, 0), mins, maxs, nullptr, 0);
+}
+
+/*
+===============
+SV_LinkEdictToAreaNode
+
+Links an edict with an up-to-date absmin/absmax into the first node that its
+box crosses.
+===============
+*/
+static void SV_LinkEdictToAreaNode(edict_t* ent)
+{
+    areanode_t* node = qcvm->areanodes;
+
+    while(true)
+    {
+        if(node->axis == -1)
+        {
+            break;
+        }
+
+        if(ent->v.absmin[node->axis] > node->dist)
+        {
+            node = node->children[0];
+        }
+        else if(ent->v.absmax[node->axis] < node->dist)
+        {
+            node = node->children[1];
+        }
+        else
+        {
+            break; // crosses the node
+        }
+    }
+
+    // link it in
+    if(ent->v.solid == SOLID_TRIGGER)
+    {
+        InsertLinkBefore(&ent->area, &node->trigger_edicts);
+    }
+    else
+    {
+        InsertLinkBefore(&ent->area, &node->solid_edicts);
+    }
+}
+
+/*
+===============
+SV_RebalanceWorld
+
+Rebuilds the areanode tree around the edicts that are currently linked, then
+relinks them. Called once the level's entities have been spawned.
+===============
+*/
+void SV_RebalanceWorld()
+{
+    std::vector<edict_t*> linked;
+    std::vector<qvec3> centers;
+
+    for(int i = 1; i < qcvm->num_edicts; i++)
+    {
+        edict_t* ent = EDICT_NUM(i);
+        if(ent->free || !ent->area.prev)
+        {
+            continue;
+        }
+
+        linked.push_back(ent);
+        centers.push_back(0.5f * (ent->v.absmin + ent->v.absmax));
+
+        RemoveLink(&ent->area);
+        ent->area.prev = ent->area.next = nullptr;
+    }
+
+    const qvec3& mins = qcvm->worldmodel->mins;
+    const qvec3& maxs = qcvm->worldmodel->maxs;
+    const int depth = SV_AreaNodeDepth(mins, maxs, int(linked.size()));
+
     memset(qcvm->areanodes, 0, sizeof(qcvm->areanodes));
     qcvm->numareanodes = 0;
-    SV_CreateAreaNode(0, qcvm->worldmodel->mins, qcvm->worldmodel->maxs);
+
+    if(sv_areanode_adaptive.value)
+    {
+        SV_CreateAreaNode(
+            0, depth, mins, maxs, centers.data(), int(centers.size()));
+    }
+    else
+    {
+        SV_CreateAreaNode(0, depth, mins, maxs, nullptr, 0);
+    }
+
+    for(edict_t* ent : linked)
+    {
+        SV_LinkEdictToAreaNode(ent);
+    }
+
+    Con_DPrintf("SV_RebalanceWorld: %d areanodes (depth %d) for %d edicts\n",
+        qcvm->numareanodes, depth, int(linked.size()));
 }
 
 
@@ -321,6 +503,8 @@ them and risking the list getting corrupt.
 static void SV_AreaTriggerEdicts(edict_t* ent, areanode_t* node, edict_t** list,
     int* listcount, const int listspace)
 {
+    ++sv_areastats.touchnodes;
+
     const auto loopEdicts = [&](link_t& edictList)
     {
         link_t* next;
@@ -403,6 +587,8 @@ void SV_TouchLinks(edict_t* ent)
 {
     const int mark = Hunk_LowMark();
 
+    ++sv_areastats.touches;
+
     // QSS
     edict_t** list = (edict_t**)Hunk_Alloc(qcvm->num_edicts * sizeof(edict_t*));
 
@@ -674,39 +860,7 @@ void SV_LinkEdict(edict_t* ent, bool touch_triggers)
         return;
     }
 
-    // find the first node that the ent's box crosses
-    areanode_t* node = qcvm->areanodes;
-
-    while(true)
-    {
-        if(node->axis == -1)
-        {
-            break;
-        }
-
-        if(ent->v.absmin[node->axis] > node->dist)
-        {
-            node = node->children[0];
-        }
-        else if(ent->v.absmax[node->axis] < node->dist)
-        {
-            node = node->children[1];
-        }
-        else
-        {
-            break; // crosses the node
-        }
-    }
-
-    // link it in
-    if(ent->v.solid == SOLID_TRIGGER)
-    {
-        InsertLinkBefore(&ent->area, &node->trigger_edicts);
-    }
-    else
-    {
-        InsertLinkBefore(&ent->area, &node->solid_edicts);
-    }
+    SV_LinkEdictToAreaNode(ent);
 
     // if touch_triggers, touch all entities at this node and decend for more
     if(touch_triggers)
@@ -1139,6 +1293,168 @@ trace_t SV_ClipMoveToEntity(edict_t* ent, const qvec3& start, const qvec3& mins,
 
 //===========================================================================
 
+/*
+===============================================================================
+
+PREFETCHED WORLD TRACES
+
+Clipping against the world hull only depends on the trace parameters and on
+static map data, so it can be computed ahead of time on worker threads. The
+physics code predicts the traces an edict is about to make; `SV_Move` then
+reuses a prefetched result only if its parameters match bit-for-bit, which
+keeps the outcome identical to tracing on the spot.
+
+===============================================================================
+*/
+
+#define MAX_PREFETCHED_TRACES 5
+
+struct prefetchedtrace_t
+{
+    qvec3 start, mins, maxs, end;
+    trace_t trace;
+};
+
+struct prefetchedtraces_t
+{
+    int count;
+    prefetchedtrace_t traces[MAX_PREFETCHED_TRACES];
+};
+
+static struct
+{
+    bool active;
+    qvec3 worldorigin;
+    std::vector<prefetchedtraces_t> edicts;
+
+    unsigned long long lookups;
+    unsigned long long hits;
+} sv_prefetch;
+
+/*
+===============
+SV_BeginWorldTracePrefetch
+
+Returns false if the world cannot be traced against off the main thread.
+===============
+*/
+bool SV_BeginWorldTracePrefetch()
+{
+    edict_t* world = qcvm->edicts;
+    const qmodel_t* model = qcvm->GetModel(int(world->v.modelindex));
+
+    // anything else would clip against the shared box hull
+    if(world->v.solid != SOLID_BSP || world->v.movetype != MOVETYPE_PUSH ||
+        !model || model->type != mod_brush)
+    {
+        return false;
+    }
+
+    sv_prefetch.edicts.resize(qcvm->num_edicts);
+    for(prefetchedtraces_t& p : sv_prefetch.edicts)
+    {
+        p.count = 0;
+    }
+
+    sv_prefetch.worldorigin = world->v.origin;
+    sv_prefetch.active = true;
+    return true;
+}
+
+/*
+===============
+SV_EndWorldTracePrefetch
+
+===============
+*/
+void SV_EndWorldTracePrefetch()
+{
+    sv_prefetch.active = false;
+}
+
+/*
+===============
+SV_PrefetchWorldTrace
+
+Safe to call from worker threads, as long as each thread only prefetches for
+its own edicts.
+===============
+*/
+void SV_PrefetchWorldTrace(const int entnum, const qvec3& start,
+    const qvec3& mins, const qvec3& maxs, const qvec3& end)
+{
+    prefetchedtraces_t& p = sv_prefetch.edicts[entnum];
+    if(p.count == MAX_PREFETCHED_TRACES)
+    {
+        return;
+    }
+
+    prefetchedtrace_t& t = p.traces[p.count];
+    t.start = start;
+    t.mins = mins;
+    t.maxs = maxs;
+    t.end = end;
+    t.trace = SV_ClipMoveToEntity(qcvm->edicts, start, mins, maxs, end);
+    ++p.count;
+}
+
+/*
+===============
+SV_ClipMoveToWorld
+
+===============
+*/
+static trace_t SV_ClipMoveToWorld(const qvec3& start, const qvec3& mins,
+    const qvec3& maxs, const qvec3& end, edict_t* const passedict)
+{
+    if(sv_prefetch.active && passedict && qcvm == &sv.qcvm)
+    {
+        const int entnum = NUM_FOR_EDICT(passedict);
+        const auto same = [](const qvec3& a, const qvec3& b)
+        { return !memcmp(&a, &b, sizeof(qvec3)); };
+
+        ++sv_prefetch.lookups;
+
+        if(entnum < int(sv_prefetch.edicts.size()) &&
+            same(qcvm->edicts->v.origin, sv_prefetch.worldorigin))
+        {
+            const prefetchedtraces_t& p = sv_prefetch.edicts[entnum];
+            for(int i = 0; i < p.count; i++)
+            {
+                const prefetchedtrace_t& t = p.traces[i];
+                if(same(t.start, start) && same(t.end, end) &&
+                    same(t.mins, mins) && same(t.maxs, maxs))
+                {
+                    ++sv_prefetch.hits;
+                    return t.trace;
+                }
+            }
+        }
+    }
+
+    return SV_ClipMoveToEntity(qcvm->edicts, start, mins, maxs, end); // QSS
+}
+
+/*
+===============
+SV_WorldTracePrefetchStats
+
+===============
+*/
+void SV_WorldTracePrefetchStats(
+    unsigned long long& lookups, unsigned long long& hits, const bool reset)
+{
+    lookups = sv_prefetch.lookups;
+    hits = sv_prefetch.hits;
+
+    if(reset)
+    {
+        sv_prefetch.lookups = sv_prefetch.hits = 0;
+    }
+}
+
+//===========================================================================
+
 /*
 ====================
 SV_ClipToLinks
@@ -1150,10 +1466,14 @@ void SV_ClipToLinks(areanode_t* node, moveclip_t* clip)
 {
     link_t* next;
 
+    ++sv_areastats.tracenodes;
+
     // touch linked edicts
     for(link_t* l = node->solid_edicts.next; l != &node->solid_edicts; l = next)
     {
         next = l->next;
+        ++sv_areastats.traceedicts;
+
         edict_t* target = EDICT_FROM_AREA(l);
         if(target->v.solid == SOLID_NOT ||
             target->v.solid == SOLID_NOT_BUT_TOUCHABLE ||
@@ -1325,8 +1645,7 @@ trace_t SV_Move(const qvec3& start, const qvec3& mins, const qvec3& maxs,
     memset(&clip, 0, sizeof(moveclip_t));
 
     // clip to world
-    clip.trace =
-        SV_ClipMoveToEntity(qcvm->edicts, start, mins, maxs, end); // QSS
+    clip.trace = SV_ClipMoveToWorld(start, mins, maxs, end, passedict);
 
     clip.start = start;
     clip.end = end;
@@ -1367,6 +1686,7 @@ trace_t SV_Move(const qvec3& start, const qvec3& mins, const qvec3& maxs,
         start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs);
 
     // clip to entities
+    ++sv_areastats.traces;
     SV_ClipToLinks(qcvm->areanodes, &clip); // QSS
 
     return clip.trace;
@@ -1382,3 +1702,177 @@ trace_t SV_MoveTrace(const qvec3& start, const qvec3& end, const int type,
 {
     return SV_Move(start, vec3_zero, vec3_zero, end, type, passedict);
 }
+
+/*
+===============================================================================
+
+AREANODE DIAGNOSTICS
+
+===============================================================================
+*/
+
+static int SV_CountLinks(const link_t& list)
+{
+    int count = 0;
+    for(const link_t* l = list.next; l != &list; l = l->next)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+/*
+==================
+SV_AreaStats_f
+
+Prints the shape of the areanode tree and the traversal counters collected
+since the last reset.
+==================
+*/
+static void SV_AreaStats_f()
+{
+    if(!sv.active)
+    {
+        return;
+    }
+
+    PR_SwitchQCVM(&sv.qcvm);
+
+    int leaves = 0;
+    int maxdepth = 0;
+    int inleaves = 0;
+    int innodes = 0;
+    int maxleaf = 0;
+
+    // walk the tree iteratively, nodes are allocated depth-first
+    struct item
+    {
+        const areanode_t* node;
+        int depth;
+    };
+
+    item stack[AREA_MAX_DEPTH + 2];
+    int sp = 0;
+    stack[sp++] = {qcvm->areanodes, 0};
+
+    while(sp > 0)
+    {
+        const item it = stack[--sp];
+        const int count = SV_CountLinks(it.node->solid_edicts) +
+                          SV_CountLinks(it.node->trigger_edicts);
+
+        if(it.node->axis == -1)
+        {
+            ++leaves;
+            inleaves += count;
+            maxleaf = q_max(maxleaf, count);
+            maxdepth = q_max(maxdepth, it.depth);
+            continue;
+        }
+
+        innodes += count;
+        stack[sp++] = {it.node->children[0], it.depth + 1};
+        stack[sp++] = {it.node->children[1], it.depth + 1};
+    }
+
+    Con_Printf("areanodes : %d (depth %d, %d leaves)\n", qcvm->numareanodes,
+        maxdepth, leaves);
+    Con_Printf("linked    : %d in leaves, %d in inner nodes\n", inleaves,
+        innodes);
+    Con_Printf("leaf avg  : %.2f edicts, max %d\n",
+        leaves ? float(inleaves) / leaves : 0.f, maxleaf);
+
+    const auto perOp = [](unsigned long long count, unsigned long long ops)
+    { return ops ? double(count) / double(ops) : 0.0; };
+
+    Con_Printf("traces    : %llu, %.2f nodes/trace, %.2f edicts/trace\n",
+        sv_areastats.traces,
+        perOp(sv_areastats.tracenodes, sv_areastats.traces),
+        perOp(sv_areastats.traceedicts, sv_areastats.traces));
+    Con_Printf("touches   : %llu, %.2f nodes/touch\n", sv_areastats.touches,
+        perOp(sv_areastats.touchnodes, sv_areastats.touches));
+
+    if(Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+    {
+        memset(&sv_areastats, 0, sizeof(sv_areastats));
+    }
+
+    PR_SwitchQCVM(nullptr);
+}
+
+/*
+==================
+SV_AreaBench_f
+
+Runs a reproducible batch of player-sized traces between random points inside
+the world bounds and reports how many areanodes and edicts each one visited.
+==================
+*/
+static void SV_AreaBench_f()
+{
+    if(!sv.active)
+    {
+        return;
+    }
+
+    const int count = Cmd_Argc() > 1 ? q_max(atoi(Cmd_Argv(1)), 1) : 10000;
+
+    PR_SwitchQCVM(&sv.qcvm);
+
+    const auto oldstats = sv_areastats;
+    memset(&sv_areastats, 0, sizeof(sv_areastats));
+
+    const qvec3& wmins = qcvm->worldmodel->mins;
+    const qvec3& wmaxs = qcvm->worldmodel->maxs;
+
+    unsigned int seed = 0x51ED270Bu;
+    const auto randomPoint = [&]
+    {
+        qvec3 p;
+        for(int i = 0; i < 3; i++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const float frac = float(seed >> 8) / float(1u << 24);
+            p[i] = wmins[i] + frac * (wmaxs[i] - wmins[i]);
+        }
+        return p;
+    };
+
+    const qvec3 mins{-16.f, -16.f, -24.f};
+    const qvec3 maxs{16.f, 16.f, 32.f};
+
+    const double start = Sys_DoubleTime();
+    for(int i = 0; i < count; i++)
+    {
+        const qvec3 a = randomPoint();
+        const qvec3 b = randomPoint();
+        SV_Move(a, mins, maxs, b, MOVE_NORMAL, nullptr);
+    }
+    const double elapsed = Sys_DoubleTime() - start;
+
+    Con_Printf("%d traces in %.3f ms: %.2f nodes/trace, %.2f edicts/trace\n",
+        count, elapsed * 1000.0,
+        double(sv_areastats.tracenodes) / double(count),
+        double(sv_areastats.traceedicts) / double(count));
+
+    sv_areastats = oldstats;
+
+    PR_SwitchQCVM(nullptr);
+}
+
+/*
+===============
+SV_InitAreaNodes
+
+===============
+*/
+void SV_InitAreaNodes()
+{
+    Cvar_RegisterVariable(&sv_areanode_adaptive);
+    Cvar_RegisterVariable(&sv_areanode_cellsize);
+    Cvar_RegisterVariable(&sv_areanode_leafedicts);
+
+    Cmd_AddCommand("sv_areastats", SV_AreaStats_f);
+    Cmd_AddCommand("sv_areabench", SV_AreaBench_f);
+}
@@ -55,9 +55,16 @@ struct trace_t
 // QSS
 #define MOVE_HITALLCONTENTS (1 << 9)
 
+void SV_InitAreaNodes();
+// registers the areanode cvars and diagnostic commands
+
 void SV_ClearWorld();
 // called after the world model has been loaded, before linking any entities
 
+void SV_RebalanceWorld();
+// rebuilds the areanode tree around the currently linked entities, called
+// once the level has been spawned
+
 void SV_UnlinkEdict(edict_t* ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -100,6 +107,15 @@ trace_t SV_MoveTrace(const qvec3& start, const qvec3& end, const int type,
 // nomonsters is used for line of sight or edge testing, where mosnters
 // shouldn't be considered solid objects
 
+// world traces computed ahead of time by worker threads, used by SV_Move
+// when the same trace is requested on behalf of the same edict
+bool SV_BeginWorldTracePrefetch();
+void SV_EndWorldTracePrefetch();
+void SV_PrefetchWorldTrace(const int entnum, const qvec3& start,
+    const qvec3& mins, const qvec3& maxs, const qvec3& end);
+void SV_WorldTracePrefetchStats(
+    unsigned long long& lookups, unsigned long long& hits, const bool reset);
+
 struct hull_t;
 
 // passedict is explicitly excluded from clipping checks (normally nullptr)